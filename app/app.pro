@@ -39,13 +39,24 @@ INCLUDEPATH += \
 ###################################################
 
 SOURCES += \
+	src/directory_listing.cpp \
+	src/hard_link_table.cpp \
+	src/linked_snapshot_scanner.cpp \
 	src/main.cpp \
 	src/mainwindow.cpp \
+	src/mount_table.cpp \
 	src/native_path.cpp \
+	src/scan_concurrency_controller.cpp \
+	src/scan_exclusions.cpp \
+	src/scan_journal.cpp \
+	src/scan_throttle.cpp \
+	src/scan_trace.cpp \
 	src/snapshot.cpp \
 	src/snapshot_comparison.cpp \
+	src/snapshot_name_pool.cpp \
 	src/snapshot_scan_runner.cpp \
 	src/snapshot_scanner.cpp \
+	src/snapshot_tree.cpp \
 	src/snapshot_usage_widget.cpp \
 	src/ui_format.cpp
 
@@ -78,6 +89,11 @@ win*{
 	Release:QMAKE_LFLAGS += /OPT:REF /OPT:ICF
 }
 
+linux*{
+	SOURCES += src/linux_statx.cpp
+	HEADERS += src/linux_statx.h
+}
+
 mac*{
 	LIBS += -framework AppKit
 
@@ -100,14 +116,25 @@ FORMS += \
 	src/snapshot_usage_widget.ui
 
 HEADERS += \
+	src/directory_listing.h \
 	src/filesystem_access.h \
+	src/hard_link_table.h \
+	src/linked_snapshot_scanner.h \
 	src/mainwindow.h \
+	src/mount_table.h \
 	src/native_path.h \
+	src/scan_concurrency_controller.h \
+	src/scan_exclusions.h \
+	src/scan_journal.h \
+	src/scan_throttle.h \
+	src/scan_trace.h \
 	src/settings.h \
 	src/snapshot.h \
 	src/snapshot_comparison.h \
 	src/snapshot_internal.h \
+	src/snapshot_name_pool.h \
 	src/snapshot_scan_runner.h \
 	src/snapshot_scanner.h \
+	src/snapshot_stream.h \
 	src/snapshot_usage_widget.h \
 	src/ui_format.h
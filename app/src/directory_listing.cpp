@@ -0,0 +1,30 @@
+#include "directory_listing.h"
+
+#include <algorithm>
+#include <utility>
+
+ChunkedDirectoryListing::ChunkedDirectoryListing(NativePath path, const ListDirectory listDirectory) noexcept
+	: m_path{std::move(path)}, m_listDirectory{listDirectory}
+{
+}
+
+thin_io::filesystem_result<std::span<const ListedDirectoryEntry>> ChunkedDirectoryListing::next()
+{
+	if (!m_entries)
+	{
+		auto entries = m_listDirectory(m_path);
+		if (!entries)
+			return std::unexpected{entries.error()};
+		m_entries = std::move(*entries);
+		m_chunk.reserve(std::min(m_entries->size(), ChunkSize));
+	}
+
+	m_chunk.clear();
+	const std::size_t end = std::min(m_entries->size(), m_nextEntry + ChunkSize);
+	for (; m_nextEntry < end; ++m_nextEntry)
+	{
+		const thin_io::directory_entry& entry = (*m_entries)[m_nextEntry];
+		m_chunk.push_back({nativeNameViewFromThinIo(entry.name), entry.attributes});
+	}
+	return std::span<const ListedDirectoryEntry>{m_chunk};
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "fs.hpp"
+#include "native_path.h"
+
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <stdint.h>
+#include <vector>
+
+// A directory entry as enumeration reports it. The name is a view into the reader that produced the entry and stays valid
+// only until that reader reads on, so the entry is handed over without its name ever being copied on the way.
+struct ListedDirectoryEntry
+{
+	NativeNameView name;
+	thin_io::entry_attributes attributes;
+	// The inode number where the enumeration reports one, 0 where it does not.
+	uint64_t fileId = 0;
+};
+
+// Hands out a directory that thin_io lists in one call as chunks of entries viewing the listing. The directory is listed by
+// the first call to next().
+class ChunkedDirectoryListing
+{
+public:
+	using ListDirectory = thin_io::filesystem_result<std::vector<thin_io::directory_entry>> (*)(const NativePath& path);
+
+	static constexpr std::size_t ChunkSize = 1024;
+
+	ChunkedDirectoryListing(NativePath path, ListDirectory listDirectory) noexcept;
+
+	// The next entries, none once the directory is exhausted.
+	[[nodiscard]] thin_io::filesystem_result<std::span<const ListedDirectoryEntry>> next();
+
+private:
+	NativePath m_path;
+	ListDirectory m_listDirectory;
+	std::optional<std::vector<thin_io::directory_entry>> m_entries;
+	std::size_t m_nextEntry = 0;
+	std::vector<ListedDirectoryEntry> m_chunk;
+};
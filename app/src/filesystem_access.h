@@ -1,26 +1,270 @@
 #pragma once
 
+#include "directory_listing.h"
 #include "fs.hpp"
 #include "native_path.h"
 
+#ifdef __linux__
+#include "linux_statx.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#endif
+
+#include <optional>
+#include <span>
+#include <stdint.h>
+#include <utility>
 #include <vector>
 
 class FilesystemAccess final
 {
 public:
+	// An open directory whose children are resolved relative to it. Where the platform (or the caller) does not support
+	// relative resolution, the handle carries the directory's absolute path and every operation resolves from the root.
+	class DirectoryHandle final
+	{
+	public:
+		DirectoryHandle(DirectoryHandle&& other) noexcept
+			: m_path{std::move(other.m_path)}, m_fd{std::exchange(other.m_fd, -1)}
+		{
+		}
+
+		DirectoryHandle& operator=(DirectoryHandle&& other) noexcept
+		{
+			if (this != &other)
+			{
+				close();
+				m_path = std::move(other.m_path);
+				m_fd = std::exchange(other.m_fd, -1);
+			}
+			return *this;
+		}
+
+		~DirectoryHandle()
+		{
+			close();
+		}
+
+		// Whether this handle occupies a native descriptor.
+		[[nodiscard]] bool native() const noexcept
+		{
+			return m_fd >= 0;
+		}
+
+	private:
+		explicit DirectoryHandle(NativePath path) noexcept : m_path{std::move(path)}
+		{
+		}
+
+		explicit DirectoryHandle(const int fd) noexcept : m_fd{fd}
+		{
+		}
+
+		void close() noexcept
+		{
+#ifdef __linux__
+			if (m_fd >= 0)
+				::close(m_fd);
+#endif
+			m_fd = -1;
+		}
+
+		NativePath m_path;
+		int m_fd = -1;
+
+		friend class FilesystemAccess;
+	};
+
+	// Reads a directory a chunk at a time; see readDirectory().
+	class DirectoryReader final
+	{
+	public:
+		// The next entries, none once the directory is exhausted. Their names stay valid until the next call.
+		[[nodiscard]] thin_io::filesystem_result<std::span<const ListedDirectoryEntry>> next()
+		{
+#ifdef __linux__
+			if (m_native)
+				return m_native->next();
+#endif
+			return m_listing.next();
+		}
+
+	private:
+		explicit DirectoryReader(NativePath path) noexcept : m_listing{std::move(path), &FilesystemAccess::listDirectory}
+		{
+		}
+
+#ifdef __linux__
+		explicit DirectoryReader(const int fd) noexcept : m_listing{{}, &FilesystemAccess::listDirectory}, m_native{std::in_place, fd}
+		{
+		}
+#endif
+
+		ChunkedDirectoryListing m_listing;
+#ifdef __linux__
+		std::optional<StatxDirectoryReader> m_native;
+#endif
+
+		friend class FilesystemAccess;
+	};
+
 	[[nodiscard]] static inline thin_io::filesystem_result<std::vector<thin_io::directory_entry>> listDirectory(const NativePath& path)
 	{
 		return thin_io::list_directory(nativePathData(path));
 	}
 
+	// The file id (inode number) that enumeration reports for each of the listed names, in the same order, where the platform
+	// provides one; empty elsewhere or if the directory can no longer be listed. Metadata fetched in file-id order follows the
+	// layout of the inode table on disk and is friendlier to the caches of network servers than name order.
+	[[nodiscard]] static inline std::vector<uint64_t> listedFileIds(
+		[[maybe_unused]] const NativePath& path, [[maybe_unused]] const std::span<const NativeName> names)
+	{
+#ifdef __linux__
+		const int fd = ::open(nativePathData(path), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0)
+			return {};
+		std::vector<uint64_t> fileIds = ::listedFileIds(fd, names);
+		::close(fd);
+		return fileIds;
+#else
+		return {};
+#endif
+	}
+
 	[[nodiscard]] static inline thin_io::filesystem_result<thin_io::entry_metadata> getEntryMetadata(
 		const NativePath& path, const thin_io::link_behavior linkBehavior)
 	{
 		return thin_io::get_entry_metadata(nativePathData(path), linkBehavior);
 	}
 
+	// The largest batch worth passing to getEntryMetadataBatch() from the calling thread; 1 means batching brings no benefit.
+	[[nodiscard]] static inline std::size_t entryMetadataBatchCapacity() noexcept
+	{
+#ifdef __linux__
+		return statxBatchCapacity();
+#else
+		return 1;
+#endif
+	}
+
+	// Links are not followed. results.size() must equal paths.size().
+	static inline void getEntryMetadataBatch(const std::span<const NativePath> paths,
+		const std::span<thin_io::filesystem_result<thin_io::entry_metadata>> results)
+	{
+#ifdef __linux__
+		statxGetEntryMetadata(paths, results);
+#else
+		for (std::size_t i = 0; i < paths.size(); ++i)
+			results[i] = getEntryMetadata(paths[i], thin_io::link_behavior::do_not_follow);
+#endif
+	}
+
+	// Like listDirectory(path), a link at path is followed. With relativeResolution disabled, or where it is unsupported,
+	// the returned handle only records the path and a missing or inaccessible directory is reported by readDirectory()
+	// instead.
+	[[nodiscard]] static inline thin_io::filesystem_result<DirectoryHandle> openDirectory(
+		const NativePath& path, [[maybe_unused]] const bool relativeResolution)
+	{
+#ifdef __linux__
+		if (relativeResolution && statxDirectoryHandlesSupported())
+			return openDirectoryAt(AT_FDCWD, nativePathData(path), 0);
+#endif
+		return DirectoryHandle{path};
+	}
+
+	// A link named name is not followed. The child inherits the parent's resolution mode.
+	[[nodiscard]] static inline thin_io::filesystem_result<DirectoryHandle> openDirectory(
+		const DirectoryHandle& parent, const NativeName& name)
+	{
+#ifdef __linux__
+		if (parent.native())
+			return openDirectoryAt(parent.m_fd, nativePathData(name), O_NOFOLLOW);
+#endif
+		return DirectoryHandle{appendNativeName(parent.m_path, name)};
+	}
+
+	// Hands the directory's entries out in chunks whose names view the reader's own buffer, so that a caller can keep them
+	// without an intermediate copy of every name. Reading is deferred to the reader's first chunk; each chunk takes at most
+	// one enumeration call, so the reads of a huge directory can be watched and interleaved with processing one by one.
+	// The reader must not outlive directory. Where the entries come from the kernel's records they carry their file ids.
+	[[nodiscard]] static inline DirectoryReader readDirectory(const DirectoryHandle& directory)
+	{
+#ifdef __linux__
+		if (directory.native() && statxDirectoryReaderSupported())
+			return DirectoryReader{directory.m_fd};
+#endif
+		return DirectoryReader{directory.m_path};
+	}
+
+	// Reads the directory again; names are those just listed from it.
+	[[nodiscard]] static inline std::vector<uint64_t> listedFileIds(
+		const DirectoryHandle& directory, const std::span<const NativeName> names)
+	{
+#ifdef __linux__
+		if (directory.native())
+			return ::listedFileIds(directory.m_fd, names);
+#endif
+		return listedFileIds(directory.m_path, names);
+	}
+
+	// Links are not followed. results.size() must equal names.size().
+	static inline void getEntryMetadataBatch(const DirectoryHandle& directory, const std::span<const NativeName> names,
+		const std::span<thin_io::filesystem_result<thin_io::entry_metadata>> results)
+	{
+#ifdef __linux__
+		if (directory.native())
+		{
+			statxGetEntryMetadataAt(directory.m_fd, names, results);
+			return;
+		}
+#endif
+		std::vector<NativePath> paths;
+		paths.reserve(names.size());
+		for (const NativeName& name : names)
+			paths.push_back(appendNativeName(directory.m_path, name));
+		getEntryMetadataBatch(paths, results);
+	}
+
 	[[nodiscard]] static inline thin_io::filesystem_result<thin_io::filesystem_space> getFilesystemSpace(const NativePath& directoryPath)
 	{
 		return thin_io::get_filesystem_space(nativePathData(directoryPath));
 	}
+
+	// The files and directories in use on the filesystem mounted at path (its used inodes); nothing if path is not a mount
+	// point, or if the filesystem allocates inodes dynamically and reports no fixed table.
+	[[nodiscard]] static inline std::optional<uint64_t> getUsedFileCount([[maybe_unused]] const NativePath& path)
+	{
+#ifndef _WIN32
+		struct stat directory{};
+		struct stat parent{};
+		if (::stat(nativePathData(path), &directory) != 0 || ::stat(nativePathData(appendNativeName(path, "..")), &parent) != 0)
+			return {};
+		// The root directory is its own parent.
+		if (directory.st_dev == parent.st_dev && directory.st_ino != parent.st_ino)
+			return {};
+		struct statvfs space{};
+		if (::statvfs(nativePathData(path), &space) != 0 || space.f_files == 0 || space.f_ffree > space.f_files)
+			return {};
+		return static_cast<uint64_t>(space.f_files - space.f_ffree);
+#else
+		return {};
+#endif
+	}
+
+private:
+#ifdef __linux__
+	static inline thin_io::filesystem_result<DirectoryHandle> openDirectoryAt(const int parentFd, const char* const name, const int flags)
+	{
+		const int fd = ::openat(parentFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | flags);
+		if (fd < 0)
+			return std::unexpected{thin_io::filesystem_error{errno}};
+		return DirectoryHandle{fd};
+	}
+#endif
 };
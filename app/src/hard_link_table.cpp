@@ -0,0 +1,52 @@
+#include "hard_link_table.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+std::size_t HardLinkTable::IdentityHash::operator()(const thin_io::entry_identity& identity) const noexcept
+{
+	// The entry bytes usually hold an inode or file index in their low half; mixing both halves with the filesystem keeps
+	// identities from several filesystems apart.
+	uint64_t low = 0;
+	uint64_t high = 0;
+	static_assert(sizeof(identity.entry) >= sizeof(low) + sizeof(high));
+	std::memcpy(&low, identity.entry.data(), sizeof(low));
+	std::memcpy(&high, identity.entry.data() + sizeof(low), sizeof(high));
+	uint64_t hash = low ^ (high * 0x9E3779B97F4A7C15ull) ^ (static_cast<uint64_t>(identity.filesystem) * 0xC2B2AE3D27D4EB4Full);
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDull;
+	hash ^= hash >> 33;
+	return static_cast<std::size_t>(hash);
+}
+
+HardLinkTable::HardLinkTable(const std::size_t shardCount)
+	: m_shardCount{std::max<std::size_t>(shardCount, 1)}, m_shards{std::make_unique<Shard[]>(m_shardCount)}
+{
+}
+
+void HardLinkTable::add(const thin_io::entry_identity& identity, NativePath alias)
+{
+	// Both halves of the hash pick the shard, whatever the width of std::size_t.
+	const std::size_t hash = IdentityHash{}(identity);
+	Shard& shard = m_shards[(hash ^ (hash >> (sizeof(std::size_t) * 4))) % m_shardCount];
+	std::lock_guard lock{shard.mutex};
+	shard.aliases[identity].push_back(std::move(alias));
+}
+
+SnapshotHardLinkAliases HardLinkTable::take()
+{
+	SnapshotHardLinkAliases grouped;
+	for (std::size_t i = 0; i < m_shardCount; ++i)
+	{
+		Shard& shard = m_shards[i];
+		std::lock_guard lock{shard.mutex};
+		grouped.reserve(grouped.size() + shard.aliases.size());
+		for (auto& [identity, aliases] : shard.aliases)
+			grouped.emplace_back(identity, std::move(aliases));
+		shard.aliases.clear();
+	}
+	return grouped;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "snapshot.h"
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Collects the aliases of multi-link regular files from concurrent scan participants as their metadata arrives, so that
+// the snapshot's hard-link groups are ready when traversal ends. Identities are hashed over independently locked shards;
+// participants recording different files rarely contend.
+class HardLinkTable
+{
+public:
+	explicit HardLinkTable(std::size_t shardCount = 64);
+
+	HardLinkTable(const HardLinkTable&) = delete;
+	HardLinkTable& operator=(const HardLinkTable&) = delete;
+
+	void add(const thin_io::entry_identity& identity, NativePath alias);
+
+	// The recorded aliases grouped by identity, in no particular order. Not safe to call while aliases are being added.
+	[[nodiscard]] SnapshotHardLinkAliases take();
+
+private:
+	struct IdentityHash
+	{
+		[[nodiscard]] std::size_t operator()(const thin_io::entry_identity& identity) const noexcept;
+	};
+
+	struct IdentityEqual
+	{
+		[[nodiscard]] bool operator()(const thin_io::entry_identity& left, const thin_io::entry_identity& right) const noexcept
+		{
+			return left.filesystem == right.filesystem && left.entry == right.entry;
+		}
+	};
+
+	struct alignas(64) Shard
+	{
+		std::mutex mutex;
+		std::unordered_map<thin_io::entry_identity, std::vector<NativePath>, IdentityHash, IdentityEqual> aliases;
+	};
+
+	const std::size_t m_shardCount;
+	const std::unique_ptr<Shard[]> m_shards;
+};
@@ -0,0 +1,189 @@
+#include "linked_snapshot_scanner.h"
+#include "scan_exclusions.h"
+
+#include "threading/cworkerthread.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <condition_variable>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace {
+
+struct DeviceGroup
+{
+	std::vector<std::size_t> targets; // Indices into the scan targets, in scan order.
+	std::atomic_uint32_t participantShare = 1;
+	SnapshotScanOptions options;
+};
+
+SnapshotEntry* findEntry(SnapshotEntry& root, const std::vector<NativeName>& components)
+{
+	SnapshotEntry* entry = &root;
+	for (const NativeName& component : components)
+	{
+		const auto child = entry->children.find(component);
+		if (child == entry->children.end())
+			return nullptr;
+		entry = &child.value();
+	}
+	return entry;
+}
+
+std::optional<SnapshotOperation> failureOperation(const SnapshotScanFailureCode code) noexcept
+{
+	switch (code)
+	{
+	case SnapshotScanFailureCode::root_metadata_unavailable: return SnapshotOperation::root_metadata;
+	case SnapshotScanFailureCode::filesystem_space_at_start_unavailable: return SnapshotOperation::filesystem_space_at_start;
+	case SnapshotScanFailureCode::root_enumeration_unavailable: return SnapshotOperation::directory_enumeration;
+	case SnapshotScanFailureCode::root_call_stalled: return SnapshotOperation::call_deadline_exceeded;
+	default: return {};
+	}
+}
+
+} // namespace
+
+LinkedSnapshotScanResult scanLinkedSnapshots(
+	const NativePath& normalizedRootPath, const std::vector<MountedFilesystem>& mounts, const std::atomic_bool& canceled,
+	CWorkerThreadPool& workerPool, SnapshotScanProgressChannel* const progress, const SnapshotScanOptions& options)
+{
+	// The root comes first; a mount exactly at the root only contributes its device.
+	std::vector<NativePath> targets{normalizedRootPath};
+	std::map<std::string, DeviceGroup> groups;
+	std::string rootDevice;
+	for (const MountedFilesystem& mount : mounts)
+	{
+		if (mount.mountPoint == normalizedRootPath)
+			rootDevice = mount.device;
+	}
+	groups[rootDevice].targets.push_back(0);
+	// A mount point the rules exclude would not be recorded as a boundary, so scanning it would be wasted.
+	const NativePath exclusionRootPath = options.exclusionRootPath.isEmpty() ? normalizedRootPath : options.exclusionRootPath;
+	const ScanExclusions exclusions{exclusionRootPath, options.exclusionRules};
+	for (const MountedFilesystem& mount : mounts)
+	{
+		if (mount.mountPoint == normalizedRootPath || !nativeDescendantComponents(normalizedRootPath, mount.mountPoint)
+			|| exclusions.excludes(mount.mountPoint))
+			continue;
+		groups[mount.device].targets.push_back(targets.size());
+		targets.push_back(mount.mountPoint);
+	}
+
+	const uint32_t poolShare = options.participantShare ? options.participantShare->load(std::memory_order_relaxed)
+		: static_cast<uint32_t>(workerPool.maxWorkersCount());
+	for (auto& [device, group] : groups)
+	{
+		group.participantShare = std::max(poolShare / static_cast<uint32_t>(groups.size()), 1u);
+		group.options = options;
+		group.options.participantShare = &group.participantShare;
+		group.options.exclusionRootPath = exclusionRootPath;
+	}
+
+	std::vector<std::optional<SnapshotScanResult>> results(targets.size());
+	const auto scanGroup = [&](DeviceGroup& group) noexcept {
+		for (const std::size_t target : group.targets)
+		{
+			if (canceled.load(std::memory_order_relaxed))
+				return;
+			try
+			{
+				results[target] = scanSnapshot(targets[target], canceled, workerPool, progress, group.options);
+			}
+			catch (...)
+			{
+				results[target] = SnapshotScanFailure{SnapshotScanFailureCode::unexpected_error, targets[target], {}};
+			}
+		}
+	};
+
+	// Every group but the root's runs as a pool task, which scans with its own helpers once a worker picks it up.
+	std::mutex groupsMutex;
+	std::condition_variable groupsFinished;
+	std::size_t remainingGroups = 0;
+	std::vector<DeviceGroup*> inlineGroups{&groups[rootDevice]};
+	for (auto& [device, group] : groups)
+	{
+		if (device == rootDevice)
+			continue;
+		DeviceGroup* const groupPointer = &group;
+		try
+		{
+			{
+				std::lock_guard lock{groupsMutex};
+				++remainingGroups;
+			}
+			workerPool.enqueue([&, groupPointer] {
+				scanGroup(*groupPointer);
+				// Notified under the lock: the waiting caller may return and release both as soon as it sees zero.
+				std::lock_guard lock{groupsMutex};
+				--remainingGroups;
+				groupsFinished.notify_all();
+			});
+		}
+		catch (...)
+		{
+			std::lock_guard lock{groupsMutex};
+			--remainingGroups;
+			inlineGroups.push_back(groupPointer);
+		}
+	}
+	for (DeviceGroup* const group : inlineGroups)
+		scanGroup(*group);
+	{
+		std::unique_lock lock{groupsMutex};
+		groupsFinished.wait(lock, [&remainingGroups] { return remainingGroups == 0; });
+	}
+
+	if (canceled.load(std::memory_order_relaxed))
+		return SnapshotScanCanceled{};
+	assert(results.front());
+	if (auto* failure = std::get_if<SnapshotScanFailure>(&*results.front()))
+		return std::move(*failure);
+
+	LinkedSnapshots linked;
+	for (std::optional<SnapshotScanResult>& result : results)
+	{
+		if (!result || std::holds_alternative<SnapshotScanCanceled>(*result))
+			return SnapshotScanCanceled{};
+		if (auto* snapshot = std::get_if<Snapshot>(&*result))
+			linked.snapshots.push_back(std::move(*snapshot));
+		else
+			linked.failures.push_back(std::get<SnapshotScanFailure>(std::move(*result)));
+	}
+	return linked;
+}
+
+Snapshot mergeLinkedSnapshots(LinkedSnapshots linked, CWorkerThreadPool* const workerPool)
+{
+	assert(!linked.snapshots.empty());
+	Snapshot merged = std::move(linked.snapshots.front());
+	// Mounted trees are grafted in nested form, which the rebuild below turns back into one tree.
+	if (linked.snapshots.size() > 1)
+		merged.root = merged.tree.toEntry();
+	for (auto mounted = linked.snapshots.begin() + 1; mounted != linked.snapshots.end(); ++mounted)
+	{
+		merged.operationTimings.add(mounted->operationTimings);
+		merged.directoryCosts.add(mounted->directoryCosts);
+		const auto components = nativeDescendantComponents(merged.rootPath, mounted->rootPath);
+		SnapshotEntry* const boundary = components ? findEntry(merged.root, *components) : nullptr;
+		// A mount point below an unreadable directory, or one replaced since the mount table was read, is not linked.
+		if (!boundary || boundary->traversalState != DirectoryTraversalState::mount_boundary)
+			continue;
+		*boundary = mounted->tree.toEntry();
+		std::ranges::move(mounted->diagnostics, std::back_inserter(merged.diagnostics));
+	}
+	for (const SnapshotScanFailure& failure : linked.failures)
+	{
+		if (const auto operation = failureOperation(failure.code);
+			operation && snapshotOperationHasNativeErrorCode(*operation) == failure.nativeErrorCode.has_value())
+			merged.diagnostics.push_back({failure.path, *operation, failure.nativeErrorCode});
+	}
+	merged.rebuildDerivedData(workerPool);
+	return merged;
+}
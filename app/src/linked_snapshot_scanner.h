@@ -0,0 +1,32 @@
+#pragma once
+
+#include "mount_table.h"
+#include "snapshot_scanner.h"
+
+#include <atomic>
+#include <variant>
+#include <vector>
+
+// One snapshot per mounted filesystem under a root. Every snapshot after the first is rooted at a mount point recorded
+// as a mount boundary by the snapshot of its parent filesystem, and parents come before their children.
+struct LinkedSnapshots
+{
+	std::vector<Snapshot> snapshots; // The filesystem containing the root comes first.
+	// Mounted filesystems that could not be scanned; their mount points remain boundaries.
+	std::vector<SnapshotScanFailure> failures;
+};
+
+using LinkedSnapshotScanResult = std::variant<LinkedSnapshots, SnapshotScanFailure, SnapshotScanCanceled>;
+
+// Scans rootPath and each of `mounts` below it (see mountsUnder()). Filesystems on different devices are scanned
+// concurrently, each device with its own share of the worker pool and its own adaptive concurrency; filesystems on one
+// device are scanned one after another so that they do not compete for its queue. Only a failure to scan rootPath
+// itself fails the whole scan.
+[[nodiscard]] LinkedSnapshotScanResult scanLinkedSnapshots(
+	const NativePath& normalizedRootPath, const std::vector<MountedFilesystem>& mounts, const std::atomic_bool& canceled,
+	CWorkerThreadPool& workerPool, SnapshotScanProgressChannel* progress = nullptr, const SnapshotScanOptions& options = {});
+
+// Grafts every linked snapshot onto the mount boundary it was scanned from, producing one tree for display. Space and
+// timing are those of the first snapshot; diagnostics, operation latencies and directory costs are merged, and failures
+// with a native error become diagnostics. The merged tree's data is derived on workerPool when given.
+[[nodiscard]] Snapshot mergeLinkedSnapshots(LinkedSnapshots linked, CWorkerThreadPool* workerPool = nullptr);
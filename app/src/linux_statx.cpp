@@ -0,0 +1,647 @@
+#include "linux_statx.h"
+
+#include "fs.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <assert.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace {
+
+constexpr unsigned RingDepth = 64;
+constexpr uint64_t StatxBlockSize = 512;
+#ifdef STATX_MNT_ID
+constexpr unsigned StatxMountId = STATX_MNT_ID;
+#else
+constexpr unsigned StatxMountId = 0x00001000U;
+#endif
+constexpr unsigned StatxRequestMask = STATX_BASIC_STATS | StatxMountId;
+constexpr unsigned StatxRequiredMask = STATX_TYPE | STATX_NLINK | STATX_INO | STATX_SIZE | STATX_BLOCKS;
+
+using MetadataResult = thin_io::filesystem_result<thin_io::entry_metadata>;
+
+int ioUringSetup(const unsigned entries, io_uring_params* const params) noexcept
+{
+	return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(const int ringFd, const unsigned toSubmit, const unsigned minComplete) noexcept
+{
+	return static_cast<int>(::syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0));
+}
+
+int ioUringRegister(const int ringFd, const unsigned opcode, void* const argument, const unsigned argumentCount) noexcept
+{
+	return static_cast<int>(::syscall(__NR_io_uring_register, ringFd, opcode, argument, argumentCount));
+}
+
+// Returns empty for entries that need thin_io's own interpretation: links report their target's kind, and the sparse and
+// compressed attributes are not derivable from statx alone. Those entries are delegated to the synchronous path.
+std::optional<thin_io::entry_metadata> entryMetadataFromStatx(const struct statx& status)
+{
+	if ((status.stx_mask & StatxRequiredMask) != StatxRequiredMask)
+		return {};
+
+	const mode_t type = status.stx_mode & S_IFMT;
+	const uint64_t allocatedSize = status.stx_blocks * StatxBlockSize;
+	if (type == S_IFLNK || (status.stx_attributes & STATX_ATTR_COMPRESSED) != 0 || (type == S_IFREG && allocatedSize < status.stx_size))
+		return {};
+
+	thin_io::entry_metadata metadata;
+	metadata.attributes.kind = type == S_IFREG ? thin_io::entry_kind::regular_file
+		: (type == S_IFDIR ? thin_io::entry_kind::directory : thin_io::entry_kind::other);
+	metadata.logical_size = status.stx_size;
+	metadata.allocated_size = allocatedSize;
+	metadata.hard_link_count = status.stx_nlink;
+
+	thin_io::entry_identity identity;
+	identity.filesystem = makedev(status.stx_dev_major, status.stx_dev_minor);
+	for (size_t i = 0; i < sizeof(status.stx_ino); ++i)
+		identity.entry[i] = static_cast<uint8_t>(status.stx_ino >> (i * 8));
+	metadata.identity = identity;
+	if ((status.stx_mask & StatxMountId) != 0)
+		metadata.mount_id = status.stx_mnt_id;
+	return metadata;
+}
+
+std::string procFdPath(const int directoryFd)
+{
+	return "/proc/self/fd/" + std::to_string(directoryFd);
+}
+
+// Each linux_dirent64 record holds d_ino, d_off, d_reclen and d_type, followed by the null-terminated name.
+struct DirectoryRecord
+{
+	uint64_t inode = 0;
+	unsigned short length = 0;
+	unsigned char type = DT_UNKNOWN;
+	const char* name = nullptr;
+};
+
+constexpr size_t DirectoryRecordBufferSize = 32768;
+
+DirectoryRecord directoryRecord(const std::byte* const record) noexcept
+{
+	constexpr size_t InodeOffset = 0;
+	constexpr size_t LengthOffset = 16;
+	constexpr size_t TypeOffset = 18;
+	constexpr size_t NameOffset = 19;
+	DirectoryRecord parsed;
+	std::memcpy(&parsed.inode, record + InodeOffset, sizeof(parsed.inode));
+	std::memcpy(&parsed.length, record + LengthOffset, sizeof(parsed.length));
+	std::memcpy(&parsed.type, record + TypeOffset, sizeof(parsed.type));
+	parsed.name = reinterpret_cast<const char*>(record + NameOffset);
+	return parsed;
+}
+
+// Names an entry either by absolute path (directoryFd == AT_FDCWD) or relative to an open directory.
+struct StatxTarget
+{
+	int directoryFd;
+	const char* name;
+};
+
+MetadataResult delegatedEntryMetadata(const StatxTarget& target)
+{
+	if (target.directoryFd == AT_FDCWD)
+		return thin_io::get_entry_metadata(target.name, thin_io::link_behavior::do_not_follow);
+
+	// The magic link resolves to the open directory itself, so only the final component is looked up by name.
+	const std::string path = procFdPath(target.directoryFd) + '/' + target.name;
+	return thin_io::get_entry_metadata(path.c_str(), thin_io::link_behavior::do_not_follow);
+}
+
+MetadataResult entryMetadataResult(const StatxTarget& target, const struct statx& status)
+{
+	if (const auto metadata = entryMetadataFromStatx(status))
+		return *metadata;
+	return delegatedEntryMetadata(target);
+}
+
+MetadataResult synchronousEntryMetadata(const StatxTarget& target)
+{
+	struct statx status;
+	if (::statx(target.directoryFd, target.name, AT_SYMLINK_NOFOLLOW, StatxRequestMask, &status) != 0)
+		return std::unexpected{thin_io::filesystem_error{errno}};
+	return entryMetadataResult(target, status);
+}
+
+class StatxRing final
+{
+public:
+	[[nodiscard]] static std::unique_ptr<StatxRing> create() noexcept
+	{
+		io_uring_params parameters{};
+		const int ringFd = ioUringSetup(RingDepth, &parameters);
+		if (ringFd < 0)
+			return {};
+
+		std::unique_ptr<StatxRing> ring{new (std::nothrow) StatxRing{ringFd}};
+		if (!ring)
+		{
+			::close(ringFd);
+			return {};
+		}
+		if (!ring->map(parameters))
+			return {};
+		return ring;
+	}
+
+	~StatxRing()
+	{
+		if (m_sqes != MAP_FAILED)
+			::munmap(m_sqes, m_sqesSize);
+		if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+			::munmap(m_cqRing, m_cqRingSize);
+		if (m_sqRing != MAP_FAILED)
+			::munmap(m_sqRing, m_sqRingSize);
+		::close(m_fd);
+	}
+
+	StatxRing(const StatxRing&) = delete;
+	StatxRing& operator=(const StatxRing&) = delete;
+
+	[[nodiscard]] unsigned depth() const noexcept
+	{
+		return m_depth;
+	}
+
+	[[nodiscard]] bool failed() const noexcept
+	{
+		return m_failed;
+	}
+
+	[[nodiscard]] bool supportsStatx() const noexcept
+	{
+		constexpr unsigned ProbedOperationCount = IORING_OP_STATX + 1;
+		alignas(io_uring_probe) std::array<std::byte, sizeof(io_uring_probe) + ProbedOperationCount * sizeof(io_uring_probe_op)> storage{};
+		auto* const probe = reinterpret_cast<io_uring_probe*>(storage.data());
+		if (ioUringRegister(m_fd, IORING_REGISTER_PROBE, probe, ProbedOperationCount) < 0 || probe->last_op < IORING_OP_STATX)
+			return false;
+		return (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED) != 0;
+	}
+
+	// names are absolute paths when directoryFd is AT_FDCWD.
+	void getEntryMetadata(const int directoryFd, const std::span<const NativeName> names, const std::span<MetadataResult> results)
+	{
+		assert(names.size() == results.size());
+		for (size_t windowStart = 0; windowStart < names.size(); windowStart += m_depth)
+		{
+			const size_t windowSize = std::min<size_t>(m_depth, names.size() - windowStart);
+			if (!m_failed)
+			{
+				getWindowMetadata(directoryFd, names.subspan(windowStart, windowSize), results.subspan(windowStart, windowSize));
+				continue;
+			}
+			for (size_t i = windowStart; i < windowStart + windowSize; ++i)
+				results[i] = synchronousEntryMetadata({directoryFd, names[i].constData()});
+		}
+	}
+
+private:
+	explicit StatxRing(const int ringFd) noexcept : m_fd{ringFd}
+	{
+	}
+
+	bool map(const io_uring_params& parameters) noexcept
+	{
+		m_depth = std::min(parameters.sq_entries, RingDepth);
+		m_sqRingSize = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned);
+		m_cqRingSize = parameters.cq_off.cqes + parameters.cq_entries * sizeof(io_uring_cqe);
+		const bool singleMapping = (parameters.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (singleMapping)
+			m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+		m_sqRing = ::mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+		if (m_sqRing == MAP_FAILED)
+			return false;
+		m_cqRing = singleMapping ? m_sqRing
+			: ::mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+		if (m_cqRing == MAP_FAILED)
+			return false;
+		m_sqesSize = parameters.sq_entries * sizeof(io_uring_sqe);
+		m_sqes = ::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+		if (m_sqes == MAP_FAILED)
+			return false;
+
+		auto* const sqRing = static_cast<std::byte*>(m_sqRing);
+		auto* const cqRing = static_cast<std::byte*>(m_cqRing);
+		m_sqTail = reinterpret_cast<unsigned*>(sqRing + parameters.sq_off.tail);
+		m_sqMask = *reinterpret_cast<const unsigned*>(sqRing + parameters.sq_off.ring_mask);
+		m_sqArray = reinterpret_cast<unsigned*>(sqRing + parameters.sq_off.array);
+		m_cqHead = reinterpret_cast<unsigned*>(cqRing + parameters.cq_off.head);
+		m_cqTail = reinterpret_cast<unsigned*>(cqRing + parameters.cq_off.tail);
+		m_cqMask = *reinterpret_cast<const unsigned*>(cqRing + parameters.cq_off.ring_mask);
+		m_cqes = reinterpret_cast<io_uring_cqe*>(cqRing + parameters.cq_off.cqes);
+		return true;
+	}
+
+	void getWindowMetadata(const int directoryFd, const std::span<const NativeName> names, const std::span<MetadataResult> results)
+	{
+		assert(names.size() <= m_depth);
+		const auto windowSize = static_cast<unsigned>(names.size());
+		std::array<bool, RingDepth> completed{};
+
+		const unsigned tail = std::atomic_ref{*m_sqTail}.load(std::memory_order_relaxed);
+		for (unsigned i = 0; i < windowSize; ++i)
+		{
+			const unsigned index = (tail + i) & m_sqMask;
+			io_uring_sqe& request = static_cast<io_uring_sqe*>(m_sqes)[index];
+			std::memset(&request, 0, sizeof(request));
+			request.opcode = IORING_OP_STATX;
+			request.fd = directoryFd;
+			request.addr = reinterpret_cast<uint64_t>(names[i].constData());
+			request.len = StatxRequestMask;
+			request.off = reinterpret_cast<uint64_t>(&m_buffers[i]);
+			request.statx_flags = AT_SYMLINK_NOFOLLOW;
+			request.user_data = i;
+			m_sqArray[index] = index;
+		}
+		std::atomic_ref{*m_sqTail}.store(tail + windowSize, std::memory_order_release);
+
+		unsigned submittedCount = 0;
+		unsigned completedCount = 0;
+		while (completedCount < windowSize)
+		{
+			const int entered = ioUringEnter(m_fd, windowSize - submittedCount, windowSize - completedCount);
+			const int enterError = entered < 0 ? errno : 0;
+			if (entered >= 0)
+				submittedCount += static_cast<unsigned>(entered);
+			completedCount += reapCompletions(directoryFd, names, results, completed);
+			if (entered >= 0 || enterError == EINTR || ((enterError == EAGAIN || enterError == EBUSY) && completedCount < submittedCount))
+				continue;
+
+			// Submitted requests may still complete into m_buffers, so a failed ring is never reused or unmapped.
+			m_failed = true;
+			break;
+		}
+
+		for (unsigned i = 0; i < windowSize; ++i)
+		{
+			if (!completed[i])
+				results[i] = synchronousEntryMetadata({directoryFd, names[i].constData()});
+		}
+	}
+
+	unsigned reapCompletions(const int directoryFd, const std::span<const NativeName> names,
+		const std::span<MetadataResult> results, std::array<bool, RingDepth>& completed)
+	{
+		unsigned head = std::atomic_ref{*m_cqHead}.load(std::memory_order_relaxed);
+		const unsigned tail = std::atomic_ref{*m_cqTail}.load(std::memory_order_acquire);
+		unsigned reaped = 0;
+		for (; head != tail; ++head, ++reaped)
+		{
+			const io_uring_cqe& completion = m_cqes[head & m_cqMask];
+			const auto index = static_cast<size_t>(completion.user_data);
+			assert(index < results.size() && !completed[index]);
+			if (completion.res < 0)
+				results[index] = std::unexpected{thin_io::filesystem_error{-completion.res}};
+			else
+				results[index] = entryMetadataResult({directoryFd, names[index].constData()}, m_buffers[index]);
+			completed[index] = true;
+		}
+		std::atomic_ref{*m_cqHead}.store(head, std::memory_order_release);
+		return reaped;
+	}
+
+private:
+	const int m_fd;
+	unsigned m_depth = 0;
+	bool m_failed = false;
+	void* m_sqRing = MAP_FAILED;
+	void* m_cqRing = MAP_FAILED;
+	void* m_sqes = MAP_FAILED;
+	size_t m_sqRingSize = 0;
+	size_t m_cqRingSize = 0;
+	size_t m_sqesSize = 0;
+	unsigned* m_sqTail = nullptr;
+	unsigned* m_sqArray = nullptr;
+	unsigned m_sqMask = 0;
+	unsigned* m_cqHead = nullptr;
+	unsigned* m_cqTail = nullptr;
+	unsigned m_cqMask = 0;
+	io_uring_cqe* m_cqes = nullptr;
+	std::array<struct statx, RingDepth> m_buffers{};
+};
+
+// Attributes as thin_io::list_directory() reports them; empty for an entry removed since it was listed.
+std::optional<thin_io::entry_attributes> listedAttributes(const int directoryFd, const DirectoryRecord& record)
+{
+	thin_io::entry_attributes attributes;
+	switch (record.type)
+	{
+	case DT_REG:
+		attributes.kind = thin_io::entry_kind::regular_file;
+		return attributes;
+	case DT_DIR:
+		attributes.kind = thin_io::entry_kind::directory;
+		return attributes;
+	case DT_LNK:
+	case DT_UNKNOWN:
+		break;
+	default:
+		attributes.kind = thin_io::entry_kind::other;
+		return attributes;
+	}
+
+	// Links report their target's kind, which only a lookup tells; so does an entry whose type the filesystem leaves out.
+	const MetadataResult metadata = synchronousEntryMetadata({directoryFd, record.name});
+	if (metadata)
+		return metadata->attributes;
+	if (metadata.error().native_code == ENOENT)
+		return {};
+	return attributes; // Left unknown; the entry's own metadata request reports the failure.
+}
+
+bool sameResult(const MetadataResult& left, const MetadataResult& right)
+{
+	return left.has_value() == right.has_value()
+		&& (left ? *left == *right : left.error().native_code == right.error().native_code);
+}
+
+struct ProbeEntries
+{
+	NativePath executable;
+	NativePath executableDirectory;
+	NativeName executableName;
+	std::array<NativePath, 3> paths;
+};
+
+// A directory, a regular file and a failing lookup.
+std::optional<ProbeEntries> probeEntries()
+{
+	std::array<char, 4096> executablePath{};
+	const ssize_t executablePathSize = ::readlink("/proc/self/exe", executablePath.data(), executablePath.size() - 1);
+	if (executablePathSize <= 0)
+		return {};
+
+	ProbeEntries entries;
+	entries.executable = NativePath{executablePath.data(), static_cast<qsizetype>(executablePathSize)};
+	const qsizetype separator = entries.executable.lastIndexOf('/');
+	if (separator < 0 || separator + 1 == entries.executable.size())
+		return {};
+	entries.executableDirectory = separator == 0 ? NativePath{"/"} : entries.executable.first(separator);
+	entries.executableName = entries.executable.sliced(separator + 1);
+	entries.paths = {NativePath{"/"}, entries.executable, appendNativeName(entries.executable, "probe")};
+	return entries;
+}
+
+// The conversion mirrors thin_io rather than sharing its code, so it is checked against thin_io before any use.
+bool statxConversionConforms(const ProbeEntries& entries)
+{
+	return std::ranges::all_of(entries.paths, [](const NativePath& path) {
+		return sameResult(synchronousEntryMetadata({AT_FDCWD, path.constData()}), delegatedEntryMetadata({AT_FDCWD, path.constData()}));
+	});
+}
+
+bool directoryHandlesConform(const ProbeEntries& entries)
+{
+	const int directoryFd = ::open(entries.executableDirectory.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (directoryFd < 0)
+		return false;
+
+	const MetadataResult expected = delegatedEntryMetadata({AT_FDCWD, entries.executable.constData()});
+	const StatxTarget relative{directoryFd, entries.executableName.constData()};
+	const bool conforms = expected && sameResult(synchronousEntryMetadata(relative), expected)
+		&& sameResult(delegatedEntryMetadata(relative), expected)
+		&& thin_io::list_directory(procFdPath(directoryFd).c_str()).has_value();
+	::close(directoryFd);
+	return conforms;
+}
+
+// Both enumerations in name order, as they need not agree on any other.
+bool directoryReaderConforms(const ProbeEntries& entries)
+{
+	using Listing = std::vector<std::pair<std::string, thin_io::entry_attributes>>;
+	for (const NativePath& path : {NativePath{"/"}, entries.executableDirectory})
+	{
+		const auto expectedEntries = thin_io::list_directory(path.constData());
+		if (!expectedEntries)
+			return false;
+		Listing expected;
+		for (const thin_io::directory_entry& entry : *expectedEntries)
+			expected.emplace_back(entry.name, entry.attributes);
+
+		const int directoryFd = ::open(path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (directoryFd < 0)
+			return false;
+		Listing listed;
+		StatxDirectoryReader reader{directoryFd};
+		bool failed = false;
+		for (;;)
+		{
+			const auto chunk = reader.next();
+			failed = !chunk;
+			if (failed || chunk->empty())
+				break;
+			for (const ListedDirectoryEntry& entry : *chunk)
+				listed.emplace_back(std::string{entry.name.data(), static_cast<size_t>(entry.name.size())}, entry.attributes);
+		}
+		::close(directoryFd);
+
+		std::ranges::sort(expected, {}, &Listing::value_type::first);
+		std::ranges::sort(listed, {}, &Listing::value_type::first);
+		if (failed || listed != expected)
+			return false;
+	}
+	return true;
+}
+
+bool ringConforms(StatxRing& ring, const ProbeEntries& entries)
+{
+	std::array<MetadataResult, std::tuple_size_v<decltype(entries.paths)>> results;
+	ring.getEntryMetadata(AT_FDCWD, entries.paths, results);
+	if (ring.failed())
+		return false;
+	return std::ranges::equal(entries.paths, results, [](const NativePath& path, const MetadataResult& result) {
+		return sameResult(delegatedEntryMetadata({AT_FDCWD, path.constData()}), result);
+	});
+}
+
+struct ProbeResult
+{
+	bool directoryHandles = false;
+	bool directoryReader = false;
+	bool ring = false;
+};
+
+const ProbeResult& probeResult() noexcept
+{
+	static const ProbeResult result = []() noexcept {
+		ProbeResult probed;
+		try
+		{
+			const auto entries = probeEntries();
+			if (!entries || !statxConversionConforms(*entries))
+				return probed;
+			probed.directoryHandles = directoryHandlesConform(*entries);
+			probed.directoryReader = probed.directoryHandles && directoryReaderConforms(*entries);
+
+			auto ring = StatxRing::create();
+			probed.ring = ring && ring->supportsStatx() && ringConforms(*ring, *entries);
+			if (ring && ring->failed())
+				(void)ring.release(); // See threadRing().
+		}
+		catch (...)
+		{
+		}
+		return probed;
+	}();
+	return result;
+}
+
+StatxRing* threadRing() noexcept
+{
+	if (!probeResult().ring)
+		return nullptr;
+
+	thread_local bool creationAttempted = false;
+	thread_local std::unique_ptr<StatxRing> ring;
+	if (!creationAttempted)
+	{
+		creationAttempted = true;
+		ring = StatxRing::create();
+	}
+	if (ring && ring->failed())
+		(void)ring.release(); // Deliberately leaked: the kernel may still write into its buffers.
+	return ring.get();
+}
+
+} // namespace
+
+bool statxDirectoryHandlesSupported() noexcept
+{
+	return probeResult().directoryHandles;
+}
+
+bool statxDirectoryReaderSupported() noexcept
+{
+	return probeResult().directoryReader;
+}
+
+std::size_t statxBatchCapacity() noexcept
+{
+	const StatxRing* const ring = threadRing();
+	return ring ? ring->depth() : 1;
+}
+
+void statxGetEntryMetadata(const std::span<const NativePath> paths, const std::span<MetadataResult> results)
+{
+	assert(paths.size() == results.size());
+	if (StatxRing* const ring = threadRing())
+	{
+		ring->getEntryMetadata(AT_FDCWD, paths, results);
+		return;
+	}
+
+	for (size_t i = 0; i < paths.size(); ++i)
+		results[i] = delegatedEntryMetadata({AT_FDCWD, paths[i].constData()});
+}
+
+void statxGetEntryMetadataAt(const int directoryFd, const std::span<const NativeName> names, const std::span<MetadataResult> results)
+{
+	assert(statxDirectoryHandlesSupported());
+	assert(names.size() == results.size());
+	if (StatxRing* const ring = threadRing())
+	{
+		ring->getEntryMetadata(directoryFd, names, results);
+		return;
+	}
+
+	for (size_t i = 0; i < names.size(); ++i)
+		results[i] = synchronousEntryMetadata({directoryFd, names[i].constData()});
+}
+
+StatxDirectoryReader::StatxDirectoryReader(const int directoryFd) noexcept : m_directoryFd{directoryFd}
+{
+}
+
+thin_io::filesystem_result<std::span<const ListedDirectoryEntry>> StatxDirectoryReader::next()
+{
+	if (!m_started)
+	{
+		if (::lseek(m_directoryFd, 0, SEEK_SET) < 0)
+			return std::unexpected{thin_io::filesystem_error{errno}};
+		m_records.resize(DirectoryRecordBufferSize);
+		m_started = true;
+	}
+
+	m_chunk.clear();
+	// A buffer may hold nothing but the dot entries, in which case reading goes on.
+	while (m_chunk.empty() && !m_exhausted)
+	{
+		const long size = ::syscall(SYS_getdents64, m_directoryFd, m_records.data(), m_records.size());
+		if (size < 0)
+			return std::unexpected{thin_io::filesystem_error{errno}};
+		m_exhausted = size == 0;
+		for (size_t offset = 0; offset < static_cast<size_t>(size);)
+		{
+			const DirectoryRecord record = directoryRecord(m_records.data() + offset);
+			offset += record.length;
+			const std::string_view name{record.name};
+			if (name == "." || name == "..")
+				continue;
+			if (const auto attributes = listedAttributes(m_directoryFd, record))
+				m_chunk.push_back({NativeNameView{name.data(), static_cast<qsizetype>(name.size())}, *attributes, record.inode});
+		}
+	}
+	return std::span<const ListedDirectoryEntry>{m_chunk};
+}
+
+std::vector<uint64_t> listedFileIds(const int directoryFd, const std::span<const NativeName> names)
+{
+	if (::lseek(directoryFd, 0, SEEK_SET) < 0)
+		return {};
+
+	// The records are kept whole so that the names can be matched in place.
+	std::vector<std::byte> records;
+	for (;;)
+	{
+		const size_t used = records.size();
+		records.resize(used + DirectoryRecordBufferSize);
+		const long size = ::syscall(SYS_getdents64, directoryFd, records.data() + used, DirectoryRecordBufferSize);
+		if (size < 0)
+			return {};
+		records.resize(used + static_cast<size_t>(size));
+		if (size == 0)
+			break;
+	}
+
+	std::vector<std::pair<std::string_view, uint64_t>> listed;
+	listed.reserve(names.size() + 2);
+	for (size_t offset = 0; offset < records.size();)
+	{
+		const DirectoryRecord record = directoryRecord(records.data() + offset);
+		listed.emplace_back(record.name, record.inode);
+		offset += record.length;
+	}
+
+	std::ranges::sort(listed);
+	std::vector<uint64_t> fileIds;
+	fileIds.reserve(names.size());
+	for (const NativeName& entryName : names)
+	{
+		const std::string_view name{entryName.constData(), static_cast<size_t>(entryName.size())};
+		const auto found = std::ranges::lower_bound(listed, name, {}, &std::pair<std::string_view, uint64_t>::first);
+		fileIds.push_back(found != listed.end() && found->first == name ? found->second : 0);
+	}
+	return fileIds;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "directory_listing.h"
+#include "filesystem_error.hpp"
+#include "filesystem_types.hpp"
+#include "native_path.h"
+
+#include <cstddef>
+#include <span>
+#include <stdint.h>
+#include <vector>
+
+// Linux-only statx backends for FilesystemAccess.
+//
+// Entry metadata is converted from statx here instead of inside thin_io, which enables two things thin_io's path-based API
+// cannot do: keeping a whole batch of requests in flight through a per-thread io_uring (round-trip-bound filesystems such as
+// NFS and Ceph then overlap their latencies), and resolving names relative to an open directory. Both are enabled only after
+// a one-time probe confirms that the conversion reproduces thin_io::get_entry_metadata(); entries whose attributes need
+// thin_io's own interpretation (links, possibly sparse or compressed files) are always delegated to thin_io.
+// Links are never followed by any function below.
+
+// Whether fd-relative metadata and enumeration are trustworthy in this process.
+[[nodiscard]] bool statxDirectoryHandlesSupported() noexcept;
+
+// Whether StatxDirectoryReader lists directories exactly as thin_io::list_directory() does in this process. Implies
+// statxDirectoryHandlesSupported().
+[[nodiscard]] bool statxDirectoryReaderSupported() noexcept;
+
+// Largest batch worth passing to the functions below from the calling thread; 1 when io_uring is unavailable there.
+[[nodiscard]] std::size_t statxBatchCapacity() noexcept;
+
+// results.size() must equal paths.size(); each result is what thin_io::get_entry_metadata() would have returned.
+void statxGetEntryMetadata(std::span<const NativePath> paths,
+	std::span<thin_io::filesystem_result<thin_io::entry_metadata>> results);
+
+// Names are resolved relative to directoryFd, which must stay open until the call returns.
+// Requires statxDirectoryHandlesSupported().
+void statxGetEntryMetadataAt(int directoryFd, std::span<const NativeName> names,
+	std::span<thin_io::filesystem_result<thin_io::entry_metadata>> results);
+
+// Enumerates an open directory straight from the kernel's records, one buffer at a time, without thin_io's copy of every
+// name: the names of a chunk point into the buffer. Kinds come from the records' types; links and entries of unreported
+// type are delegated to thin_io. Every entry carries its inode number as its file id. The directory must stay open while
+// the reader is used, and reading moves the descriptor's file offset. Requires statxDirectoryReaderSupported().
+class StatxDirectoryReader final
+{
+public:
+	explicit StatxDirectoryReader(int directoryFd) noexcept;
+
+	// The next entries, none once the directory is exhausted.
+	[[nodiscard]] thin_io::filesystem_result<std::span<const ListedDirectoryEntry>> next();
+
+private:
+	int m_directoryFd;
+	bool m_started = false;
+	bool m_exhausted = false;
+	std::vector<std::byte> m_records;
+	std::vector<ListedDirectoryEntry> m_chunk;
+};
+
+// The inode number that enumerating the open directory reports for each of names, in the same order; 0 for an entry that
+// has been removed since it was listed. Empty if the directory cannot be enumerated. Moves the descriptor's file offset.
+[[nodiscard]] std::vector<uint64_t> listedFileIds(int directoryFd, std::span<const NativeName> names);
@@ -1,9 +1,57 @@
 ﻿ #include "mainwindow.h"
+ #include "snapshot.h"
+ #include "ui_format.h"
 
  #include <QApplication>
+ #include <QCoreApplication>
+ #include <QTextStream>
+
+ #include <cstring>
+ #include <vector>
+
+namespace {
+
+constexpr char DirectoryCostsOption[] = "--directory-costs";
+
+void printDirectoryCosts(QTextStream& out, const char* title, const std::vector<SnapshotDirectoryCost>& costs)
+{
+	out << title << ":\n";
+	for (const SnapshotDirectoryCost& cost : costs)
+		out << "  " << formatDuration(cost.elapsed) << '\t' << cost.entries << " entries\t" << nativePathForDisplay(cost.path) << '\n';
+	if (costs.empty())
+		out << "  (not recorded)\n";
+}
+
+// SpaceGuard --directory-costs <snapshot> lists the directories that cost the scan of a saved snapshot the most, without
+// opening a window.
+int printDirectoryCosts(const QString& snapshotPath)
+{
+	QTextStream out{stdout};
+	const auto snapshot = Snapshot::load(snapshotPath);
+	if (!snapshot)
+	{
+		QTextStream{stderr} << "Cannot load " << snapshotPath << ": " << snapshotLoadErrorDescription(snapshot.error()) << '\n';
+		return 1;
+	}
+
+	out << "Scan of " << nativePathForDisplay(snapshot->rootPath) << " from " << formatSnapshotTime(snapshot->scanStartedAtUtc)
+		<< " to " << formatSnapshotTime(snapshot->scanCompletedAtUtc) << "\n\n";
+	printDirectoryCosts(out, "Slowest directories", snapshot->directoryCosts.slowest);
+	out << '\n';
+	printDirectoryCosts(out, "Largest directories", snapshot->directoryCosts.largest);
+	return 0;
+}
+
+} // namespace
 
  int main(int argc, char* argv[])
  {
+	if (argc == 3 && std::strcmp(argv[1], DirectoryCostsOption) == 0)
+	{
+		QCoreApplication app{argc, argv};
+		return printDirectoryCosts(QCoreApplication::arguments().at(2));
+	}
+
 	QApplication app{argc, argv};
 
 	app.setOrganizationName("GitHubSoft");
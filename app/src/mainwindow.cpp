@@ -16,11 +16,13 @@
 #include <QHeaderView>
 #include <QMessageBox>
 #include <QProcess>
+#include <QStandardPaths>
 #include <QTableWidget>
 #include <QUrl>
 
 #include <algorithm>
 #include <assert.h>
+#include <chrono>
 #include <exception>
 #include <map>
 #include <utility>
@@ -224,26 +226,6 @@ QString saveErrorDescription(const SnapshotSaveError& error)
 	return description;
 }
 
-QString loadErrorDescription(const SnapshotLoadError& error)
-{
-	QString description;
-	switch (error.code)
-	{
-	case SnapshotLoadErrorCode::open_failed: description = "The snapshot file could not be opened."; break;
-	case SnapshotLoadErrorCode::read_failed: description = "The snapshot file could not be read."; break;
-	case SnapshotLoadErrorCode::unsupported_legacy_format: description = "Legacy snapshots are not supported."; break;
-	case SnapshotLoadErrorCode::unsupported_version: description = "This snapshot version is not supported."; break;
-	case SnapshotLoadErrorCode::wrong_platform: description = "The snapshot was created on a different platform."; break;
-	case SnapshotLoadErrorCode::decompression_failed: description = "The snapshot data could not be decompressed."; break;
-	case SnapshotLoadErrorCode::truncated: description = "The snapshot file is truncated."; break;
-	case SnapshotLoadErrorCode::corrupt_data: description = "The snapshot data is corrupt."; break;
-	case SnapshotLoadErrorCode::trailing_data: description = "The snapshot contains unexpected trailing data."; break;
-	}
-	if (!error.systemMessage.isEmpty())
-		description += "\n\n" + error.systemMessage;
-	return description;
-}
-
 QString scanFailureDescription(const SnapshotScanFailure& failure)
 {
 	QString description;
@@ -257,6 +239,7 @@ QString scanFailureDescription(const SnapshotScanFailure& failure)
 	case SnapshotScanFailureCode::root_filesystem_identity_mismatch: description = "The root does not belong to the filesystem reported for the selected path."; break;
 	case SnapshotScanFailureCode::root_enumeration_unavailable: description = "The root directory could not be enumerated."; break;
 	case SnapshotScanFailureCode::root_filesystem_identity_changed: description = "The root filesystem identity changed during the scan."; break;
+	case SnapshotScanFailureCode::root_call_stalled: description = "A filesystem call for the root directory did not return in time."; break;
 	case SnapshotScanFailureCode::unexpected_error: description = "The scan stopped because of an unexpected error."; break;
 	}
 
@@ -292,6 +275,7 @@ QString diagnosticOperationName(const SnapshotOperation operation)
 	case SnapshotOperation::filesystem_space_at_start: return "Filesystem space at start";
 	case SnapshotOperation::filesystem_space_at_completion: return "Filesystem space at completion";
 	case SnapshotOperation::entry_changed_during_scan: return "Entry changed during scan";
+	case SnapshotOperation::call_deadline_exceeded: return "Call deadline exceeded";
 	}
 	return "Unknown";
 }
@@ -311,11 +295,15 @@ QString scanIssueSummary(const std::vector<SnapshotDiagnostic>& diagnostics)
 QString excludedRegionReason(const ComparisonExcludedRegion& region)
 {
 	QStringList reasons;
-	if (region.baselineCoverageIncomplete)
+	if (region.baselineExcludedByRule)
+		reasons.push_back("excluded from baseline scan");
+	if (region.currentExcludedByRule)
+		reasons.push_back("excluded from current scan");
+	if (region.baselineCoverageIncomplete && !region.baselineExcludedByRule)
 		reasons.push_back("baseline coverage incomplete");
 	if (region.baselineAccountingUncertain)
 		reasons.push_back("baseline accounting uncertain");
-	if (region.currentCoverageIncomplete)
+	if (region.currentCoverageIncomplete && !region.currentExcludedByRule)
 		reasons.push_back("current coverage incomplete");
 	if (region.currentAccountingUncertain)
 		reasons.push_back("current accounting uncertain");
@@ -375,6 +363,25 @@ void appendSnapshotDiagnostics(QTableWidget& table, const QString& source, const
 	}
 }
 
+void appendDirectoryCosts(QTableWidget& table, const QString& source, const Snapshot& snapshot)
+{
+	const auto append = [&table, &source](const QString& ranking, const std::vector<SnapshotDirectoryCost>& costs) {
+		for (const SnapshotDirectoryCost& cost : costs)
+		{
+			const int row = table.rowCount();
+			table.insertRow(row);
+			table.setItem(row, 0, new QTableWidgetItem{source});
+			table.setItem(row, 1, new QTableWidgetItem{ranking});
+			table.setItem(row, 2, new QTableWidgetItem{formatDuration(cost.elapsed)});
+			table.setItem(row, 3, new QTableWidgetItem{QString::number(static_cast<qulonglong>(cost.entries))});
+			table.setItem(row, 4, new QTableWidgetItem{nativePathForDisplay(cost.path)});
+			setRowPath(table, row, cost.path);
+		}
+	};
+	append("Slowest", snapshot.directoryCosts.slowest);
+	append("Largest", snapshot.directoryCosts.largest);
+}
+
 } // namespace
 
 MainWindow::MainWindow(QWidget* parent)
@@ -405,12 +412,13 @@ MainWindow::MainWindow(QWidget* parent)
 	connect(m_ui->changesTable, &QTableWidget::itemActivated, this, [this](QTableWidgetItem* item) { revealTableItemInFileManager(item); });
 	connect(m_ui->excludedTable, &QTableWidget::itemActivated, this, [this](QTableWidgetItem* item) { revealTableItemInFileManager(item); });
 	connect(m_ui->diagnosticsTable, &QTableWidget::itemActivated, this, [this](QTableWidgetItem* item) { revealTableItemInFileManager(item); });
+	connect(m_ui->directoryCostsTable, &QTableWidget::itemActivated, this, [this](QTableWidgetItem* item) { revealTableItemInFileManager(item); });
 	connect(m_ui->changesTable, &QTableWidget::itemSelectionChanged, this, [this] { updateGrowthActions(); });
 	connect(m_ui->showInUsageButton, &QAbstractButton::clicked, this, [this] { showSelectedGrowthInCurrentUsage(); });
 	connect(m_ui->revealGrowthButton, &QAbstractButton::clicked, this, [this] { revealSelectedGrowthInFileManager(); });
 	connect(m_ui->snapshotUsageWidget, &SnapshotUsageWidget::pathActivated, this, [this](const NativePath& path) { revealPath(path); });
 
-	for (QTableWidget* table : {m_ui->changesTable, m_ui->excludedTable, m_ui->diagnosticsTable})
+	for (QTableWidget* table : {m_ui->changesTable, m_ui->excludedTable, m_ui->diagnosticsTable, m_ui->directoryCostsTable})
 	{
 		table->horizontalHeader()->setStretchLastSection(true);
 		table->verticalHeader()->setVisible(false);
@@ -423,12 +431,17 @@ MainWindow::MainWindow(QWidget* parent)
 	m_ui->excludedTable->horizontalHeader()->setSectionResizeMode(0, QHeaderView::ResizeToContents);
 	m_ui->diagnosticsTable->horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeToContents);
 	m_ui->diagnosticsTable->horizontalHeader()->setSectionResizeMode(4, QHeaderView::Stretch);
+	m_ui->directoryCostsTable->horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeToContents);
+	m_ui->directoryCostsTable->horizontalHeader()->setSectionResizeMode(4, QHeaderView::Stretch);
 	m_ui->changesTable->setSortingEnabled(true);
 	m_ui->changesTable->sortItems(0, Qt::DescendingOrder);
 
 	CSettings settings;
 	m_ui->rootPathEdit->setText(settings.value(Settings::Path).toString());
 	m_ui->thresholdSpinBox->setValue(settings.value(Settings::Threshold, 1024).toInt());
+	m_scanRunner.setTraceDirectory(settings.value(Settings::ScanTraceDirectory).toString());
+	m_scanRunner.setJournalDirectory(settings.value(Settings::ScanJournalDirectory,
+		QDir{QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation)}.filePath("scan-journals")).toString());
 	m_ui->thresholdSpinBox->setEnabled(false);
 	m_ui->resultViewTabs->setTabEnabled(GrowthViewIndex, false);
 	m_ui->resultViewTabs->setTabEnabled(UsageViewIndex, false);
@@ -484,10 +497,10 @@ void MainWindow::findGrowth()
 	if (snapshotPath.isEmpty())
 		return;
 
-	auto loaded = Snapshot::load(snapshotPath);
+	auto loaded = m_scanRunner.loadSnapshot(snapshotPath);
 	if (!loaded)
 	{
-		QMessageBox::critical(this, "Cannot load snapshot", loadErrorDescription(loaded.error()));
+		QMessageBox::critical(this, "Cannot load snapshot", snapshotLoadErrorDescription(loaded.error()));
 		return;
 	}
 
@@ -511,7 +524,7 @@ void MainWindow::inspectCurrentUsage()
 
 void MainWindow::cancelScan()
 {
-	if (!m_scanRunner.cancel())
+	if (!m_activeGeneration || !m_scanRunner.cancel(*m_activeGeneration))
 		return;
 	m_ui->cancelScanButton->setEnabled(false);
 	m_ui->scanStatusLabel->setText("Canceling...");
@@ -521,10 +534,20 @@ void MainWindow::beginScan(const ScanPurpose purpose, const NativePath& rootPath
 {
 	try
 	{
-		const std::optional<uint64_t> generation = m_scanRunner.start(rootPath);
+		// Baselines and comparisons stay on one filesystem so that their snapshots remain comparable.
+		const SnapshotScanScope scope = purpose == ScanPurpose::inspect_current_usage && m_ui->includeMountsCheckBox->isChecked()
+			? SnapshotScanScope::all_mounts : SnapshotScanScope::single_filesystem;
+		// A comparison scan revisits the baseline's tree, whose shape tells the scanner where the large subtrees are.
+		const std::shared_ptr<const Snapshot> baseline = purpose == ScanPurpose::compare_with_baseline ? m_baselineSnapshot : nullptr;
+		const bool resume = scope == SnapshotScanScope::single_filesystem && m_scanRunner.hasResumableScan(rootPath)
+			&& QMessageBox::question(this, "Resume scan",
+				QString{"A scan of %1 was interrupted. Resume it instead of starting over?"}.arg(nativePathForDisplay(rootPath)))
+				== QMessageBox::Yes;
+		const std::optional<uint64_t> generation = resume ? m_scanRunner.resume(rootPath, {}, baseline)
+			: m_scanRunner.start(rootPath, scope, {}, baseline);
 		if (!generation)
 		{
-			QMessageBox::warning(this, "Scan already active", "Wait for the current scan to finish or cancel it first.");
+			QMessageBox::warning(this, "Too many scans active", "Wait for a running scan to finish or cancel it first.");
 			return;
 		}
 		m_activePurpose = purpose;
@@ -533,6 +556,7 @@ void MainWindow::beginScan(const ScanPurpose purpose, const NativePath& rootPath
 		m_scanElapsedUpdateTimer.start();
 		m_ui->scanStatusLabel->setText(purpose == ScanPurpose::create_baseline ? "Creating baseline..." : "Scanning current state...");
 		m_ui->scanCountsLabel->clear();
+		m_ui->scanProgressBar->setRange(0, 0);
 		m_ui->scanDurationLabel->setText("Elapsed: <1 s");
 		setScanActive(true);
 	}
@@ -550,10 +574,23 @@ void MainWindow::updateScanProgress(const uint64_t generation, const SnapshotSca
 {
 	if (!m_activeGeneration || generation != *m_activeGeneration)
 		return;
-	m_ui->scanCountsLabel->setText(QString{"%1 directories, %2 entries, %3 issues"}
+	QString counts = QString{"%1 directories, %2 entries, %3 issues"}
 		.arg(static_cast<qulonglong>(progress.directoriesCompleted))
 		.arg(static_cast<qulonglong>(progress.entriesDiscovered))
-		.arg(static_cast<qulonglong>(progress.issues)));
+		.arg(static_cast<qulonglong>(progress.issues));
+
+	// Without an expected total the progress bar stays a busy indicator.
+	if (const auto fraction = scanCompletedFraction(progress))
+	{
+		counts += QString{" (%1% of about %2)"}
+			.arg(static_cast<int>(*fraction * 100))
+			.arg(static_cast<qulonglong>(progress.expectedEntries));
+		if (const auto remaining = scanRemainingTime(progress))
+			counts += ", about " + formatElapsedTime(std::chrono::milliseconds{*remaining}.count()) + " left";
+		m_ui->scanProgressBar->setRange(0, 1000);
+		m_ui->scanProgressBar->setValue(static_cast<int>(*fraction * 1000));
+	}
+	m_ui->scanCountsLabel->setText(counts);
 }
 
 void MainWindow::scanCompleted(
@@ -587,11 +624,12 @@ void MainWindow::scanCompleted(
 
 	const Snapshot& snapshot = std::get<Snapshot>(*result);
 	const std::shared_ptr<const Snapshot> completedSnapshot{result, &snapshot};
-	if (snapshot.root.derived.allocationOverflow)
+	const SnapshotEntryDerivedData rootDerived = snapshot.tree.derived(SnapshotTree::RootIndex);
+	if (rootDerived.allocationOverflow)
 		m_ui->scanStatusLabel->setText("Scan complete; some allocated-size totals overflowed.");
-	else if (!snapshot.root.derived.subtreeAllocatedSize && snapshot.root.derived.knownSubtreeAllocatedSizeLowerBound)
+	else if (!rootDerived.subtreeAllocatedSize && rootDerived.knownSubtreeAllocatedSizeLowerBound)
 		m_ui->scanStatusLabel->setText("Scan complete; some totals are known lower bounds.");
-	else if (!snapshot.root.derived.subtreeAllocatedSize)
+	else if (!rootDerived.subtreeAllocatedSize)
 		m_ui->scanStatusLabel->setText("Scan complete; some allocated-size data is unavailable.");
 	else
 		m_ui->scanStatusLabel->setText("Scan complete.");
@@ -627,6 +665,7 @@ void MainWindow::setScanActive(const bool active)
 	m_ui->createSnapshotButton->setEnabled(!active);
 	m_ui->compareSnapshotButton->setEnabled(!active);
 	m_ui->inspectUsageButton->setEnabled(!active);
+	m_ui->includeMountsCheckBox->setEnabled(!active);
 	m_ui->cancelScanButton->setEnabled(active);
 	m_ui->scanProgressBar->setVisible(active);
 	m_ui->thresholdSpinBox->setEnabled(!active && m_baselineSnapshot && m_currentSnapshot);
@@ -658,9 +697,10 @@ void MainWindow::saveCreatedSnapshot(const Snapshot& snapshot)
 		qualifications.push_back(QString{"%1 scan issue%2: %3"}
 			.arg(issueCount).arg(issueCount == 1 ? "" : "s").arg(scanIssueSummary(snapshot.diagnostics)));
 	}
-	if (!snapshot.root.derived.subtreeCoverageComplete)
+	const SnapshotEntryDerivedData rootDerived = snapshot.tree.derived(SnapshotTree::RootIndex);
+	if (!rootDerived.subtreeCoverageComplete)
 		qualifications.push_back("incomplete directory coverage");
-	if (!snapshot.root.derived.subtreeAllocatedSize)
+	if (!rootDerived.subtreeAllocatedSize)
 		qualifications.push_back("incomplete allocated-size accounting");
 	if (!qualifications.empty())
 	{
@@ -804,6 +844,7 @@ void MainWindow::clearComparisonDisplay()
 	updateGrowthActions();
 	m_ui->excludedTable->setRowCount(0);
 	m_ui->diagnosticsTable->setRowCount(0);
+	m_ui->directoryCostsTable->setRowCount(0);
 	m_ui->detailsTabs->setTabText(0, "Excluded regions");
 	m_ui->detailsTabs->setTabText(1, "Scan issues");
 	m_ui->detailsButton->setChecked(false);
@@ -815,10 +856,17 @@ void MainWindow::clearComparisonDisplay()
 void MainWindow::populateDiagnostics()
 {
 	m_ui->diagnosticsTable->setRowCount(0);
+	m_ui->directoryCostsTable->setRowCount(0);
 	if (m_baselineSnapshot)
+	{
 		appendSnapshotDiagnostics(*m_ui->diagnosticsTable, "Baseline", *m_baselineSnapshot);
+		appendDirectoryCosts(*m_ui->directoryCostsTable, "Baseline", *m_baselineSnapshot);
+	}
 	if (m_currentSnapshot)
+	{
 		appendSnapshotDiagnostics(*m_ui->diagnosticsTable, "Current scan", *m_currentSnapshot);
+		appendDirectoryCosts(*m_ui->directoryCostsTable, "Current scan", *m_currentSnapshot);
+	}
 	updateDetailsDisclosure();
 }
 
@@ -826,6 +874,8 @@ void MainWindow::populateCompletedScanDiagnostics(const Snapshot& snapshot)
 {
 	m_ui->diagnosticsTable->setRowCount(0);
 	appendSnapshotDiagnostics(*m_ui->diagnosticsTable, "Current scan", snapshot);
+	m_ui->directoryCostsTable->setRowCount(0);
+	appendDirectoryCosts(*m_ui->directoryCostsTable, "Current scan", snapshot);
 	updateDetailsDisclosure();
 	if (!snapshot.diagnostics.empty())
 	{
@@ -848,7 +898,7 @@ void MainWindow::updateDetailsDisclosure()
 		counts.push_back(QString{"%1 scan issue%2"}.arg(diagnosticCount).arg(diagnosticCount == 1 ? "" : "s"));
 	m_ui->detailsButton->setText(counts.empty() ? "Details" : "Details (" + counts.join(", ") + ")");
 
-	const bool detailsAvailable = m_comparison.has_value() || diagnosticCount != 0;
+	const bool detailsAvailable = m_comparison.has_value() || diagnosticCount != 0 || m_ui->directoryCostsTable->rowCount() != 0;
 	m_ui->detailsButton->setEnabled(detailsAvailable);
 	if (!detailsAvailable)
 		m_ui->detailsButton->setChecked(false);
@@ -0,0 +1,254 @@
+#include "mount_table.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif defined __APPLE__
+#include <sys/mount.h>
+#include <sys/param.h>
+#include <sys/ucred.h>
+#elif defined __linux__
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cwchar>
+#include <memory>
+#include <optional>
+
+namespace {
+
+[[maybe_unused]] constexpr std::array<std::string_view, 22> PseudoFilesystemTypes{
+	"autofs", "binfmt_misc", "bpf", "cgroup", "cgroup2", "configfs", "debugfs", "devfs", "devpts", "devtmpfs", "efivarfs",
+	"fusectl", "hugetlbfs", "mqueue", "nsfs", "proc", "pstore", "rpc_pipefs", "securityfs", "selinuxfs", "sysfs", "tracefs"
+};
+
+[[maybe_unused]] constexpr std::array<std::string_view, 14> NetworkFilesystemTypes{
+	"9p", "afpfs", "afs", "ceph", "cifs", "fuse.glusterfs", "fuse.sshfs", "glusterfs", "lustre", "nfs", "nfs4", "smb3",
+	"smbfs", "webdav"
+};
+
+[[maybe_unused]] bool isPseudoFilesystem(const std::string_view type) noexcept
+{
+	return std::ranges::find(PseudoFilesystemTypes, type) != PseudoFilesystemTypes.end();
+}
+
+[[maybe_unused]] bool isNetworkFilesystem(const std::string_view type) noexcept
+{
+	return std::ranges::find(NetworkFilesystemTypes, type) != NetworkFilesystemTypes.end();
+}
+
+// "server:/export" and "//server/share" both name the server; other sources are kept whole.
+[[maybe_unused]] std::string networkDevice(const std::string_view source)
+{
+	std::string_view host = source;
+	if (host.starts_with("//"))
+	{
+		host.remove_prefix(2);
+		host = host.substr(0, host.find('/'));
+	}
+	else if (const auto separator = host.find(':'); separator != std::string_view::npos && separator > 0)
+		host = host.substr(0, separator);
+	return "network:" + std::string{host};
+}
+
+// Mount points escape space, tab, newline and backslash as three octal digits.
+std::string unescapeMountInfoField(const std::string_view field)
+{
+	std::string result;
+	result.reserve(field.size());
+	for (std::size_t i = 0; i < field.size(); ++i)
+	{
+		if (field[i] == '\\' && i + 3 < field.size()
+			&& std::ranges::all_of(field.substr(i + 1, 3), [](const char c) { return c >= '0' && c <= '7'; }))
+		{
+			result += static_cast<char>((field[i + 1] - '0') * 64 + (field[i + 2] - '0') * 8 + (field[i + 3] - '0'));
+			i += 3;
+		}
+		else
+			result += field[i];
+	}
+	return result;
+}
+
+bool isAtOrBelow(const NativePath& path, const NativePath& ancestor)
+{
+	return nativeDescendantComponents(ancestor, path).has_value();
+}
+
+#ifdef __linux__
+std::string readWholeFile(const char* const path)
+{
+	std::string contents;
+	std::unique_ptr<std::FILE, decltype(&std::fclose)> file{std::fopen(path, "re"), &std::fclose};
+	if (!file)
+		return contents;
+	char buffer[16384];
+	while (const std::size_t size = std::fread(buffer, 1, sizeof(buffer), file.get()))
+		contents.append(buffer, size);
+	return contents;
+}
+
+// Partitions share their disk's request queue, so they are grouped under the disk. Device-mapper and other stacked
+// devices are not partitions and stay separate.
+std::optional<std::string> wholeDiskDevice(const std::string& blockDevicePath)
+{
+	struct stat status{};
+	if (::stat(blockDevicePath.c_str(), &status) != 0 || !S_ISBLK(status.st_mode))
+		return {};
+
+	const std::string number = std::to_string(major(status.st_rdev)) + ':' + std::to_string(minor(status.st_rdev));
+	const std::string sysfsPath = "/sys/dev/block/" + number;
+	struct stat partition{};
+	if (::stat((sysfsPath + "/partition").c_str(), &partition) != 0)
+		return "disk:" + number;
+
+	std::unique_ptr<char, decltype(&::free)> resolved{::realpath(sysfsPath.c_str(), nullptr), &::free};
+	if (!resolved)
+		return "disk:" + number;
+	std::string disk{resolved.get()};
+	disk.resize(disk.rfind('/'));
+	std::string diskNumber = readWholeFile((disk + "/dev").c_str());
+	while (!diskNumber.empty() && (diskNumber.back() == '\n' || diskNumber.back() == ' '))
+		diskNumber.pop_back();
+	return "disk:" + (diskNumber.empty() ? number : diskNumber);
+}
+#endif
+
+} // namespace
+
+std::vector<MountedFilesystem> parseMountInfo(std::string_view mountInfo)
+{
+	std::vector<MountedFilesystem> mounts;
+	while (!mountInfo.empty())
+	{
+		const std::size_t lineEnd = std::min(mountInfo.find('\n'), mountInfo.size());
+		std::string_view line = mountInfo.substr(0, lineEnd);
+		mountInfo.remove_prefix(std::min(lineEnd + 1, mountInfo.size()));
+
+		// mount-id parent-id major:minor root mount-point options [optional fields...] - type source super-options
+		std::vector<std::string_view> fields;
+		while (!line.empty())
+		{
+			const std::size_t fieldEnd = std::min(line.find(' '), line.size());
+			if (fieldEnd > 0)
+				fields.push_back(line.substr(0, fieldEnd));
+			line.remove_prefix(std::min(fieldEnd + 1, line.size()));
+		}
+		const auto separator = std::ranges::find(fields, "-");
+		if (fields.size() < 6 || separator == fields.end() || std::distance(separator, fields.end()) < 3
+			|| std::distance(fields.begin(), separator) < 6)
+		{
+			continue;
+		}
+
+		MountedFilesystem mount;
+		mount.filesystemType = separator[1];
+		if (isPseudoFilesystem(mount.filesystemType))
+			continue;
+#ifdef _WIN32
+		mount.mountPoint = QString::fromStdString(unescapeMountInfoField(fields[4]));
+#else
+		mount.mountPoint = QByteArray::fromStdString(unescapeMountInfoField(fields[4]));
+#endif
+		mount.source = unescapeMountInfoField(separator[2]);
+		mount.device = isNetworkFilesystem(mount.filesystemType) ? networkDevice(mount.source) : "device:" + std::string{fields[2]};
+		mounts.push_back(std::move(mount));
+	}
+	return mounts;
+}
+
+std::vector<MountedFilesystem> readMountTable()
+{
+	std::vector<MountedFilesystem> mounts;
+#ifdef _WIN32
+	// Volumes mounted on drive letters and in folders; each volume is its own device.
+	wchar_t volumeName[MAX_PATH];
+	const HANDLE volumes = ::FindFirstVolumeW(volumeName, MAX_PATH);
+	if (volumes == INVALID_HANDLE_VALUE)
+		return mounts;
+	do
+	{
+		DWORD length = 0;
+		std::vector<wchar_t> paths(MAX_PATH);
+		if (!::GetVolumePathNamesForVolumeNameW(volumeName, paths.data(), static_cast<DWORD>(paths.size()), &length))
+		{
+			if (::GetLastError() != ERROR_MORE_DATA)
+				continue;
+			paths.resize(length);
+			if (!::GetVolumePathNamesForVolumeNameW(volumeName, paths.data(), static_cast<DWORD>(paths.size()), &length))
+				continue;
+		}
+
+		wchar_t filesystemName[MAX_PATH + 1] = {};
+		const bool hasFilesystemName = ::GetVolumeInformationW(volumeName, nullptr, 0, nullptr, nullptr, nullptr,
+			filesystemName, MAX_PATH + 1) != FALSE;
+		for (const wchar_t* path = paths.data(); *path != L'\0'; path += std::wcslen(path) + 1)
+		{
+			const auto mountPoint = normalizedAbsoluteNativePath(QString::fromWCharArray(path));
+			if (!mountPoint)
+				continue;
+			MountedFilesystem mount;
+			mount.mountPoint = *mountPoint;
+			if (hasFilesystemName)
+				mount.filesystemType = QString::fromWCharArray(filesystemName).toStdString();
+			mount.source = QString::fromWCharArray(volumeName).toStdString();
+			mount.device = "volume:" + mount.source;
+			mounts.push_back(std::move(mount));
+		}
+	}
+	while (::FindNextVolumeW(volumes, volumeName, MAX_PATH));
+	::FindVolumeClose(volumes);
+	// Shorter paths first approximates mount order, which is not reported.
+	std::ranges::stable_sort(mounts, {}, [](const MountedFilesystem& mount) { return mount.mountPoint.size(); });
+#elif defined __APPLE__
+	struct statfs* filesystems = nullptr;
+	const int count = ::getmntinfo(&filesystems, MNT_NOWAIT);
+	for (int i = 0; i < count; ++i)
+	{
+		const struct statfs& filesystem = filesystems[i];
+		MountedFilesystem mount;
+		mount.filesystemType = filesystem.f_fstypename;
+		if (isPseudoFilesystem(mount.filesystemType))
+			continue;
+		mount.mountPoint = NativePath{filesystem.f_mntonname};
+		mount.source = filesystem.f_mntfromname;
+		if (isNetworkFilesystem(mount.filesystemType))
+			mount.device = networkDevice(mount.source);
+		else if (mount.source.starts_with("/dev/disk"))
+			// APFS volumes of one container and the slices of one disk share /dev/diskN.
+			mount.device = "disk:" + mount.source.substr(0, mount.source.find('s', std::string_view{"/dev/disk"}.size()));
+		else
+			mount.device = "device:" + mount.source;
+		mounts.push_back(std::move(mount));
+	}
+#elif defined __linux__
+	mounts = parseMountInfo(readWholeFile("/proc/self/mountinfo"));
+	for (MountedFilesystem& mount : mounts)
+	{
+		if (!mount.source.starts_with("/dev/"))
+			continue;
+		if (auto disk = wholeDiskDevice(mount.source))
+			mount.device = std::move(*disk);
+	}
+#endif
+	return mounts;
+}
+
+std::vector<MountedFilesystem> mountsUnder(const std::vector<MountedFilesystem>& mounts, const NativePath& rootPath)
+{
+	std::vector<MountedFilesystem> visible;
+	for (const MountedFilesystem& mount : mounts)
+	{
+		// A later mount hides everything mounted at or below its mount point.
+		std::erase_if(visible, [&mount](const MountedFilesystem& earlier) { return isAtOrBelow(earlier.mountPoint, mount.mountPoint); });
+		if (isAtOrBelow(mount.mountPoint, rootPath))
+			visible.push_back(mount);
+	}
+	// An ancestor's path is strictly shorter than its descendants'.
+	std::ranges::stable_sort(visible, {}, [](const MountedFilesystem& mount) { return mount.mountPoint.size(); });
+	return visible;
+}
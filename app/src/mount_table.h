@@ -0,0 +1,31 @@
+#pragma once
+
+#include "native_path.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct MountedFilesystem
+{
+	NativePath mountPoint;
+	std::string filesystemType;
+	std::string source;
+	// Identifies the backing device: the whole disk for a partition, the server for a network filesystem. Filesystems with
+	// the same device compete for one I/O queue.
+	std::string device;
+
+	[[nodiscard]] bool operator==(const MountedFilesystem&) const = default;
+};
+
+// Parses the contents of /proc/self/mountinfo, in mount order. Pseudo filesystems that store no data (proc, sysfs,
+// cgroup and the like) are left out. Block devices are identified by their own device number; readMountTable() maps
+// partitions to their disks.
+[[nodiscard]] std::vector<MountedFilesystem> parseMountInfo(std::string_view mountInfo);
+
+// The mount table of the current process, in mount order; empty where it cannot be read.
+[[nodiscard]] std::vector<MountedFilesystem> readMountTable();
+
+// The mounts visible at or below rootPath, parents before children. A mount hidden by a later one at or above its mount
+// point is left out; the mount containing rootPath itself is not included unless mounted exactly at rootPath.
+[[nodiscard]] std::vector<MountedFilesystem> mountsUnder(const std::vector<MountedFilesystem>& mounts, const NativePath& rootPath);
@@ -4,7 +4,10 @@
 #include <QFile>
 #include <QUrl>
 
+#include <algorithm>
 #include <assert.h>
+#include <functional>
+#include <string_view>
 #include <utility>
 
 bool isAbsoluteNativePath(const NativePath& path) noexcept
@@ -56,7 +59,54 @@ NativeName nativeNameFromThinIo(const thin_io::native_string& name)
 #endif
 }
 
-NativePath appendNativeName(const NativePath& parentPath, const NativeName& name)
+NativeNameView nativeNameViewFromThinIo(const thin_io::native_string& name) noexcept
+{
+#ifdef _WIN32
+	return QStringView{reinterpret_cast<const char16_t*>(name.data()), static_cast<qsizetype>(name.size())};
+#else
+	return QByteArrayView{name.data(), static_cast<qsizetype>(name.size())};
+#endif
+}
+
+NativeName nativeNameFromView(const NativeNameView name)
+{
+#ifdef _WIN32
+	return name.toString();
+#else
+	return name.toByteArray();
+#endif
+}
+
+bool nativeNameLess(const NativeNameView left, const NativeNameView right) noexcept
+{
+#ifdef _WIN32
+	return left < right;
+#else
+	return std::string_view{left.data(), static_cast<std::size_t>(left.size())}
+		< std::string_view{right.data(), static_cast<std::size_t>(right.size())};
+#endif
+}
+
+bool nativeNamesEqual(const NativeNameView left, const NativeNameView right) noexcept
+{
+#ifdef _WIN32
+	return left == right;
+#else
+	return std::string_view{left.data(), static_cast<std::size_t>(left.size())}
+		== std::string_view{right.data(), static_cast<std::size_t>(right.size())};
+#endif
+}
+
+std::size_t NativeNameHash::operator()(const NativeNameView name) const noexcept
+{
+#ifdef _WIN32
+	return std::hash<std::u16string_view>{}(std::u16string_view{name.utf16(), static_cast<std::size_t>(name.size())});
+#else
+	return std::hash<std::string_view>{}(std::string_view{name.data(), static_cast<std::size_t>(name.size())});
+#endif
+}
+
+NativePath appendNativeName(const NativePath& parentPath, const NativeNameView name)
 {
 	assert(!parentPath.isEmpty());
 	assert(!name.isEmpty());
@@ -65,14 +115,14 @@ NativePath appendNativeName(const NativePath& parentPath, const NativeName& name
 	assert(!name.contains('/') && !name.contains('\\'));
 	constexpr QChar separator = '\\';
 #else
-	assert(!name.contains('/'));
+	assert(std::ranges::find(name, '/') == name.end());
 	constexpr char separator = '/';
 #endif
 
 	NativePath result = parentPath;
 	if (!result.endsWith(separator))
 		result += separator;
-	result += name;
+	result.append(name);
 	return result;
 }
 
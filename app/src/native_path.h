@@ -3,25 +3,53 @@
 #include "filesystem_types.hpp"
 
 #include <QByteArray>
+#include <QByteArrayView>
 #include <QString>
+#include <QStringView>
 
+#include <cstddef>
 #include <optional>
 #include <vector>
 
 #ifdef _WIN32
 using NativePath = QString;
 using NativeName = QString;
+using NativeNameView = QStringView;
 using NativePathCharacter = wchar_t;
 #else
 using NativePath = QByteArray;
 using NativeName = QByteArray;
+using NativeNameView = QByteArrayView;
 using NativePathCharacter = char;
 #endif
 
 [[nodiscard]] std::optional<NativePath> normalizedAbsoluteNativePath(const QString& path);
 [[nodiscard]] bool isAbsoluteNativePath(const NativePath& path) noexcept;
 [[nodiscard]] NativeName nativeNameFromThinIo(const thin_io::native_string& name);
-[[nodiscard]] NativePath appendNativeName(const NativePath& parentPath, const NativeName& name);
+// Refers to the characters of name, which must outlive the view.
+[[nodiscard]] NativeNameView nativeNameViewFromThinIo(const thin_io::native_string& name) noexcept;
+[[nodiscard]] NativeName nativeNameFromView(NativeNameView name);
+// In the order of NativeName's operator<, which snapshots keep their entries in.
+[[nodiscard]] bool nativeNameLess(NativeNameView left, NativeNameView right) noexcept;
+[[nodiscard]] bool nativeNamesEqual(NativeNameView left, NativeNameView right) noexcept;
+
+// For hashed containers of names, which can then be searched by view.
+struct NativeNameHash
+{
+	using is_transparent = void;
+	[[nodiscard]] std::size_t operator()(NativeNameView name) const noexcept;
+};
+
+struct NativeNameEqual
+{
+	using is_transparent = void;
+	[[nodiscard]] bool operator()(const NativeNameView left, const NativeNameView right) const noexcept
+	{
+		return nativeNamesEqual(left, right);
+	}
+};
+
+[[nodiscard]] NativePath appendNativeName(const NativePath& parentPath, NativeNameView name);
 [[nodiscard]] std::optional<std::vector<NativeName>> nativeDescendantComponents(
 	const NativePath& rootPath, const NativePath& path);
 [[nodiscard]] QString nativePathForDisplay(const NativePath& path);
@@ -0,0 +1,109 @@
+#include "scan_concurrency_controller.h"
+
+#include <algorithm>
+#include <assert.h>
+
+namespace {
+
+// A change in participant count is judged by the share of ideal linear scaling it achieved.
+constexpr double ScalingEfficiencyThreshold = 0.5;
+// Growth stops accelerating once a step more than doubles the mean call latency.
+constexpr double LatencyGrowthLimit = 2.0;
+// A settled count is probed upwards after this many intervals without change.
+constexpr uint32_t ProbeAfterSettledIntervals = 8;
+
+} // namespace
+
+ScanConcurrencyController::ScanConcurrencyController(const uint32_t minimum, const uint32_t maximum, const uint32_t initial) noexcept
+	: m_minimum{std::max(minimum, 1u)},
+	  m_maximum{std::max(maximum, m_minimum)},
+	  m_participants{std::clamp(initial, m_minimum, m_maximum)},
+	  m_maximumStep{std::max((m_maximum - m_minimum) / 4, 1u)}
+{
+}
+
+uint32_t ScanConcurrencyController::participants() const noexcept
+{
+	return m_participants;
+}
+
+uint32_t ScanConcurrencyController::update(const ScanConcurrencyMeasurement& measurement) noexcept
+{
+	// An interval without completed calls says nothing about the current count, e.g. when every participant is blocked.
+	if (measurement.completedOperations == 0 || measurement.interval.count() <= 0)
+		return m_participants;
+
+	const double operations = static_cast<double>(measurement.completedOperations);
+	const double throughput = operations / std::chrono::duration<double>(measurement.interval).count();
+	const double latency = std::chrono::duration<double>(measurement.totalOperationLatency).count() / operations;
+	const double gain = m_previousThroughput > 0 ? throughput / m_previousThroughput : 1.0;
+	const double latencyGrowth = m_previousLatency > 0 ? latency / m_previousLatency : 1.0;
+	const double countRatio = m_previousParticipants > 0
+		? static_cast<double>(m_participants) / static_cast<double>(m_previousParticipants) : 1.0;
+	m_previousThroughput = throughput;
+	m_previousLatency = latency;
+	m_previousParticipants = m_participants;
+
+	if (m_lastMove == 0)
+	{
+		// First measurement, or the count was held: probe now and then, upwards unless already at the maximum.
+		if (m_settledIntervals == 0 || ++m_settledIntervals > ProbeAfterSettledIntervals)
+		{
+			m_settledIntervals = 0;
+			m_step = 1;
+			move(m_participants < m_maximum ? 1 : -1);
+		}
+	}
+	else if (countRatio > 1)
+	{
+		// Extra participants are worth keeping while they add a fair share of ideal linear scaling.
+		if ((gain - 1) / (countRatio - 1) >= ScalingEfficiencyThreshold)
+		{
+			if (latencyGrowth < LatencyGrowthLimit)
+				m_step = std::min(m_step * 2, m_maximumStep);
+			move(1);
+		}
+		else
+		{
+			// They only queued behind the device: undo the growth and look for the smallest count that keeps up.
+			m_step = 1;
+			move(-1, static_cast<uint32_t>(m_lastMove));
+		}
+	}
+	else
+	{
+		// Removed participants are missed when throughput fell by a fair share of the reduction. Shrinking goes one
+		// participant at a time so that it stops right at the saturation point.
+		if ((1 - gain) / (1 - countRatio) < ScalingEfficiencyThreshold)
+		{
+			m_step = 1;
+			move(-1);
+		}
+		else
+		{
+			m_step = 1;
+			move(1, static_cast<uint32_t>(-m_lastMove));
+			m_settledIntervals = 1;
+			m_lastMove = 0;
+		}
+	}
+	return m_participants;
+}
+
+void ScanConcurrencyController::move(const int direction) noexcept
+{
+	move(direction, m_step);
+}
+
+void ScanConcurrencyController::move(const int direction, const uint32_t step) noexcept
+{
+	assert(direction == 1 || direction == -1);
+	const uint32_t previous = m_participants;
+	if (direction > 0)
+		m_participants += std::min(step, m_maximum - m_participants);
+	else
+		m_participants -= std::min(step, m_participants - m_minimum);
+	m_lastMove = static_cast<int64_t>(m_participants) - static_cast<int64_t>(previous);
+	if (m_lastMove == 0 && m_settledIntervals == 0)
+		m_settledIntervals = 1;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <chrono>
+#include <stdint.h>
+
+// Throughput and latency of the native filesystem calls made by all scan participants over one adjustment interval.
+struct ScanConcurrencyMeasurement
+{
+	uint64_t completedOperations = 0;
+	std::chrono::nanoseconds totalOperationLatency{0};
+	std::chrono::nanoseconds interval{0};
+};
+
+// Hill-climbing choice of how many scan participants to keep active. Each change is judged by how much of ideal linear
+// scaling it achieved: growth continues, accelerating, while added participants raise throughput in proportion; once they
+// only lengthen the queue in front of the device the count shrinks until removing participants costs throughput, then
+// settles. A settled count is probed upwards again now and then, so that a filesystem whose latency changes is tracked.
+class ScanConcurrencyController
+{
+public:
+	ScanConcurrencyController(uint32_t minimum, uint32_t maximum, uint32_t initial) noexcept;
+
+	[[nodiscard]] uint32_t participants() const noexcept;
+
+	// Feeds the measurement taken at participants() and returns the participant count for the next interval.
+	uint32_t update(const ScanConcurrencyMeasurement& measurement) noexcept;
+
+private:
+	void move(int direction) noexcept;
+	void move(int direction, uint32_t step) noexcept;
+
+	const uint32_t m_minimum;
+	const uint32_t m_maximum;
+	uint32_t m_participants;
+	const uint32_t m_maximumStep;
+	uint32_t m_step = 1;
+	int64_t m_lastMove = 0;
+	uint32_t m_settledIntervals = 0;
+	uint32_t m_previousParticipants = 0;
+	double m_previousThroughput = 0;
+	double m_previousLatency = 0;
+};
@@ -0,0 +1,142 @@
+#include "scan_exclusions.h"
+
+#include <utility>
+
+namespace {
+
+#ifdef _WIN32
+constexpr QChar Separator = '\\';
+#else
+constexpr char Separator = '/';
+#endif
+
+// '*' matches any run and '?' any single character, neither of them a separator.
+bool globMatches(const NativePath& pattern, const NativeNameView text)
+{
+	qsizetype p = 0;
+	qsizetype t = 0;
+	qsizetype starPattern = -1;
+	qsizetype starText = 0;
+	while (t < text.size())
+	{
+		if (p < pattern.size() && pattern[p] == '*')
+		{
+			starPattern = p++;
+			starText = t;
+		}
+		else if (p < pattern.size() && (pattern[p] == text[t] || (pattern[p] == '?' && text[t] != Separator)))
+		{
+			++p;
+			++t;
+		}
+		else if (starPattern >= 0 && text[starText] != Separator)
+		{
+			// Lets the last star absorb one more character; a star never spans a separator, so neither can an earlier one.
+			p = starPattern + 1;
+			t = ++starText;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	while (p < pattern.size() && pattern[p] == '*')
+		++p;
+	return p == pattern.size();
+}
+
+bool isAtOrBelow(const NativePath& path, const NativePath& prefix)
+{
+	if (!path.startsWith(prefix))
+		return false;
+	return path.size() == prefix.size() || prefix.endsWith(Separator) || path[prefix.size()] == Separator;
+}
+
+} // namespace
+
+ScanExclusions::ScanExclusions(NativePath rootPath, const std::span<const SnapshotExclusionRule> rules)
+	: m_rootPath{std::move(rootPath)}
+{
+	for (const SnapshotExclusionRule& rule : rules)
+	{
+		if (rule.kind == SnapshotExclusionPatternKind::marker_file)
+		{
+			m_markers.push_back(rule.pattern);
+			continue;
+		}
+
+		NativePath pattern = rule.pattern;
+#ifdef _WIN32
+		pattern.replace('/', Separator);
+#endif
+		const bool relativePath = rule.kind == SnapshotExclusionPatternKind::glob && pattern.contains(Separator);
+		m_needsDirectoryPath |= relativePath || rule.kind == SnapshotExclusionPatternKind::path_prefix;
+		m_rules.push_back({rule.kind, std::move(pattern), rule.action, relativePath});
+	}
+}
+
+bool ScanExclusions::empty() const noexcept
+{
+	return m_rules.empty();
+}
+
+bool ScanExclusions::needsDirectoryPath() const noexcept
+{
+	return m_needsDirectoryPath;
+}
+
+const std::vector<NativeName>& ScanExclusions::markers() const noexcept
+{
+	return m_markers;
+}
+
+std::optional<SnapshotExclusionAction> ScanExclusions::match(const NativePath& directoryPath, const NativeNameView name) const
+{
+	std::optional<NativePath> path;
+	std::optional<NativePath> relativePath;
+	for (const Rule& rule : m_rules)
+	{
+		bool matches = false;
+		if (rule.kind == SnapshotExclusionPatternKind::path_prefix)
+		{
+			if (!path)
+				path = appendNativeName(directoryPath, name);
+			matches = isAtOrBelow(*path, rule.pattern);
+		}
+		else if (rule.relativePath)
+		{
+			if (!relativePath)
+			{
+				if (!path)
+					path = appendNativeName(directoryPath, name);
+				const qsizetype rootLength = m_rootPath.size() + (m_rootPath.endsWith(Separator) ? 0 : 1);
+				relativePath = isAtOrBelow(*path, m_rootPath) && path->size() > rootLength ? path->sliced(rootLength) : NativePath{};
+			}
+			matches = !relativePath->isEmpty() && globMatches(rule.pattern, *relativePath);
+		}
+		else
+		{
+			matches = globMatches(rule.pattern, name);
+		}
+
+		if (matches)
+			return rule.action;
+	}
+	return {};
+}
+
+bool ScanExclusions::excludes(const NativePath& path) const
+{
+	const auto components = nativeDescendantComponents(m_rootPath, path);
+	if (!components || empty())
+		return false;
+
+	NativePath directoryPath = m_rootPath;
+	for (const NativeName& component : *components)
+	{
+		if (match(directoryPath, component))
+			return true;
+		directoryPath = appendNativeName(directoryPath, component);
+	}
+	return false;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "snapshot.h"
+
+#include <optional>
+#include <span>
+#include <vector>
+
+// Decides which entries of a scan rooted at rootPath the exclusion rules cover. The first rule that matches an entry
+// decides its action; marker rules are reported separately, as they depend on a directory's contents.
+class ScanExclusions
+{
+public:
+	ScanExclusions(NativePath rootPath, std::span<const SnapshotExclusionRule> rules);
+
+	// Whether no glob or path prefix rule exists.
+	[[nodiscard]] bool empty() const noexcept;
+	// Whether match() needs the directory path, i.e. whether some rule depends on more than the entry name.
+	[[nodiscard]] bool needsDirectoryPath() const noexcept;
+	// The names whose presence in a directory excludes it.
+	[[nodiscard]] const std::vector<NativeName>& markers() const noexcept;
+
+	// directoryPath is the absolute path of the entry's parent; it may be left empty unless needsDirectoryPath().
+	[[nodiscard]] std::optional<SnapshotExclusionAction> match(const NativePath& directoryPath, NativeNameView name) const;
+	// Whether a scan would not enumerate path because a glob or path prefix rule matches it or a directory between the
+	// root and it. Paths outside the root are never excluded.
+	[[nodiscard]] bool excludes(const NativePath& path) const;
+
+private:
+	struct Rule
+	{
+		SnapshotExclusionPatternKind kind;
+		NativePath pattern; // Separators are native.
+		SnapshotExclusionAction action;
+		bool relativePath = false;
+	};
+
+	const NativePath m_rootPath;
+	std::vector<Rule> m_rules;
+	std::vector<NativeName> m_markers;
+	bool m_needsDirectoryPath = false;
+};
@@ -0,0 +1,308 @@
+#include "scan_journal.h"
+#include "snapshot_stream.h"
+
+#include <QTimeZone>
+#include <QtEndian>
+
+#include <utility>
+
+namespace {
+
+constexpr char FileMagic[] = {'S', 'P', 'G', 'J', 'R', 'N', 'L', '\0'};
+constexpr uint16_t FormatVersion = 1;
+constexpr qsizetype FileHeaderSize = sizeof(FileMagic) + sizeof(uint16_t);
+// Each record is framed by its length and checksum.
+constexpr qsizetype FrameHeaderSize = sizeof(uint32_t) + sizeof(uint16_t);
+constexpr uint32_t MaximumFrameSize = uint32_t{1} << 30;
+constexpr uint32_t MaximumExclusionRuleCount = 64 * 1024;
+
+QByteArray encodeHeader(const ScanJournalHeader& header)
+{
+	QByteArray payload;
+	QDataStream stream{&payload, QIODevice::WriteOnly};
+	SnapshotStream::configure(stream);
+	SnapshotStream::writeNativeString(stream, header.rootPath);
+	stream << static_cast<qint64>(header.scanStartedAtUtc.toMSecsSinceEpoch());
+	SnapshotStream::writeFilesystemSpace(stream, header.filesystemSpaceAtStart);
+	SnapshotStream::writeEntryFields(stream, header.root);
+	stream << static_cast<quint8>(header.fileResolution) << static_cast<quint64>(header.memoryBudget);
+	stream << static_cast<quint32>(header.exclusionRules.size());
+	for (const SnapshotExclusionRule& rule : header.exclusionRules)
+		SnapshotStream::writeExclusionRule(stream, rule);
+	SnapshotStream::writeNativeString(stream, header.exclusionRootPath);
+	return payload;
+}
+
+std::optional<ScanJournalHeader> decodeHeader(const QByteArray& payload)
+{
+	QDataStream stream{payload};
+	SnapshotStream::configure(stream);
+	ScanJournalHeader header;
+	qint64 startedAt = 0;
+	quint8 fileResolution = 0;
+	quint64 memoryBudget = 0;
+	quint32 ruleCount = 0;
+	if (!SnapshotStream::readNativeString(stream, header.rootPath) || !isAbsoluteNativePath(header.rootPath))
+		return {};
+	stream >> startedAt;
+	if (!SnapshotStream::readFilesystemSpace(stream, header.filesystemSpaceAtStart)
+		|| !SnapshotStream::readEntryFields(stream, header.root))
+		return {};
+	stream >> fileResolution >> memoryBudget >> ruleCount;
+	if (stream.status() != QDataStream::Ok || fileResolution > static_cast<quint8>(SnapshotFileResolution::budgeted)
+		|| ruleCount > MaximumExclusionRuleCount)
+		return {};
+	header.scanStartedAtUtc = QDateTime::fromMSecsSinceEpoch(startedAt, QTimeZone::UTC);
+	header.fileResolution = static_cast<SnapshotFileResolution>(fileResolution);
+	header.memoryBudget = memoryBudget;
+	header.exclusionRules.resize(ruleCount);
+	for (SnapshotExclusionRule& rule : header.exclusionRules)
+	{
+		if (!SnapshotStream::readExclusionRule(stream, rule))
+			return {};
+	}
+	if (!SnapshotStream::readNativeString(stream, header.exclusionRootPath) || !stream.atEnd())
+		return {};
+	return header;
+}
+
+bool decodeDirectory(const QByteArray& payload, NativePath& path, ScanJournalDirectory& directory)
+{
+	QDataStream stream{payload};
+	SnapshotStream::configure(stream);
+	if (!SnapshotStream::readNativeString(stream, path) || !isAbsoluteNativePath(path)
+		|| !SnapshotStream::readEntryFields(stream, directory.entry))
+		return false;
+
+	quint32 childCount = 0;
+	stream >> childCount;
+	// Every child takes several bytes, which bounds the count by the frame.
+	if (stream.status() != QDataStream::Ok || childCount > payload.size())
+		return false;
+	directory.entry.children.reserve(childCount);
+	directory.entry.children.begin_batch();
+	for (quint32 i = 0; i < childCount; ++i)
+	{
+		NativeName name;
+		SnapshotEntry child;
+		if (!SnapshotStream::readNativeString(stream, name) || !SnapshotStream::isValidName(name)
+			|| !SnapshotStream::readEntryFields(stream, child))
+		{
+			directory.entry.children.end_batch();
+			return false;
+		}
+		directory.entry.children.append_unsorted(std::move(name), std::move(child));
+	}
+	directory.entry.children.end_batch();
+	if (directory.entry.children.size() != childCount)
+		return false; // A name was recorded twice.
+
+	quint32 diagnosticCount = 0;
+	stream >> diagnosticCount;
+	if (stream.status() != QDataStream::Ok || diagnosticCount > payload.size())
+		return false;
+	directory.diagnostics.resize(diagnosticCount);
+	for (SnapshotDiagnostic& diagnostic : directory.diagnostics)
+	{
+		if (!SnapshotStream::readDiagnostic(stream, diagnostic))
+			return false;
+	}
+	return stream.atEnd();
+}
+
+} // namespace
+
+ScanJournalRecord::ScanJournalRecord()
+	: m_childStream{&m_children, QIODevice::WriteOnly}, m_diagnosticStream{&m_diagnostics, QIODevice::WriteOnly}
+{
+	SnapshotStream::configure(m_childStream);
+	SnapshotStream::configure(m_diagnosticStream);
+}
+
+void ScanJournalRecord::addChild(const NativeName& name, const SnapshotEntry& child)
+{
+	SnapshotStream::writeNativeString(m_childStream, name);
+	SnapshotStream::writeEntryFields(m_childStream, child);
+	++m_childCount;
+}
+
+void ScanJournalRecord::addDiagnostic(const SnapshotDiagnostic& diagnostic)
+{
+	SnapshotStream::writeDiagnostic(m_diagnosticStream, diagnostic);
+	++m_diagnosticCount;
+}
+
+void ScanJournalRecord::append(const ScanJournalRecord& other)
+{
+	m_childStream.writeRawData(other.m_children.constData(), static_cast<int>(other.m_children.size()));
+	m_diagnosticStream.writeRawData(other.m_diagnostics.constData(), static_cast<int>(other.m_diagnostics.size()));
+	m_childCount += other.m_childCount;
+	m_diagnosticCount += other.m_diagnosticCount;
+}
+
+ScanJournal::ScanJournal(const QString& path, const std::chrono::milliseconds checkpointInterval)
+	: m_checkpointInterval{checkpointInterval}, m_file{path}, m_lastCheckpoint{std::chrono::steady_clock::now()}
+{
+}
+
+ScanJournal::~ScanJournal()
+{
+	checkpoint();
+}
+
+std::expected<std::unique_ptr<ScanJournal>, QString> ScanJournal::create(
+	const QString& path, const std::chrono::milliseconds checkpointInterval)
+{
+	std::unique_ptr<ScanJournal> journal{new ScanJournal{path, checkpointInterval}};
+	if (!journal->m_file.open(QIODevice::ReadWrite | QIODevice::Truncate))
+		return std::unexpected{journal->m_file.errorString()};
+	return journal;
+}
+
+std::expected<std::unique_ptr<ScanJournal>, QString> ScanJournal::resume(
+	const QString& path, const std::chrono::milliseconds checkpointInterval)
+{
+	std::unique_ptr<ScanJournal> journal{new ScanJournal{path, checkpointInterval}};
+	if (!journal->m_file.open(QIODevice::ReadWrite))
+		return std::unexpected{journal->m_file.errorString()};
+	journal->readRecords(journal->m_file.readAll());
+	return journal;
+}
+
+void ScanJournal::readRecords(const QByteArray& contents)
+{
+	qsizetype validEnd = 0;
+	if (contents.size() >= FileHeaderSize && contents.startsWith(QByteArray{FileMagic, sizeof(FileMagic)})
+		&& qFromLittleEndian<quint16>(contents.constData() + sizeof(FileMagic)) == FormatVersion)
+	{
+		for (qsizetype offset = FileHeaderSize; contents.size() - offset >= FrameHeaderSize;)
+		{
+			const auto size = qFromLittleEndian<quint32>(contents.constData() + offset);
+			const auto checksum = qFromLittleEndian<quint16>(contents.constData() + offset + sizeof(uint32_t));
+			if (size > MaximumFrameSize || contents.size() - offset - FrameHeaderSize < size)
+				break;
+			const QByteArray payload = contents.sliced(offset + FrameHeaderSize, size);
+			if (qChecksum(payload) != checksum)
+				break;
+			if (!m_resumedHeader)
+			{
+				m_resumedHeader = decodeHeader(payload);
+				if (!m_resumedHeader)
+					break;
+			}
+			else
+			{
+				NativePath directoryPath;
+				ScanJournalDirectory directory;
+				if (!decodeDirectory(payload, directoryPath, directory))
+					break;
+				m_resumedDirectories.insert_or_assign(std::move(directoryPath), std::move(directory));
+			}
+			offset += FrameHeaderSize + size;
+			validEnd = offset;
+		}
+	}
+
+	// Appending continues after the last complete record; a journal without a header is started over by begin().
+	if (!m_resumedHeader)
+		validEnd = 0;
+	if (validEnd != contents.size() && !m_file.resize(validEnd))
+		m_error = m_file.errorString();
+	if (!m_file.seek(validEnd))
+		m_error = m_file.errorString();
+}
+
+const std::optional<ScanJournalHeader>& ScanJournal::resumedHeader() const noexcept
+{
+	return m_resumedHeader;
+}
+
+std::map<NativePath, ScanJournalDirectory> ScanJournal::takeResumedDirectories() noexcept
+{
+	return std::exchange(m_resumedDirectories, {});
+}
+
+void ScanJournal::begin(const ScanJournalHeader& header)
+{
+	std::lock_guard lock{m_mutex};
+	m_resumedHeader.reset();
+	m_resumedDirectories.clear();
+	m_buffer.clear();
+	if (!m_error && (!m_file.resize(0) || !m_file.seek(0)))
+		m_error = m_file.errorString();
+
+	m_buffer.append(FileMagic, sizeof(FileMagic));
+	uchar version[sizeof(uint16_t)];
+	qToLittleEndian<quint16>(FormatVersion, version);
+	m_buffer.append(reinterpret_cast<const char*>(version), sizeof(version));
+	appendFrame(encodeHeader(header));
+	// The header is written out right away, so that a journal on an unwritable path shows from the start.
+	writeBuffer();
+}
+
+void ScanJournal::append(const NativePath& directoryPath, const SnapshotEntry& directory, const ScanJournalRecord& contents)
+{
+	QByteArray payload;
+	{
+		QDataStream stream{&payload, QIODevice::WriteOnly};
+		SnapshotStream::configure(stream);
+		SnapshotStream::writeNativeString(stream, directoryPath);
+		SnapshotStream::writeEntryFields(stream, directory);
+		stream << static_cast<quint32>(contents.m_childCount);
+		stream.writeRawData(contents.m_children.constData(), static_cast<int>(contents.m_children.size()));
+		stream << static_cast<quint32>(contents.m_diagnosticCount);
+		stream.writeRawData(contents.m_diagnostics.constData(), static_cast<int>(contents.m_diagnostics.size()));
+	}
+
+	std::lock_guard lock{m_mutex};
+	appendFrame(payload);
+	if (std::chrono::steady_clock::now() - m_lastCheckpoint >= m_checkpointInterval)
+		writeBuffer();
+}
+
+void ScanJournal::checkpoint()
+{
+	std::lock_guard lock{m_mutex};
+	writeBuffer();
+}
+
+std::optional<QString> ScanJournal::error() const
+{
+	std::lock_guard lock{m_mutex};
+	return m_error;
+}
+
+void ScanJournal::appendFrame(const QByteArray& payload)
+{
+	if (m_error)
+		return;
+	uchar frame[FrameHeaderSize];
+	qToLittleEndian<quint32>(static_cast<quint32>(payload.size()), frame);
+	qToLittleEndian<quint16>(qChecksum(payload), frame + sizeof(uint32_t));
+	m_buffer.append(reinterpret_cast<const char*>(frame), sizeof(frame));
+	m_buffer.append(payload);
+}
+
+void ScanJournal::writeBuffer()
+{
+	m_lastCheckpoint = std::chrono::steady_clock::now();
+	if (!m_error && !m_buffer.isEmpty() && (m_file.write(m_buffer) != m_buffer.size() || !m_file.flush()))
+		m_error = m_file.errorString();
+	m_buffer.clear();
+}
+
+QString scanJournalFileName(const NativePath& rootPath)
+{
+	// FNV-1a over the path's code units, which unlike qHash() is the same in every process.
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (const auto unit : rootPath)
+	{
+#ifdef _WIN32
+		hash ^= unit.unicode();
+#else
+		hash ^= static_cast<uint8_t>(unit);
+#endif
+		hash *= 0x100000001B3ull;
+	}
+	return QString{"spaceguard-scan-%1.journal"}.arg(QString::number(static_cast<qulonglong>(hash), 16));
+}
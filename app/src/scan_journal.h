@@ -0,0 +1,127 @@
+#pragma once
+
+#include "snapshot_scanner.h"
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QString>
+
+#include <chrono>
+#include <expected>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdint.h>
+#include <vector>
+
+// What a scan records before its first directory. A scan resumes from a journal only if the root and the options that
+// shape its snapshot are the same.
+struct ScanJournalHeader
+{
+	NativePath rootPath;
+	QDateTime scanStartedAtUtc;
+	thin_io::filesystem_space filesystemSpaceAtStart;
+	// Its attributes and metadata; a root whose identity has changed since is another directory.
+	SnapshotEntry root;
+	SnapshotFileResolution fileResolution = SnapshotFileResolution::entries;
+	uint64_t memoryBudget = 0;
+	std::vector<SnapshotExclusionRule> exclusionRules;
+	NativePath exclusionRootPath;
+};
+
+// A directory whose own listing and child metadata had been collected: its traversal state and folded files, and its
+// children with their attributes, metadata and traversal states but without children of their own. Subdirectories
+// still pending traversal are those whose traversal state is not_directory.
+struct ScanJournalDirectory
+{
+	SnapshotEntry entry;
+	// Those recorded while the directory itself was processed.
+	std::vector<SnapshotDiagnostic> diagnostics;
+};
+
+// The children and diagnostics of one directory record, encoded as they are added, so that the entries they were taken
+// from may change afterwards. The records of the chunks of a split directory are appended to one another.
+class ScanJournalRecord
+{
+public:
+	ScanJournalRecord();
+
+	ScanJournalRecord(const ScanJournalRecord&) = delete;
+	ScanJournalRecord& operator=(const ScanJournalRecord&) = delete;
+
+	void addChild(const NativeName& name, const SnapshotEntry& child);
+	void addDiagnostic(const SnapshotDiagnostic& diagnostic);
+	void append(const ScanJournalRecord& other);
+
+private:
+	friend class ScanJournal;
+
+	QByteArray m_children;
+	QByteArray m_diagnostics;
+	QDataStream m_childStream;
+	QDataStream m_diagnosticStream;
+	uint32_t m_childCount = 0;
+	uint32_t m_diagnosticCount = 0;
+};
+
+// An append-only file of the directories a scan has completed, from which the scan can be resumed after it was canceled
+// or its process ended. Records are buffered and written out as a checkpoint once the checkpoint interval has passed,
+// so an ended process loses the directories of its last interval at most; each record carries its length and checksum,
+// and reading stops at the first one that is incomplete. A resumed scan only restores the records it reaches from the
+// root, so a subdirectory recorded without its parent is traversed again.
+class ScanJournal
+{
+public:
+	static constexpr std::chrono::seconds DefaultCheckpointInterval{5};
+
+	ScanJournal(const ScanJournal&) = delete;
+	ScanJournal& operator=(const ScanJournal&) = delete;
+
+	// Writes out the buffered records.
+	~ScanJournal();
+
+	// Starts an empty journal at path, replacing any file there. Returns the system message on failure.
+	[[nodiscard]] static std::expected<std::unique_ptr<ScanJournal>, QString> create(
+		const QString& path, std::chrono::milliseconds checkpointInterval = DefaultCheckpointInterval);
+	// Reads the journal at path and continues it after its last complete record. A missing or unreadable journal yields
+	// one with nothing to resume.
+	[[nodiscard]] static std::expected<std::unique_ptr<ScanJournal>, QString> resume(
+		const QString& path, std::chrono::milliseconds checkpointInterval = DefaultCheckpointInterval);
+
+	// The header read by resume(), if any.
+	[[nodiscard]] const std::optional<ScanJournalHeader>& resumedHeader() const noexcept;
+	// The directories read by resume() by path; a path recorded again replaces its earlier record. Leaves none behind.
+	[[nodiscard]] std::map<NativePath, ScanJournalDirectory> takeResumedDirectories() noexcept;
+
+	// Discards the contents, including those read by resume(), and starts over with header.
+	void begin(const ScanJournalHeader& header);
+	// Safe to call from any thread once begin() has returned, or after resume() for a scan that continues the journal.
+	void append(const NativePath& directoryPath, const SnapshotEntry& directory, const ScanJournalRecord& contents);
+	// Writes out the buffered records.
+	void checkpoint();
+	// The first write failure, after which nothing more is written; the scan itself does not depend on its journal.
+	[[nodiscard]] std::optional<QString> error() const;
+
+private:
+	ScanJournal(const QString& path, std::chrono::milliseconds checkpointInterval);
+
+	void readRecords(const QByteArray& contents);
+	// Both require m_mutex.
+	void appendFrame(const QByteArray& payload);
+	void writeBuffer();
+
+	const std::chrono::milliseconds m_checkpointInterval;
+	mutable std::mutex m_mutex;
+	QFile m_file;
+	QByteArray m_buffer;
+	std::chrono::steady_clock::time_point m_lastCheckpoint;
+	std::optional<QString> m_error;
+	std::optional<ScanJournalHeader> m_resumedHeader;
+	std::map<NativePath, ScanJournalDirectory> m_resumedDirectories;
+};
+
+// The journal file a scan of the root keeps in the journal directory, the same for every scan of that root.
+[[nodiscard]] QString scanJournalFileName(const NativePath& rootPath);
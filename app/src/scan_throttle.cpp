@@ -0,0 +1,187 @@
+#include "scan_throttle.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif defined __APPLE__
+#include <sys/resource.h>
+#elif defined __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <thread>
+
+namespace {
+
+// Tokens accumulate for at most this long, so an idle pause does not turn into a burst afterwards.
+constexpr std::chrono::duration<double> BurstDuration{0.1};
+// Waits are split into slices of this length so that cancellation is noticed promptly.
+constexpr std::chrono::milliseconds MaximumWaitSlice{50};
+// Pressure backoff never throttles below this rate, which keeps the scan making progress on a saturated host.
+constexpr double MinimumPressureRate = 10;
+// Recovery is slower than backoff so that the rate hovers just below the pressure target.
+constexpr double PressureRecoveryFactor = 1.25;
+
+#ifdef __linux__
+constexpr int IoprioWhoProcess = 1; // With who == 0: the calling thread.
+constexpr int IoprioClassShift = 13;
+constexpr int IoprioClassBestEffort = 2;
+constexpr int IoprioLowestBestEffortLevel = 7;
+#endif
+
+} // namespace
+
+std::optional<uint64_t> parseIoPressureStallTotal(std::string_view pressure) noexcept
+{
+	constexpr std::string_view SomeLine = "some ";
+	constexpr std::string_view Total = "total=";
+	while (!pressure.empty())
+	{
+		const std::size_t lineEnd = std::min(pressure.find('\n'), pressure.size());
+		const std::string_view line = pressure.substr(0, lineEnd);
+		pressure.remove_prefix(std::min(lineEnd + 1, pressure.size()));
+		if (!line.starts_with(SomeLine))
+			continue;
+
+		const std::size_t totalPosition = line.find(Total);
+		if (totalPosition == std::string_view::npos)
+			return {};
+		const char* const begin = line.data() + totalPosition + Total.size();
+		uint64_t total = 0;
+		const auto [end, error] = std::from_chars(begin, line.data() + line.size(), total);
+		if (error != std::errc{} || end == begin)
+			return {};
+		return total;
+	}
+	return {};
+}
+
+std::optional<std::chrono::microseconds> ioPressureStallTotal() noexcept
+{
+#ifdef __linux__
+	std::FILE* const file = std::fopen("/proc/pressure/io", "re");
+	if (!file)
+		return {};
+	char buffer[512];
+	const std::size_t size = std::fread(buffer, 1, sizeof(buffer), file);
+	std::fclose(file);
+	if (const auto total = parseIoPressureStallTotal({buffer, size}))
+		return std::chrono::microseconds{static_cast<std::chrono::microseconds::rep>(*total)};
+#endif
+	return {};
+}
+
+ScanThrottle::ScanThrottle(const double maximumOperationsPerSecond, const double pressureTarget) noexcept
+	: m_maximumRate{std::max(maximumOperationsPerSecond, 0.0)},
+	  m_pressureTarget{std::max(pressureTarget, 0.0)}
+{
+	setRate(m_maximumRate);
+}
+
+void ScanThrottle::acquire(const uint64_t operations, const std::atomic_bool& canceled)
+{
+	if (operations == 0 || m_unlimited.load(std::memory_order_relaxed))
+		return;
+
+	std::chrono::steady_clock::time_point deadline;
+	{
+		std::lock_guard lock{m_mutex};
+		if (m_rate <= 0)
+			return;
+
+		const auto now = std::chrono::steady_clock::now();
+		const double burst = std::max(m_rate * BurstDuration.count(), 1.0);
+		m_tokens = std::min(m_tokens + std::chrono::duration<double>(now - m_lastRefill).count() * m_rate, burst);
+		m_lastRefill = now;
+		m_tokens -= static_cast<double>(operations);
+		if (m_tokens >= 0)
+			return;
+		deadline = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(-m_tokens / m_rate));
+	}
+
+	for (auto now = std::chrono::steady_clock::now(); now < deadline && !canceled.load(std::memory_order_relaxed);
+		now = std::chrono::steady_clock::now())
+	{
+		std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(deadline - now, MaximumWaitSlice));
+	}
+}
+
+void ScanThrottle::updatePressure(const double stallShare, const uint64_t completedOperations,
+	const std::chrono::nanoseconds interval) noexcept
+{
+	if (m_pressureTarget <= 0 || interval.count() <= 0)
+		return;
+
+	std::lock_guard lock{m_mutex};
+	const double measuredRate = static_cast<double>(completedOperations) / std::chrono::duration<double>(interval).count();
+	if (stallShare > m_pressureTarget)
+	{
+		// Halve what the scan actually achieved rather than a limit it was not reaching.
+		const double current = m_rate > 0 && (measuredRate <= 0 || m_rate < measuredRate) ? m_rate : measuredRate;
+		if (current > 0)
+			setRate(std::max(current / 2, MinimumPressureRate));
+	}
+	else if (m_rate > 0)
+	{
+		const double next = std::max(m_rate * PressureRecoveryFactor, m_rate + MinimumPressureRate);
+		if (m_maximumRate > 0)
+			setRate(std::min(next, m_maximumRate));
+		else
+			// Without a configured maximum the limit is dropped once it no longer binds.
+			setRate(next > 2 * measuredRate ? 0 : next);
+	}
+}
+
+double ScanThrottle::rate() const noexcept
+{
+	std::lock_guard lock{m_mutex};
+	return m_rate;
+}
+
+void ScanThrottle::setRate(const double rate) noexcept
+{
+	if (m_rate <= 0 && rate > 0)
+	{
+		m_tokens = std::max(rate * BurstDuration.count(), 1.0);
+		m_lastRefill = std::chrono::steady_clock::now();
+	}
+	m_rate = rate;
+	m_unlimited.store(rate <= 0, std::memory_order_relaxed);
+}
+
+ScopedBackgroundIoPriority::ScopedBackgroundIoPriority(const bool enabled) noexcept
+{
+	if (!enabled)
+		return;
+
+#ifdef _WIN32
+	// Background mode lowers both the CPU and the I/O priority of the thread.
+	m_lowered = ::SetThreadPriority(::GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN) != FALSE;
+#elif defined __APPLE__
+	m_previousPriority = ::getiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD);
+	m_lowered = m_previousPriority >= 0 && ::setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, IOPOL_THROTTLE) == 0;
+#elif defined __linux__
+	// The idle class could starve the scan on a busy host, so the lowest best-effort level is used instead.
+	m_previousPriority = static_cast<int>(::syscall(SYS_ioprio_get, IoprioWhoProcess, 0));
+	m_lowered = m_previousPriority >= 0 && ::syscall(SYS_ioprio_set, IoprioWhoProcess, 0,
+		(IoprioClassBestEffort << IoprioClassShift) | IoprioLowestBestEffortLevel) == 0;
+#endif
+}
+
+ScopedBackgroundIoPriority::~ScopedBackgroundIoPriority()
+{
+	if (!m_lowered)
+		return;
+
+#ifdef _WIN32
+	::SetThreadPriority(::GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+#elif defined __APPLE__
+	::setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, m_previousPriority);
+#elif defined __linux__
+	::syscall(SYS_ioprio_set, IoprioWhoProcess, 0, m_previousPriority);
+#endif
+}
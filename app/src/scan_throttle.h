@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <stdint.h>
+#include <string_view>
+
+// Cumulative time, in microseconds, during which some task was stalled on I/O, as reported by the "some" line of
+// Linux pressure stall information.
+[[nodiscard]] std::optional<uint64_t> parseIoPressureStallTotal(std::string_view pressure) noexcept;
+
+// Reads /proc/pressure/io; empty where pressure stall information is unavailable.
+[[nodiscard]] std::optional<std::chrono::microseconds> ioPressureStallTotal() noexcept;
+
+// Token bucket for the native filesystem calls of all scan participants. The rate starts at the configured maximum (0
+// leaving it unlimited) and, when a pressure target is set, is halved whenever an interval's I/O stall share exceeds the
+// target and grows back gradually while it stays below it.
+class ScanThrottle
+{
+public:
+	ScanThrottle(double maximumOperationsPerSecond, double pressureTarget) noexcept;
+
+	ScanThrottle(const ScanThrottle&) = delete;
+	ScanThrottle& operator=(const ScanThrottle&) = delete;
+
+	// Waits until `operations` more calls fit the rate, returning early once canceled. A request larger than the bucket
+	// is admitted in debt, which delays the next one.
+	void acquire(uint64_t operations, const std::atomic_bool& canceled);
+
+	// stallShare is the fraction of the interval with I/O stalls; completedOperations were made during the same interval.
+	void updatePressure(double stallShare, uint64_t completedOperations, std::chrono::nanoseconds interval) noexcept;
+
+	// Operations per second; 0 while unlimited.
+	[[nodiscard]] double rate() const noexcept;
+
+private:
+	void setRate(double rate) noexcept;
+
+	const double m_maximumRate;
+	const double m_pressureTarget;
+	mutable std::mutex m_mutex;
+	double m_rate = 0;
+	double m_tokens = 0;
+	std::chrono::steady_clock::time_point m_lastRefill;
+	std::atomic_bool m_unlimited = true;
+};
+
+// Lowers the I/O priority of the calling thread for its lifetime, restoring the previous priority afterwards. A no-op
+// when not enabled or where the platform does not support it.
+class ScopedBackgroundIoPriority
+{
+public:
+	explicit ScopedBackgroundIoPriority(bool enabled) noexcept;
+	~ScopedBackgroundIoPriority();
+
+	ScopedBackgroundIoPriority(const ScopedBackgroundIoPriority&) = delete;
+	ScopedBackgroundIoPriority& operator=(const ScopedBackgroundIoPriority&) = delete;
+
+private:
+	bool m_lowered = false;
+	[[maybe_unused]] int m_previousPriority = 0;
+};
@@ -0,0 +1,175 @@
+#include "scan_trace.h"
+
+#include <QSaveFile>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <limits>
+
+namespace {
+
+std::atomic_uint64_t nextTraceSerial{1};
+
+const char* activityName(const ScanTraceActivity activity) noexcept
+{
+	switch (activity)
+	{
+	case ScanTraceActivity::enumeration: return "enumeration";
+	case ScanTraceActivity::metadata: return "metadata";
+	case ScanTraceActivity::idle_wait: return "idle wait";
+	case ScanTraceActivity::lock_wait: return "lock wait";
+	}
+	return "unknown";
+}
+
+void appendInteger(QByteArray& json, const uint64_t value)
+{
+	char digits[std::numeric_limits<uint64_t>::digits10 + 1];
+	const auto end = std::to_chars(std::begin(digits), std::end(digits), value).ptr;
+	json.append(digits, end - digits);
+}
+
+// The format counts in microseconds; nanoseconds are kept as three decimals.
+void appendMicroseconds(QByteArray& json, const int64_t nanoseconds)
+{
+	const auto magnitude = static_cast<uint64_t>(std::max<int64_t>(nanoseconds, 0));
+	appendInteger(json, magnitude / 1000);
+	const auto fraction = static_cast<unsigned>(magnitude % 1000);
+	const char decimals[] = {'.', static_cast<char>('0' + fraction / 100), static_cast<char>('0' + fraction / 10 % 10),
+		static_cast<char>('0' + fraction % 10)};
+	json.append(decimals, sizeof(decimals));
+}
+
+} // namespace
+
+thread_local ScanTrace::ThreadRing ScanTrace::s_threadRing;
+
+ScanTrace::ScanTrace(const std::size_t eventsPerThread)
+	: m_serial{nextTraceSerial.fetch_add(1, std::memory_order_relaxed)},
+	  m_eventsPerThread{std::max<std::size_t>(eventsPerThread, 1)},
+	  m_origin{std::chrono::steady_clock::now()}
+{
+}
+
+void ScanTrace::record(const ScanTraceActivity activity, const std::chrono::steady_clock::time_point started,
+	const std::chrono::steady_clock::time_point finished, const uint32_t count) noexcept
+{
+	Ring* const ring = threadRing();
+	if (!ring)
+		return;
+
+	const Event event{
+		std::chrono::duration_cast<std::chrono::nanoseconds>(started - m_origin).count(),
+		std::chrono::duration_cast<std::chrono::nanoseconds>(finished - started).count(),
+		count,
+		activity
+	};
+	if (ring->events.size() < m_eventsPerThread)
+	{
+		try
+		{
+			ring->events.push_back(event);
+		}
+		catch (...)
+		{
+			return; // The trace is a diagnostic; an event that cannot be stored is dropped.
+		}
+	}
+	else
+		ring->events[ring->recorded % m_eventsPerThread] = event;
+	++ring->recorded;
+}
+
+ScanTrace::Ring* ScanTrace::threadRing() noexcept
+{
+	if (s_threadRing.traceSerial == m_serial)
+		return s_threadRing.ring;
+
+	// Once per thread, or again when a thread alternates between traces.
+	const std::thread::id thread = std::this_thread::get_id();
+	std::lock_guard lock{m_ringsMutex};
+	const auto existing = std::ranges::find(m_rings, thread, [](const std::unique_ptr<Ring>& ring) { return ring->owner; });
+	Ring* ring = existing != m_rings.end() ? existing->get() : nullptr;
+	if (!ring)
+	{
+		try
+		{
+			m_rings.push_back(std::make_unique<Ring>());
+		}
+		catch (...)
+		{
+			return nullptr;
+		}
+		ring = m_rings.back().get();
+		ring->owner = thread;
+	}
+	s_threadRing = {m_serial, ring};
+	return ring;
+}
+
+QByteArray ScanTrace::chromeTraceJson() const
+{
+	std::lock_guard lock{m_ringsMutex};
+	QByteArray json{"{\"displayTimeUnit\":\"ms\",\"traceEvents\":["};
+	bool first = true;
+	const auto beginEvent = [&json, &first] {
+		if (!first)
+			json += ',';
+		first = false;
+	};
+
+	for (std::size_t track = 0; track < m_rings.size(); ++track)
+	{
+		const Ring& ring = *m_rings[track];
+		beginEvent();
+		json += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":";
+		appendInteger(json, track + 1);
+		json += ",\"args\":{\"name\":\"Scan thread ";
+		appendInteger(json, track + 1);
+		json += "\"}}";
+
+		// Oldest first: a full ring continues where the next event would have been written.
+		const std::size_t size = ring.events.size();
+		const std::size_t oldest = ring.recorded > size ? ring.recorded % size : 0;
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			const Event& event = ring.events[(oldest + i) % size];
+			beginEvent();
+			json += "{\"name\":\"";
+			json += activityName(event.activity);
+			json += "\",\"cat\":\"scan\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+			appendInteger(json, track + 1);
+			json += ",\"ts\":";
+			appendMicroseconds(json, event.startNanoseconds);
+			json += ",\"dur\":";
+			appendMicroseconds(json, event.durationNanoseconds);
+			if (event.count != 0)
+			{
+				json += ",\"args\":{\"count\":";
+				appendInteger(json, event.count);
+				json += '}';
+			}
+			json += '}';
+		}
+	}
+	json += "]}";
+	return json;
+}
+
+std::expected<void, QString> ScanTrace::writeChromeTrace(const QString& path) const
+{
+	const QByteArray json = chromeTraceJson();
+	QSaveFile file{path};
+	if (!file.open(QIODevice::WriteOnly))
+		return std::unexpected{file.errorString()};
+	if (file.write(json) != json.size())
+	{
+		const QString message = file.errorString();
+		file.cancelWriting();
+		return std::unexpected{message};
+	}
+	if (!file.commit())
+		return std::unexpected{file.errorString()};
+	return {};
+}
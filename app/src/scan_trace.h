@@ -0,0 +1,78 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+
+#include <chrono>
+#include <cstddef>
+#include <expected>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+enum class ScanTraceActivity : uint8_t {
+	enumeration, // Opening and listing a directory, or reading the file ids of its entries.
+	metadata, // A batch of metadata lookups.
+	idle_wait, // Waiting for a directory while no queue has one.
+	lock_wait // Waiting for a contended work-queue lock; uncontended locks are not recorded.
+};
+
+// Records what every scan participant was doing over time, for a timeline in the Chrome trace viewer or Perfetto. Each
+// thread records into a ring buffer of its own, registered on its first event, so recording never takes a lock; once a
+// buffer is full its oldest events are overwritten. Several scans may share a trace, but it must not be read until they
+// have all ended.
+class ScanTrace
+{
+public:
+	// Buffers grow as events arrive, up to eventsPerThread.
+	explicit ScanTrace(std::size_t eventsPerThread = std::size_t{1} << 16);
+
+	ScanTrace(const ScanTrace&) = delete;
+	ScanTrace& operator=(const ScanTrace&) = delete;
+
+	// count is what the activity worked on: the entries listed or looked up.
+	void record(ScanTraceActivity activity, std::chrono::steady_clock::time_point started,
+		std::chrono::steady_clock::time_point finished, uint32_t count = 0) noexcept;
+
+	// Trace Event Format with one track per recording thread, numbered in the order the threads joined; times are
+	// relative to the construction of the trace.
+	[[nodiscard]] QByteArray chromeTraceJson() const;
+	// Returns the system message on failure.
+	[[nodiscard]] std::expected<void, QString> writeChromeTrace(const QString& path) const;
+
+private:
+	struct Event
+	{
+		int64_t startNanoseconds = 0;
+		int64_t durationNanoseconds = 0;
+		uint32_t count = 0;
+		ScanTraceActivity activity = ScanTraceActivity::enumeration;
+	};
+
+	struct Ring
+	{
+		std::thread::id owner;
+		std::vector<Event> events;
+		std::size_t recorded = 0; // Including those overwritten since.
+	};
+
+	// The ring of the calling thread in the trace it last recorded into. Traces are told apart by serial rather than by
+	// address, which a later trace may reuse.
+	struct ThreadRing
+	{
+		uint64_t traceSerial = 0;
+		Ring* ring = nullptr;
+	};
+
+	[[nodiscard]] Ring* threadRing() noexcept;
+
+	static thread_local ThreadRing s_threadRing;
+
+	const uint64_t m_serial;
+	const std::size_t m_eventsPerThread;
+	const std::chrono::steady_clock::time_point m_origin;
+	mutable std::mutex m_ringsMutex;
+	std::vector<std::unique_ptr<Ring>> m_rings; // In registration order.
+};
@@ -5,4 +5,8 @@ namespace Settings {
 	static constexpr auto Threshold = "Threshold";
 
 	static constexpr auto SavePath = "SavePath";
+	// Not set from the UI; when set, every scan writes a Chrome trace of its activity to this directory.
+	static constexpr auto ScanTraceDirectory = "ScanTraceDirectory";
+	// Not set from the UI; where scans keep the journals they resume from, the application data directory by default.
+	static constexpr auto ScanJournalDirectory = "ScanJournalDirectory";
 }
@@ -1,5 +1,9 @@
 #include "snapshot.h"
 #include "snapshot_internal.h"
+#include "snapshot_name_pool.h"
+#include "snapshot_stream.h"
+
+#include "threading/cworkerthread.h"
 
 #include <QDataStream>
 #include <QFile>
@@ -8,7 +12,16 @@
 #include <QtEndian>
 
 #include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <iterator>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <utility>
 
 namespace {
@@ -18,7 +31,17 @@ constexpr qsizetype FileHeaderSize = sizeof(FileMagic) + sizeof(uint16_t) + size
 constexpr uint32_t MaximumNativeStringLength = 16 * 1024 * 1024;
 constexpr uint32_t MaximumEntryCount = 100 * 1000 * 1000;
 constexpr uint32_t MaximumDiagnosticCount = 10 * 1000 * 1000;
+constexpr uint32_t MaximumExclusionRuleCount = 64 * 1024;
 constexpr uint32_t MaximumTreeDepth = 1024;
+// Below this many entries a pass over a tree is not split: handing out the work would take longer than doing it.
+constexpr SnapshotTree::Index MinimumParallelEntries = 64 * 1024;
+// Consecutive entries whose flags share a word of the tree's bitsets.
+constexpr SnapshotTree::Index FlagWordEntries = 64;
+// Entries per task of a split pass, whole words of flags so that no two tasks write to one.
+constexpr SnapshotTree::Index ParallelChunkEntries = 16 * 1024;
+static_assert(ParallelChunkEntries % FlagWordEntries == 0);
+// Hard-link groups per task when resolving them in parallel.
+constexpr std::size_t ParallelChunkHardLinkGroups = 1024;
 
 void configureStream(QDataStream& stream)
 {
@@ -68,7 +91,7 @@ bool readBool(QDataStream& stream, bool& value)
 	return true;
 }
 
-void writeNativeString(QDataStream& stream, const NativePath& value)
+void writeNativeString(QDataStream& stream, const NativeNameView value)
 {
 	stream << static_cast<quint32>(value.size());
 #ifdef _WIN32
@@ -219,14 +242,15 @@ bool readOptionalEntryMetadata(QDataStream& stream, std::optional<SnapshotEntryM
 	return true;
 }
 
-bool isValidNativeName(const NativeName& name)
+bool isValidNativeName(const NativeNameView name)
 {
 	if (name.isEmpty() || name.size() > MaximumNativeStringLength)
 		return false;
 #ifdef _WIN32
-	return name != "." && name != ".." && !name.contains(QChar{}) && !name.contains('/') && !name.contains('\\');
+	return name != QStringView{u"."} && name != QStringView{u".."} && !name.contains(QChar{}) && !name.contains('/') && !name.contains('\\');
 #else
-	return name != "." && name != ".." && !name.contains('\0') && !name.contains('/');
+	return !nativeNamesEqual(name, ".") && !nativeNamesEqual(name, "..")
+		&& std::ranges::find(name, '\0') == name.end() && std::ranges::find(name, '/') == name.end();
 #endif
 }
 
@@ -235,67 +259,104 @@ bool isValidRootPath(const NativePath& path)
 	return path.size() <= MaximumNativeStringLength && isAbsoluteNativePath(path);
 }
 
-bool isValidEntry(const SnapshotEntry& entry, const uint32_t depth, uint64_t& totalEntryCount)
+bool isValidEntry(const SnapshotTree& tree, const SnapshotTree::Index entry)
 {
-	if (depth > MaximumTreeDepth || ++totalEntryCount > MaximumEntryCount)
+	const thin_io::entry_attributes attributes = tree.attributes(entry);
+	const std::optional<SnapshotEntryMetadata> metadata = tree.metadata(entry);
+	const DirectoryTraversalState traversalState = tree.traversalState(entry);
+	const std::optional<SnapshotFoldedFiles> foldedFiles = tree.foldedFiles(entry);
+	const bool hasChildren = !tree.children(entry).empty();
+	if (entry != SnapshotTree::RootIndex && !isValidNativeName(tree.name(entry)))
 		return false;
 
-	const auto kind = entry.attributes.kind;
+	const auto kind = attributes.kind;
 	if (kind > thin_io::entry_kind::other)
 		return false;
 
-	if (!entry.attributes.is_link && entry.attributes.reparse_tag != 0)
+	if (!attributes.is_link && attributes.reparse_tag != 0)
 		return false;
-	if (entry.metadata && entry.metadata->hardLinkCount == 0)
+	if (metadata && metadata->hardLinkCount == 0)
 		return false;
 
 	if (kind != thin_io::entry_kind::directory)
-		return entry.traversalState == DirectoryTraversalState::not_directory && entry.children.empty();
+		return traversalState == DirectoryTraversalState::not_directory && !hasChildren && !foldedFiles;
+	if (foldedFiles)
+	{
+		const SnapshotFoldedFiles& folded = *foldedFiles;
+		if (traversalState != DirectoryTraversalState::completed || folded.hardLinkCandidates > folded.files
+			|| folded.metadataUnavailable > folded.files - folded.hardLinkCandidates)
+			return false;
+	}
 
-	switch (entry.traversalState)
+	switch (traversalState)
 	{
 	case DirectoryTraversalState::completed:
-		if (!entry.metadata || entry.attributes.is_link)
-			return false;
-		break;
+		return metadata && !attributes.is_link;
 	case DirectoryTraversalState::enumeration_failed:
-		if (!entry.metadata || entry.attributes.is_link || !entry.children.empty())
-			return false;
-		break;
+		return metadata && !attributes.is_link && !hasChildren;
 	case DirectoryTraversalState::metadata_unavailable:
-		if (entry.metadata || !entry.children.empty())
-			return false;
-		break;
+		return !metadata && !hasChildren;
 	case DirectoryTraversalState::link_boundary:
-		if (!entry.attributes.is_link || !entry.children.empty())
-			return false;
-		break;
+		return attributes.is_link && !hasChildren;
 	case DirectoryTraversalState::mount_boundary:
-		if (!entry.metadata || entry.attributes.is_link || !entry.metadata->identity || !entry.children.empty())
-			return false;
-		break;
+		return metadata && !attributes.is_link && metadata->identity && !hasChildren;
+	case DirectoryTraversalState::excluded:
+		return metadata && !attributes.is_link && !hasChildren;
+	case DirectoryTraversalState::stalled:
+		return metadata && !attributes.is_link;
 	case DirectoryTraversalState::not_directory:
 		return false;
 	}
+	return false;
+}
 
-	for (const auto& [name, child] : entry.children)
+bool isValidTree(const SnapshotTree& tree)
+{
+	if (tree.empty() || tree.size() > MaximumEntryCount)
+		return false;
+
+	// Entries are numbered level by level, so the depth grows by one where the entries of the previous level end.
+	uint32_t depth = 0;
+	SnapshotTree::Index levelEnd = SnapshotTree::RootIndex + 1;
+	SnapshotTree::Index nextLevelEnd = levelEnd;
+	for (SnapshotTree::Index entry = SnapshotTree::RootIndex; entry < tree.size(); ++entry)
 	{
-		if (!isValidNativeName(name) || !isValidEntry(child, depth + 1, totalEntryCount))
+		if (entry == levelEnd)
+		{
+			if (++depth > MaximumTreeDepth)
+				return false;
+			levelEnd = nextLevelEnd;
+		}
+		if (!isValidEntry(tree, entry))
 			return false;
+		if (const SnapshotTree::Children children = tree.children(entry); !children.empty())
+			nextLevelEnd = std::max(nextLevelEnd, children.back() + 1);
 	}
 	return true;
 }
 
+bool isValidExclusionRule(const SnapshotExclusionRule& rule)
+{
+	if (rule.kind > SnapshotExclusionPatternKind::marker_file || rule.action > SnapshotExclusionAction::stat_only
+		|| rule.pattern.isEmpty() || rule.pattern.size() > MaximumNativeStringLength)
+		return false;
+	if (rule.kind == SnapshotExclusionPatternKind::path_prefix)
+		return isAbsoluteNativePath(rule.pattern);
+	if (rule.kind == SnapshotExclusionPatternKind::marker_file)
+		return isValidNativeName(rule.pattern);
+	return true;
+}
+
 bool isValidSpace(const thin_io::filesystem_space& space)
 {
 	return space.available <= space.free && space.available <= space.capacity;
 }
 
-bool identitiesAgree(const Snapshot& snapshot)
+bool identitiesAgree(const Snapshot& snapshot, const SnapshotTree& tree)
 {
 	std::optional<thin_io::filesystem_identity> expected;
-	if (snapshot.root.metadata && snapshot.root.metadata->identity)
-		expected = snapshot.root.metadata->identity->filesystem;
+	if (const auto rootMetadata = tree.metadata(SnapshotTree::RootIndex); rootMetadata && rootMetadata->identity)
+		expected = rootMetadata->identity->filesystem;
 
 	for (const auto* space : {snapshot.filesystemSpaceAtStart ? &*snapshot.filesystemSpaceAtStart : nullptr,
 		 snapshot.filesystemSpaceAtCompletion ? &*snapshot.filesystemSpaceAtCompletion : nullptr})
@@ -309,82 +370,80 @@ bool identitiesAgree(const Snapshot& snapshot)
 	return true;
 }
 
-bool isValidSnapshot(const Snapshot& snapshot)
+bool isValidDirectoryCostList(const std::vector<SnapshotDirectoryCost>& costs)
+{
+	return costs.size() <= SnapshotDirectoryCostReport::Size
+		&& std::ranges::all_of(costs, [](const SnapshotDirectoryCost& cost) {
+			return isValidRootPath(cost.path) && cost.elapsed.count() >= 0;
+		});
+}
+
+// The entries of the snapshot are validated in tree, which is either its own or one built from its staged root.
+bool isValidSnapshot(const Snapshot& snapshot, const SnapshotTree& tree)
 {
 	if (!isValidRootPath(snapshot.rootPath)
-		|| snapshot.root.attributes.kind != thin_io::entry_kind::directory
-		|| snapshot.root.attributes.is_link
-		|| !snapshot.root.metadata
-		|| snapshot.root.traversalState != DirectoryTraversalState::completed
+		|| !isValidTree(tree)
+		|| tree.kind(SnapshotTree::RootIndex) != thin_io::entry_kind::directory
+		|| tree.attributes(SnapshotTree::RootIndex).is_link
+		|| !tree.metadata(SnapshotTree::RootIndex)
+		|| tree.traversalState(SnapshotTree::RootIndex) != DirectoryTraversalState::completed
 		|| !snapshot.scanStartedAtUtc.isValid()
 		|| !snapshot.scanCompletedAtUtc.isValid()
 		|| snapshot.scanStartedAtUtc.timeSpec() != Qt::UTC
 		|| snapshot.scanCompletedAtUtc.timeSpec() != Qt::UTC
 		|| snapshot.scanStartedAtUtc > snapshot.scanCompletedAtUtc
 		|| snapshot.diagnostics.size() > MaximumDiagnosticCount
+		|| snapshot.exclusionRules.size() > MaximumExclusionRuleCount
+		|| !std::ranges::all_of(snapshot.exclusionRules, isValidExclusionRule)
+		|| !isValidDirectoryCostList(snapshot.directoryCosts.slowest)
+		|| !isValidDirectoryCostList(snapshot.directoryCosts.largest)
 		|| (snapshot.filesystemSpaceAtStart && !isValidSpace(*snapshot.filesystemSpaceAtStart))
 		|| (snapshot.filesystemSpaceAtCompletion && !isValidSpace(*snapshot.filesystemSpaceAtCompletion))
-		|| !identitiesAgree(snapshot))
-		return false;
-
-	uint64_t totalEntryCount = 0;
-	if (!isValidEntry(snapshot.root, 0, totalEntryCount))
+		|| !identitiesAgree(snapshot, tree))
 		return false;
 
 	for (const SnapshotDiagnostic& diagnostic : snapshot.diagnostics)
 	{
 		if (!isValidRootPath(diagnostic.path)
-			|| diagnostic.operation > SnapshotOperation::entry_changed_during_scan
-			|| ((diagnostic.operation == SnapshotOperation::entry_changed_during_scan) == diagnostic.nativeErrorCode.has_value()))
+			|| diagnostic.operation > SnapshotOperation::call_deadline_exceeded
+			|| (snapshotOperationHasNativeErrorCode(diagnostic.operation) != diagnostic.nativeErrorCode.has_value()))
 			return false;
 	}
 	return true;
 }
 
-void writeEntry(QDataStream& stream, const SnapshotEntry& entry)
+void writeOptionalFoldedFiles(QDataStream& stream, const std::optional<SnapshotFoldedFiles>& folded)
 {
-	writeAttributes(stream, entry.attributes);
-	writeOptionalEntryMetadata(stream, entry.metadata);
-	writeEnum(stream, entry.traversalState);
-	stream << static_cast<quint32>(entry.children.size());
-	for (const auto& [name, child] : entry.children)
-	{
-		writeNativeString(stream, name);
-		writeEntry(stream, child);
-	}
+	writeBool(stream, folded.has_value());
+	if (!folded)
+		return;
+	writeUint64(stream, folded->files);
+	writeUint64(stream, folded->logicalSize);
+	writeUint64(stream, folded->allocatedSize);
+	writeUint64(stream, folded->hardLinkCandidates);
+	writeUint64(stream, folded->metadataUnavailable);
 }
 
-bool readEntry(QDataStream& stream, SnapshotEntry& entry, const uint32_t depth, uint64_t& totalEntryCount)
+bool readOptionalFoldedFiles(QDataStream& stream, std::optional<SnapshotFoldedFiles>& folded)
 {
-	if (depth > MaximumTreeDepth || ++totalEntryCount > MaximumEntryCount)
-		return false;
-
-	uint8_t traversalState = 0;
-	uint32_t childCount = 0;
-	if (!readAttributes(stream, entry.attributes)
-		|| !readOptionalEntryMetadata(stream, entry.metadata)
-		|| !readByte(stream, traversalState)
-		|| traversalState > static_cast<uint8_t>(DirectoryTraversalState::mount_boundary))
+	bool hasFolded = false;
+	if (!readBool(stream, hasFolded))
 		return false;
 
-	entry.traversalState = static_cast<DirectoryTraversalState>(traversalState);
-	quint32 serializedChildCount = 0;
-	stream >> serializedChildCount;
-	childCount = serializedChildCount;
-	if (stream.status() != QDataStream::Ok || childCount > MaximumEntryCount - totalEntryCount)
-		return false;
-
-	entry.children.clear();
-	entry.children.reserve(childCount);
-	for (uint32_t i = 0; i < childCount; ++i)
+	if (!hasFolded)
 	{
-		NativeName name;
-		SnapshotEntry child;
-		if (!readNativeString(stream, name) || !isValidNativeName(name) || !readEntry(stream, child, depth + 1, totalEntryCount))
-			return false;
-		if (!entry.children.append_sorted_unique(std::move(name), std::move(child)))
-			return false;
+		folded.reset();
+		return true;
 	}
+
+	SnapshotFoldedFiles value;
+	if (!readUint64(stream, value.files)
+		|| !readUint64(stream, value.logicalSize)
+		|| !readUint64(stream, value.allocatedSize)
+		|| !readUint64(stream, value.hardLinkCandidates)
+		|| !readUint64(stream, value.metadataUnavailable))
+		return false;
+	folded = value;
 	return true;
 }
 
@@ -444,26 +503,265 @@ bool readOptionalFilesystemSpace(QDataStream& stream, std::optional<thin_io::fil
 	return true;
 }
 
-QByteArray serializePayload(const Snapshot& snapshot)
+} // namespace
+
+namespace SnapshotStream {
+
+void configure(QDataStream& stream)
+{
+	configureStream(stream);
+}
+
+void writeNativeString(QDataStream& stream, const NativePath& value)
+{
+	::writeNativeString(stream, value);
+}
+
+bool readNativeString(QDataStream& stream, NativePath& value)
+{
+	return ::readNativeString(stream, value);
+}
+
+bool isValidName(const NativeName& name)
+{
+	return isValidNativeName(name);
+}
+
+void writeEntryFields(QDataStream& stream, const SnapshotEntry& entry)
+{
+	writeAttributes(stream, entry.attributes);
+	writeOptionalEntryMetadata(stream, entry.metadata);
+	writeEnum(stream, entry.traversalState);
+	writeOptionalFoldedFiles(stream, entry.foldedFiles);
+}
+
+bool readEntryFields(QDataStream& stream, SnapshotEntry& entry, const uint16_t formatVersion)
+{
+	uint8_t traversalState = 0;
+	if (!readAttributes(stream, entry.attributes)
+		|| !readOptionalEntryMetadata(stream, entry.metadata)
+		|| !readByte(stream, traversalState)
+		|| traversalState > static_cast<uint8_t>(DirectoryTraversalState::stalled))
+		return false;
+
+	entry.traversalState = static_cast<DirectoryTraversalState>(traversalState);
+	// Folded files were added in version 4.
+	return formatVersion < 4 || readOptionalFoldedFiles(stream, entry.foldedFiles);
+}
+
+void writeDiagnostic(QDataStream& stream, const SnapshotDiagnostic& diagnostic)
+{
+	writeNativeString(stream, diagnostic.path);
+	writeEnum(stream, diagnostic.operation);
+	writeBool(stream, diagnostic.nativeErrorCode.has_value());
+	if (diagnostic.nativeErrorCode)
+		stream << static_cast<qint64>(*diagnostic.nativeErrorCode);
+}
+
+bool readDiagnostic(QDataStream& stream, SnapshotDiagnostic& diagnostic)
+{
+	uint8_t operation = 0;
+	bool hasNativeErrorCode = false;
+	qint64 nativeErrorCode = 0;
+	if (!readNativeString(stream, diagnostic.path) || !readByte(stream, operation) || !readBool(stream, hasNativeErrorCode))
+		return false;
+	if (hasNativeErrorCode)
+	{
+		stream >> nativeErrorCode;
+		if (stream.status() != QDataStream::Ok)
+			return false;
+	}
+	if (operation > static_cast<uint8_t>(SnapshotOperation::call_deadline_exceeded)
+		|| (hasNativeErrorCode
+			&& (nativeErrorCode < std::numeric_limits<thin_io::filesystem_error_code>::min()
+				|| nativeErrorCode > std::numeric_limits<thin_io::filesystem_error_code>::max())))
+		return false;
+
+	diagnostic.operation = static_cast<SnapshotOperation>(operation);
+	diagnostic.nativeErrorCode.reset();
+	if (hasNativeErrorCode)
+		diagnostic.nativeErrorCode = static_cast<thin_io::filesystem_error_code>(nativeErrorCode);
+	return true;
+}
+
+void writeExclusionRule(QDataStream& stream, const SnapshotExclusionRule& rule)
+{
+	writeEnum(stream, rule.kind);
+	writeEnum(stream, rule.action);
+	writeNativeString(stream, rule.pattern);
+}
+
+bool readExclusionRule(QDataStream& stream, SnapshotExclusionRule& rule)
+{
+	uint8_t kind = 0;
+	uint8_t action = 0;
+	if (!readByte(stream, kind) || !readByte(stream, action) || !readNativeString(stream, rule.pattern))
+		return false;
+	if (kind > static_cast<uint8_t>(SnapshotExclusionPatternKind::marker_file)
+		|| action > static_cast<uint8_t>(SnapshotExclusionAction::stat_only))
+		return false;
+	rule.kind = static_cast<SnapshotExclusionPatternKind>(kind);
+	rule.action = static_cast<SnapshotExclusionAction>(action);
+	return true;
+}
+
+void writeFilesystemSpace(QDataStream& stream, const thin_io::filesystem_space& space)
+{
+	::writeFilesystemSpace(stream, space);
+}
+
+bool readFilesystemSpace(QDataStream& stream, thin_io::filesystem_space& space)
+{
+	return ::readFilesystemSpace(stream, space);
+}
+
+} // namespace SnapshotStream
+
+namespace {
+
+// Whether entries were assigned to root since the tree was last built from it.
+bool hasStagedEntries(const Snapshot& snapshot)
+{
+	return snapshot.root != SnapshotEntry{};
+}
+
+// The entries of the snapshot, building a tree for them into staged while they are still in root.
+const SnapshotTree& entryTree(const Snapshot& snapshot, std::optional<SnapshotTree>& staged)
+{
+	return hasStagedEntries(snapshot) ? staged.emplace(snapshot.root) : snapshot.tree;
+}
+
+void writeNameTable(QDataStream& stream, const SnapshotTree& tree)
+{
+	stream << static_cast<quint32>(tree.nameCount());
+	for (SnapshotTree::NameHandle name = 0; name < tree.nameCount(); ++name)
+		writeNativeString(stream, tree.pooledName(name));
+}
+
+// The layout of nested entries, which files keep whatever the entries are held in. Names are indexes into the name table.
+void writeEntry(QDataStream& stream, const SnapshotTree& tree, const SnapshotTree::Index entry)
+{
+	writeAttributes(stream, tree.attributes(entry));
+	writeOptionalEntryMetadata(stream, tree.metadata(entry));
+	writeEnum(stream, tree.traversalState(entry));
+	writeOptionalFoldedFiles(stream, tree.foldedFiles(entry));
+	const SnapshotTree::Children children = tree.children(entry);
+	stream << static_cast<quint32>(children.size());
+	for (const SnapshotTree::Index child : children)
+	{
+		stream << static_cast<quint32>(tree.nameHandle(child));
+		writeEntry(stream, tree, child);
+	}
+}
+
+// The names of the entries being read: looked up in the file's name table, or pooled as they are read from files that
+// predate the table.
+class EntryNameReader
+{
+public:
+	explicit EntryNameReader(const uint16_t formatVersion)
+		: m_formatVersion{formatVersion}, m_pool{1}
+	{
+	}
+
+	[[nodiscard]] bool readTable(QDataStream& stream)
+	{
+		if (m_formatVersion < 7)
+			return true;
+		quint32 nameCount = 0;
+		stream >> nameCount;
+		if (stream.status() != QDataStream::Ok || nameCount > MaximumEntryCount)
+			return false;
+		m_table.reserve(nameCount);
+		for (quint32 i = 0; i < nameCount; ++i)
+		{
+			NativeName name;
+			if (!readNativeString(stream, name) || !isValidNativeName(name))
+				return false;
+			m_table.push_back(std::move(name));
+		}
+		return true;
+	}
+
+	[[nodiscard]] bool read(QDataStream& stream, NativeName& name)
+	{
+		if (m_formatVersion < 7)
+		{
+			if (!readNativeString(stream, name) || !isValidNativeName(name))
+				return false;
+			name = m_pool.intern(name);
+			return true;
+		}
+		quint32 index = 0;
+		stream >> index;
+		if (stream.status() != QDataStream::Ok || index >= m_table.size())
+			return false;
+		name = m_table[index];
+		return true;
+	}
+
+private:
+	const uint16_t m_formatVersion;
+	std::vector<NativeName> m_table;
+	SnapshotNamePool m_pool;
+};
+
+bool readEntry(QDataStream& stream, SnapshotEntry& entry, const uint16_t formatVersion, EntryNameReader& names,
+	const uint32_t depth, uint64_t& totalEntryCount)
+{
+	if (depth > MaximumTreeDepth || ++totalEntryCount > MaximumEntryCount)
+		return false;
+
+	uint32_t childCount = 0;
+	if (!SnapshotStream::readEntryFields(stream, entry, formatVersion))
+		return false;
+	quint32 serializedChildCount = 0;
+	stream >> serializedChildCount;
+	childCount = serializedChildCount;
+	if (stream.status() != QDataStream::Ok || childCount > MaximumEntryCount - totalEntryCount)
+		return false;
+
+	entry.children.clear();
+	entry.children.reserve(childCount);
+	for (uint32_t i = 0; i < childCount; ++i)
+	{
+		NativeName name;
+		SnapshotEntry child;
+		if (!names.read(stream, name) || !readEntry(stream, child, formatVersion, names, depth + 1, totalEntryCount))
+			return false;
+		if (!entry.children.append_sorted_unique(std::move(name), std::move(child)))
+			return false;
+	}
+	return true;
+}
+
+QByteArray serializePayload(const Snapshot& snapshot, const SnapshotTree& tree)
 {
 	QByteArray payload;
 	QDataStream stream{&payload, QIODevice::WriteOnly};
 	configureStream(stream);
 
 	writeNativeString(stream, snapshot.rootPath);
-	writeEntry(stream, snapshot.root);
+	writeNameTable(stream, tree);
+	writeEntry(stream, tree, SnapshotTree::RootIndex);
 	writeOptionalFilesystemSpace(stream, snapshot.filesystemSpaceAtStart);
 	writeOptionalFilesystemSpace(stream, snapshot.filesystemSpaceAtCompletion);
 	stream << static_cast<qint64>(snapshot.scanStartedAtUtc.toMSecsSinceEpoch())
 		<< static_cast<qint64>(snapshot.scanCompletedAtUtc.toMSecsSinceEpoch());
+	stream << static_cast<quint32>(snapshot.exclusionRules.size());
+	for (const SnapshotExclusionRule& rule : snapshot.exclusionRules)
+		SnapshotStream::writeExclusionRule(stream, rule);
 	stream << static_cast<quint32>(snapshot.diagnostics.size());
 	for (const SnapshotDiagnostic& diagnostic : snapshot.diagnostics)
+		SnapshotStream::writeDiagnostic(stream, diagnostic);
+	for (const std::vector<SnapshotDirectoryCost>* costs : {&snapshot.directoryCosts.slowest, &snapshot.directoryCosts.largest})
 	{
-		writeNativeString(stream, diagnostic.path);
-		writeEnum(stream, diagnostic.operation);
-		writeBool(stream, diagnostic.nativeErrorCode.has_value());
-		if (diagnostic.nativeErrorCode)
-			stream << static_cast<qint64>(*diagnostic.nativeErrorCode);
+		stream << static_cast<quint32>(costs->size());
+		for (const SnapshotDirectoryCost& cost : *costs)
+		{
+			writeNativeString(stream, cost.path);
+			stream << static_cast<qint64>(cost.elapsed.count()) << static_cast<quint64>(cost.entries);
+		}
 	}
 
 	return stream.status() == QDataStream::Ok ? payload : QByteArray{};
@@ -476,7 +774,56 @@ enum class PayloadReadResult {
 	trailing
 };
 
-PayloadReadResult deserializePayload(const QByteArray& payload, Snapshot& snapshot)
+PayloadReadResult readExclusionRules(QDataStream& stream, std::vector<SnapshotExclusionRule>& rules)
+{
+	quint32 ruleCount = 0;
+	stream >> ruleCount;
+	if (stream.status() != QDataStream::Ok)
+		return PayloadReadResult::truncated;
+	if (ruleCount > MaximumExclusionRuleCount)
+		return PayloadReadResult::corrupt;
+
+	rules.clear();
+	rules.reserve(ruleCount);
+	for (quint32 i = 0; i < ruleCount; ++i)
+	{
+		SnapshotExclusionRule rule;
+		if (!SnapshotStream::readExclusionRule(stream, rule))
+			return stream.status() == QDataStream::ReadPastEnd ? PayloadReadResult::truncated : PayloadReadResult::corrupt;
+		rules.push_back(std::move(rule));
+	}
+	return PayloadReadResult::success;
+}
+
+PayloadReadResult readDirectoryCosts(QDataStream& stream, std::vector<SnapshotDirectoryCost>& costs)
+{
+	quint32 costCount = 0;
+	stream >> costCount;
+	if (stream.status() != QDataStream::Ok)
+		return PayloadReadResult::truncated;
+	if (costCount > SnapshotDirectoryCostReport::Size)
+		return PayloadReadResult::corrupt;
+
+	costs.clear();
+	costs.reserve(costCount);
+	for (quint32 i = 0; i < costCount; ++i)
+	{
+		SnapshotDirectoryCost cost;
+		qint64 elapsed = 0;
+		quint64 entries = 0;
+		if (!readNativeString(stream, cost.path))
+			return stream.status() == QDataStream::ReadPastEnd ? PayloadReadResult::truncated : PayloadReadResult::corrupt;
+		stream >> elapsed >> entries;
+		if (stream.status() != QDataStream::Ok)
+			return PayloadReadResult::truncated;
+		cost.elapsed = std::chrono::nanoseconds{elapsed};
+		cost.entries = entries;
+		costs.push_back(std::move(cost));
+	}
+	return PayloadReadResult::success;
+}
+
+PayloadReadResult deserializePayload(const QByteArray& payload, const uint16_t formatVersion, Snapshot& snapshot)
 {
 	QDataStream stream{payload};
 	configureStream(stream);
@@ -485,14 +832,27 @@ PayloadReadResult deserializePayload(const QByteArray& payload, Snapshot& snapsh
 	qint64 startedAt = 0;
 	qint64 completedAt = 0;
 	uint32_t diagnosticCount = 0;
+	EntryNameReader names{formatVersion};
 	if (!readNativeString(stream, snapshot.rootPath)
-		|| !readEntry(stream, snapshot.root, 0, totalEntryCount)
+		|| !names.readTable(stream)
+		|| !readEntry(stream, snapshot.root, formatVersion, names, 0, totalEntryCount)
 		|| !readOptionalFilesystemSpace(stream, snapshot.filesystemSpaceAtStart)
 		|| !readOptionalFilesystemSpace(stream, snapshot.filesystemSpaceAtCompletion))
 		return stream.status() == QDataStream::ReadPastEnd ? PayloadReadResult::truncated : PayloadReadResult::corrupt;
 
+	stream >> startedAt >> completedAt;
+	if (stream.status() != QDataStream::Ok)
+		return PayloadReadResult::truncated;
+	// Version 2 has no exclusion rules; everything else is laid out the same.
+	snapshot.exclusionRules.clear();
+	if (formatVersion >= 3)
+	{
+		if (const PayloadReadResult rulesResult = readExclusionRules(stream, snapshot.exclusionRules); rulesResult != PayloadReadResult::success)
+			return rulesResult;
+	}
+
 	quint32 serializedDiagnosticCount = 0;
-	stream >> startedAt >> completedAt >> serializedDiagnosticCount;
+	stream >> serializedDiagnosticCount;
 	diagnosticCount = serializedDiagnosticCount;
 	if (stream.status() != QDataStream::Ok)
 		return PayloadReadResult::truncated;
@@ -506,32 +866,26 @@ PayloadReadResult deserializePayload(const QByteArray& payload, Snapshot& snapsh
 	for (uint32_t i = 0; i < diagnosticCount; ++i)
 	{
 		SnapshotDiagnostic diagnostic;
-		uint8_t operation = 0;
-		bool hasNativeErrorCode = false;
-		qint64 nativeErrorCode = 0;
-		if (!readNativeString(stream, diagnostic.path) || !readByte(stream, operation) || !readBool(stream, hasNativeErrorCode))
+		if (!SnapshotStream::readDiagnostic(stream, diagnostic))
 			return stream.status() == QDataStream::ReadPastEnd ? PayloadReadResult::truncated : PayloadReadResult::corrupt;
-		if (hasNativeErrorCode)
+		snapshot.diagnostics.push_back(std::move(diagnostic));
+	}
+
+	// Directory costs were added in version 5.
+	snapshot.directoryCosts = {};
+	if (formatVersion >= 5)
+	{
+		for (std::vector<SnapshotDirectoryCost>* costs : {&snapshot.directoryCosts.slowest, &snapshot.directoryCosts.largest})
 		{
-			stream >> nativeErrorCode;
-			if (stream.status() != QDataStream::Ok)
-				return PayloadReadResult::truncated;
+			if (const PayloadReadResult costsResult = readDirectoryCosts(stream, *costs); costsResult != PayloadReadResult::success)
+				return costsResult;
 		}
-		if (operation > static_cast<uint8_t>(SnapshotOperation::entry_changed_during_scan)
-			|| (hasNativeErrorCode
-				&& (nativeErrorCode < std::numeric_limits<thin_io::filesystem_error_code>::min()
-					|| nativeErrorCode > std::numeric_limits<thin_io::filesystem_error_code>::max())))
-			return PayloadReadResult::corrupt;
-
-		diagnostic.operation = static_cast<SnapshotOperation>(operation);
-		if (hasNativeErrorCode)
-			diagnostic.nativeErrorCode = static_cast<thin_io::filesystem_error_code>(nativeErrorCode);
-		snapshot.diagnostics.push_back(std::move(diagnostic));
 	}
 
 	if (!stream.atEnd())
 		return PayloadReadResult::trailing;
-	return isValidSnapshot(snapshot) ? PayloadReadResult::success : PayloadReadResult::corrupt;
+	snapshot.tree = SnapshotTree{std::move(snapshot.root)};
+	return isValidSnapshot(snapshot, snapshot.tree) ? PayloadReadResult::success : PayloadReadResult::corrupt;
 }
 
 SnapshotLoadError loadError(const SnapshotLoadErrorCode code, QString systemMessage = {})
@@ -550,71 +904,186 @@ bool isKnownPlatform(const uint8_t platform)
 		&& platform <= static_cast<uint8_t>(SnapshotPlatform::freebsd);
 }
 
+// One observed name of a multi-link file.
 struct HardLinkEntry
 {
-	SnapshotEntry* entry;
+	SnapshotTree::Index entry;
 	NativePath path;
 };
 
-using HardLinkEntries = std::map<thin_io::entry_identity, std::vector<HardLinkEntry>, SnapshotInternal::EntryIdentityLess>;
+struct IdentifiedHardLinkEntry
+{
+	thin_io::entry_identity identity;
+	HardLinkEntry entry;
+};
 
-bool localCoverageIsComplete(const SnapshotEntry& entry)
+// Runs task(0) to task(count - 1) and returns once all have run, on the calling thread and on whichever of the pool's
+// workers become free meanwhile. The caller takes tasks itself rather than waiting for a worker to start them, so a busy
+// pool, or a caller that is one of its workers, only costs the parallelism; a worker that starts late finds nothing left.
+// The first exception a task throws is rethrown once all have run.
+template <class Task>
+void runTasks(CWorkerThreadPool* const workerPool, const std::size_t count, const Task& task)
 {
-	if (entry.attributes.kind != thin_io::entry_kind::directory)
+	if (!workerPool || count < 2)
+	{
+		for (std::size_t i = 0; i < count; ++i)
+			task(i);
+		return;
+	}
+
+	struct Progress
+	{
+		std::atomic_size_t next = 0;
+		std::mutex mutex;
+		std::condition_variable finished;
+		std::size_t remaining = 0;
+		std::exception_ptr error;
+	};
+	const auto progress = std::make_shared<Progress>();
+	progress->remaining = count;
+	const auto runAvailable = [progress, count, &task] {
+		for (std::size_t i; (i = progress->next.fetch_add(1, std::memory_order_relaxed)) < count;)
+		{
+			std::exception_ptr error;
+			try
+			{
+				task(i);
+			}
+			catch (...)
+			{
+				error = std::current_exception();
+			}
+			// Notified under the lock: the caller returns, releasing task, as soon as it sees none remaining.
+			std::lock_guard lock{progress->mutex};
+			if (error && !progress->error)
+				progress->error = error;
+			if (--progress->remaining == 0)
+				progress->finished.notify_all();
+		}
+	};
+
+	const std::size_t helpers = std::min(count - 1, workerPool->maxWorkersCount());
+	for (std::size_t i = 0; i < helpers; ++i)
+	{
+		try
+		{
+			workerPool->enqueue(runAvailable);
+		}
+		catch (...)
+		{
+			// The caller runs whatever no helper takes.
+			break;
+		}
+	}
+	runAvailable();
+
+	std::unique_lock lock{progress->mutex};
+	progress->finished.wait(lock, [&progress] { return progress->remaining == 0; });
+	if (progress->error)
+		std::rethrow_exception(progress->error);
+}
+
+// Calls task(group) for each of groupCount hard-link groups, split by identity across the pool.
+template <class Task>
+void forEachHardLinkGroup(CWorkerThreadPool* const workerPool, const std::size_t groupCount, const Task& task)
+{
+	const std::size_t chunkCount = (groupCount + ParallelChunkHardLinkGroups - 1) / ParallelChunkHardLinkGroups;
+	runTasks(workerPool, chunkCount, [groupCount, &task](const std::size_t chunk) {
+		const std::size_t end = std::min(groupCount, (chunk + 1) * ParallelChunkHardLinkGroups);
+		for (std::size_t group = chunk * ParallelChunkHardLinkGroups; group < end; ++group)
+			task(group);
+	});
+}
+
+// [begin, end) in one range, or split for a pool at multiples of ParallelChunkEntries.
+std::vector<std::pair<SnapshotTree::Index, SnapshotTree::Index>> entryRanges(
+	const CWorkerThreadPool* const workerPool, const SnapshotTree::Index begin, const SnapshotTree::Index end)
+{
+	if (!workerPool || end - begin < MinimumParallelEntries)
+		return {{begin, end}};
+
+	std::vector<std::pair<SnapshotTree::Index, SnapshotTree::Index>> ranges;
+	for (SnapshotTree::Index first = begin; first < end;)
+	{
+		const SnapshotTree::Index last = std::min(end, (first / ParallelChunkEntries + 1) * ParallelChunkEntries);
+		ranges.emplace_back(first, last);
+		first = last;
+	}
+	return ranges;
+}
+
+bool localCoverageIsComplete(const SnapshotTree& tree, const SnapshotTree::Index entry)
+{
+	if (tree.kind(entry) != thin_io::entry_kind::directory)
 		return true;
 
-	return entry.traversalState == DirectoryTraversalState::completed
-		|| entry.traversalState == DirectoryTraversalState::link_boundary
-		|| entry.traversalState == DirectoryTraversalState::mount_boundary;
+	const DirectoryTraversalState traversalState = tree.traversalState(entry);
+	return traversalState == DirectoryTraversalState::completed
+		|| traversalState == DirectoryTraversalState::link_boundary
+		|| traversalState == DirectoryTraversalState::mount_boundary;
 }
 
-void initializeDerivedData(SnapshotEntry& entry, const NativePath& path, HardLinkEntries& hardLinkEntries)
+// Returns whether the entry is left for its hard-link group to account.
+bool initializeLocalDerivedData(SnapshotTree& tree, const SnapshotTree::Index entry)
 {
-	entry.derived = {};
-	entry.derived.localCoverageComplete = localCoverageIsComplete(entry);
+	SnapshotEntryDerivedData derived;
+	derived.localCoverageComplete = localCoverageIsComplete(tree, entry);
 
-	if (entry.traversalState == DirectoryTraversalState::mount_boundary)
+	const std::optional<SnapshotEntryMetadata> metadata = tree.metadata(entry);
+	if (tree.traversalState(entry) == DirectoryTraversalState::mount_boundary)
+		derived.localAllocatedSize = 0;
+	else if (isHardLinkAlias(tree, entry))
 	{
-		entry.derived.localAllocatedSize = 0;
+		tree.setDerived(entry, derived);
+		return true;
 	}
-	else if (entry.metadata)
+	else if (metadata && (tree.kind(entry) != thin_io::entry_kind::regular_file || metadata->hardLinkCount == 1))
+		derived.localAllocatedSize = metadata->allocatedSize;
+
+	if (const std::optional<SnapshotFoldedFiles> folded = tree.foldedFiles(entry))
 	{
-		const bool isRegularFile = entry.attributes.kind == thin_io::entry_kind::regular_file;
-		if (isRegularFile && entry.metadata->hardLinkCount > 1 && entry.metadata->identity)
-		{
-			hardLinkEntries[*entry.metadata->identity].push_back({&entry, path});
-		}
-		else if (!isRegularFile || entry.metadata->hardLinkCount == 1)
-		{
-			entry.derived.localAllocatedSize = entry.metadata->allocatedSize;
-		}
+		// Folded files are part of their directory's own space. Those counted without a size leave it a lower bound.
+		derived.localCoverageComplete &= folded->hardLinkCandidates == 0 && folded->metadataUnavailable == 0;
+		derived.localAllocatedSize = SnapshotInternal::addAllocatedSizes(
+			derived.localAllocatedSize, folded->allocatedSize, derived.allocationOverflow);
 	}
+	tree.setDerived(entry, derived);
+	return false;
+}
 
-	for (auto [name, child] : entry.children)
-		initializeDerivedData(child, appendNativeName(path, name), hardLinkEntries);
+bool hardLinkMetadataMatches(const SnapshotTree& tree, const SnapshotTree::Index left, const SnapshotTree::Index right)
+{
+	const std::optional<SnapshotEntryMetadata> leftMetadata = tree.metadata(left);
+	const std::optional<SnapshotEntryMetadata> rightMetadata = tree.metadata(right);
+	return tree.attributes(left) == tree.attributes(right)
+		&& leftMetadata->logicalSize == rightMetadata->logicalSize
+		&& leftMetadata->allocatedSize == rightMetadata->allocatedSize
+		&& leftMetadata->hardLinkCount == rightMetadata->hardLinkCount;
 }
 
-bool hardLinkMetadataMatches(const SnapshotEntry& left, const SnapshotEntry& right)
+void setLocalAllocatedSize(SnapshotTree& tree, const SnapshotTree::Index entry, const std::optional<uint64_t> size)
 {
-	return left.attributes == right.attributes
-		&& left.metadata->logicalSize == right.metadata->logicalSize
-		&& left.metadata->allocatedSize == right.metadata->allocatedSize
-		&& left.metadata->hardLinkCount == right.metadata->hardLinkCount;
+	SnapshotEntryDerivedData derived = tree.derived(entry);
+	derived.localAllocatedSize = size;
+	tree.setDerived(entry, derived);
 }
 
-SnapshotHardLinkGroup deriveHardLinkGroup(const thin_io::entry_identity& identity, std::vector<HardLinkEntry>& entries)
+// Only reads the tree, so that groups can be derived concurrently; accountHardLinkGroup() then stores what they imply.
+SnapshotHardLinkGroup deriveHardLinkGroup(const SnapshotTree& tree, const thin_io::entry_identity& identity, std::vector<HardLinkEntry>& entries)
 {
 	std::ranges::sort(entries, [](const HardLinkEntry& left, const HardLinkEntry& right) { return left.path < right.path; });
 
+	const SnapshotTree::Index first = entries.front().entry;
+	const SnapshotEntryMetadata firstMetadata = *tree.metadata(first);
 	SnapshotHardLinkGroup group;
 	group.identity = identity;
 	group.presentationPath = entries.front().path;
-	group.allocatedSize = entries.front().entry->metadata->allocatedSize;
-	group.reportedLinkCount = entries.front().entry->metadata->hardLinkCount;
+	group.allocatedSize = firstMetadata.allocatedSize;
+	group.reportedLinkCount = firstMetadata.hardLinkCount;
 	group.aliases.reserve(entries.size());
 
-	group.metadataConsistent = std::ranges::all_of(entries, [&entries](const HardLinkEntry& candidate) {
-		return hardLinkMetadataMatches(*entries.front().entry, *candidate.entry);
+	group.metadataConsistent = std::ranges::all_of(entries, [&tree, first](const HardLinkEntry& candidate) {
+		return hardLinkMetadataMatches(tree, first, candidate.entry);
 	});
 	if (entries.size() > group.reportedLinkCount)
 		group.metadataConsistent = false;
@@ -623,64 +1092,143 @@ SnapshotHardLinkGroup deriveHardLinkGroup(const thin_io::entry_identity& identit
 	group.accountingExact = group.allAliasesObserved;
 
 	for (HardLinkEntry& hardLinkEntry : entries)
-	{
-		group.aliases.push_back(hardLinkEntry.path);
-		hardLinkEntry.entry->derived.localAllocatedSize = group.metadataConsistent ? std::optional<uint64_t>{0} : std::nullopt;
-	}
-	entries.front().entry->derived.localAllocatedSize = group.accountingExact
-		? std::optional<uint64_t>{group.allocatedSize}
-		: std::nullopt;
+		group.aliases.push_back(std::move(hardLinkEntry.path));
 	return group;
 }
 
-std::optional<uint64_t> addKnownAllocatedSize(
-	const std::optional<uint64_t> total, const std::optional<uint64_t> value, bool& overflow)
+// Entries as sorted by deriveHardLinkGroup(), which leaves the first to account the group's allocation.
+void accountHardLinkGroup(SnapshotTree& tree, const SnapshotHardLinkGroup& group, const std::vector<HardLinkEntry>& entries)
 {
-	if (overflow)
-		return {};
-	if (!total)
-		return value;
-	if (!value)
-		return total;
-	if (*value > std::numeric_limits<uint64_t>::max() - *total)
+	for (const HardLinkEntry& hardLinkEntry : entries)
+		setLocalAllocatedSize(tree, hardLinkEntry.entry, group.metadataConsistent ? std::optional<uint64_t>{0} : std::nullopt);
+	setLocalAllocatedSize(tree, entries.front().entry, group.accountingExact ? std::optional<uint64_t>{group.allocatedSize} : std::nullopt);
+}
+
+// Groups are derived in parallel and accounted in order afterwards: the flags of entries in different groups may share a
+// word.
+std::vector<SnapshotHardLinkGroup> deriveHardLinkGroups(SnapshotTree& tree, const std::vector<thin_io::entry_identity>& identities,
+	std::vector<std::vector<HardLinkEntry>>& groupEntries, CWorkerThreadPool* const workerPool)
+{
+	std::vector<SnapshotHardLinkGroup> groups(identities.size());
+	forEachHardLinkGroup(workerPool, groups.size(), [&](const std::size_t group) {
+		groups[group] = deriveHardLinkGroup(tree, identities[group], groupEntries[group]);
+	});
+	for (std::size_t group = 0; group < groups.size(); ++group)
+		accountHardLinkGroup(tree, groups[group], groupEntries[group]);
+	return groups;
+}
+
+void aggregateDerivedData(SnapshotTree& tree, CWorkerThreadPool* const workerPool)
+{
+	// Children are numbered after their parent, so a reverse sweep reaches every entry after all of its subtree.
+	if (!workerPool || tree.size() < MinimumParallelEntries)
 	{
-		overflow = true;
-		return {};
+		for (SnapshotTree::Index entry = tree.size(); entry-- > SnapshotTree::RootIndex;)
+			tree.aggregateDerivedData(entry);
+		return;
+	}
+
+	// The entries of one depth are numbered together, and the children of the last end where the next depth ends. An entry
+	// depends only on the depth below it, so the depths are aggregated deepest first, each split across the pool.
+	std::vector<std::pair<SnapshotTree::Index, SnapshotTree::Index>> depths{{SnapshotTree::RootIndex, SnapshotTree::RootIndex + 1}};
+	while (depths.back().second < tree.size())
+	{
+		const SnapshotTree::Index begin = depths.back().second;
+		depths.emplace_back(begin, *tree.children(begin - 1).end());
+		assert(depths.back().second > begin);
+	}
+	for (auto depth = depths.rbegin(); depth != depths.rend(); ++depth)
+	{
+		// The last entries of a depth share a word of flags with the first of the next, which the tasks read; they are
+		// aggregated once the tasks are done.
+		const SnapshotTree::Index tail = std::max(depth->first, depth->second / FlagWordEntries * FlagWordEntries);
+		const auto ranges = entryRanges(workerPool, depth->first, tail);
+		runTasks(workerPool, ranges.size(), [&tree, &ranges](const std::size_t range) {
+			for (SnapshotTree::Index entry = ranges[range].first; entry < ranges[range].second; ++entry)
+				tree.aggregateDerivedData(entry);
+		});
+		for (SnapshotTree::Index entry = tail; entry < depth->second; ++entry)
+			tree.aggregateDerivedData(entry);
 	}
-	return *total + *value;
 }
 
-void aggregateDerivedData(SnapshotEntry& entry)
+} // namespace
+
+bool isHardLinkAlias(const SnapshotEntry& entry) noexcept
+{
+	return entry.traversalState != DirectoryTraversalState::mount_boundary
+		&& entry.attributes.kind == thin_io::entry_kind::regular_file
+		&& entry.metadata && entry.metadata->hardLinkCount > 1 && entry.metadata->identity;
+}
+
+std::size_t SnapshotLatencyHistogram::bucket(const uint64_t nanoseconds) noexcept
+{
+	return std::min<std::size_t>(static_cast<std::size_t>(std::bit_width(nanoseconds)), BucketCount - 1);
+}
+
+void SnapshotLatencyHistogram::record(const uint64_t nanoseconds) noexcept
+{
+	++count;
+	totalNanoseconds += nanoseconds;
+	++buckets[bucket(nanoseconds)];
+}
+
+void SnapshotLatencyHistogram::add(const SnapshotLatencyHistogram& other) noexcept
 {
-	entry.derived.subtreeCoverageComplete = entry.derived.localCoverageComplete;
-	bool exactSizeOverflow = false;
-	bool knownSizeOverflow = false;
-	std::optional<uint64_t> subtreeAllocatedSize = entry.derived.localAllocatedSize;
-	std::optional<uint64_t> knownSubtreeAllocatedSize = entry.derived.localAllocatedSize;
+	count += other.count;
+	totalNanoseconds += other.totalNanoseconds;
+	for (std::size_t i = 0; i < BucketCount; ++i)
+		buckets[i] += other.buckets[i];
+}
 
-	for (auto namedChild : entry.children)
+std::optional<std::chrono::nanoseconds> SnapshotLatencyHistogram::quantile(const double share) const noexcept
+{
+	if (count == 0)
+		return {};
+	const auto rank = static_cast<uint64_t>(std::ceil(std::clamp(share, 0.0, 1.0) * static_cast<double>(count)));
+	uint64_t seen = 0;
+	for (std::size_t i = 0; i < BucketCount; ++i)
 	{
-		SnapshotEntry& child = namedChild.second;
-		aggregateDerivedData(child);
-		entry.derived.subtreeCoverageComplete &= child.derived.subtreeCoverageComplete;
-		exactSizeOverflow |= child.derived.allocationOverflow;
-		knownSizeOverflow |= child.derived.allocationOverflow;
-		subtreeAllocatedSize = SnapshotInternal::addAllocatedSizes(
-			subtreeAllocatedSize, child.derived.subtreeAllocatedSize, exactSizeOverflow);
-		knownSubtreeAllocatedSize = addKnownAllocatedSize(
-			knownSubtreeAllocatedSize, child.derived.knownSubtreeAllocatedSizeLowerBound, knownSizeOverflow);
+		seen += buckets[i];
+		if (seen >= std::max<uint64_t>(rank, 1))
+			return std::chrono::nanoseconds{int64_t{1} << i};
 	}
+	return std::chrono::nanoseconds{int64_t{1} << (BucketCount - 1)};
+}
 
-	if (!entry.derived.subtreeCoverageComplete || exactSizeOverflow)
-		subtreeAllocatedSize.reset();
-	if (knownSizeOverflow)
-		knownSubtreeAllocatedSize.reset();
-	entry.derived.allocationOverflow = exactSizeOverflow || knownSizeOverflow;
-	entry.derived.subtreeAllocatedSize = subtreeAllocatedSize;
-	entry.derived.knownSubtreeAllocatedSizeLowerBound = knownSubtreeAllocatedSize;
+bool snapshotOperationHasNativeErrorCode(const SnapshotOperation operation) noexcept
+{
+	return operation != SnapshotOperation::entry_changed_during_scan && operation != SnapshotOperation::call_deadline_exceeded;
 }
 
-} // namespace
+bool slowerDirectory(const SnapshotDirectoryCost& left, const SnapshotDirectoryCost& right) noexcept
+{
+	return left.elapsed != right.elapsed ? left.elapsed > right.elapsed : left.path < right.path;
+}
+
+bool largerDirectory(const SnapshotDirectoryCost& left, const SnapshotDirectoryCost& right) noexcept
+{
+	return left.entries != right.entries ? left.entries > right.entries : left.path < right.path;
+}
+
+void SnapshotDirectoryCostReport::add(const SnapshotDirectoryCostReport& other)
+{
+	const auto keepCostliest = [](std::vector<SnapshotDirectoryCost>& costs, const std::vector<SnapshotDirectoryCost>& more,
+		bool (*const costlier)(const SnapshotDirectoryCost&, const SnapshotDirectoryCost&) noexcept) {
+		costs.insert(costs.end(), more.begin(), more.end());
+		std::ranges::sort(costs, costlier);
+		if (costs.size() > Size)
+			costs.resize(Size);
+	};
+	keepCostliest(slowest, other.slowest, slowerDirectory);
+	keepCostliest(largest, other.largest, largerDirectory);
+}
+
+void SnapshotOperationTimings::add(const SnapshotOperationTimings& other) noexcept
+{
+	for (std::size_t i = 0; i < operations.size(); ++i)
+		operations[i].add(other.operations[i]);
+}
 
 SnapshotPlatform currentSnapshotPlatform() noexcept
 {
@@ -699,10 +1247,12 @@ SnapshotPlatform currentSnapshotPlatform() noexcept
 
 std::expected<void, SnapshotSaveError> Snapshot::save(const QString& path) const
 {
-	if (!isValidSnapshot(*this))
+	std::optional<SnapshotTree> staged;
+	const SnapshotTree& entries = entryTree(*this, staged);
+	if (!isValidSnapshot(*this, entries))
 		return std::unexpected{saveError(SnapshotSaveErrorCode::invalid_snapshot)};
 
-	const QByteArray payload = serializePayload(*this);
+	const QByteArray payload = serializePayload(*this, entries);
 	if (payload.isEmpty() || payload.size() > std::numeric_limits<int>::max())
 		return std::unexpected{saveError(SnapshotSaveErrorCode::serialization_failed)};
 
@@ -738,7 +1288,7 @@ std::expected<void, SnapshotSaveError> Snapshot::save(const QString& path) const
 	return {};
 }
 
-std::expected<Snapshot, SnapshotLoadError> Snapshot::load(const QString& path)
+std::expected<Snapshot, SnapshotLoadError> Snapshot::load(const QString& path, CWorkerThreadPool* const workerPool)
 {
 	QFile file{path};
 	if (!file.open(QIODevice::ReadOnly))
@@ -767,7 +1317,7 @@ std::expected<Snapshot, SnapshotLoadError> Snapshot::load(const QString& path)
 	header >> version >> platform >> compressedSize;
 	if (header.status() != QDataStream::Ok)
 		return std::unexpected{loadError(SnapshotLoadErrorCode::truncated)};
-	if (version != CurrentFormatVersion)
+	if (version < OldestSupportedFormatVersion || version > CurrentFormatVersion)
 		return std::unexpected{loadError(SnapshotLoadErrorCode::unsupported_version)};
 	if (!isKnownPlatform(platform))
 		return std::unexpected{loadError(SnapshotLoadErrorCode::corrupt_data)};
@@ -790,10 +1340,10 @@ std::expected<Snapshot, SnapshotLoadError> Snapshot::load(const QString& path)
 		return std::unexpected{loadError(SnapshotLoadErrorCode::decompression_failed)};
 
 	Snapshot snapshot;
-	switch (deserializePayload(payload, snapshot))
+	switch (deserializePayload(payload, version, snapshot))
 	{
 	case PayloadReadResult::success:
-		snapshot.rebuildDerivedData();
+		snapshot.rebuildDerivedData(workerPool);
 		return snapshot;
 	case PayloadReadResult::truncated:
 		return std::unexpected{loadError(SnapshotLoadErrorCode::truncated)};
@@ -805,17 +1355,92 @@ std::expected<Snapshot, SnapshotLoadError> Snapshot::load(const QString& path)
 	return std::unexpected{loadError(SnapshotLoadErrorCode::corrupt_data)};
 }
 
-void Snapshot::rebuildDerivedData()
+void Snapshot::rebuildDerivedData(CWorkerThreadPool* const workerPool)
+{
+	derivedDataAvailable = false;
+	hardLinkGroups.clear();
+	if (hasStagedEntries(*this))
+		tree = SnapshotTree{std::move(root)};
+
+	const auto ranges = entryRanges(workerPool, SnapshotTree::RootIndex, tree.size());
+	std::vector<std::vector<IdentifiedHardLinkEntry>> rangeHardLinkEntries(ranges.size());
+	runTasks(workerPool, ranges.size(), [this, &ranges, &rangeHardLinkEntries](const std::size_t range) {
+		for (SnapshotTree::Index entry = ranges[range].first; entry < ranges[range].second; ++entry)
+		{
+			if (initializeLocalDerivedData(tree, entry))
+				rangeHardLinkEntries[range].push_back({*tree.metadata(entry)->identity, {entry, tree.path(rootPath, entry)}});
+		}
+	});
+
+	// Grouped in identity order, each group's entries in tree order, as a serial sweep would collect them.
+	std::vector<IdentifiedHardLinkEntry> hardLinkEntries;
+	for (std::vector<IdentifiedHardLinkEntry>& entries : rangeHardLinkEntries)
+		std::ranges::move(entries, std::back_inserter(hardLinkEntries));
+	std::ranges::stable_sort(hardLinkEntries, SnapshotInternal::EntryIdentityLess{}, &IdentifiedHardLinkEntry::identity);
+	std::vector<thin_io::entry_identity> identities;
+	std::vector<std::vector<HardLinkEntry>> groupEntries;
+	for (IdentifiedHardLinkEntry& entry : hardLinkEntries)
+	{
+		if (identities.empty() || SnapshotInternal::EntryIdentityLess{}(identities.back(), entry.identity))
+		{
+			identities.push_back(entry.identity);
+			groupEntries.emplace_back();
+		}
+		groupEntries.back().push_back(std::move(entry.entry));
+	}
+	hardLinkGroups = deriveHardLinkGroups(tree, identities, groupEntries, workerPool);
+
+	aggregateDerivedData(tree, workerPool);
+	derivedDataAvailable = true;
+}
+
+void Snapshot::rebuildDerivedData(SnapshotHardLinkAliases hardLinkAliases, CWorkerThreadPool* const workerPool)
 {
 	derivedDataAvailable = false;
 	hardLinkGroups.clear();
+	if (hasStagedEntries(*this))
+		tree = SnapshotTree{std::move(root)};
 
-	HardLinkEntries hardLinkEntries;
-	initializeDerivedData(root, rootPath, hardLinkEntries);
-	hardLinkGroups.reserve(hardLinkEntries.size());
-	for (auto& [identity, entries] : hardLinkEntries)
-		hardLinkGroups.push_back(deriveHardLinkGroup(identity, entries));
+	const auto ranges = entryRanges(workerPool, SnapshotTree::RootIndex, tree.size());
+	runTasks(workerPool, ranges.size(), [this, &ranges](const std::size_t range) {
+		for (SnapshotTree::Index entry = ranges[range].first; entry < ranges[range].second; ++entry)
+			initializeLocalDerivedData(tree, entry);
+	});
+
+	// Groups are listed in the order the full rebuild produces.
+	std::ranges::sort(hardLinkAliases, SnapshotInternal::EntryIdentityLess{}, [](const auto& group) -> const auto& { return group.first; });
+	std::vector<thin_io::entry_identity> identities(hardLinkAliases.size());
+	std::vector<std::vector<HardLinkEntry>> groupEntries(hardLinkAliases.size());
+	forEachHardLinkGroup(workerPool, hardLinkAliases.size(), [&](const std::size_t group) {
+		auto& [identity, paths] = hardLinkAliases[group];
+		assert(!paths.empty());
+		identities[group] = identity;
+		groupEntries[group].reserve(paths.size());
+		for (NativePath& path : paths)
+		{
+			const std::optional<SnapshotTree::Index> entry = tree.find(rootPath, path);
+			assert(entry && isHardLinkAlias(tree, *entry));
+			groupEntries[group].push_back({*entry, std::move(path)});
+		}
+	});
+	hardLinkGroups = deriveHardLinkGroups(tree, identities, groupEntries, workerPool);
 
-	aggregateDerivedData(root);
+	aggregateDerivedData(tree, workerPool);
 	derivedDataAvailable = true;
 }
+
+bool Snapshot::operator==(const Snapshot& other) const
+{
+	if (rootPath != other.rootPath
+		|| filesystemSpaceAtStart != other.filesystemSpaceAtStart
+		|| filesystemSpaceAtCompletion != other.filesystemSpaceAtCompletion
+		|| scanStartedAtUtc != other.scanStartedAtUtc
+		|| scanCompletedAtUtc != other.scanCompletedAtUtc
+		|| exclusionRules != other.exclusionRules
+		|| diagnostics != other.diagnostics)
+		return false;
+
+	std::optional<SnapshotTree> staged;
+	std::optional<SnapshotTree> otherStaged;
+	return entryTree(*this, staged) == entryTree(other, otherStaged);
+}
@@ -9,11 +9,20 @@
 #include <QDateTime>
 #include <QString>
 
+#include <array>
+#include <chrono>
+#include <cstddef>
 #include <expected>
+#include <limits>
 #include <optional>
+#include <ranges>
 #include <stdint.h>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+class CWorkerThreadPool;
+
 enum class SnapshotPlatform : uint8_t {
 	windows = 1,
 	macos,
@@ -27,7 +36,11 @@ enum class DirectoryTraversalState : uint8_t {
 	enumeration_failed,
 	metadata_unavailable,
 	link_boundary,
-	mount_boundary
+	mount_boundary,
+	excluded, // Matched a scan exclusion rule; the directory's own metadata is recorded, its children are not.
+	// Abandoned with the subtree of a native call that outlived the scan's call deadline. The directory the call was made
+	// for keeps the children listed before it, without the metadata not yet collected; no directory below is traversed.
+	stalled
 };
 
 enum class SnapshotOperation : uint8_t {
@@ -36,7 +49,8 @@ enum class SnapshotOperation : uint8_t {
 	entry_metadata,
 	filesystem_space_at_start,
 	filesystem_space_at_completion,
-	entry_changed_during_scan
+	entry_changed_during_scan,
+	call_deadline_exceeded // The directory's subtree was abandoned with a native call that did not return in time.
 };
 
 struct SnapshotEntryMetadata
@@ -55,8 +69,26 @@ struct SnapshotEntryDerivedData
 	bool subtreeCoverageComplete = false;
 	bool allocationOverflow = false;
 	std::optional<uint64_t> localAllocatedSize;
+	// Known exactly only together with the lower bound, which it then equals.
 	std::optional<uint64_t> subtreeAllocatedSize;
 	std::optional<uint64_t> knownSubtreeAllocatedSizeLowerBound;
+
+	[[nodiscard]] bool operator==(const SnapshotEntryDerivedData&) const = default;
+};
+
+// Regular files of a directory scanned at directory resolution, counted instead of being recorded as children.
+struct SnapshotFoldedFiles
+{
+	uint64_t files = 0;
+	// Sums over the files with one link; files with more links are only counted as hard-link candidates, since their space
+	// may be shared with names elsewhere that a counter cannot be matched against.
+	uint64_t logicalSize = 0;
+	uint64_t allocatedSize = 0;
+	uint64_t hardLinkCandidates = 0;
+	// Files whose metadata could not be read, or that changed kind while the scan ran.
+	uint64_t metadataUnavailable = 0;
+
+	[[nodiscard]] bool operator==(const SnapshotFoldedFiles&) const = default;
 };
 
 struct SnapshotEntry
@@ -65,15 +97,176 @@ struct SnapshotEntry
 	std::optional<SnapshotEntryMetadata> metadata;
 	DirectoryTraversalState traversalState = DirectoryTraversalState::not_directory;
 	flat_map<NativeName, SnapshotEntry> children;
-	SnapshotEntryDerivedData derived;
+	// Set on a completed directory whose regular files were folded; children then holds only the other entries.
+	std::optional<SnapshotFoldedFiles> foldedFiles;
 
 	[[nodiscard]] bool operator==(const SnapshotEntry& other) const
 	{
 		return attributes == other.attributes && metadata == other.metadata
-			&& traversalState == other.traversalState && children == other.children;
+			&& traversalState == other.traversalState && children == other.children && foldedFiles == other.foldedFiles;
 	}
 };
 
+// The entries of a snapshot in compact form. Entries are numbered breadth first from the root, entry 0, so the children
+// of every directory are one contiguous range of entries in name order. Entries refer to their names by handle into a
+// pool that holds each distinct name once, and metadata, identities and derived data are columns indexed by entry. That
+// takes less than a third of the memory of nested entries and turns passes over the tree into passes over arrays. Built
+// once from nested entries; only the derived data changes afterwards.
+//
+// Scans and loads still stage their entries in nested form and build the tree only once they complete, so their peak
+// memory and allocations are unchanged. The saving applies to the snapshots held afterwards.
+class SnapshotTree
+{
+public:
+	using Index = uint32_t;
+	using Children = std::ranges::iota_view<Index, Index>;
+	using NameHandle = uint32_t;
+
+	static constexpr Index RootIndex = 0;
+
+	SnapshotTree() = default;
+	// Moves the entries out of root, leaving it empty. The children of each directory are released as soon as they are
+	// copied, so that a large tree is never held in both forms.
+	explicit SnapshotTree(SnapshotEntry&& root);
+	explicit SnapshotTree(const SnapshotEntry& root);
+
+	[[nodiscard]] bool empty() const noexcept { return m_nodes.empty(); }
+	[[nodiscard]] Index size() const noexcept { return static_cast<Index>(m_nodes.size()); }
+
+	// Empty for the root.
+	[[nodiscard]] NativeNameView name(Index entry) const noexcept;
+	// Not for the root, which has no name.
+	[[nodiscard]] NameHandle nameHandle(Index entry) const noexcept;
+	// The distinct names of the entries, numbered in the order in which entries first use them.
+	[[nodiscard]] NameHandle nameCount() const noexcept;
+	[[nodiscard]] NativeNameView pooledName(NameHandle name) const noexcept;
+	[[nodiscard]] thin_io::entry_attributes attributes(Index entry) const noexcept;
+	[[nodiscard]] thin_io::entry_kind kind(Index entry) const noexcept;
+	[[nodiscard]] std::optional<SnapshotEntryMetadata> metadata(Index entry) const noexcept;
+	[[nodiscard]] DirectoryTraversalState traversalState(Index entry) const noexcept;
+	[[nodiscard]] std::optional<SnapshotFoldedFiles> foldedFiles(Index entry) const noexcept;
+	[[nodiscard]] Children children(Index entry) const noexcept;
+	// Nothing for the root.
+	[[nodiscard]] std::optional<Index> parent(Index entry) const noexcept;
+	[[nodiscard]] std::optional<Index> findChild(Index directory, NativeNameView name) const noexcept;
+	// The entry at path in a tree whose root is at rootPath.
+	[[nodiscard]] std::optional<Index> find(const NativePath& rootPath, const NativePath& path) const;
+	[[nodiscard]] NativePath path(const NativePath& rootPath, Index entry) const;
+	// The subtree at entry in nested form, without derived data.
+	[[nodiscard]] SnapshotEntry toEntry(Index entry = RootIndex) const;
+
+	// Stored by Snapshot::rebuildDerivedData(), as columns of their own: the sizes in one array each and every flag in a
+	// bitset. derived() gathers all of an entry's columns; the accessors below read only the one they are named after.
+	[[nodiscard]] SnapshotEntryDerivedData derived(Index entry) const noexcept;
+	void setDerived(Index entry, const SnapshotEntryDerivedData& derived) noexcept;
+	[[nodiscard]] std::optional<uint64_t> localAllocatedSize(const Index entry) const noexcept
+	{
+		return m_hasLocalAllocatedSize.test(entry) ? std::optional{m_localAllocatedSizes[entry]} : std::nullopt;
+	}
+	[[nodiscard]] std::optional<uint64_t> subtreeAllocatedSize(const Index entry) const noexcept
+	{
+		return m_subtreeAllocatedSizeExact.test(entry) ? std::optional{m_subtreeAllocatedSizes[entry]} : std::nullopt;
+	}
+	[[nodiscard]] std::optional<uint64_t> knownSubtreeAllocatedSizeLowerBound(const Index entry) const noexcept
+	{
+		return m_hasSubtreeAllocatedSizeLowerBound.test(entry) ? std::optional{m_subtreeAllocatedSizes[entry]} : std::nullopt;
+	}
+	[[nodiscard]] bool localCoverageComplete(const Index entry) const noexcept { return m_localCoverageComplete.test(entry); }
+	[[nodiscard]] bool subtreeCoverageComplete(const Index entry) const noexcept { return m_subtreeCoverageComplete.test(entry); }
+	[[nodiscard]] bool allocationOverflow(const Index entry) const noexcept { return m_allocationOverflow.test(entry); }
+	// Derives the subtree data of entry from its local data and the subtree data of its children, which must have been
+	// derived before. Reads and writes the derived columns only.
+	void aggregateDerivedData(Index entry) noexcept;
+
+	// Bytes allocated for the columns and the name pool.
+	[[nodiscard]] std::size_t memoryUsage() const noexcept;
+
+	// Derived data is not compared.
+	[[nodiscard]] bool operator==(const SnapshotTree& other) const;
+
+private:
+	struct Node
+	{
+		NameHandle name;
+		uint8_t kind;
+		uint8_t flags;
+		uint8_t traversalState;
+		// The link count of an entry with metadata, unless it is HardLinkCountElsewhere and the count is in m_hardLinkCounts.
+		uint8_t hardLinkCount;
+		// Where the children of an entry without any would begin, which keeps the column sorted for parent().
+		Index firstChild;
+		Index childCount;
+
+		[[nodiscard]] bool operator==(const Node&) const = default;
+	};
+
+	// Zero for an entry without metadata.
+	struct Metadata
+	{
+		uint64_t logicalSize;
+		uint64_t allocatedSize;
+
+		[[nodiscard]] bool operator==(const Metadata&) const = default;
+	};
+
+	struct Identity
+	{
+		uint32_t filesystem; // Into m_filesystems, which a tree rarely needs more than a few of.
+		decltype(thin_io::entry_identity::entry) entry;
+
+		[[nodiscard]] bool operator==(const Identity&) const = default;
+	};
+
+	static constexpr uint8_t HardLinkCountElsewhere = std::numeric_limits<uint8_t>::max();
+
+	// One bit per entry.
+	class BitColumn
+	{
+	public:
+		void assign(const std::size_t size) { m_words.assign((size + 63) / 64, 0); }
+		[[nodiscard]] bool test(const Index entry) const noexcept { return (m_words[entry / 64] >> (entry % 64) & 1) != 0; }
+		void set(const Index entry, const bool value) noexcept
+		{
+			const uint64_t bit = uint64_t{1} << (entry % 64);
+			m_words[entry / 64] = value ? m_words[entry / 64] | bit : m_words[entry / 64] & ~bit;
+		}
+		[[nodiscard]] std::size_t memoryUsage() const noexcept { return m_words.capacity() * sizeof(uint64_t); }
+
+	private:
+		std::vector<uint64_t> m_words;
+	};
+
+	// Only while the tree is built.
+	using NameHandles = std::unordered_map<NativeName, NameHandle, NativeNameHash, NativeNameEqual>;
+
+	void reserve(const SnapshotEntry& root);
+	[[nodiscard]] NameHandle internName(const NativeName& name, NameHandles& handles);
+	Index append(NameHandle name, const SnapshotEntry& entry);
+	void setChildren(Index directory, std::size_t childCount) noexcept;
+	void finish() noexcept;
+
+	std::vector<Node> m_nodes;
+	std::vector<NativePathCharacter> m_names;
+	// Where each pooled name begins in m_names, and where the last one ends.
+	std::vector<uint64_t> m_nameOffsets{0};
+	std::vector<Metadata> m_metadata;
+	std::vector<Identity> m_identities;
+	std::vector<thin_io::filesystem_identity> m_filesystems;
+	// Sorted by entry; few entries have any of these.
+	std::vector<std::pair<Index, uint64_t>> m_hardLinkCounts;
+	std::vector<std::pair<Index, uint32_t>> m_reparseTags;
+	std::vector<std::pair<Index, SnapshotFoldedFiles>> m_foldedFiles;
+	// Zero where the size is unknown. An exact subtree size equals the lower bound, so the two share a column.
+	std::vector<uint64_t> m_localAllocatedSizes;
+	std::vector<uint64_t> m_subtreeAllocatedSizes;
+	BitColumn m_hasLocalAllocatedSize;
+	BitColumn m_subtreeAllocatedSizeExact;
+	BitColumn m_hasSubtreeAllocatedSizeLowerBound;
+	BitColumn m_localCoverageComplete;
+	BitColumn m_subtreeCoverageComplete;
+	BitColumn m_allocationOverflow;
+};
+
 struct SnapshotDiagnostic
 {
 	NativePath path;
@@ -83,6 +276,9 @@ struct SnapshotDiagnostic
 	[[nodiscard]] bool operator==(const SnapshotDiagnostic&) const = default;
 };
 
+// Whether diagnostics of the operation carry the native error code of a failed call; the others record no failure.
+[[nodiscard]] bool snapshotOperationHasNativeErrorCode(SnapshotOperation operation) noexcept;
+
 struct SnapshotHardLinkGroup
 {
 	thin_io::entry_identity identity;
@@ -93,6 +289,126 @@ struct SnapshotHardLinkGroup
 	bool metadataConsistent = false;
 	bool allAliasesObserved = false;
 	bool accountingExact = false;
+
+	[[nodiscard]] bool operator==(const SnapshotHardLinkGroup&) const = default;
+};
+
+// The observed names of multi-link files by identity, as collected by a scanner for Snapshot::rebuildDerivedData().
+using SnapshotHardLinkAliases = std::vector<std::pair<thin_io::entry_identity, std::vector<NativePath>>>;
+
+enum class SnapshotExclusionPatternKind : uint8_t {
+	// Wildcards '*' and '?' that never match a separator. Matched against the entry name, or against the path relative to
+	// the scan root if the pattern contains a separator ('/' is accepted on every platform).
+	glob,
+	// A normalized absolute path; matches that path and everything below it.
+	path_prefix,
+	// A file name; matches every directory that contains an entry of that name. Such directories are kept as stat-only
+	// leaves whatever the action, since the marker is only found once the directory has been reached.
+	marker_file
+};
+
+enum class SnapshotExclusionAction : uint8_t {
+	// The entry is left out of the snapshot, together with its subtree.
+	skip,
+	// The entry is recorded with its metadata; a directory is not enumerated and has the excluded traversal state.
+	stat_only
+};
+
+struct SnapshotExclusionRule
+{
+	SnapshotExclusionPatternKind kind = SnapshotExclusionPatternKind::glob;
+	NativePath pattern;
+	SnapshotExclusionAction action = SnapshotExclusionAction::skip;
+
+	[[nodiscard]] bool operator==(const SnapshotExclusionRule&) const = default;
+};
+
+struct SnapshotConcurrencySample
+{
+	uint32_t elapsedMilliseconds = 0; // Since the scan started.
+	uint32_t participants = 0;
+
+	[[nodiscard]] bool operator==(const SnapshotConcurrencySample&) const = default;
+};
+
+// The native calls of a scan whose latencies are recorded, and the time its participants wait for work.
+enum class SnapshotTimedOperation : uint8_t {
+	directory_open, // Only where directories are opened as handles of their own.
+	directory_listing,
+	file_id_listing,
+	entry_metadata, // One sample per batch of lookups, exclusion markers included.
+	queue_wait // From asking for the next directory to getting it, idle time included.
+};
+
+inline constexpr std::size_t SnapshotTimedOperationCount = 5;
+
+// Latencies in power-of-two buckets: bucket i counts those below 2^i nanoseconds that are not in an earlier bucket, the
+// last bucket everything longer.
+struct SnapshotLatencyHistogram
+{
+	static constexpr std::size_t BucketCount = 48;
+
+	uint64_t count = 0;
+	uint64_t totalNanoseconds = 0;
+	std::array<uint64_t, BucketCount> buckets{};
+
+	[[nodiscard]] static std::size_t bucket(uint64_t nanoseconds) noexcept;
+	void record(uint64_t nanoseconds) noexcept;
+	void add(const SnapshotLatencyHistogram& other) noexcept;
+	// The upper bound of the bucket that holds the given share of the samples; nothing without samples.
+	[[nodiscard]] std::optional<std::chrono::nanoseconds> quantile(double share) const noexcept;
+
+	[[nodiscard]] bool operator==(const SnapshotLatencyHistogram&) const = default;
+};
+
+struct SnapshotOperationTimings
+{
+	std::array<SnapshotLatencyHistogram, SnapshotTimedOperationCount> operations;
+
+	[[nodiscard]] SnapshotLatencyHistogram& operator[](const SnapshotTimedOperation operation) noexcept
+	{
+		return operations[static_cast<std::size_t>(operation)];
+	}
+
+	[[nodiscard]] const SnapshotLatencyHistogram& operator[](const SnapshotTimedOperation operation) const noexcept
+	{
+		return operations[static_cast<std::size_t>(operation)];
+	}
+
+	void add(const SnapshotOperationTimings& other) noexcept;
+
+	[[nodiscard]] bool operator==(const SnapshotOperationTimings&) const = default;
+};
+
+// What one directory cost its scan: the directories that cost the most are the candidates for exclusion, or for a
+// volume of their own.
+struct SnapshotDirectoryCost
+{
+	NativePath path;
+	// Wall time from opening the directory to the end of its children's metadata lookups, throttling delays included;
+	// summed over the participants that shared a split directory.
+	std::chrono::nanoseconds elapsed{0};
+	uint64_t entries = 0; // Listed children that no exclusion rule skipped.
+
+	[[nodiscard]] bool operator==(const SnapshotDirectoryCost&) const = default;
+};
+
+// Orders by cost, costliest first, then by path.
+[[nodiscard]] bool slowerDirectory(const SnapshotDirectoryCost& left, const SnapshotDirectoryCost& right) noexcept;
+[[nodiscard]] bool largerDirectory(const SnapshotDirectoryCost& left, const SnapshotDirectoryCost& right) noexcept;
+
+struct SnapshotDirectoryCostReport
+{
+	static constexpr std::size_t Size = 25;
+
+	// Up to Size directories each, costliest first.
+	std::vector<SnapshotDirectoryCost> slowest;
+	std::vector<SnapshotDirectoryCost> largest;
+
+	// Keeps the costliest of both reports.
+	void add(const SnapshotDirectoryCostReport& other);
+
+	[[nodiscard]] bool operator==(const SnapshotDirectoryCostReport&) const = default;
 };
 
 enum class SnapshotSaveErrorCode : uint8_t {
@@ -133,31 +449,49 @@ struct SnapshotLoadError
 
 struct Snapshot
 {
-	static constexpr uint16_t CurrentFormatVersion = 2;
+	// Version 7 writes every distinct entry name once, in a table that entries refer to by index. Version 6 only added the
+	// stalled traversal state and the call deadline diagnostic, which older versions reject.
+	static constexpr uint16_t CurrentFormatVersion = 7;
+	// Oldest format load() still reads; it predates exclusion rules, folded files and directory costs.
+	static constexpr uint16_t OldestSupportedFormatVersion = 2;
 
 	NativePath rootPath;
+	// Where the entries of a snapshot are assembled. rebuildDerivedData() moves them into tree, which is what everything
+	// that reads a snapshot reads, and leaves root empty; entries assigned to root later replace the tree at the next call.
 	SnapshotEntry root;
+	SnapshotTree tree;
 	std::optional<thin_io::filesystem_space> filesystemSpaceAtStart;
 	std::optional<thin_io::filesystem_space> filesystemSpaceAtCompletion;
 	QDateTime scanStartedAtUtc;
 	QDateTime scanCompletedAtUtc;
+	// The rules the scan applied, in order. The root itself is never excluded.
+	std::vector<SnapshotExclusionRule> exclusionRules;
 	std::vector<SnapshotDiagnostic> diagnostics;
 	std::vector<SnapshotHardLinkGroup> hardLinkGroups;
+	// Active traversal participants over time, one sample per change; describes the scan run and is not persisted.
+	std::vector<SnapshotConcurrencySample> concurrencyHistory;
+	// Latencies of the scan's native calls and queue waits; describes the scan run and is not persisted.
+	SnapshotOperationTimings operationTimings;
+	// Persisted, but like the other measurements of the scan run not compared: two scans of one tree differ in them.
+	SnapshotDirectoryCostReport directoryCosts;
 	bool derivedDataAvailable = false;
 
 	[[nodiscard]] std::expected<void, SnapshotSaveError> save(const QString& path) const;
-	[[nodiscard]] static std::expected<Snapshot, SnapshotLoadError> load(const QString& path);
-	void rebuildDerivedData();
+	// Derives the loaded snapshot's data on workerPool when given, see rebuildDerivedData().
+	[[nodiscard]] static std::expected<Snapshot, SnapshotLoadError> load(const QString& path, CWorkerThreadPool* workerPool = nullptr);
+	// With a workerPool, the passes over a large tree are split between the calling thread and whichever of the pool's
+	// workers are free; the result is the same as without one.
+	void rebuildDerivedData(CWorkerThreadPool* workerPool = nullptr);
+	// Same result without looking through the tree for hard links: hardLinkAliases must hold the path of every entry for
+	// which isHardLinkAlias() is true, grouped by identity in any order.
+	void rebuildDerivedData(SnapshotHardLinkAliases hardLinkAliases, CWorkerThreadPool* workerPool = nullptr);
 
-	[[nodiscard]] bool operator==(const Snapshot& other) const
-	{
-		return rootPath == other.rootPath && root == other.root
-			&& filesystemSpaceAtStart == other.filesystemSpaceAtStart
-			&& filesystemSpaceAtCompletion == other.filesystemSpaceAtCompletion
-			&& scanStartedAtUtc == other.scanStartedAtUtc
-			&& scanCompletedAtUtc == other.scanCompletedAtUtc
-			&& diagnostics == other.diagnostics;
-	}
+	// Entries still in root compare equal to the same entries in tree.
+	[[nodiscard]] bool operator==(const Snapshot& other) const;
 };
 
 [[nodiscard]] SnapshotPlatform currentSnapshotPlatform() noexcept;
+
+// Whether the entry's allocation is shared with the other names of the same file and accounted through a hard-link group.
+[[nodiscard]] bool isHardLinkAlias(const SnapshotEntry& entry) noexcept;
+[[nodiscard]] bool isHardLinkAlias(const SnapshotTree& tree, SnapshotTree::Index entry) noexcept;
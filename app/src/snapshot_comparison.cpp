@@ -1,29 +1,41 @@
 #include "snapshot_comparison.h"
+#include "scan_exclusions.h"
 #include "snapshot_internal.h"
 
 #include <assert.h>
 #include <limits>
 #include <map>
 #include <utility>
+#include <vector>
 
 namespace {
 
 struct ComparedEntryAccounting
 {
-	const SnapshotEntry* sourceEntry = nullptr;
 	std::optional<uint64_t> localAllocatedSize;
 	std::optional<uint64_t> subtreeAllocatedSize;
 	bool allocationOverflow = false;
 };
 
-using AccountingByPath = std::map<NativePath, ComparedEntryAccounting>;
+// The accounting of every entry of one snapshot for a comparison, indexed like the snapshot's tree.
+struct SnapshotAccounting
+{
+	const Snapshot* snapshot = nullptr;
+	std::vector<ComparedEntryAccounting> entries;
+
+	[[nodiscard]] const SnapshotTree& tree() const noexcept { return snapshot->tree; }
+	[[nodiscard]] std::optional<SnapshotTree::Index> find(const NativePath& path) const { return tree().find(snapshot->rootPath, path); }
+};
+
 using HardLinkGroupsByIdentity = std::map<thin_io::entry_identity, const SnapshotHardLinkGroup*, SnapshotInternal::EntryIdentityLess>;
 
-void collectAccountingByPath(const SnapshotEntry& entry, const NativePath& path, AccountingByPath& accountingByPath)
+SnapshotAccounting collectAccounting(const Snapshot& snapshot)
 {
-	accountingByPath.emplace(path, ComparedEntryAccounting{&entry, entry.derived.localAllocatedSize});
-	for (const auto& [name, child] : entry.children)
-		collectAccountingByPath(child, appendNativeName(path, name), accountingByPath);
+	SnapshotAccounting accounting{&snapshot, {}};
+	accounting.entries.reserve(snapshot.tree.size());
+	for (SnapshotTree::Index entry = SnapshotTree::RootIndex; entry < snapshot.tree.size(); ++entry)
+		accounting.entries.push_back({snapshot.tree.localAllocatedSize(entry), {}, false});
+	return accounting;
 }
 
 std::optional<NativePath> firstCommonAlias(const std::vector<NativePath>& left, const std::vector<NativePath>& right)
@@ -54,19 +66,19 @@ HardLinkGroupsByIdentity indexExactHardLinkGroups(const Snapshot& snapshot)
 }
 
 std::optional<NativePath> firstCommonSingleLinkAlias(
-	const SnapshotHardLinkGroup& group, const AccountingByPath& otherAccounting)
+	const SnapshotHardLinkGroup& group, const SnapshotAccounting& otherAccounting)
 {
 	for (const NativePath& alias : group.aliases)
 	{
-		const auto accounting = otherAccounting.find(alias);
-		if (accounting == otherAccounting.end())
+		const std::optional<SnapshotTree::Index> entry = otherAccounting.find(alias);
+		if (!entry)
 			continue;
 
-		const SnapshotEntry& entry = *accounting->second.sourceEntry;
-		if (entry.attributes.kind == thin_io::entry_kind::regular_file
-			&& entry.metadata && entry.metadata->hardLinkCount == 1
-			&& entry.metadata->identity && *entry.metadata->identity == group.identity
-			&& accounting->second.localAllocatedSize)
+		const std::optional<SnapshotEntryMetadata> metadata = otherAccounting.tree().metadata(*entry);
+		if (otherAccounting.tree().kind(*entry) == thin_io::entry_kind::regular_file
+			&& metadata && metadata->hardLinkCount == 1
+			&& metadata->identity && *metadata->identity == group.identity
+			&& otherAccounting.entries[*entry].localAllocatedSize)
 		{
 			return alias;
 		}
@@ -74,17 +86,25 @@ std::optional<NativePath> firstCommonSingleLinkAlias(
 	return {};
 }
 
+ComparedEntryAccounting& aliasAccounting(const NativePath& alias, SnapshotAccounting& accounting)
+{
+	const std::optional<SnapshotTree::Index> entry = accounting.find(alias);
+	assert(entry);
+	return accounting.entries[*entry];
+}
+
 void anchorHardLinkGroupAtAlias(
-	const SnapshotHardLinkGroup& group, const NativePath& alias, AccountingByPath& accounting)
+	const SnapshotHardLinkGroup& group, const NativePath& alias, SnapshotAccounting& accounting)
 {
 	for (const NativePath& groupAlias : group.aliases)
-		accounting.at(groupAlias).localAllocatedSize = 0;
-	accounting.at(alias).localAllocatedSize = group.allocatedSize;
+		aliasAccounting(groupAlias, accounting).localAllocatedSize = 0;
+	aliasAccounting(alias, accounting).localAllocatedSize = group.allocatedSize;
 }
 
-void correlateHardLinkGroups(const Snapshot& baseline, const Snapshot& current,
-	AccountingByPath& baselineAccounting, AccountingByPath& currentAccounting)
+void correlateHardLinkGroups(SnapshotAccounting& baselineAccounting, SnapshotAccounting& currentAccounting)
 {
+	const Snapshot& baseline = *baselineAccounting.snapshot;
+	const Snapshot& current = *currentAccounting.snapshot;
 	const HardLinkGroupsByIdentity baselineGroups = indexExactHardLinkGroups(baseline);
 	const HardLinkGroupsByIdentity currentGroups = indexExactHardLinkGroups(current);
 	for (const SnapshotHardLinkGroup& baselineGroup : baseline.hardLinkGroups)
@@ -113,43 +133,45 @@ void correlateHardLinkGroups(const Snapshot& baseline, const Snapshot& current,
 	}
 }
 
-void recalculateSubtreeAccounting(const SnapshotEntry& entry, const NativePath& path, AccountingByPath& accountingByPath)
+void recalculateSubtreeAccounting(SnapshotAccounting& accounting)
 {
-	ComparedEntryAccounting& accounting = accountingByPath.at(path);
-	accounting.allocationOverflow = false;
-	std::optional<uint64_t> subtreeAllocatedSize = accounting.localAllocatedSize;
-	for (const auto& [name, child] : entry.children)
+	const SnapshotTree& tree = accounting.tree();
+	// Children are numbered after their parent, so a reverse sweep reaches every entry after all of its subtree.
+	for (SnapshotTree::Index entry = tree.size(); entry-- > SnapshotTree::RootIndex;)
 	{
-		const NativePath childPath = appendNativeName(path, name);
-		recalculateSubtreeAccounting(child, childPath, accountingByPath);
-		subtreeAllocatedSize = SnapshotInternal::addAllocatedSizes(
-			subtreeAllocatedSize, accountingByPath.at(childPath).subtreeAllocatedSize, accounting.allocationOverflow);
-	}
+		ComparedEntryAccounting& entryAccounting = accounting.entries[entry];
+		entryAccounting.allocationOverflow = false;
+		std::optional<uint64_t> subtreeAllocatedSize = entryAccounting.localAllocatedSize;
+		for (const SnapshotTree::Index child : tree.children(entry))
+		{
+			subtreeAllocatedSize = SnapshotInternal::addAllocatedSizes(
+				subtreeAllocatedSize, accounting.entries[child].subtreeAllocatedSize, entryAccounting.allocationOverflow);
+		}
 
-	if (!entry.derived.subtreeCoverageComplete)
-		subtreeAllocatedSize.reset();
-	accounting.subtreeAllocatedSize = subtreeAllocatedSize;
+		if (!tree.subtreeCoverageComplete(entry))
+			subtreeAllocatedSize.reset();
+		entryAccounting.subtreeAllocatedSize = subtreeAllocatedSize;
+	}
 }
 
-std::pair<AccountingByPath, AccountingByPath> buildComparisonAccounting(const Snapshot& baseline, const Snapshot& current)
+std::pair<SnapshotAccounting, SnapshotAccounting> buildComparisonAccounting(const Snapshot& baseline, const Snapshot& current)
 {
-	AccountingByPath baselineAccounting;
-	AccountingByPath currentAccounting;
-	collectAccountingByPath(baseline.root, baseline.rootPath, baselineAccounting);
-	collectAccountingByPath(current.root, current.rootPath, currentAccounting);
-	correlateHardLinkGroups(baseline, current, baselineAccounting, currentAccounting);
-	recalculateSubtreeAccounting(baseline.root, baseline.rootPath, baselineAccounting);
-	recalculateSubtreeAccounting(current.root, current.rootPath, currentAccounting);
+	SnapshotAccounting baselineAccounting = collectAccounting(baseline);
+	SnapshotAccounting currentAccounting = collectAccounting(current);
+	correlateHardLinkGroups(baselineAccounting, currentAccounting);
+	recalculateSubtreeAccounting(baselineAccounting);
+	recalculateSubtreeAccounting(currentAccounting);
 	return {std::move(baselineAccounting), std::move(currentAccounting)};
 }
 
 bool isValidComparisonRoot(const Snapshot& snapshot)
 {
 	return !snapshot.rootPath.isEmpty()
-		&& snapshot.root.attributes.kind == thin_io::entry_kind::directory
-		&& !snapshot.root.attributes.is_link
-		&& snapshot.root.metadata.has_value()
-		&& snapshot.root.traversalState == DirectoryTraversalState::completed;
+		&& !snapshot.tree.empty()
+		&& snapshot.tree.kind(SnapshotTree::RootIndex) == thin_io::entry_kind::directory
+		&& !snapshot.tree.attributes(SnapshotTree::RootIndex).is_link
+		&& snapshot.tree.metadata(SnapshotTree::RootIndex).has_value()
+		&& snapshot.tree.traversalState(SnapshotTree::RootIndex) == DirectoryTraversalState::completed;
 }
 
 std::optional<thin_io::filesystem_identity> filesystemIdentity(const Snapshot& snapshot)
@@ -158,8 +180,8 @@ std::optional<thin_io::filesystem_identity> filesystemIdentity(const Snapshot& s
 		return snapshot.filesystemSpaceAtCompletion->identity;
 	if (snapshot.filesystemSpaceAtStart && snapshot.filesystemSpaceAtStart->identity)
 		return snapshot.filesystemSpaceAtStart->identity;
-	if (snapshot.root.metadata->identity)
-		return snapshot.root.metadata->identity->filesystem;
+	if (const auto rootIdentity = snapshot.tree.metadata(SnapshotTree::RootIndex)->identity)
+		return rootIdentity->filesystem;
 	return {};
 }
 
@@ -220,24 +242,33 @@ void deriveSpaceSummary(const Snapshot& baseline, const Snapshot& current, Compa
 
 struct ComparisonSide
 {
-	const SnapshotEntry* entry = nullptr;
+	const SnapshotAccounting* accounting = nullptr;
+	std::optional<SnapshotTree::Index> entry;
 	bool absenceAuthoritative = false;
-	const AccountingByPath* accountingByPath = nullptr;
+	const ScanExclusions* exclusions = nullptr;
+	bool skippedByRule = false; // Absent because an exclusion rule skipped it.
+
+	[[nodiscard]] const SnapshotTree& tree() const noexcept { return accounting->tree(); }
 };
 
-std::optional<uint64_t> localAllocatedSize(const ComparisonSide& side, const NativePath& path)
+bool excludedByRule(const ComparisonSide& side)
+{
+	return side.skippedByRule || (side.entry && side.tree().traversalState(*side.entry) == DirectoryTraversalState::excluded);
+}
+
+std::optional<uint64_t> localAllocatedSize(const ComparisonSide& side)
 {
 	if (side.entry)
-		return side.accountingByPath->at(path).localAllocatedSize;
+		return side.accounting->entries[*side.entry].localAllocatedSize;
 	if (side.absenceAuthoritative)
 		return 0;
 	return {};
 }
 
-std::optional<uint64_t> subtreeAllocatedSize(const ComparisonSide& side, const NativePath& path)
+std::optional<uint64_t> subtreeAllocatedSize(const ComparisonSide& side)
 {
 	if (side.entry)
-		return side.accountingByPath->at(path).subtreeAllocatedSize;
+		return side.accounting->entries[*side.entry].subtreeAllocatedSize;
 	if (side.absenceAuthoritative)
 		return 0;
 	return {};
@@ -247,94 +278,126 @@ bool childrenAreAuthoritative(const ComparisonSide& side)
 {
 	if (!side.entry)
 		return side.absenceAuthoritative;
-	if (side.entry->attributes.kind != thin_io::entry_kind::directory)
+	if (side.tree().kind(*side.entry) != thin_io::entry_kind::directory)
 		return true;
-	return side.entry->traversalState == DirectoryTraversalState::completed
-		|| side.entry->traversalState == DirectoryTraversalState::link_boundary
-		|| side.entry->traversalState == DirectoryTraversalState::mount_boundary;
+	const DirectoryTraversalState traversalState = side.tree().traversalState(*side.entry);
+	return traversalState == DirectoryTraversalState::completed
+		|| traversalState == DirectoryTraversalState::link_boundary
+		|| traversalState == DirectoryTraversalState::mount_boundary;
 }
 
-bool allocationOverflowed(const ComparisonSide& side, const NativePath& path)
+bool localCoverageIncomplete(const ComparisonSide& side)
 {
-	return side.entry && side.accountingByPath->at(path).allocationOverflow;
+	return side.entry && !side.tree().localCoverageComplete(*side.entry);
+}
+
+// A regular file missing from a directory whose files were folded may only have been counted there.
+bool foldedAway(const ComparisonSide& side, const std::optional<SnapshotTree::Index> child,
+	const ComparisonSide& otherSide, const std::optional<SnapshotTree::Index> otherChild)
+{
+	if (child || !side.entry || !side.tree().foldedFiles(*side.entry))
+		return false;
+	const thin_io::entry_attributes otherAttributes = otherSide.tree().attributes(*otherChild);
+	return otherAttributes.kind == thin_io::entry_kind::regular_file && !otherAttributes.is_link;
+}
+
+bool allocationOverflowed(const ComparisonSide& side)
+{
+	return side.entry && side.accounting->entries[*side.entry].allocationOverflow;
 }
 
 ComparisonExcludedRegion excludedRegion(const NativePath& path, const ComparisonSide& baseline, const ComparisonSide& current)
 {
 	const bool baselineChildrenAuthoritative = childrenAreAuthoritative(baseline);
 	const bool currentChildrenAuthoritative = childrenAreAuthoritative(current);
-	const std::optional<uint64_t> baselineLocalSize = localAllocatedSize(baseline, path);
-	const std::optional<uint64_t> currentLocalSize = localAllocatedSize(current, path);
+	const std::optional<uint64_t> baselineLocalSize = localAllocatedSize(baseline);
+	const std::optional<uint64_t> currentLocalSize = localAllocatedSize(current);
 
 	ComparisonExcludedRegion region;
 	region.path = path;
 	region.baselineCoverageIncomplete = !baselineChildrenAuthoritative
 		|| (!baseline.entry && !baseline.absenceAuthoritative)
-		|| (baseline.entry && !baseline.entry->derived.localCoverageComplete);
+		|| localCoverageIncomplete(baseline);
 	region.currentCoverageIncomplete = !currentChildrenAuthoritative
 		|| (!current.entry && !current.absenceAuthoritative)
-		|| (current.entry && !current.entry->derived.localCoverageComplete);
-	region.baselineAccountingUncertain = allocationOverflowed(baseline, path)
+		|| localCoverageIncomplete(current);
+	region.baselineAccountingUncertain = allocationOverflowed(baseline)
 		|| (!baselineLocalSize && !region.baselineCoverageIncomplete);
-	region.currentAccountingUncertain = allocationOverflowed(current, path)
+	region.currentAccountingUncertain = allocationOverflowed(current)
 		|| (!currentLocalSize && !region.currentCoverageIncomplete);
+	region.baselineExcludedByRule = excludedByRule(baseline);
+	region.currentExcludedByRule = excludedByRule(current);
 	return region;
 }
 
 void compareEntries(const ComparisonSide& baseline, const ComparisonSide& current, const NativePath& path,
 	const uint64_t threshold, SnapshotComparisonResult& result)
 {
-	const std::optional<uint64_t> baselineSubtreeSize = subtreeAllocatedSize(baseline, path);
-	const std::optional<uint64_t> currentSubtreeSize = subtreeAllocatedSize(current, path);
+	const std::optional<uint64_t> baselineSubtreeSize = subtreeAllocatedSize(baseline);
+	const std::optional<uint64_t> currentSubtreeSize = subtreeAllocatedSize(current);
 	const bool baselineChildrenAuthoritative = childrenAreAuthoritative(baseline);
 	const bool currentChildrenAuthoritative = childrenAreAuthoritative(current);
 
-	const bool localOrChildSetIsUnknown = !localAllocatedSize(baseline, path)
-		|| !localAllocatedSize(current, path)
+	const bool localOrChildSetIsUnknown = !localAllocatedSize(baseline)
+		|| !localAllocatedSize(current)
 		|| !baselineChildrenAuthoritative
 		|| !currentChildrenAuthoritative
-		|| allocationOverflowed(baseline, path)
-		|| allocationOverflowed(current, path);
+		|| localCoverageIncomplete(baseline)
+		|| localCoverageIncomplete(current)
+		|| allocationOverflowed(baseline)
+		|| allocationOverflowed(current);
 	if ((!baselineSubtreeSize || !currentSubtreeSize) && localOrChildSetIsUnknown)
 		result.excludedRegions.push_back(excludedRegion(path, baseline, current));
 
 	const size_t changesBeforeChildren = result.changes.size();
-	auto compareChild = [&](const NativeName& name, const SnapshotEntry* baselineChild, const SnapshotEntry* currentChild)
+	auto compareChild = [&](const NativeNameView name, const std::optional<SnapshotTree::Index> baselineChild,
+		const std::optional<SnapshotTree::Index> currentChild)
 	{
 		if ((!baselineChild && !baselineChildrenAuthoritative) || (!currentChild && !currentChildrenAuthoritative))
 			return;
+		// Compared at directory resolution instead, as part of the directory's own space.
+		if (foldedAway(baseline, baselineChild, current, currentChild) || foldedAway(current, currentChild, baseline, baselineChild))
+			return;
 
+		// A child missing where the rules skip it was not looked at, so its absence does not mean that it was deleted.
+		const auto skipped = [&path, name](const ComparisonSide& side, const std::optional<SnapshotTree::Index> child) {
+			return !child && !side.exclusions->empty()
+				&& side.exclusions->match(path, name) == SnapshotExclusionAction::skip;
+		};
+		const bool baselineSkipped = skipped(baseline, baselineChild);
+		const bool currentSkipped = skipped(current, currentChild);
 		const NativePath childPath = appendNativeName(path, name);
 		compareEntries(
-			{baselineChild, !baselineChild && baselineChildrenAuthoritative, baseline.accountingByPath},
-			{currentChild, !currentChild && currentChildrenAuthoritative, current.accountingByPath},
+			{baseline.accounting, baselineChild, !baselineChild && baselineChildrenAuthoritative && !baselineSkipped,
+				baseline.exclusions, baselineSkipped},
+			{current.accounting, currentChild, !currentChild && currentChildrenAuthoritative && !currentSkipped,
+				current.exclusions, currentSkipped},
 			childPath, threshold, result);
 	};
 
-	using Children = decltype(SnapshotEntry::children);
-	static const Children noChildren;
-	const Children& baselineChildren = baseline.entry ? baseline.entry->children : noChildren;
-	const Children& currentChildren = current.entry ? current.entry->children : noChildren;
+	const SnapshotTree::Children noChildren{};
+	const SnapshotTree::Children baselineChildren = baseline.entry ? baseline.tree().children(*baseline.entry) : noChildren;
+	const SnapshotTree::Children currentChildren = current.entry ? current.tree().children(*current.entry) : noChildren;
 	auto baselineChild = baselineChildren.begin();
-	const auto baselineChildrenEnd = baselineChildren.end();
 	auto currentChild = currentChildren.begin();
-	const auto currentChildrenEnd = currentChildren.end();
-	while (baselineChild != baselineChildrenEnd || currentChild != currentChildrenEnd)
+	while (baselineChild != baselineChildren.end() || currentChild != currentChildren.end())
 	{
-		if (currentChild == currentChildrenEnd
-			|| (baselineChild != baselineChildrenEnd && baselineChildren.key_comp()(baselineChild.key(), currentChild.key())))
+		const NativeNameView baselineName = baselineChild != baselineChildren.end() ? baseline.tree().name(*baselineChild) : NativeNameView{};
+		const NativeNameView currentName = currentChild != currentChildren.end() ? current.tree().name(*currentChild) : NativeNameView{};
+		if (currentChild == currentChildren.end()
+			|| (baselineChild != baselineChildren.end() && nativeNameLess(baselineName, currentName)))
 		{
-			compareChild(baselineChild.key(), &baselineChild.value(), nullptr);
+			compareChild(baselineName, *baselineChild, {});
 			++baselineChild;
 		}
-		else if (baselineChild == baselineChildrenEnd || currentChildren.key_comp()(currentChild.key(), baselineChild.key()))
+		else if (baselineChild == baselineChildren.end() || nativeNameLess(currentName, baselineName))
 		{
-			compareChild(currentChild.key(), nullptr, &currentChild.value());
+			compareChild(currentName, {}, *currentChild);
 			++currentChild;
 		}
 		else
 		{
-			compareChild(baselineChild.key(), &baselineChild.value(), &currentChild.value());
+			compareChild(baselineName, *baselineChild, *currentChild);
 			++baselineChild;
 			++currentChild;
 		}
@@ -356,8 +419,8 @@ void compareEntries(const ComparisonSide& baseline, const ComparisonSide& curren
 		change.baselineSubtreeAllocatedSize = *baselineSubtreeSize;
 		change.currentSubtreeAllocatedSize = *currentSubtreeSize;
 		change.allocatedIncrease = allocatedIncrease;
-		change.currentEntryKind = current.entry->attributes.kind;
-		change.baselineEntryExists = baseline.entry != nullptr;
+		change.currentEntryKind = current.tree().kind(*current.entry);
+		change.baselineEntryExists = baseline.entry.has_value();
 		result.changes.push_back(std::move(change));
 	}
 }
@@ -389,8 +452,8 @@ std::expected<SnapshotComparisonResult, SnapshotComparisonError> compareSnapshot
 		result.warnings.push_back(SnapshotComparisonWarning::filesystem_identity_unavailable);
 	}
 
-	const std::optional<thin_io::entry_identity>& baselineRootIdentity = baseline.root.metadata->identity;
-	const std::optional<thin_io::entry_identity>& currentRootIdentity = current.root.metadata->identity;
+	const std::optional<thin_io::entry_identity> baselineRootIdentity = baseline.tree.metadata(SnapshotTree::RootIndex)->identity;
+	const std::optional<thin_io::entry_identity> currentRootIdentity = current.tree.metadata(SnapshotTree::RootIndex)->identity;
 	if (baselineRootIdentity && currentRootIdentity)
 	{
 		if (*baselineRootIdentity != *currentRootIdentity)
@@ -403,8 +466,8 @@ std::expected<SnapshotComparisonResult, SnapshotComparisonError> compareSnapshot
 
 	auto [baselineAccounting, currentAccounting] = buildComparisonAccounting(baseline, current);
 	deriveSpaceSummary(baseline, current, result.summary);
-	const std::optional<uint64_t> baselineAllocatedSize = baselineAccounting.at(baseline.rootPath).subtreeAllocatedSize;
-	const std::optional<uint64_t> currentAllocatedSize = currentAccounting.at(current.rootPath).subtreeAllocatedSize;
+	const std::optional<uint64_t> baselineAllocatedSize = baselineAccounting.entries[SnapshotTree::RootIndex].subtreeAllocatedSize;
+	const std::optional<uint64_t> currentAllocatedSize = currentAccounting.entries[SnapshotTree::RootIndex].subtreeAllocatedSize;
 	if (baselineAllocatedSize && currentAllocatedSize)
 		result.summary.allocatedTreeChange = magnitudeChange(*baselineAllocatedSize, *currentAllocatedSize);
 
@@ -424,9 +487,11 @@ std::expected<SnapshotComparisonResult, SnapshotComparisonError> compareSnapshot
 		}
 	}
 
+	const ScanExclusions baselineExclusions{baseline.rootPath, baseline.exclusionRules};
+	const ScanExclusions currentExclusions{current.rootPath, current.exclusionRules};
 	compareEntries(
-		{&baseline.root, false, &baselineAccounting},
-		{&current.root, false, &currentAccounting},
+		{&baselineAccounting, SnapshotTree::RootIndex, false, &baselineExclusions},
+		{&currentAccounting, SnapshotTree::RootIndex, false, &currentExclusions},
 		baseline.rootPath, allocatedIncreaseThreshold, result);
 	return result;
 }
@@ -73,6 +73,9 @@ struct ComparisonExcludedRegion
 	bool baselineAccountingUncertain = false;
 	bool currentCoverageIncomplete = false;
 	bool currentAccountingUncertain = false;
+	// The snapshot's exclusion rules left the region out, as opposed to a failure or a deletion.
+	bool baselineExcludedByRule = false;
+	bool currentExcludedByRule = false;
 
 	[[nodiscard]] bool operator==(const ComparisonExcludedRegion&) const = default;
 };
@@ -0,0 +1,30 @@
+#include "snapshot_name_pool.h"
+
+#include <algorithm>
+
+SnapshotNamePool::SnapshotNamePool(const std::size_t shardCount)
+	: m_shardCount{std::max<std::size_t>(shardCount, 1)}, m_shards{std::make_unique<Shard[]>(m_shardCount)}
+{
+}
+
+NativeName SnapshotNamePool::intern(const NativeNameView name)
+{
+	// Both halves of the hash pick the shard, whatever the width of std::size_t.
+	const std::size_t hash = NativeNameHash{}(name);
+	Shard& shard = m_shards[(hash ^ (hash >> (sizeof(std::size_t) * 4))) % m_shardCount];
+	std::lock_guard lock{shard.mutex};
+	if (const auto pooled = shard.names.find(name); pooled != shard.names.end())
+		return *pooled;
+	return *shard.names.insert(nativeNameFromView(name)).first;
+}
+
+std::size_t SnapshotNamePool::size() const
+{
+	std::size_t names = 0;
+	for (std::size_t i = 0; i < m_shardCount; ++i)
+	{
+		std::lock_guard lock{m_shards[i].mutex};
+		names += m_shards[i].names.size();
+	}
+	return names;
+}
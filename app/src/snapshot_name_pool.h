@@ -0,0 +1,34 @@
+#pragma once
+
+#include "native_path.h"
+
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+
+// Hands out one shared copy of every distinct entry name, so that the thousands of entries named index, .git or
+// node_modules in a tree refer to one buffer rather than holding a buffer each. Names are hashed over independently
+// locked shards; participants interning different names rarely contend.
+class SnapshotNamePool
+{
+public:
+	explicit SnapshotNamePool(std::size_t shardCount = 64);
+
+	SnapshotNamePool(const SnapshotNamePool&) = delete;
+	SnapshotNamePool& operator=(const SnapshotNamePool&) = delete;
+
+	// A copy of the pooled name equal to name, sharing its characters; only a name seen for the first time is allocated.
+	[[nodiscard]] NativeName intern(NativeNameView name);
+	// The distinct names interned so far.
+	[[nodiscard]] std::size_t size() const;
+
+private:
+	struct alignas(64) Shard
+	{
+		mutable std::mutex mutex;
+		std::unordered_set<NativeName, NativeNameHash, NativeNameEqual> names;
+	};
+
+	const std::size_t m_shardCount;
+	const std::unique_ptr<Shard[]> m_shards;
+};
@@ -1,9 +1,19 @@
 #include "snapshot_scan_runner.h"
 
+#include "linked_snapshot_scanner.h"
+#include "scan_journal.h"
+#include "scan_trace.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
 #include <algorithm>
 #include <assert.h>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 #include <utility>
 
@@ -12,11 +22,31 @@ namespace {
 constexpr std::chrono::milliseconds ProgressPublicationInterval{100};
 constexpr uint64_t ScanJobTag = 1;
 
-uint32_t scanParticipantCount() noexcept
+// Local disks saturate with a few outstanding requests while network filesystems keep gaining far beyond the core count,
+// so the pool is sized for the latter and the scanner adapts how many of its workers take part.
+constexpr uint32_t MaximumScanParticipants = 64;
+
+// Long enough for one listing of a huge directory on a slow network server; a call still running after it is taken to be
+// stuck on a server that stopped answering.
+constexpr std::chrono::minutes ScanCallDeadline{2};
+
+uint32_t initialScanParticipantCount() noexcept
 {
 	return std::clamp(std::thread::hardware_concurrency(), 1u, 8u);
 }
 
+SnapshotScanResult scanAllMounts(const NativePath& rootPath, const std::atomic_bool& canceled, CWorkerThreadPool& pool,
+	SnapshotScanProgressChannel& progress, const SnapshotScanOptions& options)
+{
+	LinkedSnapshotScanResult linked = scanLinkedSnapshots(rootPath, mountsUnder(readMountTable(), rootPath), canceled, pool,
+		&progress, options);
+	if (auto* snapshots = std::get_if<LinkedSnapshots>(&linked))
+		return mergeLinkedSnapshots(std::move(*snapshots), &pool);
+	if (auto* failure = std::get_if<SnapshotScanFailure>(&linked))
+		return std::move(*failure);
+	return SnapshotScanCanceled{};
+}
+
 int nextProgressQueueTag()
 {
 	static std::atomic_int nextTag{-2};
@@ -28,88 +58,194 @@ int nextProgressQueueTag()
 struct SnapshotScanRunner::RequestState
 {
 	std::atomic_bool canceled = false;
+	// Progress is coalesced per scan, so a busy scan cannot displace the progress of another.
+	const int progressQueueTag = nextProgressQueueTag();
 };
 
 SnapshotScanRunner::SnapshotScanRunner(CExecutionQueue& publicationQueue, SnapshotScanRunnerCallbacks callbacks)
 	: m_publicationQueue{publicationQueue},
 	  m_callbacks{std::move(callbacks)},
-	  m_progressQueueTag{nextProgressQueueTag()},
-	  m_scanPool{scanParticipantCount(), "SpaceGuard snapshot scan"}
+	  m_participantShare{MaximumScanParticipants},
+	  m_scanPool{MaximumScanParticipants, "SpaceGuard snapshot scan"}
 {
 	assert(m_callbacks.completed);
 }
 
 SnapshotScanRunner::~SnapshotScanRunner()
 {
-	(void)cancel();
+	cancelAll();
 	m_scanPool.retire(ScanJobTag);
 }
 
-std::optional<uint64_t> SnapshotScanRunner::start(const NativePath& normalizedRootPath)
+std::optional<uint64_t> SnapshotScanRunner::start(const NativePath& normalizedRootPath, const SnapshotScanScope scope,
+	const SnapshotScanThrottle& throttle, std::shared_ptr<const Snapshot> baseline)
+{
+	return startScan(normalizedRootPath, scope, throttle, std::move(baseline), false);
+}
+
+std::optional<uint64_t> SnapshotScanRunner::resume(const NativePath& normalizedRootPath, const SnapshotScanThrottle& throttle,
+	std::shared_ptr<const Snapshot> baseline)
+{
+	return startScan(normalizedRootPath, SnapshotScanScope::single_filesystem, throttle, std::move(baseline), true);
+}
+
+bool SnapshotScanRunner::hasResumableScan(const NativePath& normalizedRootPath) const
+{
+	std::lock_guard lock{m_stateMutex};
+	const QString path = journalPath(normalizedRootPath);
+	return !path.isEmpty() && !m_journalPathsInUse.contains(path) && QFile::exists(path);
+}
+
+std::optional<uint64_t> SnapshotScanRunner::startScan(const NativePath& normalizedRootPath, const SnapshotScanScope scope,
+	const SnapshotScanThrottle& throttle, std::shared_ptr<const Snapshot> baseline, const bool resumeJournal)
 {
 	std::lock_guard lock{m_stateMutex};
-	if (m_scanInProgress)
+	if (m_activeRequests.size() >= MaximumConcurrentScans)
 		return {};
 
+	// Scans of all mounts are not journaled; neither is a second scan of a root whose journal is in use.
+	QString scanJournalPath = scope == SnapshotScanScope::single_filesystem ? journalPath(normalizedRootPath) : QString{};
+	if (m_journalPathsInUse.contains(scanJournalPath))
+		scanJournalPath.clear();
 	const uint64_t generation = ++m_lastGeneration;
 	auto request = std::make_shared<RequestState>();
-	m_scanInProgress = true;
-	m_activeRequest = request;
+	m_activeRequests.emplace(generation, request);
+	if (!scanJournalPath.isEmpty())
+		m_journalPathsInUse.insert(scanJournalPath);
+	updateParticipantShare();
 	try
 	{
-		m_scanPool.enqueue([this, rootPath{normalizedRootPath}, generation, request{std::move(request)}]() mutable {
-			runScan(std::move(rootPath), generation, request);
+		m_scanPool.enqueue([this, rootPath{normalizedRootPath}, scope, throttle, baseline{std::move(baseline)}, generation,
+			request{std::move(request)}, traceDirectory{m_traceDirectory}, scanJournalPath, resumeJournal]() mutable {
+			runScan(std::move(rootPath), scope, throttle, baseline, generation, request, traceDirectory, scanJournalPath,
+				resumeJournal);
 		}, ScanJobTag);
 	}
 	catch (...)
 	{
-		m_scanInProgress = false;
-		m_activeRequest.reset();
+		m_activeRequests.erase(generation);
+		m_journalPathsInUse.erase(scanJournalPath);
+		updateParticipantShare();
 		throw;
 	}
 	return generation;
 }
 
-bool SnapshotScanRunner::cancel()
+bool SnapshotScanRunner::cancel(const uint64_t generation)
 {
 	std::lock_guard lock{m_stateMutex};
-	if (!m_scanInProgress)
+	const auto request = m_activeRequests.find(generation);
+	if (request == m_activeRequests.end())
 		return false;
 
-	assert(m_activeRequest);
-	m_activeRequest->canceled.store(true, std::memory_order_relaxed);
+	request->second->canceled.store(true, std::memory_order_relaxed);
 	return true;
 }
 
+void SnapshotScanRunner::cancelAll()
+{
+	std::lock_guard lock{m_stateMutex};
+	for (const auto& [generation, request] : m_activeRequests)
+		request->canceled.store(true, std::memory_order_relaxed);
+}
+
 bool SnapshotScanRunner::scanInProgress() const
 {
 	std::lock_guard lock{m_stateMutex};
-	return m_scanInProgress;
+	return !m_activeRequests.empty();
+}
+
+bool SnapshotScanRunner::scanInProgress(const uint64_t generation) const
+{
+	std::lock_guard lock{m_stateMutex};
+	return m_activeRequests.contains(generation);
+}
+
+std::expected<Snapshot, SnapshotLoadError> SnapshotScanRunner::loadSnapshot(const QString& path)
+{
+	return Snapshot::load(path, &m_scanPool);
+}
+
+void SnapshotScanRunner::setTraceDirectory(const QString& directory)
+{
+	std::lock_guard lock{m_stateMutex};
+	m_traceDirectory = directory;
+}
+
+void SnapshotScanRunner::setJournalDirectory(const QString& directory)
+{
+	std::lock_guard lock{m_stateMutex};
+	m_journalDirectory = directory;
+}
+
+QString SnapshotScanRunner::journalPath(const NativePath& rootPath) const
+{
+	return m_journalDirectory.isEmpty() ? QString{} : QDir{m_journalDirectory}.filePath(scanJournalFileName(rootPath));
 }
 
-void SnapshotScanRunner::runScan(
-	NativePath rootPath, const uint64_t generation, const std::shared_ptr<RequestState>& request)
+void SnapshotScanRunner::runScan(NativePath rootPath, const SnapshotScanScope scope, const SnapshotScanThrottle& throttle,
+	const std::shared_ptr<const Snapshot>& baseline, const uint64_t generation, const std::shared_ptr<RequestState>& request,
+	const QString& traceDirectory, const QString& journalPath, const bool resumeJournal)
 {
-	SnapshotScanProgress latestProgress;
+	// Participants only bump their own counters; this thread samples them on the publication interval.
+	SnapshotScanProgressChannel progress{m_scanPool.maxWorkersCount()};
+	// Only used by the sampler, then by this thread once the sampler has been joined.
+	SnapshotScanRateEstimator rateEstimator;
 	std::optional<SnapshotScanProgress> lastEnqueuedProgress;
-	std::mutex progressMutex;
-	auto lastProgressPublication = std::chrono::steady_clock::now() - ProgressPublicationInterval;
-	const auto reportProgress = [this, generation, &latestProgress, &lastEnqueuedProgress, &progressMutex, &lastProgressPublication](
-		const SnapshotScanProgress& progress) {
-		std::lock_guard lock{progressMutex};
-		latestProgress = progress;
-		const auto now = std::chrono::steady_clock::now();
-		if (now - lastProgressPublication < ProgressPublicationInterval)
+	const auto publishProgress = [this, generation, &request, &progress, &rateEstimator, &lastEnqueuedProgress] {
+		SnapshotScanProgress sample = progress.sample();
+		rateEstimator.update(sample, std::chrono::steady_clock::now());
+		if (lastEnqueuedProgress && *lastEnqueuedProgress == sample)
 			return;
-		enqueueProgress(generation, progress);
-		lastEnqueuedProgress = progress;
-		lastProgressPublication = now;
+		enqueueProgress(generation, request->progressQueueTag, sample);
+		lastEnqueuedProgress = sample;
 	};
 
+	std::mutex samplerMutex;
+	std::condition_variable samplerWakeup;
+	bool scanFinished = false;
+	std::thread sampler;
+	try
+	{
+		sampler = std::thread{[&] {
+			std::unique_lock lock{samplerMutex};
+			while (!samplerWakeup.wait_for(lock, ProgressPublicationInterval, [&scanFinished] { return scanFinished; }))
+				publishProgress();
+		}};
+	}
+	catch (...)
+	{
+		// Without a sampler only the final progress is published.
+	}
+
+	std::unique_ptr<ScanTrace> trace;
+	std::unique_ptr<ScanJournal> journal;
 	SnapshotScanResult result = SnapshotScanCanceled{};
 	try
 	{
-		result = scanSnapshot(rootPath, request->canceled, m_scanPool, reportProgress);
+		if (!traceDirectory.isEmpty())
+			trace = std::make_unique<ScanTrace>();
+		if (!journalPath.isEmpty() && QDir{}.mkpath(QFileInfo{journalPath}.path()))
+		{
+			// Like the trace, the journal is not needed for the scan: one that cannot be opened is done without.
+			auto opened = resumeJournal ? ScanJournal::resume(journalPath) : ScanJournal::create(journalPath);
+			if (opened)
+				journal = std::move(*opened);
+		}
+
+		SnapshotScanOptions options;
+		options.concurrency.adaptive = true;
+		options.concurrency.initialParticipants = initialScanParticipantCount();
+		options.throttle = throttle;
+		options.participantShare = &m_participantShare;
+		options.baseline = baseline.get();
+		options.trace = trace.get();
+		options.callDeadline = ScanCallDeadline;
+		options.journal = journal.get();
+		if (scope == SnapshotScanScope::all_mounts)
+			result = scanAllMounts(rootPath, request->canceled, m_scanPool, progress, options);
+		else
+			result = scanSnapshot(rootPath, request->canceled, m_scanPool, &progress, options);
 	}
 	catch (...)
 	{
@@ -117,26 +253,57 @@ void SnapshotScanRunner::runScan(
 	}
 
 	{
-		std::lock_guard lock{progressMutex};
-		if (!lastEnqueuedProgress || *lastEnqueuedProgress != latestProgress)
-			enqueueProgress(generation, latestProgress);
+		std::lock_guard lock{samplerMutex};
+		scanFinished = true;
+	}
+	samplerWakeup.notify_one();
+	if (sampler.joinable())
+		sampler.join();
+	publishProgress();
+
+	if (trace)
+	{
+		try
+		{
+			// A diagnostic: the scan result does not depend on whether its trace could be written.
+			(void)trace->writeChromeTrace(
+				QDir{traceDirectory}.filePath(QString{"spaceguard-scan-%1.json"}.arg(static_cast<qulonglong>(generation))));
+		}
+		catch (...)
+		{
+		}
+	}
+
+	if (journal)
+	{
+		try
+		{
+			journal.reset();
+			// Only a canceled scan leaves its journal behind to be resumed.
+			if (!std::holds_alternative<SnapshotScanCanceled>(result) && !request->canceled.load(std::memory_order_relaxed))
+				QFile::remove(journalPath);
+		}
+		catch (...)
+		{
+		}
 	}
 
 	std::lock_guard lock{m_stateMutex};
-	assert(m_scanInProgress && m_activeRequest == request);
+	assert(m_activeRequests.contains(generation) && m_activeRequests.at(generation) == request);
 	if (request->canceled.load(std::memory_order_relaxed))
 		result = SnapshotScanCanceled{};
+	m_journalPathsInUse.erase(journalPath);
 
 	auto publishedResult = std::make_shared<const SnapshotScanResult>(std::move(result));
 	const auto completed = m_callbacks.completed;
 	m_publicationQueue.enqueue([completed, generation, publishedResult{std::move(publishedResult)}] {
 		completed(generation, publishedResult);
 	});
-	m_activeRequest.reset();
-	m_scanInProgress = false;
+	m_activeRequests.erase(generation);
+	updateParticipantShare();
 }
 
-void SnapshotScanRunner::enqueueProgress(const uint64_t generation, const SnapshotScanProgress& progress)
+void SnapshotScanRunner::enqueueProgress(const uint64_t generation, const int progressQueueTag, const SnapshotScanProgress& progress)
 {
 	if (!m_callbacks.progress)
 		return;
@@ -144,5 +311,12 @@ void SnapshotScanRunner::enqueueProgress(const uint64_t generation, const Snapsh
 	const auto progressCallback = m_callbacks.progress;
 	m_publicationQueue.enqueue([progressCallback, generation, progress] {
 		progressCallback(generation, progress);
-	}, m_progressQueueTag);
+	}, progressQueueTag);
+}
+
+void SnapshotScanRunner::updateParticipantShare()
+{
+	// Each scan's own job thread counts towards its share.
+	const auto scans = static_cast<uint32_t>(std::max<std::size_t>(m_activeRequests.size(), 1));
+	m_participantShare.store(std::max(MaximumScanParticipants / scans, 1u), std::memory_order_relaxed);
 }
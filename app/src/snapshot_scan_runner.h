@@ -5,12 +5,23 @@
 #include "threading/cexecutionqueue.h"
 #include "threading/cworkerthread.h"
 
+#include <QString>
+
+#include <atomic>
 #include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <set>
 #include <stdint.h>
 
+enum class SnapshotScanScope : uint8_t {
+	single_filesystem,
+	// Filesystems mounted below the root are scanned too and grafted onto their mount points.
+	all_mounts
+};
+
 struct SnapshotScanRunnerCallbacks
 {
 	std::function<void(uint64_t generation, const SnapshotScanProgress& progress)> progress;
@@ -28,25 +39,64 @@ public:
 	SnapshotScanRunner(const SnapshotScanRunner&) = delete;
 	SnapshotScanRunner& operator=(const SnapshotScanRunner&) = delete;
 
-	[[nodiscard]] std::optional<uint64_t> start(const NativePath& normalizedRootPath);
-	[[nodiscard]] bool cancel();
+	// Scans run concurrently, sharing the worker pool evenly; returns nothing once MaximumConcurrentScans are running.
+	// A throttled scan trades speed for a lower impact on the latency of other workloads on the host. A baseline is kept
+	// until the scan ends and guides the order of traversal (SnapshotScanOptions::baseline).
+	[[nodiscard]] std::optional<uint64_t> start(const NativePath& normalizedRootPath,
+		SnapshotScanScope scope = SnapshotScanScope::single_filesystem, const SnapshotScanThrottle& throttle = {},
+		std::shared_ptr<const Snapshot> baseline = {});
+	// Starts a scan of a single filesystem that continues the journal an earlier scan of the root left behind, restoring
+	// the directories it completed; one that cannot be continued is scanned afresh, as by start().
+	[[nodiscard]] std::optional<uint64_t> resume(const NativePath& normalizedRootPath, const SnapshotScanThrottle& throttle = {},
+		std::shared_ptr<const Snapshot> baseline = {});
+	// Whether a scan of the root was canceled, or its process ended, with a journal left behind for resume().
+	[[nodiscard]] bool hasResumableScan(const NativePath& normalizedRootPath) const;
+	// Returns false if the scan has already completed.
+	[[nodiscard]] bool cancel(uint64_t generation);
+	void cancelAll();
 	[[nodiscard]] bool scanInProgress() const;
+	[[nodiscard]] bool scanInProgress(uint64_t generation) const;
+
+	// Snapshot::load() on the calling thread, which the scan pool's idle workers help derive the snapshot's data.
+	[[nodiscard]] std::expected<Snapshot, SnapshotLoadError> loadSnapshot(const QString& path);
+
+	// Scans started from now on write a Chrome trace of their participants' activity (ScanTrace) to
+	// spaceguard-scan-<generation>.json in this directory once they end; an empty path, the default, turns tracing off.
+	void setTraceDirectory(const QString& directory);
+	// Scans of a single filesystem started from now on journal their completed directories (ScanJournal) to
+	// scanJournalFileName() in this directory. The journal of a canceled scan is kept for resume(), any other is removed
+	// once its scan ends; an empty path, the default, turns journaling off.
+	void setJournalDirectory(const QString& directory);
+
+	static constexpr std::size_t MaximumConcurrentScans = 8;
 
 private:
 	struct RequestState;
 
-	void runScan(NativePath rootPath, uint64_t generation, const std::shared_ptr<RequestState>& request);
-	void enqueueProgress(uint64_t generation, const SnapshotScanProgress& progress);
+	[[nodiscard]] std::optional<uint64_t> startScan(const NativePath& normalizedRootPath, SnapshotScanScope scope,
+		const SnapshotScanThrottle& throttle, std::shared_ptr<const Snapshot> baseline, bool resumeJournal);
+	void runScan(NativePath rootPath, SnapshotScanScope scope, const SnapshotScanThrottle& throttle,
+		const std::shared_ptr<const Snapshot>& baseline, uint64_t generation, const std::shared_ptr<RequestState>& request,
+		const QString& traceDirectory, const QString& journalPath, bool resumeJournal);
+	// Requires m_stateMutex; empty when journaling is off.
+	[[nodiscard]] QString journalPath(const NativePath& rootPath) const;
+	void enqueueProgress(uint64_t generation, int progressQueueTag, const SnapshotScanProgress& progress);
+	// Requires m_stateMutex.
+	void updateParticipantShare();
 
 private:
 	CExecutionQueue& m_publicationQueue;
 	SnapshotScanRunnerCallbacks m_callbacks;
-	const int m_progressQueueTag;
 	mutable std::mutex m_stateMutex;
 	uint64_t m_lastGeneration = 0;
-	bool m_scanInProgress = false;
-	std::shared_ptr<RequestState> m_activeRequest;
-	// Keep last: the scan job and its nested parallelFor helpers access the runner state above. The destructor retires
-	// the scan job while the pool can still run those helpers; reverse destruction then joins the workers before other state is released.
+	std::map<uint64_t, std::shared_ptr<RequestState>> m_activeRequests; // By generation.
+	QString m_traceDirectory;
+	QString m_journalDirectory;
+	// Journals of running scans, which a concurrent scan of the same root must neither replace nor continue.
+	std::set<QString> m_journalPathsInUse;
+	// Participants each scan may keep active, so that concurrent scans divide the pool evenly.
+	std::atomic_uint32_t m_participantShare;
+	// Keep last: the scan jobs and their helper participants access the runner state above. The destructor retires
+	// the scan jobs while the pool can still run those helpers; reverse destruction then joins the workers before other state is released.
 	CWorkerThreadPool m_scanPool;
 };
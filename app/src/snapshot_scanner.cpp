@@ -1,4 +1,11 @@
 #include "snapshot_scanner.h"
+#include "hard_link_table.h"
+#include "scan_concurrency_controller.h"
+#include "scan_exclusions.h"
+#include "scan_journal.h"
+#include "scan_throttle.h"
+#include "scan_trace.h"
+#include "snapshot_name_pool.h"
 
 #ifdef SPACEGUARD_TEST_FILESYSTEM_ACCESS
 // The separate test executable recompiles this source against its callback-backed adapter.
@@ -14,14 +21,36 @@ using FilesystemAccess = TestFilesystemAccess;
 
 #include <algorithm>
 #include <assert.h>
+#include <chrono>
+#include <cmath>
 #include <condition_variable>
 #include <cstddef>
 #include <deque>
+#include <iterator>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace {
 
+// Reading a directory again for its file ids costs more than ordering saves on a few children, whose inodes mostly share
+// a block anyway.
+constexpr std::size_t MinimumFileIdOrderedChildren = 32;
+
+using ClockTicks = std::chrono::steady_clock::rep;
+// Values of a participant's watched call besides the start of a call in progress.
+constexpr ClockTicks NoCall = 0;
+constexpr ClockTicks CallAbandoned = -1;
+
+// Unwinds a participant whose native call the watchdog abandoned out of the scan.
+struct CallAbandonment
+{
+};
+
 SnapshotEntryMetadata snapshotMetadata(const thin_io::entry_metadata& metadata)
 {
 	// mount_id is meaningful only while traversing the current mount namespace and is deliberately not persisted.
@@ -34,29 +63,79 @@ SnapshotScanFailure scanFailure(const SnapshotScanFailureCode code, const Native
 	return {code, path, nativeErrorCode};
 }
 
+// Absolute paths are reconstructed from this chain only when one is needed: for diagnostics, and to reopen a directory
+// whose parent handle was not retained.
+struct DirectoryLocation
+{
+	std::shared_ptr<const DirectoryLocation> parent;
+	NativeName name; // The root location holds the root path instead.
+};
+
+NativePath locationPath(const DirectoryLocation& location)
+{
+	std::vector<const NativeName*> components;
+	const DirectoryLocation* current = &location;
+	for (; current->parent; current = current->parent.get())
+		components.push_back(&current->name);
+
+	NativePath path = current->name;
+	for (auto component = components.rbegin(); component != components.rend(); ++component)
+		path = appendNativeName(path, **component);
+	return path;
+}
+
+// Whether a listed entry is folded into its directory's counters when the directory is scanned at directory resolution.
+bool isFoldable(const thin_io::entry_attributes& attributes)
+{
+	return attributes.kind == thin_io::entry_kind::regular_file && !attributes.is_link;
+}
+
+void addFoldedFiles(SnapshotFoldedFiles& total, const SnapshotFoldedFiles& part) noexcept
+{
+	total.files += part.files;
+	total.logicalSize += part.logicalSize;
+	total.allocatedSize += part.allocatedSize;
+	total.hardLinkCandidates += part.hardLinkCandidates;
+	total.metadataUnavailable += part.metadataUnavailable;
+}
+
 void markMetadataUnavailable(SnapshotEntry& entry)
 {
 	if (entry.attributes.kind == thin_io::entry_kind::directory)
 		entry.traversalState = entry.attributes.is_link ? DirectoryTraversalState::link_boundary : DirectoryTraversalState::metadata_unavailable;
 }
 
-class Scanner
+class Scanner : public std::enable_shared_from_this<Scanner>
 {
 public:
-	Scanner(const std::atomic_bool& canceled, SnapshotScanProgressCallback progressCallback)
-		: m_canceled{canceled}, m_progressCallback{std::move(progressCallback)}
+	Scanner(const std::atomic_bool& canceled, SnapshotScanProgressChannel* const progress, const SnapshotScanOptions& options)
+		: m_canceled{canceled}, m_progress{progress}, m_options{options}
 	{
+		const SnapshotScanThrottle& throttle = m_options.throttle;
+		if (throttle.maximumOperationsPerSecond > 0 || throttle.ioPressureTarget > 0)
+			m_throttle.emplace(throttle.maximumOperationsPerSecond, throttle.ioPressureTarget);
 	}
 
 	SnapshotScanResult scan(const NativePath& rootPath)
 	{
-		return scanWithParticipants(rootPath, [this] { processDirectories(); });
+		prepareParticipants(1);
+		return scanWithParticipants(rootPath, [this] { processDirectories(0); });
 	}
 
+	// The scanner must be owned by a shared pointer, which its helper tasks share.
 	SnapshotScanResult scan(const NativePath& rootPath, CWorkerThreadPool& workerPool)
 	{
-		return scanWithParticipants(rootPath, [this, &workerPool] {
-			workerPool.parallelFor(workerPool.maxWorkersCount(), [this](const std::size_t) noexcept { processDirectories(); });
+		// The calling thread may be the only worker of the pool, which must then traverse.
+		m_watchCalls = m_options.callDeadline.count() > 0 && workerPool.maxWorkersCount() > 1;
+		prepareParticipants(workerPool.maxWorkersCount());
+		m_workerPool = &workerPool;
+		return scanWithParticipants(rootPath, [this] {
+			recruitParticipants();
+			if (m_watchCalls)
+				watchCalls();
+			else
+				processDirectories(0);
+			joinHelpers();
 		});
 	}
 
@@ -71,6 +150,9 @@ private:
 
 		m_snapshot.rootPath = rootPath;
 		m_snapshot.scanStartedAtUtc = QDateTime::currentDateTimeUtc();
+		m_snapshot.exclusionRules = m_options.exclusionRules;
+		m_exclusions.emplace(m_options.exclusionRootPath.isEmpty() ? rootPath : m_options.exclusionRootPath, m_options.exclusionRules);
+		indexBaseline(rootPath);
 
 		const auto rootMetadata = FilesystemAccess::getEntryMetadata(rootPath, thin_io::link_behavior::do_not_follow);
 		if (m_canceled.load(std::memory_order_relaxed))
@@ -98,6 +180,9 @@ private:
 		m_snapshot.filesystemSpaceAtStart = *startSpace;
 		if (!m_rootFilesystemIdentity)
 			m_rootFilesystemIdentity = startSpace->identity;
+		if (m_options.journal)
+			beginJournal(rootPath);
+		expectEntries(rootPath);
 
 		if (const auto rootFailure = scanDirectories(rootPath, std::forward<RunParticipants>(runParticipants)))
 			return *rootFailure;
@@ -109,7 +194,9 @@ private:
 			return SnapshotScanCanceled{};
 		if (!completionSpace)
 		{
-			recordDiagnostic(rootPath, SnapshotOperation::filesystem_space_at_completion, completionSpace.error().native_code);
+			// Traversal has ended, so the first participant's counters are free to take this.
+			m_snapshot.diagnostics.push_back({rootPath, SnapshotOperation::filesystem_space_at_completion, completionSpace.error().native_code});
+			reportProgress(0, {.issues = 1});
 		}
 		else
 		{
@@ -127,26 +214,150 @@ private:
 				return left.operation < right.operation;
 			return left.nativeErrorCode < right.nativeErrorCode;
 		});
-		m_snapshot.rebuildDerivedData();
+		m_snapshot.rebuildDerivedData(m_hardLinks.take(), m_workerPool);
 		return std::move(m_snapshot);
 	}
 
+	using DirectoryHandle = FilesystemAccess::DirectoryHandle;
+
+	struct DiscoveredDirectory
+	{
+		NativeName name;
+		SnapshotEntry* entry = nullptr; // Null for a file folded into its directory's counters.
+	};
+
+	// A directory's entries in listing order, less those the exclusion rules skip.
+	struct ListedEntries
+	{
+		std::vector<NativeName> names;
+		std::vector<thin_io::entry_attributes> attributes;
+		std::vector<uint64_t> fileIds; // Empty unless the listing reported one for every entry.
+		std::vector<NativeName> statOnlyDirectories;
+	};
+
+	// A listed directory whose child metadata is collected in chunks by whichever participants pick them up.
+	struct SplitDirectory
+	{
+		std::shared_ptr<const DirectoryLocation> location;
+		std::shared_ptr<const DirectoryHandle> handle;
+		// Null when the open-handle budget is exhausted; the subdirectories then reopen by path.
+		std::shared_ptr<const DirectoryHandle> handleForSubdirectories;
+		SnapshotEntry* entry = nullptr;
+		std::optional<SnapshotTree::Index> baseline;
+		// In metadata order; entry->children stays unchanged while the chunks run.
+		std::vector<DiscoveredDirectory> children;
+		std::atomic_size_t remainingChunks = 0;
+		bool foldFiles = false;
+		// Set by the watchdog when it abandons a chunk; read by the last chunk, which the remaining count orders after it.
+		bool stalled = false;
+		// Of the listing and the finished chunks, in steady clock ticks; recorded as the directory's cost by the last chunk.
+		std::atomic<std::chrono::steady_clock::rep> elapsed = 0;
+		std::mutex chunkMutex; // Guards what the finished chunks add below.
+		SnapshotFoldedFiles foldedFiles; // Summed over the finished chunks, stored by the last one.
+		ScanJournalRecord journalRecord; // Of the finished chunks, while the scan keeps a journal.
+	};
+
 	struct DirectoryWork
 	{
-		NativePath path;
+		std::shared_ptr<const DirectoryLocation> location;
+		// Children are opened relative to this while it is held; it is released as soon as the child's own handle is open.
+		std::shared_ptr<const DirectoryHandle> parentHandle;
 		SnapshotEntry* entry = nullptr;
 		bool isRoot = false;
+		// Set for a metadata chunk [chunkBegin, chunkEnd) of split->children instead of a directory to list.
+		std::shared_ptr<SplitDirectory> split;
+		std::size_t chunkBegin = 0;
+		std::size_t chunkEnd = 0;
+		std::optional<SnapshotTree::Index> baseline; // The same directory in the baseline tree, if it has one.
+	};
+
+	// Each participant pushes the directories it discovers onto its own queue and takes them back newest first, which keeps
+	// traversal depth-first and lock traffic local. An idle participant steals the oldest directory of another queue: being
+	// closest to the root, it usually carries the largest remaining subtree.
+	struct alignas(64) Participant
+	{
+		std::mutex mutex;
+		std::deque<DirectoryWork> directories;
+		// Only touched by the owning participant; merged into the snapshot once traversal ends.
+		std::vector<SnapshotDiagnostic> diagnostics;
+		SnapshotOperationTimings operationTimings;
+		// Both lists are bounded heaps with the cheapest directory kept at the front.
+		SnapshotDirectoryCostReport directoryCosts;
+		// Filesystem calls made by this participant, sampled by the concurrency controller.
+		std::atomic_uint64_t completedOperations = 0;
+		std::atomic_uint64_t operationLatencyNanoseconds = 0;
+		// Whether a pool worker is assigned to this slot, queued or running. The calling thread always holds slot 0. The slot
+		// of an abandoned call stays assigned to the worker blocked in it.
+		std::atomic_bool recruited = false;
+		// While calls are watched: the start of the native call in progress in steady clock ticks, NoCall between calls,
+		// and CallAbandoned for good once the watchdog has given up on a call.
+		std::atomic<ClockTicks> callStarted = NoCall;
+		// The directory being processed, which the watchdog completes when it abandons the call.
+		const DirectoryWork* work = nullptr;
+		// Held by the watchdog while it completes the directory of an abandoned call, which unwinding the participant
+		// destroys.
+		std::mutex abandonMutex;
+	};
+
+	// Helper tasks still queued in the pool when traversal ends return untouched.
+	struct HelperGate
+	{
+		std::mutex mutex;
+		std::condition_variable finished;
+		std::size_t running = 0;
+		bool closed = false;
 	};
 
+	void prepareParticipants(const std::size_t participantCount)
+	{
+		const auto poolSize = static_cast<uint32_t>(std::max<std::size_t>(participantCount, 1));
+		// The watchdog holds slot 0 without traversing.
+		m_participants = std::vector<Participant>(m_watchCalls ? poolSize + 1 : poolSize);
+		if (m_options.concurrency.adaptive && poolSize > 1)
+			m_controller.emplace(1, poolSize, m_options.concurrency.initialParticipants);
+		m_activeParticipants = m_controller ? m_controller->participants() : poolSize;
+		m_participants.front().recruited = true;
+		// Every participant holds the handle of the directory it is processing; only the remainder may be retained
+		// for queued subdirectories.
+		const std::size_t limit = m_options.maximumOpenDirectoryHandles;
+		m_retainedHandleLimit = limit > participantCount ? limit - participantCount : 0;
+	}
+
 	template<class RunParticipants>
 	std::optional<SnapshotScanFailure> scanDirectories(const NativePath& rootPath, RunParticipants&& runParticipants)
 	{
-		m_pendingDirectories.push_back({rootPath, &m_snapshot.root, true});
-		m_outstandingDirectories = 1;
+		auto rootLocation = std::make_shared<DirectoryLocation>();
+		rootLocation->name = rootPath;
+		std::vector<DirectoryWork> pending;
+		restoreDirectory(rootLocation, m_snapshot.root, m_baselineRoot, pending);
+		m_resumedDirectories.clear(); // Those not reached from the root.
+		std::ranges::move(pending, std::back_inserter(m_participants.front().directories));
+		m_outstandingDirectories = pending.size();
+		m_queuedDirectories = pending.size();
+		m_traversalStarted = std::chrono::steady_clock::now();
+		m_lastAdjustment = m_traversalStarted;
+		m_nextAdjustment = (m_traversalStarted + m_options.concurrency.adjustmentInterval).time_since_epoch().count();
+		m_snapshot.concurrencyHistory.push_back({0, m_activeParticipants.load()});
+		if (m_options.throttle.ioPressureTarget > 0)
+		{
+			m_lastStallTotal = ioPressureStallTotal();
+			m_pressureBackoff = m_lastStallTotal.has_value();
+			m_lastThrottleAdjustment = m_traversalStarted;
+			m_nextThrottleAdjustment = (m_traversalStarted + m_options.throttle.pressureInterval).time_since_epoch().count();
+		}
 		std::forward<RunParticipants>(runParticipants)();
+		if (m_options.journal)
+			m_options.journal->checkpoint();
 
-		assert(m_outstandingDirectories == 0);
-		assert(m_pendingDirectories.empty());
+		// Directories left behind by a stop hold retained handles, which must be released while the scanner is intact.
+		for (Participant& participant : m_participants)
+		{
+			participant.directories.clear();
+			std::ranges::move(participant.diagnostics, std::back_inserter(m_snapshot.diagnostics));
+			m_snapshot.operationTimings.add(participant.operationTimings);
+			m_snapshot.directoryCosts.add(participant.directoryCosts);
+		}
+		assert(m_stopping || m_canceled.load(std::memory_order_relaxed) || m_outstandingDirectories == 0);
 		if (m_canceled.load(std::memory_order_relaxed))
 			return {};
 		if (m_unexpectedError)
@@ -154,102 +365,1105 @@ private:
 		return std::move(m_fatalFailure);
 	}
 
-	void processDirectories() noexcept
+	[[nodiscard]] bool stopRequested() const noexcept
 	{
+		return m_canceled.load(std::memory_order_relaxed) || m_stopping.load();
+	}
+
+	// Returns false once the watchdog has abandoned a call of the participant, which is then no longer part of the scan.
+	bool processDirectories(const std::size_t participant) noexcept
+	{
+		const ScopedBackgroundIoPriority ioPriority{m_options.throttle.lowerIoPriority};
+		auto waitStarted = std::chrono::steady_clock::now();
+		while (std::optional<DirectoryWork> directory = takeDirectory(participant))
+		{
+			recordLatency(participant, SnapshotTimedOperation::queue_wait, waitStarted);
+			m_participants[participant].work = &*directory;
+			std::vector<DirectoryWork> discoveredDirectories;
+			std::optional<SnapshotScanFailure> failure;
+			bool unexpectedError = false;
+			try
+			{
+				failure = scanDirectory(participant, *directory, discoveredDirectories);
+			}
+			catch (const CallAbandonment&)
+			{
+				return false; // The watchdog has completed the directory on this participant's behalf.
+			}
+			catch (...)
+			{
+				unexpectedError = true;
+			}
+			directory.reset();
+			finishDirectory(participant, std::move(discoveredDirectories), std::move(failure), unexpectedError);
+			if (m_controller)
+				adjustConcurrency();
+			if (m_pressureBackoff)
+				adjustThrottle();
+			const std::size_t limit = activeLimit();
+			if (m_recruitedParticipants.load() < limit)
+				recruitParticipants();
+			else if (m_recruitedParticipants.load() > limit)
+				wakeParticipants(m_participants.size()); // Idle participants beyond the limit return their workers.
+			waitStarted = std::chrono::steady_clock::now();
+		}
+		return true;
+	}
+
+	// Participants are limited by the concurrency controller and by the share of the worker pool granted to this scan.
+	[[nodiscard]] std::size_t activeLimit() const noexcept
+	{
+		std::size_t limit = m_activeParticipants.load();
+		if (m_options.participantShare)
+			limit = std::min<std::size_t>(limit, std::max(m_options.participantShare->load(std::memory_order_relaxed), 1u));
+		// The limits count traversing participants, which the watchdog's slot is not.
+		return m_watchCalls ? limit + 1 : limit;
+	}
+
+	// Assigns pool workers to the participant slots below the active limit that have none. A participant beyond the limit
+	// returns its worker to the pool once it runs out of work, so that other scans sharing the pool can use it.
+	void recruitParticipants() noexcept
+	{
+		if (!m_workerPool)
+			return;
+		std::unique_lock lock{m_recruitMutex, std::try_to_lock};
+		if (!lock)
+			return;
+
+		const std::size_t limit = activeLimit();
+		for (std::size_t participant = 1; participant < limit && m_recruitedParticipants.load() < limit; ++participant)
+		{
+			Participant& slot = m_participants[participant];
+			if (slot.recruited.exchange(true))
+				continue;
+			m_recruitedParticipants.fetch_add(1);
+			try
+			{
+				m_workerPool->enqueue([scanner{shared_from_this()}, participant] { scanner->runHelper(participant); });
+			}
+			catch (...)
+			{
+				// The scan continues with the participants it has.
+				slot.recruited = false;
+				m_recruitedParticipants.fetch_sub(1);
+				return;
+			}
+		}
+	}
+
+	void runHelper(const std::size_t participant) noexcept
+	{
+		{
+			std::lock_guard lock{m_helperGate.mutex};
+			if (m_helperGate.closed)
+				return;
+			++m_helperGate.running;
+		}
+		if (!processDirectories(participant))
+			return; // The watchdog has released this helper's place at the gate.
+		m_participants[participant].recruited = false;
+		m_recruitedParticipants.fetch_sub(1);
+		{
+			std::lock_guard lock{m_helperGate.mutex};
+			--m_helperGate.running;
+		}
+		m_helperGate.finished.notify_all();
+	}
+
+	// Once the calling thread's participation ends, no helper can find more work; waits for those already running.
+	void joinHelpers() noexcept
+	{
+		std::unique_lock lock{m_helperGate.mutex};
+		m_helperGate.finished.wait(lock, [this] { return m_helperGate.running == 0; });
+		m_helperGate.closed = true;
+	}
+
+	// Runs on the calling thread in place of its participation while calls are watched. Calls that outlive the deadline
+	// are abandoned with their directories; once the scan is canceled or stopping, every call in progress is, so that the
+	// scan returns without waiting for any of them.
+	void watchCalls() noexcept
+	{
+		const auto deadline = std::chrono::duration_cast<std::chrono::steady_clock::duration>(m_options.callDeadline);
+		const auto interval = std::clamp<std::chrono::steady_clock::duration>(
+			deadline / 4, std::chrono::milliseconds{1}, std::chrono::milliseconds{100});
 		for (;;)
 		{
-			DirectoryWork directory;
+			if (m_canceled.load(std::memory_order_relaxed) && !m_stopping.exchange(true))
+				wakeParticipants(m_participants.size());
+			if (m_stopping.load())
 			{
-				std::unique_lock lock{m_workMutex};
-				// An empty queue with outstanding work implies an active participant. Its completion notification
-				// wakes idle participants after the current native call, which is also the cancellation latency bound.
-				m_workChanged.wait(lock, [this] {
-					return m_canceled.load(std::memory_order_relaxed) || m_unexpectedError || m_fatalFailure
-						|| m_outstandingDirectories == 0 || !m_pendingDirectories.empty();
-				});
-				if (m_canceled.load(std::memory_order_relaxed))
+				for (std::size_t participant = 1; participant < m_participants.size(); ++participant)
 				{
-					discardPendingDirectoriesLocked();
-					m_workChanged.notify_all();
-					return;
+					if (const ClockTicks started = m_participants[participant].callStarted.load(); started > 0)
+						abandonCall(participant, started, false);
 				}
-				if (m_unexpectedError || m_fatalFailure || m_outstandingDirectories == 0)
+				// Helpers not blocked in a call leave after it; one may still start another, which the next round abandons.
+				std::unique_lock lock{m_helperGate.mutex};
+				if (m_helperGate.finished.wait_for(lock, interval, [this] { return m_helperGate.running == 0; }))
 					return;
+				continue;
+			}
+			if (m_outstandingDirectories.load() == 0)
+				return;
 
-				directory = std::move(m_pendingDirectories.front());
-				m_pendingDirectories.pop_front();
+			const ClockTicks expired = (std::chrono::steady_clock::now() - deadline).time_since_epoch().count();
+			for (std::size_t participant = 1; participant < m_participants.size(); ++participant)
+			{
+				if (const ClockTicks started = m_participants[participant].callStarted.load(); started > 0 && started <= expired)
+					abandonCall(participant, started, true);
 			}
+			std::unique_lock lock{m_watchdogMutex};
+			m_traversalEnded.wait_for(lock, interval, [this] { return m_stopping.load() || m_outstandingDirectories.load() == 0; });
+		}
+	}
 
-			std::vector<DirectoryWork> discoveredDirectories;
-			std::optional<SnapshotScanFailure> failure;
-			bool unexpectedError = false;
-			try
+	// Takes the participant out of the scan if the call it started at the given time is still in progress, completing its
+	// directory on its behalf when asked to. The participant's worker stays blocked in the call and leaves once it returns,
+	// without touching the scan again.
+	void abandonCall(const std::size_t participant, ClockTicks started, const bool completeWork) noexcept
+	{
+		Participant& blocked = m_participants[participant];
+		{
+			std::lock_guard lock{blocked.abandonMutex};
+			if (!blocked.callStarted.compare_exchange_strong(started, CallAbandoned))
+				return; // The call has returned meanwhile.
+			if (completeWork)
+				abandonDirectory(*blocked.work);
+		}
+		{
+			std::lock_guard lock{m_helperGate.mutex};
+			--m_helperGate.running;
+		}
+		m_helperGate.finished.notify_all();
+	}
+
+	// Completes the directory of an abandoned call as the watchdog's slot. Children whose metadata the participant had
+	// collected keep it, but none of the subdirectories it had found is traversed; an abandoned root fails the scan.
+	void abandonDirectory(const DirectoryWork& work) noexcept
+	{
+		SnapshotEntry& directory = work.split ? *work.split->entry : *work.entry;
+		const DirectoryLocation& location = work.split ? *work.split->location : *work.location;
+		std::optional<SnapshotScanFailure> failure;
+		bool unexpectedError = false;
+		try
+		{
+			if (&directory == &m_snapshot.root)
+				failure = scanFailure(SnapshotScanFailureCode::root_call_stalled, locationPath(location));
+			else if (work.split)
+			{
+				SplitDirectory& split = *work.split;
+				for (std::size_t i = work.chunkBegin; i < work.chunkEnd; ++i)
+				{
+					if (split.children[i].entry)
+						abandonChild(*split.children[i].entry);
+				}
+				// One diagnostic per directory, however many of its chunks stall.
+				if (!std::exchange(split.stalled, true))
+					recordDiagnostic(0, locationPath(location), SnapshotOperation::call_deadline_exceeded, {});
+				if (split.remainingChunks.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				{
+					directory.traversalState = DirectoryTraversalState::stalled;
+					completeDirectory(0);
+				}
+			}
+			else
 			{
-				failure = scanDirectory(directory, discoveredDirectories);
+				for (auto child = directory.children.begin(), end = directory.children.end(); child != end; ++child)
+					abandonChild(child.value());
+				directory.traversalState = DirectoryTraversalState::stalled;
+				recordDiagnostic(0, locationPath(location), SnapshotOperation::call_deadline_exceeded, {});
+				completeDirectory(0);
 			}
-			catch (...)
+		}
+		catch (...)
+		{
+			unexpectedError = true;
+		}
+		finishDirectory(0, {}, std::move(failure), unexpectedError);
+	}
+
+	static void abandonChild(SnapshotEntry& child) noexcept
+	{
+		if (child.attributes.kind != thin_io::entry_kind::directory || child.traversalState != DirectoryTraversalState::not_directory)
+			return;
+		if (child.metadata)
+			child.traversalState = DirectoryTraversalState::stalled;
+		else
+			markMetadataUnavailable(child);
+	}
+
+	// Makes a native call for the participant, published to the watchdog while calls are watched. Throws CallAbandonment
+	// when the call returns after the watchdog has given up on it.
+	template<class Call>
+	std::invoke_result_t<Call&> watchedCall(const std::size_t participant, Call&& call)
+	{
+		if (!m_watchCalls)
+			return call();
+
+		Participant& self = m_participants[participant];
+		const ClockTicks started = std::max<ClockTicks>(std::chrono::steady_clock::now().time_since_epoch().count(), 1);
+		self.callStarted.store(started);
+		const auto finishCall = [&self, started] {
+			ClockTicks expected = started;
+			if (self.callStarted.compare_exchange_strong(expected, NoCall))
+				return;
+			std::lock_guard lock{self.abandonMutex}; // Until the watchdog is done with this participant's directory.
+			throw CallAbandonment{};
+		};
+		try
+		{
+			if constexpr (std::is_void_v<std::invoke_result_t<Call&>>)
 			{
-				unexpectedError = true;
+				call();
+				finishCall();
 			}
-			finishDirectory(std::move(discoveredDirectories), std::move(failure), unexpectedError);
+			else
+			{
+				auto result = call();
+				finishCall();
+				return result;
+			}
+		}
+		catch (const CallAbandonment&)
+		{
+			throw;
+		}
+		catch (...)
+		{
+			finishCall();
+			throw;
+		}
+	}
+
+	// Runs on whichever participant first notices that the adjustment interval has elapsed; the others move on.
+	void adjustConcurrency() noexcept
+	{
+		const auto now = std::chrono::steady_clock::now();
+		if (now.time_since_epoch().count() < m_nextAdjustment.load(std::memory_order_relaxed))
+			return;
+		std::unique_lock lock{m_controllerMutex, std::try_to_lock};
+		if (!lock || now < m_lastAdjustment + m_options.concurrency.adjustmentInterval)
+			return;
+
+		ScanConcurrencyMeasurement measurement;
+		const auto [totalOperations, totalLatency] = operationTotals();
+		measurement.completedOperations = totalOperations - m_measuredOperations;
+		measurement.totalOperationLatency = std::chrono::nanoseconds{static_cast<int64_t>(totalLatency - m_measuredLatency)};
+		measurement.interval = now - m_lastAdjustment;
+		m_measuredOperations = totalOperations;
+		m_measuredLatency = totalLatency;
+		m_lastAdjustment = now;
+		m_nextAdjustment.store((now + m_options.concurrency.adjustmentInterval).time_since_epoch().count(), std::memory_order_relaxed);
+
+		const uint32_t previous = m_controller->participants();
+		const uint32_t next = m_controller->update(measurement);
+		if (next == previous)
+			return;
+		m_activeParticipants.store(next);
+		try
+		{
+			const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - m_traversalStarted);
+			m_snapshot.concurrencyHistory.push_back({static_cast<uint32_t>(elapsed.count()), next});
+		}
+		catch (...)
+		{
+			// The history is informational; a scan does not fail for the lack of it.
+		}
+		if (next > previous)
+			recruitParticipants();
+		else
+			wakeParticipants(m_participants.size()); // Lets idle participants beyond the new limit return their workers.
+	}
+
+	// Same scheme as adjustConcurrency(), on the pressure interval. Pressure is sampled only while traversal runs, and the
+	// backoff stays inactive when the stall totals cannot be read.
+	void adjustThrottle() noexcept
+	{
+		const auto now = std::chrono::steady_clock::now();
+		if (now.time_since_epoch().count() < m_nextThrottleAdjustment.load(std::memory_order_relaxed))
+			return;
+		std::unique_lock lock{m_throttleMutex, std::try_to_lock};
+		if (!lock || now < m_lastThrottleAdjustment + m_options.throttle.pressureInterval)
+			return;
+
+		const auto stallTotal = ioPressureStallTotal();
+		const uint64_t totalOperations = operationTotals().first;
+		const auto interval = std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_lastThrottleAdjustment);
+		if (stallTotal && *stallTotal >= *m_lastStallTotal)
+		{
+			const double stallShare = std::chrono::duration<double>(*stallTotal - *m_lastStallTotal).count()
+				/ std::chrono::duration<double>(interval).count();
+			m_throttle->updatePressure(stallShare, totalOperations - m_throttleMeasuredOperations, interval);
+		}
+		if (stallTotal)
+			m_lastStallTotal = stallTotal;
+		m_throttleMeasuredOperations = totalOperations;
+		m_lastThrottleAdjustment = now;
+		m_nextThrottleAdjustment.store((now + m_options.throttle.pressureInterval).time_since_epoch().count(), std::memory_order_relaxed);
+	}
+
+	// Completed filesystem calls and their summed latency in nanoseconds, across all participants.
+	[[nodiscard]] std::pair<uint64_t, uint64_t> operationTotals() const noexcept
+	{
+		std::pair<uint64_t, uint64_t> totals;
+		for (const Participant& participant : m_participants)
+		{
+			totals.first += participant.completedOperations.load(std::memory_order_relaxed);
+			totals.second += participant.operationLatencyNanoseconds.load(std::memory_order_relaxed);
 		}
+		return totals;
+	}
+
+	// Waits for the throttle to admit the calls and returns when they start.
+	[[nodiscard]] std::chrono::steady_clock::time_point operationStarted(const uint64_t operations)
+	{
+		if (m_throttle)
+			m_throttle->acquire(operations, m_canceled);
+		return std::chrono::steady_clock::now();
+	}
+
+	// Records the latency of a native call, or of a queue wait, and returns the time it ended, which the next call made
+	// right away can be timed from. A clock read and a few uncontended additions per call keep this far below the cost of
+	// the calls themselves.
+	std::chrono::steady_clock::time_point recordLatency(const std::size_t participant, const SnapshotTimedOperation operation,
+		const std::chrono::steady_clock::time_point started) noexcept
+	{
+		const auto finished = std::chrono::steady_clock::now();
+		const auto nanoseconds = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(finished - started).count());
+		m_participants[participant].operationTimings[operation].record(nanoseconds);
+		if (m_progress)
+			m_progress->addLatency(participant, operation, nanoseconds);
+		return finished;
+	}
+
+	void trace(const ScanTraceActivity activity, const std::chrono::steady_clock::time_point started,
+		const std::chrono::steady_clock::time_point finished, const std::size_t count = 0) const noexcept
+	{
+		if (m_options.trace)
+			m_options.trace->record(activity, started, finished, static_cast<uint32_t>(std::min<std::size_t>(count, UINT32_MAX)));
+	}
+
+	// Takes a lock of the work queues, tracing the wait when it is contended.
+	[[nodiscard]] std::unique_lock<std::mutex> lockTraced(std::mutex& mutex) const
+	{
+		if (!m_options.trace)
+			return std::unique_lock{mutex};
+		std::unique_lock lock{mutex, std::try_to_lock};
+		if (!lock)
+		{
+			const auto started = std::chrono::steady_clock::now();
+			lock.lock();
+			trace(ScanTraceActivity::lock_wait, started, std::chrono::steady_clock::now());
+		}
+		return lock;
+	}
+
+	// Feeds the concurrency controller and the pressure backoff, which count the calls of a batch individually.
+	void operationsCompleted(const std::size_t participant, const uint64_t operations,
+		const std::chrono::steady_clock::time_point started, const std::chrono::steady_clock::time_point finished) noexcept
+	{
+		if (!m_controller && !m_pressureBackoff)
+			return;
+		// Calls in one batch are in flight together, so each of them took the batch's duration.
+		const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(finished - started);
+		Participant& owner = m_participants[participant];
+		owner.completedOperations.fetch_add(operations, std::memory_order_relaxed);
+		owner.operationLatencyNanoseconds.fetch_add(operations * static_cast<uint64_t>(latency.count()), std::memory_order_relaxed);
+	}
+
+	// Returns nothing once the scan is complete or stopping.
+	std::optional<DirectoryWork> takeDirectory(const std::size_t participant) noexcept
+	{
+		for (;;)
+		{
+			if (stopRequested())
+				return {};
+			// A participant beyond the active limit leaves; its queued directories remain for the others to steal.
+			if (participant >= activeLimit())
+				return {};
+			if (auto directory = popDirectory(participant))
+				return directory;
+			for (std::size_t offset = 1; offset < m_participants.size(); ++offset)
+			{
+				if (auto directory = stealDirectory((participant + offset) % m_participants.size()))
+					return directory;
+			}
+
+			std::unique_lock lock = lockTraced(m_idleMutex);
+			// Queued work is announced to idle participants individually. Outstanding work with nothing queued implies an
+			// active participant, whose completion wakes everyone if the scan is done or stopping; for cancellation that
+			// happens after its current native call, which is also the cancellation latency bound.
+			m_idleParticipants.fetch_add(1);
+			const auto idleStarted = m_options.trace ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+			m_workAvailable.wait(lock, [this, participant] {
+				return stopRequested() || m_outstandingDirectories.load() == 0 || m_queuedDirectories.load() > 0
+					|| participant >= activeLimit();
+			});
+			m_idleParticipants.fetch_sub(1);
+			if (m_options.trace)
+				trace(ScanTraceActivity::idle_wait, idleStarted, std::chrono::steady_clock::now());
+			if (m_outstandingDirectories.load() == 0)
+				return {};
+		}
+	}
+
+	std::optional<DirectoryWork> popDirectory(const std::size_t participant) noexcept
+	{
+		Participant& owner = m_participants[participant];
+		const std::unique_lock lock = lockTraced(owner.mutex);
+		if (owner.directories.empty())
+			return {};
+		std::optional<DirectoryWork> directory{std::move(owner.directories.back())};
+		owner.directories.pop_back();
+		m_queuedDirectories.fetch_sub(1);
+		return directory;
+	}
+
+	std::optional<DirectoryWork> stealDirectory(const std::size_t victim) noexcept
+	{
+		Participant& target = m_participants[victim];
+		const std::unique_lock lock = lockTraced(target.mutex);
+		if (target.directories.empty())
+			return {};
+		std::optional<DirectoryWork> directory{std::move(target.directories.front())};
+		target.directories.pop_front();
+		m_queuedDirectories.fetch_sub(1);
+		return directory;
+	}
+
+	thin_io::filesystem_result<DirectoryHandle> openDirectory(DirectoryWork& work) const
+	{
+		if (!work.parentHandle)
+		{
+			const bool relativeResolution = m_options.traversalMode == SnapshotTraversalMode::directory_handles;
+			return FilesystemAccess::openDirectory(locationPath(*work.location), relativeResolution);
+		}
+
+		auto handle = FilesystemAccess::openDirectory(*work.parentHandle, work.location->name);
+		work.parentHandle.reset();
+		return handle;
+	}
+
+	// Shares the handle with the discovered subdirectories while the open-handle budget allows, otherwise they reopen by path
+	// and the handle is left with the caller.
+	std::shared_ptr<const DirectoryHandle> retainForChildren(DirectoryHandle& handle)
+	{
+		if (!handle.native())
+			return std::make_shared<const DirectoryHandle>(std::move(handle));
+		if (m_retainedHandles.fetch_add(1, std::memory_order_relaxed) >= m_retainedHandleLimit)
+		{
+			m_retainedHandles.fetch_sub(1, std::memory_order_relaxed);
+			return {};
+		}
+
+		std::unique_ptr<const DirectoryHandle> retained;
+		try
+		{
+			retained = std::make_unique<const DirectoryHandle>(std::move(handle));
+		}
+		catch (...)
+		{
+			m_retainedHandles.fetch_sub(1, std::memory_order_relaxed);
+			throw;
+		}
+		// The deleter also runs if the control block cannot be allocated.
+		return {retained.release(), [this](const DirectoryHandle* directory) noexcept {
+			delete directory;
+			m_retainedHandles.fetch_sub(1, std::memory_order_relaxed);
+		}};
 	}
 
 	std::optional<SnapshotScanFailure> scanDirectory(
-		const DirectoryWork& work, std::vector<DirectoryWork>& discoveredDirectories)
+		const std::size_t participant, DirectoryWork& work, std::vector<DirectoryWork>& discoveredDirectories)
 	{
 		if (m_canceled.load(std::memory_order_relaxed))
 			return {};
+		if (work.split)
+			return scanChunk(participant, work, discoveredDirectories);
 
-		const auto entries = FilesystemAccess::listDirectory(work.path);
+		const auto directoryStarted = std::chrono::steady_clock::now();
+		const std::size_t firstDiagnostic = m_participants[participant].diagnostics.size();
+		auto listingStarted = operationStarted(1);
+		auto handle = watchedCall(participant, [&] { return openDirectory(work); });
+		// A handle that only records the path took no native call.
+		auto opened = !handle || handle->native() ? recordLatency(participant, SnapshotTimedOperation::directory_open, listingStarted)
+			: listingStarted;
 		if (m_canceled.load(std::memory_order_relaxed))
 			return {};
-		if (!entries)
+		if (handle && !work.isRoot && !m_exclusions->markers().empty())
 		{
+			// The open counts as an operation of its own here, so that the marker lookups are not timed as part of it.
+			operationsCompleted(participant, 1, listingStarted, opened);
+			trace(ScanTraceActivity::enumeration, listingStarted, opened);
+			if (containsExclusionMarker(participant, *handle))
+			{
+				work.entry->traversalState = DirectoryTraversalState::excluded;
+				journalDirectory(participant, *work.location, *work.entry, firstDiagnostic);
+				completeDirectory(participant);
+				return {};
+			}
+			listingStarted = operationStarted(1);
+			opened = listingStarted;
+		}
+		ListedEntries listed;
+		const std::optional<thin_io::filesystem_error> listingError = handle
+			? listEntries(participant, *handle, *work.location, listed) : std::optional{handle.error()};
+		const auto finished = handle ? recordLatency(participant, SnapshotTimedOperation::directory_listing, opened) : opened;
+		operationsCompleted(participant, 1, listingStarted, finished);
+		trace(ScanTraceActivity::enumeration, listingStarted, finished, listed.names.size());
+		if (m_canceled.load(std::memory_order_relaxed))
+			return {};
+		if (listingError)
+		{
+			const NativePath path = locationPath(*work.location);
 			if (work.isRoot)
-				return scanFailure(SnapshotScanFailureCode::root_enumeration_unavailable, work.path, entries.error().native_code);
+				return scanFailure(SnapshotScanFailureCode::root_enumeration_unavailable, path, listingError->native_code);
 			work.entry->traversalState = DirectoryTraversalState::enumeration_failed;
-			recordDiagnostic(work.path, SnapshotOperation::directory_enumeration, entries.error().native_code);
-			completeDirectory();
+			recordDiagnostic(participant, path, SnapshotOperation::directory_enumeration, listingError->native_code);
+			recordDirectoryCost(participant, *work.location, std::chrono::steady_clock::now() - directoryStarted, 0);
+			journalDirectory(participant, *work.location, *work.entry, firstDiagnostic);
+			completeDirectory(participant);
 			return {};
 		}
 
-		work.entry->children.reserve(entries->size());
+		const bool foldFiles = foldsFiles();
+		const std::size_t listedCount = listed.names.size();
+		std::vector<NativeName> foldedNames;
+		uint64_t estimatedBytes = 0;
+		work.entry->children.reserve(listedCount);
 		work.entry->children.begin_batch();
-		for (const thin_io::directory_entry& listedEntry : *entries)
+		for (std::size_t i = 0; i < listedCount; ++i)
 		{
 			if (m_canceled.load(std::memory_order_relaxed))
 				return {};
+			if (foldFiles && isFoldable(listed.attributes[i]))
+			{
+				foldedNames.push_back(listed.names[i]);
+				continue;
+			}
 			SnapshotEntry child;
-			child.attributes = listedEntry.attributes;
-			work.entry->children.append_unsorted(nativeNameFromThinIo(listedEntry.name), std::move(child));
+			child.attributes = listed.attributes[i];
+			estimatedBytes += sizeof(SnapshotEntry) + sizeof(NativeName) + listed.names[i].size() * sizeof(*listed.names[i].constData());
+			work.entry->children.append_unsorted(listed.names[i], std::move(child));
 		}
 		work.entry->children.end_batch();
-		assert(work.entry->children.size() == entries->size());
-		discoverEntries(static_cast<uint64_t>(entries->size()));
+		assert(work.entry->children.size() + foldedNames.size() == listedCount);
+		if (m_options.fileResolution == SnapshotFileResolution::budgeted)
+			m_estimatedTreeBytes.fetch_add(estimatedBytes, std::memory_order_relaxed);
+		for (const NativeName& name : listed.statOnlyDirectories)
+			work.entry->children.find(name).value().traversalState = DirectoryTraversalState::excluded;
+		discoverEntries(participant, static_cast<uint64_t>(listedCount));
+		std::vector<uint64_t> fileIds;
+		if (m_options.metadataOrder == SnapshotMetadataOrder::file_id)
+		{
+			if (!listed.fileIds.empty())
+			{
+				fileIds = std::move(listed.fileIds);
+			}
+			else if (listedCount >= MinimumFileIdOrderedChildren)
+			{
+				const auto started = std::chrono::steady_clock::now();
+				fileIds = watchedCall(participant, [&] { return FilesystemAccess::listedFileIds(*handle, listed.names); });
+				trace(ScanTraceActivity::enumeration, started,
+					recordLatency(participant, SnapshotTimedOperation::file_id_listing, started), listedCount);
+			}
+		}
+		std::vector<DiscoveredDirectory> children = childrenInMetadataOrder(*work.entry, listed.names, std::move(foldedNames), fileIds);
+		if (children.size() > m_options.metadataChunkSize && m_participants.size() > 1)
+		{
+			splitDirectory(work, std::move(*handle), std::move(children), foldFiles, directoryStarted, discoveredDirectories);
+			return {};
+		}
 
-		for (auto [name, child] : work.entry->children)
+		// Metadata requests are grouped so that a batching backend can keep many of them in flight; with a capacity of 1
+		// this degenerates to one request per child, with a cancellation check after each.
+		const std::size_t batchCapacity = std::max<std::size_t>(FilesystemAccess::entryMetadataBatchCapacity(), 1);
+		MetadataBatch batch;
+		batch.reserve(std::min(batchCapacity, children.size()));
+		std::vector<DiscoveredDirectory> discoveredEntries;
+		SnapshotFoldedFiles foldedFiles;
+		for (auto& [name, child] : children)
 		{
-			if (m_canceled.load(std::memory_order_relaxed))
+			batch.names.push_back(std::move(name));
+			batch.entries.push_back(child);
+			if (batch.entries.size() == batchCapacity
+				&& !collectMetadata(participant, *handle, *work.location, batch, discoveredEntries, foldedFiles))
 				return {};
-			NativePath childPath = appendNativeName(work.path, name);
-			const auto metadata = FilesystemAccess::getEntryMetadata(childPath, thin_io::link_behavior::do_not_follow);
-			if (m_canceled.load(std::memory_order_relaxed))
+		}
+		if (!batch.entries.empty() && !collectMetadata(participant, *handle, *work.location, batch, discoveredEntries, foldedFiles))
+			return {};
+
+		if (!discoveredEntries.empty())
+			queueSubdirectories(work.location, retainForChildren(*handle), work.baseline, discoveredEntries, discoveredDirectories);
+
+		if (!m_canceled.load(std::memory_order_relaxed))
+		{
+			if (foldFiles)
+				work.entry->foldedFiles = foldedFiles;
+			work.entry->traversalState = DirectoryTraversalState::completed;
+			recordDirectoryCost(participant, *work.location, std::chrono::steady_clock::now() - directoryStarted, listedCount);
+			journalDirectory(participant, *work.location, *work.entry, firstDiagnostic);
+			completeDirectory(participant);
+		}
+		return {};
+	}
+
+	// Decided as each directory is listed; the budget is compared with an estimate that the participants update without
+	// coordination, so a budgeted scan may overshoot it by the directories listed concurrently.
+	[[nodiscard]] bool foldsFiles() const noexcept
+	{
+		switch (m_options.fileResolution)
+		{
+		case SnapshotFileResolution::entries: return false;
+		case SnapshotFileResolution::directories: return true;
+		case SnapshotFileResolution::budgeted: return m_estimatedTreeBytes.load(std::memory_order_relaxed) >= m_options.memoryBudget;
+		}
+		return false;
+	}
+
+	// The listed children of directory in the order their metadata is collected: by file id when the listing reported
+	// one for every child, by name otherwise, with the folded files after the entries. Ties keep the listing order.
+	static std::vector<DiscoveredDirectory> childrenInMetadataOrder(SnapshotEntry& directory,
+		const std::vector<NativeName>& listedNames, std::vector<NativeName> foldedNames, const std::vector<uint64_t>& fileIds)
+	{
+		std::vector<DiscoveredDirectory> children;
+		children.reserve(directory.children.size() + foldedNames.size());
+		if (fileIds.empty() || fileIds.size() != listedNames.size())
+		{
+			for (auto child = directory.children.begin(), end = directory.children.end(); child != end; ++child)
+				children.push_back({child.key(), &child.value()});
+			std::ranges::sort(foldedNames);
+			for (NativeName& name : foldedNames)
+				children.push_back({std::move(name), nullptr});
+			return children;
+		}
+
+		std::vector<std::size_t> order(listedNames.size());
+		for (std::size_t i = 0; i < order.size(); ++i)
+			order[i] = i;
+		std::ranges::stable_sort(order, {}, [&fileIds](const std::size_t i) { return fileIds[i]; });
+		for (const std::size_t i : order)
+		{
+			// Only the folded files are missing from the children.
+			const auto child = directory.children.find(listedNames[i]);
+			children.push_back({listedNames[i], child != directory.children.end() ? &child.value() : nullptr});
+		}
+		assert(children.size() == directory.children.size() + foldedNames.size());
+		return children;
+	}
+
+	// Queues the directory's metadata phase as chunks that other participants can steal. The directory completes with its
+	// last chunk; diagnostics and the sorted children come out exactly as from a single participant.
+	void splitDirectory(const DirectoryWork& work, DirectoryHandle handle, std::vector<DiscoveredDirectory> children,
+		const bool foldFiles, const std::chrono::steady_clock::time_point started, std::vector<DirectoryWork>& discoveredDirectories)
+	{
+		auto split = std::make_shared<SplitDirectory>();
+		split->location = work.location;
+		split->entry = work.entry;
+		split->baseline = work.baseline;
+		split->foldFiles = foldFiles;
+		split->handleForSubdirectories = retainForChildren(handle);
+		split->handle = split->handleForSubdirectories ? split->handleForSubdirectories
+			: std::make_shared<const DirectoryHandle>(std::move(handle));
+		split->children = std::move(children);
+		split->elapsed = (std::chrono::steady_clock::now() - started).count();
+
+		const std::size_t chunkSize = std::max<std::size_t>(m_options.metadataChunkSize, 1);
+		const std::size_t chunkCount = (split->children.size() + chunkSize - 1) / chunkSize;
+		split->remainingChunks = chunkCount;
+		discoveredDirectories.reserve(discoveredDirectories.size() + chunkCount);
+		for (std::size_t begin = 0; begin < split->children.size(); begin += chunkSize)
+		{
+			DirectoryWork chunk;
+			chunk.split = split;
+			chunk.chunkBegin = begin;
+			chunk.chunkEnd = std::min(begin + chunkSize, split->children.size());
+			discoveredDirectories.push_back(std::move(chunk));
+		}
+	}
+
+	std::optional<SnapshotScanFailure> scanChunk(
+		const std::size_t participant, const DirectoryWork& work, std::vector<DirectoryWork>& discoveredDirectories)
+	{
+		SplitDirectory& split = *work.split;
+		const auto chunkStarted = std::chrono::steady_clock::now();
+		const std::size_t firstDiagnostic = m_participants[participant].diagnostics.size();
+		const std::size_t batchCapacity = std::max<std::size_t>(FilesystemAccess::entryMetadataBatchCapacity(), 1);
+		MetadataBatch batch;
+		batch.reserve(std::min(batchCapacity, work.chunkEnd - work.chunkBegin));
+		std::vector<DiscoveredDirectory> discoveredEntries;
+		SnapshotFoldedFiles foldedFiles;
+		for (std::size_t i = work.chunkBegin; i < work.chunkEnd; ++i)
+		{
+			batch.names.push_back(split.children[i].name);
+			batch.entries.push_back(split.children[i].entry);
+			if (batch.entries.size() == batchCapacity
+				&& !collectMetadata(participant, *split.handle, *split.location, batch, discoveredEntries, foldedFiles))
 				return {};
+		}
+		if (!batch.entries.empty()
+			&& !collectMetadata(participant, *split.handle, *split.location, batch, discoveredEntries, foldedFiles))
+			return {};
+
+		if (!discoveredEntries.empty())
+			queueSubdirectories(split.location, split.handleForSubdirectories, split.baseline, discoveredEntries, discoveredDirectories);
+
+		if (split.foldFiles || m_options.journal)
+		{
+			// The chunk's children are encoded before its subdirectories are queued, which may change them.
+			std::optional<ScanJournalRecord> record;
+			if (m_options.journal)
+			{
+				record.emplace();
+				for (std::size_t i = work.chunkBegin; i < work.chunkEnd; ++i)
+				{
+					if (split.children[i].entry)
+						record->addChild(split.children[i].name, *split.children[i].entry);
+				}
+				addJournalDiagnostics(*record, participant, firstDiagnostic);
+			}
+			std::lock_guard lock{split.chunkMutex};
+			addFoldedFiles(split.foldedFiles, foldedFiles);
+			if (record)
+				split.journalRecord.append(*record);
+		}
+		split.elapsed.fetch_add((std::chrono::steady_clock::now() - chunkStarted).count(), std::memory_order_relaxed);
+		if (split.remainingChunks.fetch_sub(1, std::memory_order_acq_rel) == 1 && !m_canceled.load(std::memory_order_relaxed))
+		{
+			if (split.stalled)
+				split.entry->traversalState = DirectoryTraversalState::stalled;
+			else
+			{
+				if (split.foldFiles)
+					split.entry->foldedFiles = split.foldedFiles;
+				split.entry->traversalState = DirectoryTraversalState::completed;
+				recordDirectoryCost(participant, *split.location,
+					std::chrono::steady_clock::duration{split.elapsed.load(std::memory_order_relaxed)}, split.children.size());
+				if (m_options.journal)
+					m_options.journal->append(locationPath(*split.location), *split.entry, split.journalRecord);
+			}
+			completeDirectory(participant);
+		}
+		return {};
+	}
+
+	void queueSubdirectories(const std::shared_ptr<const DirectoryLocation>& parentLocation,
+		const std::shared_ptr<const DirectoryHandle>& parentHandle, const std::optional<SnapshotTree::Index> parentBaseline,
+		std::vector<DiscoveredDirectory>& subdirectories, std::vector<DirectoryWork>& discoveredDirectories) const
+	{
+		const std::size_t firstQueued = discoveredDirectories.size();
+		discoveredDirectories.reserve(discoveredDirectories.size() + subdirectories.size());
+		for (auto& [name, entry] : subdirectories)
+		{
+			const std::optional<SnapshotTree::Index> baseline = baselineChild(parentBaseline, name);
+			auto location = std::make_shared<DirectoryLocation>();
+			location->parent = parentLocation;
+			location->name = std::move(name);
+			discoveredDirectories.push_back({std::move(location), parentHandle, entry, false});
+			discoveredDirectories.back().baseline = baseline;
+		}
+
+		// Other participants steal from the front of the queue and the owner continues from the back, so the largest
+		// subtrees go to whoever is idle while the owner works through the small ones.
+		if (parentBaseline)
+		{
+			std::stable_sort(discoveredDirectories.begin() + static_cast<std::ptrdiff_t>(firstQueued), discoveredDirectories.end(),
+				[this](const DirectoryWork& left, const DirectoryWork& right) {
+					return baselineSubtreeSize(left.baseline) > baselineSubtreeSize(right.baseline);
+				});
+		}
+	}
+
+	// Finds the scan root in the baseline and records the subtree sizes below it, before any participant starts.
+	void indexBaseline(const NativePath& rootPath)
+	{
+		if (!m_options.baseline)
+			return;
+		const std::optional<SnapshotTree::Index> entry = m_options.baseline->tree.find(m_options.baseline->rootPath, rootPath);
+		if (!entry)
+			return;
+		m_baselineRoot = entry;
+		const auto rootFilesystem = baselineFilesystem(*entry);
+		indexBaselineSubtree(*entry, rootFilesystem, true);
+	}
+
+	// Returns the number of entries below directory, counting folded files, and records it for each nonempty directory.
+	// Entries listed in directories of the root's filesystem also count towards m_baselineRootFilesystemEntries.
+	uint64_t indexBaselineSubtree(const SnapshotTree::Index directory,
+		const std::optional<thin_io::filesystem_identity>& rootFilesystem, const bool onRootFilesystem)
+	{
+		const SnapshotTree& tree = m_options.baseline->tree;
+		const auto foldedFiles = tree.foldedFiles(directory);
+		const SnapshotTree::Children children = tree.children(directory);
+		uint64_t size = foldedFiles ? foldedFiles->files : 0;
+		size += children.size();
+		if (onRootFilesystem)
+			m_baselineRootFilesystemEntries += size;
+		for (const SnapshotTree::Index child : children)
+		{
+			if (!tree.children(child).empty() || tree.foldedFiles(child))
+			{
+				const auto childFilesystem = baselineFilesystem(child);
+				const bool sameFilesystem = !rootFilesystem || !childFilesystem || *childFilesystem == *rootFilesystem;
+				size += indexBaselineSubtree(child, rootFilesystem, onRootFilesystem && sameFilesystem);
+			}
+		}
+		m_baselineSubtreeSizes.emplace(directory, size);
+		return size;
+	}
+
+	[[nodiscard]] std::optional<thin_io::filesystem_identity> baselineFilesystem(const SnapshotTree::Index entry) const
+	{
+		const auto metadata = m_options.baseline->tree.metadata(entry);
+		if (!metadata || !metadata->identity)
+			return {};
+		return metadata->identity->filesystem;
+	}
+
+	// The child of a baseline directory with the given name, if both exist.
+	[[nodiscard]] std::optional<SnapshotTree::Index> baselineChild(
+		const std::optional<SnapshotTree::Index> baseline, const NativeName& name) const noexcept
+	{
+		if (!baseline)
+			return {};
+		return m_options.baseline->tree.findChild(*baseline, name);
+	}
+
+	// Scans sharing a progress channel each add their own filesystem's share, so a baseline that was scanned across
+	// mounts only counts the entries of the root's filesystem here. The files in use on a filesystem are only a measure
+	// of the tree when the scan starts from its mount point; the root itself is not discovered.
+	void expectEntries(const NativePath& rootPath)
+	{
+		if (!m_progress)
+			return;
+		if (m_baselineRoot)
+			m_progress->addExpectedEntries(m_baselineRootFilesystemEntries);
+		else if (const auto usedFiles = FilesystemAccess::getUsedFileCount(rootPath); usedFiles && *usedFiles > 0)
+			m_progress->addExpectedEntries(*usedFiles - 1);
+	}
+
+	[[nodiscard]] uint64_t baselineSubtreeSize(const std::optional<SnapshotTree::Index> baseline) const
+	{
+		if (!baseline)
+			return 0;
+		const auto size = m_baselineSubtreeSizes.find(*baseline);
+		return size != m_baselineSubtreeSizes.end() ? size->second : 0;
+	}
+
+	// Resumes the scan the journal recorded if it was one of this root with the same options, or starts the journal over.
+	void beginJournal(const NativePath& rootPath)
+	{
+		ScanJournalHeader header;
+		header.rootPath = rootPath;
+		header.scanStartedAtUtc = m_snapshot.scanStartedAtUtc;
+		header.filesystemSpaceAtStart = *m_snapshot.filesystemSpaceAtStart;
+		header.root.attributes = m_snapshot.root.attributes;
+		header.root.metadata = m_snapshot.root.metadata;
+		header.fileResolution = m_options.fileResolution;
+		header.memoryBudget = m_options.memoryBudget;
+		header.exclusionRules = m_options.exclusionRules;
+		header.exclusionRootPath = m_options.exclusionRootPath;
+
+		ScanJournal& journal = *m_options.journal;
+		const std::optional<ScanJournalHeader>& resumed = journal.resumedHeader();
+		if (resumed && resumed->rootPath == header.rootPath && resumed->root.attributes == header.root.attributes
+			&& resumed->root.metadata && resumed->root.metadata->identity == header.root.metadata->identity
+			&& resumed->fileResolution == header.fileResolution && resumed->memoryBudget == header.memoryBudget
+			&& resumed->exclusionRules == header.exclusionRules && resumed->exclusionRootPath == header.exclusionRootPath)
+		{
+			m_snapshot.scanStartedAtUtc = resumed->scanStartedAtUtc;
+			m_snapshot.filesystemSpaceAtStart = resumed->filesystemSpaceAtStart;
+			m_resumedDirectories = journal.takeResumedDirectories();
+			return;
+		}
+		journal.begin(header);
+	}
+
+	// Restores the directory from the journal the scan resumes and descends into its pending subdirectories, or adds it to
+	// pending when the journal did not record it. Restored directories count as completed and their entries as discovered.
+	void restoreDirectory(const std::shared_ptr<const DirectoryLocation>& location, SnapshotEntry& directory,
+		const std::optional<SnapshotTree::Index> baseline, std::vector<DirectoryWork>& pending)
+	{
+		const NativePath path = locationPath(*location);
+		const auto recorded = m_resumedDirectories.find(path);
+		if (recorded == m_resumedDirectories.end())
+		{
+			pending.push_back({location, {}, &directory, !location->parent});
+			pending.back().baseline = baseline;
+			return;
+		}
+
+		ScanJournalDirectory& record = recorded->second;
+		directory.traversalState = record.entry.traversalState;
+		directory.foldedFiles = record.entry.foldedFiles;
+		directory.children = std::move(record.entry.children);
+		const uint64_t issues = record.diagnostics.size();
+		std::ranges::move(record.diagnostics, std::back_inserter(m_snapshot.diagnostics));
+		m_resumedDirectories.erase(recorded);
+		const uint64_t entries = directory.children.size() + (directory.foldedFiles ? directory.foldedFiles->files : 0);
+		reportProgress(0, {.directoriesCompleted = 1, .entriesDiscovered = entries, .issues = issues});
+
+		uint64_t estimatedBytes = 0;
+		for (auto child = directory.children.begin(), end = directory.children.end(); child != end; ++child)
+		{
+			const NativeName& name = child.key();
+			SnapshotEntry& entry = child.value();
+			estimatedBytes += sizeof(SnapshotEntry) + sizeof(NativeName) + name.size() * sizeof(*name.constData());
+			if (isHardLinkAlias(entry))
+				m_hardLinks.add(*entry.metadata->identity, appendNativeName(path, name));
+			// Subdirectories whose traversal the scan had not finished when it was recorded.
+			if (entry.attributes.kind != thin_io::entry_kind::directory || entry.traversalState != DirectoryTraversalState::not_directory)
+				continue;
+			auto childLocation = std::make_shared<DirectoryLocation>();
+			childLocation->parent = location;
+			childLocation->name = name;
+			restoreDirectory(childLocation, entry, baselineChild(baseline, name), pending);
+		}
+		if (m_options.fileResolution == SnapshotFileResolution::budgeted)
+			m_estimatedTreeBytes.fetch_add(estimatedBytes, std::memory_order_relaxed);
+	}
+
+	// Records a directory whose listing and child metadata are complete, before its subdirectories are queued, with the
+	// diagnostics its participant recorded for it from firstDiagnostic on.
+	void journalDirectory(const std::size_t participant, const DirectoryLocation& location, const SnapshotEntry& directory,
+		const std::size_t firstDiagnostic)
+	{
+		if (!m_options.journal)
+			return;
+		ScanJournalRecord record;
+		for (auto child = directory.children.begin(), end = directory.children.end(); child != end; ++child)
+			record.addChild(child.key(), child.value());
+		addJournalDiagnostics(record, participant, firstDiagnostic);
+		m_options.journal->append(locationPath(location), directory, record);
+	}
+
+	void addJournalDiagnostics(ScanJournalRecord& record, const std::size_t participant, const std::size_t firstDiagnostic) const
+	{
+		const std::vector<SnapshotDiagnostic>& diagnostics = m_participants[participant].diagnostics;
+		for (std::size_t i = firstDiagnostic; i < diagnostics.size(); ++i)
+			record.addDiagnostic(diagnostics[i]);
+	}
+
+	struct MetadataBatch
+	{
+		std::vector<NativeName> names;
+		std::vector<SnapshotEntry*> entries;
+		std::vector<thin_io::filesystem_result<thin_io::entry_metadata>> results;
+
+		void reserve(const std::size_t capacity)
+		{
+			names.reserve(capacity);
+			entries.reserve(capacity);
+			results.reserve(capacity);
+		}
+
+		void clear() noexcept
+		{
+			names.clear();
+			entries.clear();
+			results.clear();
+		}
+	};
+
+	// Looks the markers up in the directory; any entry of a marker's name counts.
+	bool containsExclusionMarker(const std::size_t participant, const DirectoryHandle& directory)
+	{
+		const std::vector<NativeName>& markers = m_exclusions->markers();
+		std::vector<thin_io::filesystem_result<thin_io::entry_metadata>> results(markers.size());
+		const auto started = operationStarted(markers.size());
+		watchedCall(participant, [&] { FilesystemAccess::getEntryMetadataBatch(directory, markers, results); });
+		const auto finished = recordLatency(participant, SnapshotTimedOperation::entry_metadata, started);
+		operationsCompleted(participant, markers.size(), started, finished);
+		trace(ScanTraceActivity::metadata, started, finished, markers.size());
+		return std::ranges::any_of(results, [](const auto& result) { return result.has_value(); });
+	}
+
+	// Reads the directory into listed, a chunk per watched call. The exclusion rules are applied to the names in the reader's
+	// buffer as the chunks arrive, and only the names kept are interned. Nothing of the directory's entry is touched before the whole
+	// listing is in: a call that the watchdog abandons leaves the directory to it.
+	std::optional<thin_io::filesystem_error> listEntries(const std::size_t participant, const DirectoryHandle& handle,
+		const DirectoryLocation& location, ListedEntries& listed)
+	{
+		const NativePath directoryPath = !m_exclusions->empty() && m_exclusions->needsDirectoryPath() ? locationPath(location)
+			: NativePath{};
+		bool fileIdsListed = true;
+		auto reader = FilesystemAccess::readDirectory(handle);
+		for (;;)
+		{
+			const auto chunk = watchedCall(participant, [&] { return reader.next(); });
+			if (!chunk)
+				return chunk.error();
+			if (chunk->empty() || m_canceled.load(std::memory_order_relaxed))
+				break;
+			for (const ListedDirectoryEntry& entry : *chunk)
+			{
+				const auto action = m_exclusions->empty() ? std::nullopt : m_exclusions->match(directoryPath, entry.name);
+				if (action == SnapshotExclusionAction::skip)
+					continue;
+				NativeName name = m_names.intern(entry.name);
+				if (action == SnapshotExclusionAction::stat_only && entry.attributes.kind == thin_io::entry_kind::directory)
+					listed.statOnlyDirectories.push_back(name);
+				listed.names.push_back(std::move(name));
+				listed.attributes.push_back(entry.attributes);
+				fileIdsListed = fileIdsListed && entry.fileId != 0;
+				if (fileIdsListed)
+					listed.fileIds.push_back(entry.fileId);
+			}
+		}
+		if (!fileIdsListed)
+			listed.fileIds.clear();
+		return {};
+	}
+
+	// Returns false once the scan is canceled. The batch is left empty for reuse otherwise. Files folded into the directory
+	// are added to foldedFiles.
+	bool collectMetadata(const std::size_t participant, const DirectoryHandle& directory, const DirectoryLocation& location,
+		MetadataBatch& batch, std::vector<DiscoveredDirectory>& discoveredEntries, SnapshotFoldedFiles& foldedFiles)
+	{
+		if (m_canceled.load(std::memory_order_relaxed))
+			return false;
+		batch.results.resize(batch.names.size());
+		const auto started = operationStarted(batch.names.size());
+		watchedCall(participant, [&] { FilesystemAccess::getEntryMetadataBatch(directory, batch.names, batch.results); });
+		const auto finished = recordLatency(participant, SnapshotTimedOperation::entry_metadata, started);
+		operationsCompleted(participant, batch.names.size(), started, finished);
+		trace(ScanTraceActivity::metadata, started, finished, batch.names.size());
+		if (m_canceled.load(std::memory_order_relaxed))
+			return false;
+
+		std::optional<NativePath> directoryPath;
+		for (std::size_t i = 0; i < batch.entries.size(); ++i)
+		{
+			if (!batch.entries[i])
+			{
+				foldFile(participant, location, batch.names[i], batch.results[i], foldedFiles);
+				continue;
+			}
+			SnapshotEntry& child = *batch.entries[i];
+			const auto& metadata = batch.results[i];
 			if (!metadata)
 			{
 				markMetadataUnavailable(child);
-				recordDiagnostic(childPath, SnapshotOperation::entry_metadata, metadata.error().native_code);
+				recordDiagnostic(participant, appendNativeName(locationPath(location), batch.names[i]),
+					SnapshotOperation::entry_metadata, metadata.error().native_code);
 				continue;
 			}
 			if (metadata->attributes != child.attributes)
 			{
 				markMetadataUnavailable(child);
-				recordDiagnostic(childPath, SnapshotOperation::entry_changed_during_scan, {});
+				recordDiagnostic(participant, appendNativeName(locationPath(location), batch.names[i]),
+					SnapshotOperation::entry_changed_during_scan, {});
 				continue;
 			}
 
 			child.metadata = snapshotMetadata(*metadata);
+			if (isHardLinkAlias(child))
+			{
+				// Grouped as the aliases arrive, so that no pass over the finished tree has to look for them.
+				if (!directoryPath)
+					directoryPath = locationPath(location);
+				m_hardLinks.add(*child.metadata->identity, appendNativeName(*directoryPath, batch.names[i]));
+			}
 			if (child.attributes.kind != thin_io::entry_kind::directory)
 				continue;
 			if (child.attributes.is_link)
@@ -257,6 +1471,8 @@ private:
 				child.traversalState = DirectoryTraversalState::link_boundary;
 				continue;
 			}
+			if (child.traversalState == DirectoryTraversalState::excluded)
+				continue;
 			const bool crossesMount = m_rootMountIdentity && metadata->mount_id && *m_rootMountIdentity != *metadata->mount_id;
 			const bool crossesFilesystem = m_rootFilesystemIdentity && metadata->identity
 				&& *m_rootFilesystemIdentity != metadata->identity->filesystem;
@@ -266,114 +1482,338 @@ private:
 				continue;
 			}
 			if (m_canceled.load(std::memory_order_relaxed))
-				return {};
-			discoveredDirectories.push_back({std::move(childPath), &child, false});
+				return false;
+			discoveredEntries.push_back({std::move(batch.names[i]), &child});
 		}
+		batch.clear();
+		return true;
+	}
 
-		if (!m_canceled.load(std::memory_order_relaxed))
+	void foldFile(const std::size_t participant, const DirectoryLocation& location, const NativeName& name,
+		const thin_io::filesystem_result<thin_io::entry_metadata>& metadata, SnapshotFoldedFiles& foldedFiles)
+	{
+		++foldedFiles.files;
+		if (!metadata)
 		{
-			work.entry->traversalState = DirectoryTraversalState::completed;
-			completeDirectory();
+			++foldedFiles.metadataUnavailable;
+			recordDiagnostic(participant, appendNativeName(locationPath(location), name),
+				SnapshotOperation::entry_metadata, metadata.error().native_code);
+			return;
 		}
-		return {};
+		if (metadata->attributes.kind != thin_io::entry_kind::regular_file || metadata->attributes.is_link)
+		{
+			++foldedFiles.metadataUnavailable;
+			recordDiagnostic(participant, appendNativeName(locationPath(location), name),
+				SnapshotOperation::entry_changed_during_scan, {});
+			return;
+		}
+		if (metadata->hard_link_count > 1)
+		{
+			++foldedFiles.hardLinkCandidates;
+			return;
+		}
+		foldedFiles.logicalSize += metadata->logical_size;
+		foldedFiles.allocatedSize += metadata->allocated_size;
 	}
 
-	void finishDirectory(std::vector<DirectoryWork> discoveredDirectories,
+	void finishDirectory(const std::size_t participant, std::vector<DirectoryWork> discoveredDirectories,
 		std::optional<SnapshotScanFailure> failure, const bool unexpectedError) noexcept
 	{
+		if (unexpectedError || failure)
+			stop(std::move(failure), unexpectedError);
+
+		std::size_t published = 0;
+		if (!stopRequested() && !discoveredDirectories.empty())
 		{
-			std::lock_guard lock{m_workMutex};
+			Participant& owner = m_participants[participant];
 			try
 			{
-				if (unexpectedError)
-					m_unexpectedError = true;
-				else if (failure && !m_fatalFailure)
-					m_fatalFailure = std::move(failure);
-
-				if (!m_canceled.load(std::memory_order_relaxed) && !m_unexpectedError && !m_fatalFailure)
+				const std::unique_lock lock = lockTraced(owner.mutex);
+				for (DirectoryWork& discovered : discoveredDirectories)
 				{
-					for (DirectoryWork& discovered : discoveredDirectories)
-					{
-						m_pendingDirectories.push_back(std::move(discovered));
-						++m_outstandingDirectories;
-					}
+					owner.directories.push_back(std::move(discovered));
+					// Counted before this directory's own completion below, so the outstanding count cannot reach zero early.
+					m_outstandingDirectories.fetch_add(1);
+					++published;
 				}
 			}
 			catch (...)
 			{
-				m_unexpectedError = true;
+				stop({}, true);
 			}
+			m_queuedDirectories.fetch_add(published);
+		}
+
+		const bool scanComplete = m_outstandingDirectories.fetch_sub(1) == 1;
+		// Cancellation is requested from outside; mirroring it into m_stopping orders it with the idle handshake below.
+		if (m_canceled.load(std::memory_order_relaxed))
+			m_stopping.store(true);
+		if (scanComplete || m_stopping.load())
+		{
+			wakeParticipants(m_participants.size());
+			wakeWatchdog();
+		}
+		else if (published > 1)
+			wakeParticipants(published - 1); // This participant takes one of them itself.
+	}
+
+	void stop(std::optional<SnapshotScanFailure> failure, const bool unexpectedError) noexcept
+	{
+		std::lock_guard lock{m_failureMutex};
+		if (unexpectedError)
+			m_unexpectedError = true;
+		else if (failure && !m_fatalFailure)
+			m_fatalFailure = std::move(failure);
+		m_stopping.store(true);
+	}
+
+	void wakeParticipants(const std::size_t count) noexcept
+	{
+		// Pairs with the increment in takeDirectory(): either the idle participant observes the published state before
+		// waiting, or it is counted here and waiting by the time the mutex is acquired.
+		const std::size_t idleParticipants = m_idleParticipants.load();
+		if (idleParticipants == 0)
+			return;
+
+		{
+			std::lock_guard lock{m_idleMutex};
+		}
+		// A targeted wakeup could land on a participant beyond the active limit, which would leave the work unclaimed.
+		if (count >= idleParticipants || m_recruitedParticipants.load() > activeLimit())
+			m_workAvailable.notify_all();
+		else
+		{
+			for (std::size_t i = 0; i < count; ++i)
+				m_workAvailable.notify_one();
+		}
+	}
 
-			if (m_canceled.load(std::memory_order_relaxed) || m_unexpectedError || m_fatalFailure)
-				discardPendingDirectoriesLocked();
-			assert(m_outstandingDirectories > 0);
-			--m_outstandingDirectories;
+	void wakeWatchdog() noexcept
+	{
+		if (!m_watchCalls)
+			return;
+		{
+			std::lock_guard lock{m_watchdogMutex};
 		}
-		m_workChanged.notify_all();
+		m_traversalEnded.notify_all();
 	}
 
-	void discardPendingDirectoriesLocked() noexcept
+	void recordDirectoryCost(const std::size_t participant, const DirectoryLocation& location,
+		const std::chrono::steady_clock::duration elapsed, const uint64_t entries)
 	{
-		assert(m_outstandingDirectories >= m_pendingDirectories.size());
-		m_outstandingDirectories -= m_pendingDirectories.size();
-		m_pendingDirectories.clear();
+		SnapshotDirectoryCost cost{{}, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed), entries};
+		SnapshotDirectoryCostReport& costs = m_participants[participant].directoryCosts;
+		keepCostliest(costs.slowest, cost, location, &SnapshotDirectoryCost::elapsed, slowerDirectory);
+		keepCostliest(costs.largest, cost, location, &SnapshotDirectoryCost::entries, largerDirectory);
+	}
+
+	// Costs are compared before the path is built, so that the path of a directory that is not kept never is.
+	template<class Cost>
+	static void keepCostliest(std::vector<SnapshotDirectoryCost>& heap, SnapshotDirectoryCost& cost,
+		const DirectoryLocation& location, Cost SnapshotDirectoryCost::* const measure,
+		bool (*const costlier)(const SnapshotDirectoryCost&, const SnapshotDirectoryCost&) noexcept)
+	{
+		const bool full = heap.size() >= SnapshotDirectoryCostReport::Size;
+		if (full && cost.*measure < heap.front().*measure)
+			return;
+		if (cost.path.isEmpty())
+			cost.path = locationPath(location);
+		if (!full)
+		{
+			heap.push_back(cost);
+			std::ranges::push_heap(heap, costlier);
+		}
+		else if (costlier(cost, heap.front()))
+		{
+			std::ranges::pop_heap(heap, costlier);
+			heap.back() = cost;
+			std::ranges::push_heap(heap, costlier);
+		}
 	}
 
-	void recordDiagnostic(const NativePath& path, const SnapshotOperation operation,
+	void recordDiagnostic(const std::size_t participant, const NativePath& path, const SnapshotOperation operation,
 		const std::optional<thin_io::filesystem_error_code> nativeErrorCode)
 	{
-		std::lock_guard lock{m_resultMutex};
-		m_snapshot.diagnostics.push_back({path, operation, nativeErrorCode});
-		++m_progress.issues;
-		reportProgressLocked();
+		m_participants[participant].diagnostics.push_back({path, operation, nativeErrorCode});
+		reportProgress(participant, {.issues = 1});
 	}
 
-	void discoverEntries(const uint64_t count)
+	void discoverEntries(const std::size_t participant, const uint64_t count) noexcept
 	{
-		std::lock_guard lock{m_resultMutex};
-		m_progress.entriesDiscovered += count;
-		reportProgressLocked();
+		reportProgress(participant, {.entriesDiscovered = count});
 	}
 
-	void completeDirectory()
+	void completeDirectory(const std::size_t participant) noexcept
 	{
-		std::lock_guard lock{m_resultMutex};
-		++m_progress.directoriesCompleted;
-		reportProgressLocked();
+		reportProgress(participant, {.directoriesCompleted = 1});
 	}
 
-	void reportProgressLocked() const
+	void reportProgress(const std::size_t participant, const SnapshotScanProgress& increment) noexcept
 	{
-		if (m_progressCallback)
-			m_progressCallback(m_progress);
+		if (m_progress)
+			m_progress->add(participant, increment);
 	}
 
 	const std::atomic_bool& m_canceled;
-	SnapshotScanProgressCallback m_progressCallback;
+	SnapshotScanProgressChannel* const m_progress;
+	const SnapshotScanOptions m_options;
+	CWorkerThreadPool* m_workerPool = nullptr;
+	std::atomic_uint32_t m_activeParticipants = 1;
+	std::atomic_size_t m_recruitedParticipants = 1;
+	std::mutex m_recruitMutex;
+	HelperGate m_helperGate;
+	bool m_watchCalls = false; // Fixed before participants start.
+	std::mutex m_watchdogMutex;
+	std::condition_variable m_traversalEnded;
+	std::optional<ScanConcurrencyController> m_controller;
+	std::mutex m_controllerMutex;
+	std::chrono::steady_clock::time_point m_traversalStarted;
+	std::chrono::steady_clock::time_point m_lastAdjustment;
+	std::atomic<std::chrono::steady_clock::rep> m_nextAdjustment = 0;
+	uint64_t m_measuredOperations = 0;
+	uint64_t m_measuredLatency = 0;
+	std::optional<ScanThrottle> m_throttle;
+	std::mutex m_throttleMutex;
+	bool m_pressureBackoff = false; // Fixed before participants start.
+	std::optional<std::chrono::microseconds> m_lastStallTotal;
+	std::chrono::steady_clock::time_point m_lastThrottleAdjustment;
+	std::atomic<std::chrono::steady_clock::rep> m_nextThrottleAdjustment = 0;
+	uint64_t m_throttleMeasuredOperations = 0;
+	std::size_t m_retainedHandleLimit = 0;
+	std::atomic_size_t m_retainedHandles = 0;
 	Snapshot m_snapshot;
-	SnapshotScanProgress m_progress;
+	HardLinkTable m_hardLinks;
+	SnapshotNamePool m_names; // Shared by the entries of the tree being built, which outlives it.
+	std::atomic_uint64_t m_estimatedTreeBytes = 0; // Maintained for the budgeted file resolution only.
+	std::optional<ScanExclusions> m_exclusions; // Set once the root is known.
+	// Read from a resumed journal by path, and consumed before traversal starts.
+	std::map<NativePath, ScanJournalDirectory> m_resumedDirectories;
+	std::optional<SnapshotTree::Index> m_baselineRoot; // In the tree of the baseline.
+	std::unordered_map<SnapshotTree::Index, uint64_t> m_baselineSubtreeSizes; // Read-only once traversal starts.
+	uint64_t m_baselineRootFilesystemEntries = 0;
 	std::optional<thin_io::mount_identity> m_rootMountIdentity;
 	std::optional<thin_io::filesystem_identity> m_rootFilesystemIdentity;
-	std::mutex m_workMutex;
-	std::condition_variable m_workChanged;
-	std::deque<DirectoryWork> m_pendingDirectories;
-	std::size_t m_outstandingDirectories = 0;
+	std::vector<Participant> m_participants;
+	std::atomic_size_t m_outstandingDirectories = 0; // Queued or being processed.
+	std::atomic_size_t m_queuedDirectories = 0;
+	std::mutex m_idleMutex;
+	std::condition_variable m_workAvailable;
+	std::atomic_size_t m_idleParticipants = 0;
+	std::atomic_bool m_stopping = false;
+	std::mutex m_failureMutex;
 	std::optional<SnapshotScanFailure> m_fatalFailure;
 	bool m_unexpectedError = false;
-	std::mutex m_resultMutex;
 };
 
 } // namespace
 
-SnapshotScanResult scanSnapshot(
-	const NativePath& normalizedRootPath, const std::atomic_bool& canceled, SnapshotScanProgressCallback progressCallback)
+SnapshotScanProgressChannel::SnapshotScanProgressChannel(const std::size_t participantCount)
+	: m_counters(std::max<std::size_t>(participantCount, 1))
+{
+}
+
+SnapshotScanProgress SnapshotScanProgressChannel::sample() const noexcept
+{
+	SnapshotScanProgress progress;
+	for (const Counters& counters : m_counters)
+	{
+		progress.directoriesCompleted += counters.directoriesCompleted.load(std::memory_order_relaxed);
+		progress.entriesDiscovered += counters.entriesDiscovered.load(std::memory_order_relaxed);
+		progress.issues += counters.issues.load(std::memory_order_relaxed);
+		for (std::size_t operation = 0; operation < SnapshotTimedOperationCount; ++operation)
+		{
+			const LatencyHistogram& source = counters.latencies[operation];
+			SnapshotLatencyHistogram& target = progress.operationTimings.operations[operation];
+			target.count += source.count.load(std::memory_order_relaxed);
+			target.totalNanoseconds += source.totalNanoseconds.load(std::memory_order_relaxed);
+			for (std::size_t bucket = 0; bucket < SnapshotLatencyHistogram::BucketCount; ++bucket)
+				target.buckets[bucket] += source.buckets[bucket].load(std::memory_order_relaxed);
+		}
+	}
+	progress.expectedEntries = m_expectedEntries.load(std::memory_order_relaxed);
+	return progress;
+}
+
+void SnapshotScanProgressChannel::add(const std::size_t participant, const SnapshotScanProgress& increment) noexcept
+{
+	Counters& counters = m_counters[participant % m_counters.size()];
+	if (increment.directoriesCompleted != 0)
+		counters.directoriesCompleted.fetch_add(increment.directoriesCompleted, std::memory_order_relaxed);
+	if (increment.entriesDiscovered != 0)
+		counters.entriesDiscovered.fetch_add(increment.entriesDiscovered, std::memory_order_relaxed);
+	if (increment.issues != 0)
+		counters.issues.fetch_add(increment.issues, std::memory_order_relaxed);
+}
+
+void SnapshotScanProgressChannel::addExpectedEntries(const uint64_t count) noexcept
+{
+	m_expectedEntries.fetch_add(count, std::memory_order_relaxed);
+}
+
+void SnapshotScanProgressChannel::addLatency(
+	const std::size_t participant, const SnapshotTimedOperation operation, const uint64_t nanoseconds) noexcept
+{
+	LatencyHistogram& histogram = m_counters[participant % m_counters.size()].latencies[static_cast<std::size_t>(operation)];
+	histogram.count.fetch_add(1, std::memory_order_relaxed);
+	histogram.totalNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+	histogram.buckets[SnapshotLatencyHistogram::bucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void SnapshotScanRateEstimator::update(SnapshotScanProgress& progress, const std::chrono::steady_clock::time_point now) noexcept
+{
+	using Seconds = std::chrono::duration<double>;
+	if (!m_firstSampleTime)
+	{
+		m_firstSampleTime = now;
+		m_lastSampleTime = now;
+		m_firstEntries = progress.entriesDiscovered;
+		m_lastEntries = progress.entriesDiscovered;
+	}
+
+	const double interval = Seconds{now - m_lastSampleTime}.count();
+	if (interval > 0)
+	{
+		const double sinceFirst = Seconds{now - *m_firstSampleTime}.count();
+		if (sinceFirst <= Seconds{SmoothingTime}.count())
+			m_entriesPerSecond = static_cast<double>(progress.entriesDiscovered - m_firstEntries) / sinceFirst;
+		else
+		{
+			const double rate = static_cast<double>(progress.entriesDiscovered - m_lastEntries) / interval;
+			const double weight = 1 - std::exp(-interval / Seconds{SmoothingTime}.count());
+			m_entriesPerSecond += weight * (rate - m_entriesPerSecond);
+		}
+		m_lastSampleTime = now;
+		m_lastEntries = progress.entriesDiscovered;
+	}
+	progress.entriesPerSecond = m_entriesPerSecond;
+}
+
+std::optional<double> scanCompletedFraction(const SnapshotScanProgress& progress) noexcept
+{
+	if (progress.expectedEntries == 0)
+		return {};
+	// The last hundredth is left for the entries beyond the estimate and for the directories still being finished.
+	return std::min(static_cast<double>(progress.entriesDiscovered) / static_cast<double>(progress.expectedEntries), 0.99);
+}
+
+std::optional<std::chrono::seconds> scanRemainingTime(const SnapshotScanProgress& progress) noexcept
+{
+	if (progress.expectedEntries <= progress.entriesDiscovered || progress.entriesPerSecond <= 0)
+		return {};
+	const double seconds = static_cast<double>(progress.expectedEntries - progress.entriesDiscovered) / progress.entriesPerSecond;
+	return std::chrono::seconds{static_cast<int64_t>(std::ceil(std::min(seconds, 1e9)))};
+}
+
+SnapshotScanResult scanSnapshot(const NativePath& normalizedRootPath, const std::atomic_bool& canceled,
+	SnapshotScanProgressChannel* const progress, const SnapshotScanOptions& options)
 {
-	return Scanner{canceled, std::move(progressCallback)}.scan(normalizedRootPath);
+	return Scanner{canceled, progress, options}.scan(normalizedRootPath);
 }
 
-SnapshotScanResult scanSnapshot(
-	const NativePath& normalizedRootPath, const std::atomic_bool& canceled, CWorkerThreadPool& workerPool,
-	SnapshotScanProgressCallback progressCallback)
+SnapshotScanResult scanSnapshot(const NativePath& normalizedRootPath, const std::atomic_bool& canceled,
+	CWorkerThreadPool& workerPool, SnapshotScanProgressChannel* const progress, const SnapshotScanOptions& options)
 {
-	return Scanner{canceled, std::move(progressCallback)}.scan(normalizedRootPath, workerPool);
+	// Helper tasks share the scanner, so that neither those still queued when traversal ends nor those left blocked in an
+	// abandoned call outlive it.
+	return std::make_shared<Scanner>(canceled, progress, options)->scan(normalizedRootPath, workerPool);
 }
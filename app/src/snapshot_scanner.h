@@ -2,13 +2,18 @@
 
 #include "snapshot.h"
 
+#include <array>
 #include <atomic>
-#include <functional>
+#include <chrono>
+#include <cstddef>
 #include <optional>
 #include <stdint.h>
 #include <variant>
+#include <vector>
 
 class CWorkerThreadPool;
+class ScanJournal;
+class ScanTrace;
 
 enum class SnapshotScanFailureCode : uint8_t {
 	invalid_root,
@@ -19,6 +24,7 @@ enum class SnapshotScanFailureCode : uint8_t {
 	root_filesystem_identity_mismatch,
 	root_enumeration_unavailable,
 	root_filesystem_identity_changed,
+	root_call_stalled, // A native call made for the root directory outlived the call deadline.
 	unexpected_error
 };
 
@@ -41,19 +47,185 @@ struct SnapshotScanProgress
 	uint64_t directoriesCompleted = 0;
 	uint64_t entriesDiscovered = 0;
 	uint64_t issues = 0;
+	// The entries the scan expects to discover in all, 0 while unknown: the baseline's count below the scan root, or the files
+	// in use on a filesystem scanned from its mount point. Either may be exceeded, so entriesDiscovered is not bounded by it.
+	uint64_t expectedEntries = 0;
+	// Entries discovered per second, smoothed over several seconds by SnapshotScanRateEstimator; 0 until measured.
+	double entriesPerSecond = 0;
+	// Summed over the participants as for the counters above.
+	SnapshotOperationTimings operationTimings{};
 
 	[[nodiscard]] bool operator==(const SnapshotScanProgress&) const = default;
 };
 
+enum class SnapshotTraversalMode : uint8_t {
+	// Subdirectories are opened and their children queried relative to the parent's open handle where the platform
+	// supports it, so the cost of path resolution does not grow with depth.
+	directory_handles,
+	// Every directory and entry is resolved from its absolute path.
+	absolute_paths
+};
+
+enum class SnapshotMetadataOrder : uint8_t {
+	// Children are queried in the order they are stored.
+	name,
+	// Children are queried in the order of the file ids reported by enumeration, where the platform reports them, which
+	// cuts seeks on rotational disks and cache misses on network servers. Falls back to name order elsewhere.
+	file_id
+};
+
+enum class SnapshotFileResolution : uint8_t {
+	// Every listed entry becomes a snapshot entry.
+	entries,
+	// The regular files of every directory are folded into counters on the directory (SnapshotEntry::foldedFiles), which
+	// keeps memory proportional to the directory count; sizes and comparisons then resolve to directories.
+	directories,
+	// Entries until the estimated memory of the tree reaches memoryBudget, directories for the directories listed after.
+	budgeted
+};
+
+struct SnapshotConcurrencyOptions
+{
+	// Adapts the number of active participants to the measured throughput and latency of filesystem calls, between one
+	// and the worker pool size. Otherwise every pool worker participates throughout.
+	bool adaptive = false;
+	uint32_t initialParticipants = 8;
+	std::chrono::milliseconds adjustmentInterval{200};
+};
+
+// Keeps a scan from hurting the latency of other workloads on the host, at the cost of scan speed.
+struct SnapshotScanThrottle
+{
+	// Native filesystem calls per second across all participants; 0 leaves the rate unlimited.
+	uint32_t maximumOperationsPerSecond = 0;
+	// Participants run at the lowest best-effort I/O priority while they traverse.
+	bool lowerIoPriority = false;
+	// Share of wall time, between 0 and 1, during which some task on the host may stall on I/O (Linux pressure stall
+	// information). Above it the call rate is halved, below it the rate recovers gradually; 0 disables the backoff, which
+	// is also inactive where pressure information is unavailable.
+	double ioPressureTarget = 0;
+	std::chrono::milliseconds pressureInterval{500};
+
+	[[nodiscard]] bool operator==(const SnapshotScanThrottle&) const = default;
+};
+
+struct SnapshotScanOptions
+{
+	SnapshotTraversalMode traversalMode = SnapshotTraversalMode::directory_handles;
+	// Counts the handles held by active traversal participants as well as those retained for queued subdirectories.
+	// Subdirectories queued beyond the budget are reopened from their absolute path.
+	uint32_t maximumOpenDirectoryHandles = 256;
+	// Directories with more children than this have their child metadata collected in chunks of this size, which idle
+	// participants can pick up. A split directory keeps its handle open until its last chunk is done.
+	uint32_t metadataChunkSize = 4096;
+	// Only the order of the filesystem calls depends on this, never the snapshot.
+	SnapshotMetadataOrder metadataOrder = SnapshotMetadataOrder::file_id;
+	SnapshotFileResolution fileResolution = SnapshotFileResolution::entries;
+	// In bytes, for the budgeted resolution. The estimate counts the entries and names of the tree, not the allocator's
+	// overhead or the scanner's transient state, and is checked as each directory is listed.
+	uint64_t memoryBudget = 0;
+	SnapshotConcurrencyOptions concurrency;
+	SnapshotScanThrottle throttle;
+	// Caps the active participants of a pool scan, read as the scan goes; lets scans sharing one worker pool divide it.
+	// Participants beyond the cap return their pool workers once they run out of work.
+	const std::atomic_uint32_t* participantShare = nullptr;
+	// Applied before a directory is enumerated, so excluded subtrees cost no enumeration; a marker rule costs one metadata
+	// lookup per marker and directory. The rules are stored in the snapshot.
+	std::vector<SnapshotExclusionRule> exclusionRules;
+	// The path that glob rules with a separator are relative to; the scan root when empty. Lets the scan of a mounted
+	// filesystem apply the rules of the scan that contains it.
+	NativePath exclusionRootPath;
+	// An earlier snapshot containing the scan root, read while the scan runs. The subdirectories of every directory are
+	// queued largest subtree first by their entry counts in it, so that the participants that go looking for work start
+	// the historically largest subtrees early instead of leaving one of them to finish alone. Only the order of the
+	// filesystem calls depends on this, never the snapshot.
+	const Snapshot* baseline = nullptr;
+	// Receives the timeline of every participant's activity; nothing is timed for it without one.
+	ScanTrace* trace = nullptr;
+	// For scans on a pool of several workers, a native call made during traversal that runs longer than this is abandoned
+	// with the subtree of the directory it was made for, which becomes stalled, and the scan goes on without it; 0 waits for
+	// every call. The calling thread then watches the calls instead of traversing, and a canceled or failed scan returns
+	// without waiting for calls in progress. The worker of an abandoned call stays blocked in it until the call returns.
+	// Calls made for the root before traversal starts are not watched.
+	std::chrono::milliseconds callDeadline{0};
+	// Receives a record of every directory once its listing and child metadata are collected. When the journal was read
+	// by ScanJournal::resume() from a scan of the same root with the same options, the scan restores the directories it
+	// recorded and traverses only those it had not reached, keeping the start time and space of the first attempt;
+	// otherwise the journal starts over. Directory costs, timings and the concurrency history cover this attempt only.
+	ScanJournal* journal = nullptr;
+};
+
+// Progress of a running scan, sampled by any thread on its own schedule. Each participant adds to its own counters, so
+// recording never waits on a lock; a sample sums them, with every field monotonic but not captured at a single instant.
+class SnapshotScanProgressChannel final
+{
+public:
+	// Participants beyond participantCount share counters, which stays correct but no longer contention-free.
+	explicit SnapshotScanProgressChannel(std::size_t participantCount = 1);
+
+	// The rate is left to SnapshotScanRateEstimator.
+	[[nodiscard]] SnapshotScanProgress sample() const noexcept;
+	// Only the counters of increment are added.
+	void add(std::size_t participant, const SnapshotScanProgress& increment) noexcept;
+	// Each scan sharing the channel adds the entries it expects below its own root, once, before traversal starts.
+	void addExpectedEntries(uint64_t count) noexcept;
+	void addLatency(std::size_t participant, SnapshotTimedOperation operation, uint64_t nanoseconds) noexcept;
+
+private:
+	struct LatencyHistogram
+	{
+		std::atomic_uint64_t count = 0;
+		std::atomic_uint64_t totalNanoseconds = 0;
+		std::array<std::atomic_uint64_t, SnapshotLatencyHistogram::BucketCount> buckets{};
+	};
+
+	struct alignas(64) Counters
+	{
+		std::atomic_uint64_t directoriesCompleted = 0;
+		std::atomic_uint64_t entriesDiscovered = 0;
+		std::atomic_uint64_t issues = 0;
+		std::array<LatencyHistogram, SnapshotTimedOperationCount> latencies{};
+	};
+
+	std::vector<Counters> m_counters;
+	std::atomic_uint64_t m_expectedEntries = 0;
+};
+
+// Smooths the discovery rate over the successive samples of one scan, for the one thread that publishes them.
+class SnapshotScanRateEstimator final
+{
+public:
+	// Sets progress.entriesPerSecond: the mean rate since the first sample for the first SmoothingTime, an exponentially
+	// weighted one after that, so that the estimate follows phases of the scan without jumping with every sample.
+	void update(SnapshotScanProgress& progress, std::chrono::steady_clock::time_point now) noexcept;
+
+	static constexpr std::chrono::seconds SmoothingTime{10};
+
+private:
+	std::optional<std::chrono::steady_clock::time_point> m_firstSampleTime;
+	std::chrono::steady_clock::time_point m_lastSampleTime;
+	uint64_t m_firstEntries = 0;
+	uint64_t m_lastEntries = 0;
+	double m_entriesPerSecond = 0;
+};
+
+// The share of the expected entries discovered so far, kept below 1 since a scan may find more than expected; nothing
+// while no total is expected.
+[[nodiscard]] std::optional<double> scanCompletedFraction(const SnapshotScanProgress& progress) noexcept;
+// Time left at the current rate to discover the remaining expected entries; nothing while either is unknown or once
+// the expected entries have all been discovered.
+[[nodiscard]] std::optional<std::chrono::seconds> scanRemainingTime(const SnapshotScanProgress& progress) noexcept;
+
 using SnapshotScanResult = std::variant<Snapshot, SnapshotScanFailure, SnapshotScanCanceled>;
-using SnapshotScanProgressCallback = std::function<void(const SnapshotScanProgress&)>;
 
 // Runs traversal entirely on the calling thread.
 [[nodiscard]] SnapshotScanResult scanSnapshot(
 	const NativePath& normalizedRootPath, const std::atomic_bool& canceled,
-	SnapshotScanProgressCallback progressCallback = {});
+	SnapshotScanProgressChannel* progress = nullptr, const SnapshotScanOptions& options = {});
 
-// The calling thread participates, so maxWorkersCount() is the total traversal participant count.
+// The calling thread participates, so maxWorkersCount() is the total traversal participant count, unless it watches calls
+// against options.callDeadline. The other participants are pool tasks that stay queued until a worker is free, so the pool
+// may be shared with other scans.
 [[nodiscard]] SnapshotScanResult scanSnapshot(
 	const NativePath& normalizedRootPath, const std::atomic_bool& canceled, CWorkerThreadPool& workerPool,
-	SnapshotScanProgressCallback progressCallback = {});
+	SnapshotScanProgressChannel* progress = nullptr, const SnapshotScanOptions& options = {});
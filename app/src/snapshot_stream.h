@@ -0,0 +1,33 @@
+#pragma once
+
+#include "snapshot.h"
+
+#include <stdint.h>
+
+class QDataStream;
+
+// The encoding of the parts of a snapshot file, shared with the scan journal (ScanJournal) so that both stay in step.
+// Readers return false on a truncated or out-of-range value.
+namespace SnapshotStream {
+
+void configure(QDataStream& stream);
+
+void writeNativeString(QDataStream& stream, const NativePath& value);
+[[nodiscard]] bool readNativeString(QDataStream& stream, NativePath& value);
+// A single path component, neither empty nor a dot entry.
+[[nodiscard]] bool isValidName(const NativeName& name);
+
+// Everything of an entry but its children.
+void writeEntryFields(QDataStream& stream, const SnapshotEntry& entry);
+[[nodiscard]] bool readEntryFields(QDataStream& stream, SnapshotEntry& entry, uint16_t formatVersion = Snapshot::CurrentFormatVersion);
+
+void writeDiagnostic(QDataStream& stream, const SnapshotDiagnostic& diagnostic);
+[[nodiscard]] bool readDiagnostic(QDataStream& stream, SnapshotDiagnostic& diagnostic);
+
+void writeExclusionRule(QDataStream& stream, const SnapshotExclusionRule& rule);
+[[nodiscard]] bool readExclusionRule(QDataStream& stream, SnapshotExclusionRule& rule);
+
+void writeFilesystemSpace(QDataStream& stream, const thin_io::filesystem_space& space);
+[[nodiscard]] bool readFilesystemSpace(QDataStream& stream, thin_io::filesystem_space& space);
+
+} // namespace SnapshotStream
@@ -0,0 +1,456 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <deque>
+#include <limits>
+#include <utility>
+
+namespace {
+
+enum NodeFlag : uint8_t {
+	IsLink = 1 << 0,
+	Sparse = 1 << 1,
+	Compressed = 1 << 2,
+	HasMetadata = 1 << 3,
+	HasIdentity = 1 << 4,
+	HasReparseTag = 1 << 5,
+	HasFoldedFiles = 1 << 6
+};
+
+const NativePathCharacter* nameCharacters(const NativeNameView name) noexcept
+{
+#ifdef _WIN32
+	return reinterpret_cast<const NativePathCharacter*>(name.utf16());
+#else
+	return name.data();
+#endif
+}
+
+template <class Value>
+const Value* findSparse(const std::vector<std::pair<SnapshotTree::Index, Value>>& values, const SnapshotTree::Index entry) noexcept
+{
+	const auto value = std::ranges::lower_bound(values, entry, {}, &std::pair<SnapshotTree::Index, Value>::first);
+	return value != values.end() && value->first == entry ? &value->second : nullptr;
+}
+
+} // namespace
+
+SnapshotTree::SnapshotTree(SnapshotEntry&& root)
+{
+	reserve(root);
+	NameHandles names;
+	append({}, root);
+	// The children of each directory become the next range of entries, in the order the directories were numbered in.
+	std::deque<std::pair<Index, decltype(SnapshotEntry::children)>> pending;
+	pending.emplace_back(RootIndex, std::move(root.children));
+	root = {};
+	while (!pending.empty())
+	{
+		auto& [directory, children] = pending.front();
+		setChildren(directory, children.size());
+		for (auto child = children.begin(), end = children.end(); child != end; ++child)
+		{
+			const Index index = append(internName(child.key(), names), child.value());
+			if (!child.value().children.empty())
+				pending.emplace_back(index, std::move(child.value().children));
+		}
+		pending.pop_front();
+	}
+	finish();
+}
+
+SnapshotTree::SnapshotTree(const SnapshotEntry& root)
+{
+	reserve(root);
+	NameHandles names;
+	append({}, root);
+	std::deque<std::pair<Index, const SnapshotEntry*>> pending;
+	pending.emplace_back(RootIndex, &root);
+	while (!pending.empty())
+	{
+		const auto [directory, entry] = pending.front();
+		pending.pop_front();
+		setChildren(directory, entry->children.size());
+		for (auto child = entry->children.begin(), end = entry->children.end(); child != end; ++child)
+		{
+			const Index index = append(internName(child.key(), names), child.value());
+			if (!child.value().children.empty())
+				pending.emplace_back(index, &child.value());
+		}
+	}
+	finish();
+}
+
+void SnapshotTree::reserve(const SnapshotEntry& root)
+{
+	// The names are left to grow, since how many of them are distinct is only known once they are pooled.
+	std::size_t entries = 0;
+	const auto count = [&entries](auto&& self, const SnapshotEntry& entry) -> void {
+		entries += entry.children.size();
+		for (auto child = entry.children.begin(), end = entry.children.end(); child != end; ++child)
+			self(self, child.value());
+	};
+	count(count, root);
+	m_nodes.reserve(entries + 1);
+	m_metadata.reserve(entries + 1);
+	m_identities.reserve(entries + 1);
+}
+
+SnapshotTree::NameHandle SnapshotTree::internName(const NativeName& name, NameHandles& handles)
+{
+	const auto [pooled, added] = handles.try_emplace(name, nameCount());
+	if (added)
+	{
+		const NativeNameView characters = name;
+		m_names.insert(m_names.end(), nameCharacters(characters), nameCharacters(characters) + characters.size());
+		m_nameOffsets.push_back(m_names.size());
+	}
+	return pooled->second;
+}
+
+SnapshotTree::Index SnapshotTree::append(const NameHandle name, const SnapshotEntry& entry)
+{
+	const auto index = static_cast<Index>(m_nodes.size());
+	Node node{};
+	node.name = name;
+	node.kind = static_cast<uint8_t>(entry.attributes.kind);
+	node.traversalState = static_cast<uint8_t>(entry.traversalState);
+	uint8_t flags = 0;
+	if (entry.attributes.is_link)
+		flags |= IsLink;
+	if (entry.attributes.sparse)
+		flags |= Sparse;
+	if (entry.attributes.compressed)
+		flags |= Compressed;
+	if (entry.attributes.reparse_tag != 0)
+	{
+		flags |= HasReparseTag;
+		m_reparseTags.emplace_back(index, entry.attributes.reparse_tag);
+	}
+	if (entry.foldedFiles)
+	{
+		flags |= HasFoldedFiles;
+		m_foldedFiles.emplace_back(index, *entry.foldedFiles);
+	}
+
+	Metadata metadata{};
+	Identity identity{};
+	if (entry.metadata)
+	{
+		flags |= HasMetadata;
+		metadata = {entry.metadata->logicalSize, entry.metadata->allocatedSize};
+		if (entry.metadata->hardLinkCount < HardLinkCountElsewhere)
+			node.hardLinkCount = static_cast<uint8_t>(entry.metadata->hardLinkCount);
+		else
+		{
+			node.hardLinkCount = HardLinkCountElsewhere;
+			m_hardLinkCounts.emplace_back(index, entry.metadata->hardLinkCount);
+		}
+		if (entry.metadata->identity)
+		{
+			flags |= HasIdentity;
+			const thin_io::filesystem_identity filesystem = entry.metadata->identity->filesystem;
+			auto known = std::ranges::find(m_filesystems, filesystem);
+			if (known == m_filesystems.end())
+				known = m_filesystems.insert(known, filesystem);
+			identity = {static_cast<uint32_t>(known - m_filesystems.begin()), entry.metadata->identity->entry};
+		}
+	}
+	node.flags = flags;
+
+	m_nodes.push_back(node);
+	m_metadata.push_back(metadata);
+	m_identities.push_back(identity);
+	return index;
+}
+
+void SnapshotTree::setChildren(const Index directory, const std::size_t childCount) noexcept
+{
+	m_nodes[directory].firstChild = static_cast<Index>(m_nodes.size());
+	m_nodes[directory].childCount = static_cast<Index>(childCount);
+}
+
+void SnapshotTree::finish() noexcept
+{
+	Index nextChildren = size();
+	for (auto node = m_nodes.rbegin(); node != m_nodes.rend(); ++node)
+	{
+		if (node->childCount == 0)
+			node->firstChild = nextChildren;
+		else
+			nextChildren = node->firstChild;
+	}
+	m_names.shrink_to_fit();
+	m_nameOffsets.shrink_to_fit();
+	m_localAllocatedSizes.assign(m_nodes.size(), 0);
+	m_subtreeAllocatedSizes.assign(m_nodes.size(), 0);
+	for (BitColumn* const column : {&m_hasLocalAllocatedSize, &m_subtreeAllocatedSizeExact, &m_hasSubtreeAllocatedSizeLowerBound,
+			 &m_localCoverageComplete, &m_subtreeCoverageComplete, &m_allocationOverflow})
+		column->assign(m_nodes.size());
+}
+
+NativeNameView SnapshotTree::name(const Index entry) const noexcept
+{
+	if (entry == RootIndex)
+		return {};
+	return pooledName(m_nodes[entry].name);
+}
+
+SnapshotTree::NameHandle SnapshotTree::nameHandle(const Index entry) const noexcept
+{
+	assert(entry != RootIndex);
+	return m_nodes[entry].name;
+}
+
+SnapshotTree::NameHandle SnapshotTree::nameCount() const noexcept
+{
+	return static_cast<NameHandle>(m_nameOffsets.size() - 1);
+}
+
+NativeNameView SnapshotTree::pooledName(const NameHandle name) const noexcept
+{
+	const uint64_t begin = m_nameOffsets[name];
+	return {m_names.data() + begin, static_cast<qsizetype>(m_nameOffsets[name + 1] - begin)};
+}
+
+thin_io::entry_attributes SnapshotTree::attributes(const Index entry) const noexcept
+{
+	const Node& node = m_nodes[entry];
+	thin_io::entry_attributes attributes;
+	attributes.kind = static_cast<thin_io::entry_kind>(node.kind);
+	attributes.is_link = (node.flags & IsLink) != 0;
+	attributes.sparse = (node.flags & Sparse) != 0;
+	attributes.compressed = (node.flags & Compressed) != 0;
+	if (node.flags & HasReparseTag)
+		attributes.reparse_tag = *findSparse(m_reparseTags, entry);
+	return attributes;
+}
+
+thin_io::entry_kind SnapshotTree::kind(const Index entry) const noexcept
+{
+	return static_cast<thin_io::entry_kind>(m_nodes[entry].kind);
+}
+
+std::optional<SnapshotEntryMetadata> SnapshotTree::metadata(const Index entry) const noexcept
+{
+	const Node& node = m_nodes[entry];
+	if (!(node.flags & HasMetadata))
+		return {};
+	const Metadata& metadata = m_metadata[entry];
+	const uint64_t hardLinkCount = node.hardLinkCount != HardLinkCountElsewhere ? node.hardLinkCount
+		: *findSparse(m_hardLinkCounts, entry);
+	SnapshotEntryMetadata result{metadata.logicalSize, metadata.allocatedSize, hardLinkCount, {}};
+	if (node.flags & HasIdentity)
+	{
+		const Identity& identity = m_identities[entry];
+		result.identity = thin_io::entry_identity{m_filesystems[identity.filesystem], identity.entry};
+	}
+	return result;
+}
+
+DirectoryTraversalState SnapshotTree::traversalState(const Index entry) const noexcept
+{
+	return static_cast<DirectoryTraversalState>(m_nodes[entry].traversalState);
+}
+
+std::optional<SnapshotFoldedFiles> SnapshotTree::foldedFiles(const Index entry) const noexcept
+{
+	if (!(m_nodes[entry].flags & HasFoldedFiles))
+		return {};
+	return *findSparse(m_foldedFiles, entry);
+}
+
+SnapshotTree::Children SnapshotTree::children(const Index entry) const noexcept
+{
+	const Node& node = m_nodes[entry];
+	return {node.firstChild, node.firstChild + node.childCount};
+}
+
+std::optional<SnapshotTree::Index> SnapshotTree::parent(const Index entry) const noexcept
+{
+	if (entry == RootIndex)
+		return {};
+	// The last entry whose children begin at or before this one is the one whose range holds it.
+	const auto next = std::ranges::upper_bound(m_nodes, entry, {}, &Node::firstChild);
+	assert(next != m_nodes.begin());
+	return static_cast<Index>(next - m_nodes.begin() - 1);
+}
+
+std::optional<SnapshotTree::Index> SnapshotTree::findChild(const Index directory, const NativeNameView name) const noexcept
+{
+	const Children range = children(directory);
+	const auto child = std::ranges::lower_bound(range, name, nativeNameLess, [this](const Index candidate) { return this->name(candidate); });
+	if (child == range.end() || !nativeNamesEqual(this->name(*child), name))
+		return {};
+	return *child;
+}
+
+std::optional<SnapshotTree::Index> SnapshotTree::find(const NativePath& rootPath, const NativePath& path) const
+{
+	if (empty())
+		return {};
+	const auto components = nativeDescendantComponents(rootPath, path);
+	if (!components)
+		return {};
+	Index entry = RootIndex;
+	for (const NativeName& component : *components)
+	{
+		const auto child = findChild(entry, component);
+		if (!child)
+			return {};
+		entry = *child;
+	}
+	return entry;
+}
+
+NativePath SnapshotTree::path(const NativePath& rootPath, const Index entry) const
+{
+	std::vector<Index> ancestry;
+	for (std::optional<Index> current = entry; current && *current != RootIndex; current = parent(*current))
+		ancestry.push_back(*current);
+	NativePath result = rootPath;
+	for (auto ancestor = ancestry.rbegin(); ancestor != ancestry.rend(); ++ancestor)
+		result = appendNativeName(result, name(*ancestor));
+	return result;
+}
+
+SnapshotEntry SnapshotTree::toEntry(const Index entry) const
+{
+	SnapshotEntry result;
+	result.attributes = attributes(entry);
+	result.metadata = metadata(entry);
+	result.traversalState = traversalState(entry);
+	result.foldedFiles = foldedFiles(entry);
+	const Children range = children(entry);
+	result.children.reserve(range.size());
+	for (const Index child : range)
+		result.children.append_sorted_unique(nativeNameFromView(name(child)), toEntry(child));
+	return result;
+}
+
+SnapshotEntryDerivedData SnapshotTree::derived(const Index entry) const noexcept
+{
+	SnapshotEntryDerivedData derived;
+	derived.localCoverageComplete = localCoverageComplete(entry);
+	derived.subtreeCoverageComplete = subtreeCoverageComplete(entry);
+	derived.allocationOverflow = allocationOverflow(entry);
+	derived.localAllocatedSize = localAllocatedSize(entry);
+	derived.subtreeAllocatedSize = subtreeAllocatedSize(entry);
+	derived.knownSubtreeAllocatedSizeLowerBound = knownSubtreeAllocatedSizeLowerBound(entry);
+	return derived;
+}
+
+void SnapshotTree::setDerived(const Index entry, const SnapshotEntryDerivedData& derived) noexcept
+{
+	assert(!derived.subtreeAllocatedSize || derived.subtreeAllocatedSize == derived.knownSubtreeAllocatedSizeLowerBound);
+	m_localCoverageComplete.set(entry, derived.localCoverageComplete);
+	m_subtreeCoverageComplete.set(entry, derived.subtreeCoverageComplete);
+	m_allocationOverflow.set(entry, derived.allocationOverflow);
+	m_hasLocalAllocatedSize.set(entry, derived.localAllocatedSize.has_value());
+	m_subtreeAllocatedSizeExact.set(entry, derived.subtreeAllocatedSize.has_value());
+	m_hasSubtreeAllocatedSizeLowerBound.set(entry, derived.knownSubtreeAllocatedSizeLowerBound.has_value());
+	m_localAllocatedSizes[entry] = derived.localAllocatedSize.value_or(0);
+	m_subtreeAllocatedSizes[entry] = derived.knownSubtreeAllocatedSizeLowerBound.value_or(0);
+}
+
+void SnapshotTree::aggregateDerivedData(const Index entry) noexcept
+{
+	// The exact size is summed only while every part of it is known; the lower bound skips the unknown parts. Both start
+	// from the entry's own size and fail together on overflow, so an exact size always equals the lower bound.
+	const bool hasLocalSize = m_hasLocalAllocatedSize.test(entry);
+	const uint64_t localSize = m_localAllocatedSizes[entry];
+	bool coverageComplete = m_localCoverageComplete.test(entry);
+	bool exactOverflow = m_allocationOverflow.test(entry);
+	bool knownOverflow = exactOverflow;
+	bool exact = hasLocalSize;
+	bool known = hasLocalSize;
+	uint64_t exactSize = localSize;
+	uint64_t knownSize = localSize;
+
+	for (const Index child : children(entry))
+	{
+		coverageComplete &= m_subtreeCoverageComplete.test(child);
+		const bool childOverflow = m_allocationOverflow.test(child);
+		exactOverflow |= childOverflow;
+		knownOverflow |= childOverflow;
+		const uint64_t childSize = m_subtreeAllocatedSizes[child];
+		if (exact)
+		{
+			exact = m_subtreeAllocatedSizeExact.test(child);
+			if (exact && childSize > std::numeric_limits<uint64_t>::max() - exactSize)
+			{
+				exactOverflow = true;
+				exact = false;
+			}
+			exactSize += exact ? childSize : 0;
+		}
+		if (knownOverflow)
+		{
+			known = false;
+		}
+		else if (m_hasSubtreeAllocatedSizeLowerBound.test(child))
+		{
+			if (!known)
+			{
+				known = true;
+				knownSize = childSize;
+			}
+			else if (childSize > std::numeric_limits<uint64_t>::max() - knownSize)
+			{
+				knownOverflow = true;
+				known = false;
+			}
+			else
+			{
+				knownSize += childSize;
+			}
+		}
+	}
+
+	exact = exact && coverageComplete && !exactOverflow;
+	known = known && !knownOverflow;
+	assert(!exact || (known && knownSize == exactSize));
+	m_subtreeCoverageComplete.set(entry, coverageComplete);
+	m_allocationOverflow.set(entry, exactOverflow || knownOverflow);
+	m_subtreeAllocatedSizeExact.set(entry, exact);
+	m_hasSubtreeAllocatedSizeLowerBound.set(entry, known);
+	m_subtreeAllocatedSizes[entry] = known ? knownSize : 0;
+}
+
+std::size_t SnapshotTree::memoryUsage() const noexcept
+{
+	return m_nodes.capacity() * sizeof(Node)
+		+ m_names.capacity() * sizeof(NativePathCharacter)
+		+ m_nameOffsets.capacity() * sizeof(uint64_t)
+		+ m_metadata.capacity() * sizeof(Metadata)
+		+ m_identities.capacity() * sizeof(Identity)
+		+ m_filesystems.capacity() * sizeof(thin_io::filesystem_identity)
+		+ m_hardLinkCounts.capacity() * sizeof(std::pair<Index, uint64_t>)
+		+ m_reparseTags.capacity() * sizeof(std::pair<Index, uint32_t>)
+		+ m_foldedFiles.capacity() * sizeof(std::pair<Index, SnapshotFoldedFiles>)
+		+ m_localAllocatedSizes.capacity() * sizeof(uint64_t)
+		+ m_subtreeAllocatedSizes.capacity() * sizeof(uint64_t)
+		+ m_hasLocalAllocatedSize.memoryUsage()
+		+ m_subtreeAllocatedSizeExact.memoryUsage()
+		+ m_hasSubtreeAllocatedSizeLowerBound.memoryUsage()
+		+ m_localCoverageComplete.memoryUsage()
+		+ m_subtreeCoverageComplete.memoryUsage()
+		+ m_allocationOverflow.memoryUsage();
+}
+
+bool SnapshotTree::operator==(const SnapshotTree& other) const
+{
+	// The same entries are always laid out the same way.
+	return m_nodes == other.m_nodes && m_names == other.m_names && m_nameOffsets == other.m_nameOffsets
+		&& m_metadata == other.m_metadata && m_identities == other.m_identities && m_filesystems == other.m_filesystems
+		&& m_hardLinkCounts == other.m_hardLinkCounts && m_reparseTags == other.m_reparseTags && m_foldedFiles == other.m_foldedFiles;
+}
+
+bool isHardLinkAlias(const SnapshotTree& tree, const SnapshotTree::Index entry) noexcept
+{
+	if (tree.traversalState(entry) == DirectoryTraversalState::mount_boundary || tree.kind(entry) != thin_io::entry_kind::regular_file)
+		return false;
+	const auto metadata = tree.metadata(entry);
+	return metadata && metadata->hardLinkCount > 1 && metadata->identity;
+}
@@ -25,12 +25,12 @@ constexpr int RootPercentageColumn = 3;
 class SnapshotUsageTreeItem final : public QTreeWidgetItem
 {
 public:
-	SnapshotUsageTreeItem(const SnapshotEntry& entry_, NativePath path_)
-		: entry{&entry_}, path{std::move(path_)}
+	SnapshotUsageTreeItem(const SnapshotTree::Index entry_, NativePath path_)
+		: entry{entry_}, path{std::move(path_)}
 	{
 	}
 
-	const SnapshotEntry* entry;
+	SnapshotTree::Index entry;
 	NativePath path;
 	bool childrenPopulated = false;
 };
@@ -42,20 +42,20 @@ struct DisplayedAllocation
 	bool overflow = false;
 };
 
-std::optional<uint64_t> exactDisplayedAllocatedSize(const SnapshotEntry& entry)
+std::optional<uint64_t> exactDisplayedAllocatedSize(const SnapshotTree& tree, const SnapshotTree::Index entry)
 {
-	if (entry.attributes.kind == thin_io::entry_kind::directory)
-		return entry.derived.subtreeAllocatedSize;
-	return entry.derived.localAllocatedSize;
+	if (tree.kind(entry) == thin_io::entry_kind::directory)
+		return tree.subtreeAllocatedSize(entry);
+	return tree.localAllocatedSize(entry);
 }
 
-DisplayedAllocation displayedAllocation(const SnapshotEntry& entry)
+DisplayedAllocation displayedAllocation(const SnapshotTree& tree, const SnapshotTree::Index entry)
 {
-	if (const std::optional<uint64_t> exactSize = exactDisplayedAllocatedSize(entry))
+	if (const std::optional<uint64_t> exactSize = exactDisplayedAllocatedSize(tree, entry))
 		return {*exactSize, true, false};
-	if (entry.derived.allocationOverflow)
+	if (tree.allocationOverflow(entry))
 		return {{}, false, true};
-	return {entry.derived.knownSubtreeAllocatedSizeLowerBound, false, false};
+	return {tree.knownSubtreeAllocatedSizeLowerBound(entry), false, false};
 }
 
 QString formatDisplayedAllocation(const DisplayedAllocation& allocation)
@@ -76,25 +76,31 @@ QString formatPercentage(const DisplayedAllocation& numerator, const DisplayedAl
 		static_cast<double>(*numerator.bytes) * 100.0 / static_cast<double>(*denominator.bytes), 'f', 1) + "%";
 }
 
-QString entryStateSuffix(const SnapshotEntry& entry)
+QString entryStateSuffix(const SnapshotTree& tree, const SnapshotTree::Index entry)
 {
-	switch (entry.traversalState)
+	switch (tree.traversalState(entry))
 	{
 	case DirectoryTraversalState::enumeration_failed:
 	case DirectoryTraversalState::metadata_unavailable:
 		return {};
 	case DirectoryTraversalState::link_boundary: return " (link boundary)";
 	case DirectoryTraversalState::mount_boundary: return " (mount boundary)";
-	case DirectoryTraversalState::not_directory: return entry.attributes.is_link ? " (link)" : QString{};
-	case DirectoryTraversalState::completed: return {};
+	case DirectoryTraversalState::excluded: return " (excluded)";
+	case DirectoryTraversalState::stalled: return " (stalled)";
+	case DirectoryTraversalState::not_directory: return tree.attributes(entry).is_link ? " (link)" : QString{};
+	case DirectoryTraversalState::completed:
+		if (const auto foldedFiles = tree.foldedFiles(entry))
+			return QString{" (%1 files counted)"}.arg(static_cast<qulonglong>(foldedFiles->files));
+		return {};
 	}
 	return {};
 }
 
-QString entryQualification(const SnapshotEntry& entry)
+QString entryQualification(const SnapshotTree& tree, const SnapshotTree::Index entry)
 {
 	QStringList qualifications;
-	switch (entry.traversalState)
+	const DirectoryTraversalState traversalState = tree.traversalState(entry);
+	switch (traversalState)
 	{
 	case DirectoryTraversalState::enumeration_failed:
 		qualifications.push_back("Directory enumeration failed; this subtree may be incomplete.");
@@ -108,13 +114,30 @@ QString entryQualification(const SnapshotEntry& entry)
 	case DirectoryTraversalState::mount_boundary:
 		qualifications.push_back("This filesystem or mount boundary was intentionally not traversed.");
 		break;
+	case DirectoryTraversalState::excluded:
+		qualifications.push_back("An exclusion rule kept this directory from being traversed.");
+		break;
+	case DirectoryTraversalState::stalled:
+		qualifications.push_back("A filesystem call for this directory did not return in time; this subtree was abandoned.");
+		break;
 	case DirectoryTraversalState::not_directory:
 	case DirectoryTraversalState::completed:
 		break;
 	}
-	if (entry.attributes.is_link && entry.traversalState != DirectoryTraversalState::link_boundary)
+	if (tree.attributes(entry).is_link && traversalState != DirectoryTraversalState::link_boundary)
 		qualifications.push_back("This link target was intentionally not traversed.");
-	const DisplayedAllocation allocation = displayedAllocation(entry);
+	if (const std::optional<SnapshotFoldedFiles> foldedFiles = tree.foldedFiles(entry))
+	{
+		const SnapshotFoldedFiles& folded = *foldedFiles;
+		qualifications.push_back(QString{"This directory was scanned at directory resolution: its %1 regular files are counted "
+			"in its total instead of being listed."}.arg(static_cast<qulonglong>(folded.files)));
+		if (folded.hardLinkCandidates > 0)
+			qualifications.push_back(QString{"%1 of them have other hard links and are not included in the allocated size."}
+				.arg(static_cast<qulonglong>(folded.hardLinkCandidates)));
+		if (folded.metadataUnavailable > 0)
+			qualifications.push_back(QString{"%1 of them could not be measured."}.arg(static_cast<qulonglong>(folded.metadataUnavailable)));
+	}
+	const DisplayedAllocation allocation = displayedAllocation(tree, entry);
 	if (allocation.overflow)
 		qualifications.push_back("Allocated-size arithmetic overflowed; the subtree total is unavailable.");
 	else if (!allocation.exact && allocation.bytes)
@@ -196,7 +219,8 @@ void SnapshotUsageWidget::setSnapshot(std::shared_ptr<const Snapshot> snapshot)
 		}
 	}
 
-	const DisplayedAllocation rootAllocation = displayedAllocation(m_snapshot->root);
+	const SnapshotTree& tree = m_snapshot->tree;
+	const DisplayedAllocation rootAllocation = displayedAllocation(tree, SnapshotTree::RootIndex);
 	m_ui->usageTree->headerItem()->setText(ParentPercentageColumn, rootAllocation.exact ? "% parent" : "% known parent");
 	m_ui->usageTree->headerItem()->setText(RootPercentageColumn, rootAllocation.exact ? "% root" : "% known root");
 	const QString sizeText = formatDisplayedAllocation(rootAllocation);
@@ -213,14 +237,14 @@ void SnapshotUsageWidget::setSnapshot(std::shared_ptr<const Snapshot> snapshot)
 	m_ui->snapshotQualificationLabel->setText(qualification);
 	m_ui->snapshotQualificationLabel->setVisible(!qualification.isEmpty());
 
-	auto* rootItem = new SnapshotUsageTreeItem{m_snapshot->root, m_snapshot->rootPath};
+	auto* rootItem = new SnapshotUsageTreeItem{SnapshotTree::RootIndex, m_snapshot->rootPath};
 	rootItem->setText(NameColumn, nativePathForDisplay(m_snapshot->rootPath));
 	rootItem->setText(AllocatedColumn, sizeText);
 	rootItem->setText(ParentPercentageColumn, "-");
 	rootItem->setText(RootPercentageColumn, formatPercentage(rootAllocation, rootAllocation));
-	rootItem->setChildIndicatorPolicy(m_snapshot->root.children.empty()
+	rootItem->setChildIndicatorPolicy(tree.children(SnapshotTree::RootIndex).empty()
 		? QTreeWidgetItem::DontShowIndicator : QTreeWidgetItem::ShowIndicator);
-	setItemToolTip(*rootItem, entryQualification(m_snapshot->root));
+	setItemToolTip(*rootItem, entryQualification(tree, SnapshotTree::RootIndex));
 	m_ui->usageTree->addTopLevelItem(rootItem);
 	populateChildren(rootItem);
 	rootItem->setExpanded(true);
@@ -253,11 +277,11 @@ bool SnapshotUsageWidget::selectPath(const NativePath& path)
 		return false;
 
 	auto* currentItem = usageTreeItem(m_ui->usageTree->topLevelItem(0));
-	const SnapshotEntry* currentEntry = &m_snapshot->root;
+	SnapshotTree::Index currentEntry = SnapshotTree::RootIndex;
 	for (const NativeName& component : *components)
 	{
-		const auto factualChild = currentEntry->children.find(component);
-		if (factualChild == currentEntry->children.end())
+		const std::optional<SnapshotTree::Index> factualChild = m_snapshot->tree.findChild(currentEntry, component);
+		if (!factualChild)
 			return false;
 
 		populateChildren(currentItem);
@@ -266,7 +290,7 @@ bool SnapshotUsageWidget::selectPath(const NativePath& path)
 		for (int index = 0; index < currentItem->childCount(); ++index)
 		{
 			auto* candidate = usageTreeItem(currentItem->child(index));
-			if (candidate->entry == &factualChild.value())
+			if (candidate->entry == *factualChild)
 			{
 				childItem = candidate;
 				break;
@@ -274,7 +298,7 @@ bool SnapshotUsageWidget::selectPath(const NativePath& path)
 		}
 		assert(childItem);
 		currentItem = childItem;
-		currentEntry = &factualChild.value();
+		currentEntry = *factualChild;
 	}
 
 	m_ui->usageTree->setCurrentItem(currentItem);
@@ -317,7 +341,8 @@ std::optional<NativePath> SnapshotUsageWidget::findNextMatchingPath(const QStrin
 	std::optional<NativePath> firstMatch;
 	std::optional<NativePath> nextMatch;
 	bool passedLastMatch = !m_lastSearchPath;
-	auto visit = [&](auto&& self, const SnapshotEntry& entry, const NativePath& path) -> bool {
+	const SnapshotTree& tree = m_snapshot->tree;
+	auto visit = [&](auto&& self, const SnapshotTree::Index entry, const NativePath& path) -> bool {
 		const bool matches = nativePathForDisplay(path).contains(query, caseSensitivity);
 		if (matches && !firstMatch)
 			firstMatch = path;
@@ -329,14 +354,14 @@ std::optional<NativePath> SnapshotUsageWidget::findNextMatchingPath(const QStrin
 			return true;
 		}
 
-		for (const auto& [name, child] : entry.children)
+		for (const SnapshotTree::Index child : tree.children(entry))
 		{
-			if (self(self, child, appendNativeName(path, name)))
+			if (self(self, child, appendNativeName(path, tree.name(child))))
 				return true;
 		}
 		return false;
 	};
-	visit(visit, m_snapshot->root, m_snapshot->rootPath);
+	visit(visit, SnapshotTree::RootIndex, m_snapshot->rootPath);
 	return nextMatch ? nextMatch : firstMatch;
 }
 
@@ -349,21 +374,24 @@ void SnapshotUsageWidget::populateChildren(QTreeWidgetItem* item)
 
 	struct ChildReference
 	{
-		const NativeName* name;
-		const SnapshotEntry* entry;
+		NativeNameView name;
+		SnapshotTree::Index entry;
 		NativePath path;
 		DisplayedAllocation allocation;
 	};
+	const SnapshotTree& tree = m_snapshot->tree;
+	const SnapshotTree::Children childEntries = tree.children(parentItem->entry);
 	std::vector<ChildReference> children;
-	children.reserve(parentItem->entry->children.size());
-	for (auto child = parentItem->entry->children.begin(); child != parentItem->entry->children.end(); ++child)
+	children.reserve(childEntries.size());
+	for (const SnapshotTree::Index child : childEntries)
 	{
-		NativePath childPath = appendNativeName(parentItem->path, child.key());
-		DisplayedAllocation allocation = displayedAllocation(child.value());
+		const NativeNameView name = tree.name(child);
+		NativePath childPath = appendNativeName(parentItem->path, name);
+		DisplayedAllocation allocation = displayedAllocation(tree, child);
 		const auto hardLinkPresentation = m_hardLinkPresentationByAlias.find(childPath);
 		if (hardLinkPresentation != m_hardLinkPresentationByAlias.end() && !hardLinkPresentation->second.accountingExact)
 			allocation = {};
-		children.push_back({&child.key(), &child.value(), std::move(childPath), allocation});
+		children.push_back({name, child, std::move(childPath), allocation});
 	}
 	std::sort(children.begin(), children.end(), [](const ChildReference& left, const ChildReference& right) {
 		const DisplayedAllocation& leftAllocation = left.allocation;
@@ -374,19 +402,19 @@ void SnapshotUsageWidget::populateChildren(QTreeWidgetItem* item)
 			return leftAllocation.bytes.has_value();
 		if (leftAllocation.bytes && *leftAllocation.bytes != *rightAllocation.bytes)
 			return *leftAllocation.bytes > *rightAllocation.bytes;
-		return *left.name < *right.name;
+		return nativeNameLess(left.name, right.name);
 	});
 
-	const DisplayedAllocation parentAllocation = displayedAllocation(*parentItem->entry);
-	const DisplayedAllocation rootAllocation = displayedAllocation(m_snapshot->root);
+	const DisplayedAllocation parentAllocation = displayedAllocation(tree, parentItem->entry);
+	const DisplayedAllocation rootAllocation = displayedAllocation(tree, SnapshotTree::RootIndex);
 	for (ChildReference& child : children)
 	{
-		auto* childItem = new SnapshotUsageTreeItem{*child.entry, std::move(child.path)};
-		childItem->setText(NameColumn, nativePathForDisplay(*child.name) + entryStateSuffix(*child.entry));
-		childItem->setChildIndicatorPolicy(child.entry->children.empty()
+		auto* childItem = new SnapshotUsageTreeItem{child.entry, std::move(child.path)};
+		childItem->setText(NameColumn, nativePathForDisplay(nativeNameFromView(child.name)) + entryStateSuffix(tree, child.entry));
+		childItem->setChildIndicatorPolicy(tree.children(child.entry).empty()
 			? QTreeWidgetItem::DontShowIndicator : QTreeWidgetItem::ShowIndicator);
 
-		QString toolTip = entryQualification(*child.entry);
+		QString toolTip = entryQualification(tree, child.entry);
 		const auto presentation = m_hardLinkPresentationByAlias.find(childItem->path);
 		if (presentation != m_hardLinkPresentationByAlias.end())
 		{
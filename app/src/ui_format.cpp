@@ -1,5 +1,7 @@
 #include "ui_format.h"
 
+#include "snapshot.h"
+
 #include <QLocale>
 
 QString formatByteCount(const uint64_t bytes)
@@ -20,7 +22,38 @@ QString formatByteCount(const uint64_t bytes)
 	return QString::number(static_cast<double>(bytes) / TiB, 'f', 1) + " TiB";
 }
 
+QString formatDuration(const std::chrono::nanoseconds duration)
+{
+	const auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+	if (milliseconds < 1000)
+		return QString::number(static_cast<qlonglong>(milliseconds)) + " ms";
+	if (milliseconds < 60 * 1000)
+		return QString::number(static_cast<double>(milliseconds) / 1000, 'f', 1) + " s";
+	const qint64 totalSeconds = milliseconds / 1000;
+	return QString{"%1 min %2 s"}.arg(totalSeconds / 60).arg(totalSeconds % 60);
+}
+
 QString formatSnapshotTime(const QDateTime& utcTime)
 {
 	return QLocale{}.toString(utcTime.toLocalTime(), QLocale::ShortFormat);
 }
+
+QString snapshotLoadErrorDescription(const SnapshotLoadError& error)
+{
+	QString description;
+	switch (error.code)
+	{
+	case SnapshotLoadErrorCode::open_failed: description = "The snapshot file could not be opened."; break;
+	case SnapshotLoadErrorCode::read_failed: description = "The snapshot file could not be read."; break;
+	case SnapshotLoadErrorCode::unsupported_legacy_format: description = "Legacy snapshots are not supported."; break;
+	case SnapshotLoadErrorCode::unsupported_version: description = "This snapshot version is not supported."; break;
+	case SnapshotLoadErrorCode::wrong_platform: description = "The snapshot was created on a different platform."; break;
+	case SnapshotLoadErrorCode::decompression_failed: description = "The snapshot data could not be decompressed."; break;
+	case SnapshotLoadErrorCode::truncated: description = "The snapshot file is truncated."; break;
+	case SnapshotLoadErrorCode::corrupt_data: description = "The snapshot data is corrupt."; break;
+	case SnapshotLoadErrorCode::trailing_data: description = "The snapshot contains unexpected trailing data."; break;
+	}
+	if (!error.systemMessage.isEmpty())
+		description += "\n\n" + error.systemMessage;
+	return description;
+}
@@ -3,7 +3,13 @@
 #include <QDateTime>
 #include <QString>
 
+#include <chrono>
 #include <stdint.h>
 
+struct SnapshotLoadError;
+
 [[nodiscard]] QString formatByteCount(uint64_t bytes);
+// Milliseconds below a second, seconds with a decimal below a minute, whole minutes and seconds above.
+[[nodiscard]] QString formatDuration(std::chrono::nanoseconds duration);
 [[nodiscard]] QString formatSnapshotTime(const QDateTime& utcTime);
+[[nodiscard]] QString snapshotLoadErrorDescription(const SnapshotLoadError& error);
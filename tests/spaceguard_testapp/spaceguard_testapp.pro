@@ -48,6 +48,11 @@ win*{
 	Release:QMAKE_LFLAGS += /OPT:REF /OPT:ICF
 }
 
+linux*{
+	SOURCES += ../../app/src/linux_statx.cpp
+	HEADERS += ../../app/src/linux_statx.h
+}
+
 linux*|mac*|freebsd {
 	QMAKE_CXXFLAGS_WARN_ON = -Wall -Wextra
 
@@ -56,25 +61,57 @@ linux*|mac*|freebsd {
 }
 
 SOURCES += \
+	../../app/src/directory_listing.cpp \
+	../../app/src/hard_link_table.cpp \
+	../../app/src/linked_snapshot_scanner.cpp \
+	../../app/src/mount_table.cpp \
 	../../app/src/native_path.cpp \
+	../../app/src/scan_concurrency_controller.cpp \
+	../../app/src/scan_exclusions.cpp \
+	../../app/src/scan_journal.cpp \
+	../../app/src/scan_throttle.cpp \
+	../../app/src/scan_trace.cpp \
 	../../app/src/snapshot.cpp \
 	../../app/src/snapshot_comparison.cpp \
+	../../app/src/snapshot_name_pool.cpp \
 	../../app/src/snapshot_scan_runner.cpp \
 	../../app/src/snapshot_scanner.cpp \
+	../../app/src/snapshot_tree.cpp \
 	test_filesystem_access.cpp \
+	test_hard_link_table.cpp \
+	test_linked_snapshot_scanner.cpp \
+	test_mount_table.cpp \
 	test_native_path.cpp \
+	test_scan_concurrency_controller.cpp \
+	test_scan_exclusions.cpp \
+	test_scan_journal.cpp \
+	test_scan_throttle.cpp \
+	test_scan_trace.cpp \
 	test_snapshot.cpp \
 	test_snapshot_comparison.cpp \
+	test_snapshot_name_pool.cpp \
 	test_snapshot_scan_runner.cpp \
 	test_snapshot_scanner.cpp \
+	test_snapshot_tree.cpp \
 	tests_main.cpp
 
 HEADERS += \
+	../../app/src/directory_listing.h \
 	../../app/src/filesystem_access.h \
+	../../app/src/hard_link_table.h \
+	../../app/src/linked_snapshot_scanner.h \
+	../../app/src/mount_table.h \
 	../../app/src/native_path.h \
+	../../app/src/scan_concurrency_controller.h \
+	../../app/src/scan_exclusions.h \
+	../../app/src/scan_journal.h \
+	../../app/src/scan_throttle.h \
+	../../app/src/scan_trace.h \
 	../../app/src/snapshot.h \
 	../../app/src/snapshot_comparison.h \
 	../../app/src/snapshot_internal.h \
+	../../app/src/snapshot_name_pool.h \
 	../../app/src/snapshot_scan_runner.h \
 	../../app/src/snapshot_scanner.h \
+	../../app/src/snapshot_stream.h \
 	test_filesystem_access_adapter.h
@@ -2,10 +2,51 @@
 
 #include "filesystem_access.h"
 
+#include <QDir>
 #include <QFile>
 #include <QTemporaryDir>
 
+#ifdef __linux__
+#include <sys/stat.h>
+#endif
+
 #include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using ReadEntry = std::pair<NativeName, thin_io::entry_attributes>;
+
+// Every entry readDirectory() hands out for the directory, in the order it hands them out.
+std::vector<ReadEntry> readEntries(const FilesystemAccess::DirectoryHandle& directory)
+{
+	std::vector<ReadEntry> entries;
+	auto reader = FilesystemAccess::readDirectory(directory);
+	for (;;)
+	{
+		const auto chunk = reader.next();
+		REQUIRE(chunk);
+		if (chunk->empty())
+			return entries;
+		for (const ListedDirectoryEntry& entry : *chunk)
+			entries.emplace_back(nativeNameFromView(entry.name), entry.attributes);
+	}
+}
+
+// thin_io's own listing, which the readers must agree with, in name order.
+std::vector<ReadEntry> listedEntries(const NativePath& directory)
+{
+	const auto listed = thin_io::list_directory(nativePathData(directory));
+	REQUIRE(listed);
+	std::vector<ReadEntry> entries;
+	for (const thin_io::directory_entry& entry : *listed)
+		entries.emplace_back(nativeNameFromThinIo(entry.name), entry.attributes);
+	std::ranges::sort(entries, {}, &ReadEntry::first);
+	return entries;
+}
+
+} // namespace
 
 TEST_CASE("FilesystemAccess forwards native filesystem operations", "[filesystem-access][integration]")
 {
@@ -20,19 +61,14 @@ TEST_CASE("FilesystemAccess forwards native filesystem operations", "[filesystem
 	const auto nativeDirectory = normalizedAbsoluteNativePath(directory.path());
 	REQUIRE(nativeDirectory);
 
-	const auto entries = FilesystemAccess::listDirectory(*nativeDirectory);
-	REQUIRE(entries);
-
-	const auto entry = std::ranges::find_if(*entries, [](const thin_io::directory_entry& candidate) {
-#ifdef _WIN32
-		return candidate.name == L"entry.bin";
-#else
-		return candidate.name == "entry.bin";
-#endif
-	});
-	REQUIRE(entry != entries->end());
+	const auto handle = FilesystemAccess::openDirectory(*nativeDirectory, true);
+	REQUIRE(handle);
+	const std::vector<ReadEntry> entries = readEntries(*handle);
+	const auto entry = std::ranges::find(entries, NativeName{"entry.bin"}, &ReadEntry::first);
+	REQUIRE(entry != entries.end());
+	CHECK(entry->second.kind == thin_io::entry_kind::regular_file);
 
-	const NativePath nativeFile = appendNativeName(*nativeDirectory, nativeNameFromThinIo(entry->name));
+	const NativePath nativeFile = appendNativeName(*nativeDirectory, entry->first);
 	const auto metadata = FilesystemAccess::getEntryMetadata(nativeFile, thin_io::link_behavior::do_not_follow);
 	REQUIRE(metadata);
 	CHECK(metadata->attributes.kind == thin_io::entry_kind::regular_file);
@@ -42,3 +78,198 @@ TEST_CASE("FilesystemAccess forwards native filesystem operations", "[filesystem
 	REQUIRE(space);
 	CHECK(space->capacity > 0);
 }
+
+TEST_CASE("FilesystemAccess batched metadata matches per-entry metadata", "[filesystem-access][integration]")
+{
+	QTemporaryDir directory;
+	REQUIRE(directory.isValid());
+	REQUIRE(QDir{directory.path()}.mkdir("nested"));
+	QFile file{directory.filePath("entry.bin")};
+	REQUIRE(file.open(QIODevice::WriteOnly));
+	REQUIRE(file.write("data") == 4);
+	file.close();
+
+	const auto nativeDirectory = normalizedAbsoluteNativePath(directory.path());
+	REQUIRE(nativeDirectory);
+	const auto handle = FilesystemAccess::openDirectory(*nativeDirectory, true);
+	REQUIRE(handle);
+
+	std::vector<NativePath> paths{*nativeDirectory};
+	for (const ReadEntry& entry : readEntries(*handle))
+		paths.push_back(appendNativeName(*nativeDirectory, entry.first));
+	paths.push_back(appendNativeName(*nativeDirectory, "missing"));
+
+	REQUIRE(FilesystemAccess::entryMetadataBatchCapacity() >= 1);
+	std::vector<thin_io::filesystem_result<thin_io::entry_metadata>> results(paths.size());
+	FilesystemAccess::getEntryMetadataBatch(paths, results);
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		const auto expected = FilesystemAccess::getEntryMetadata(paths[i], thin_io::link_behavior::do_not_follow);
+		REQUIRE(expected.has_value() == results[i].has_value());
+		if (expected)
+			CHECK(*expected == *results[i]);
+		else
+			CHECK(expected.error().native_code == results[i].error().native_code);
+	}
+}
+
+TEST_CASE("FilesystemAccess directory handles match path-based access", "[filesystem-access][integration]")
+{
+	QTemporaryDir directory;
+	REQUIRE(directory.isValid());
+	REQUIRE(QDir{directory.path()}.mkpath("nested/inner"));
+	QFile file{directory.filePath("nested/entry.bin")};
+	REQUIRE(file.open(QIODevice::WriteOnly));
+	REQUIRE(file.write("data") == 4);
+	file.close();
+
+	const auto nativeDirectory = normalizedAbsoluteNativePath(directory.path());
+	REQUIRE(nativeDirectory);
+	const NativePath nestedPath = appendNativeName(*nativeDirectory, "nested");
+	const std::vector<ReadEntry> expectedEntries = listedEntries(nestedPath);
+
+	for (const bool relativeResolution : {false, true})
+	{
+		const auto root = FilesystemAccess::openDirectory(*nativeDirectory, relativeResolution);
+		REQUIRE(root);
+		const auto nested = FilesystemAccess::openDirectory(*root, "nested");
+		REQUIRE(nested);
+		CHECK(nested->native() == root->native());
+		// Path-based handles report a missing directory when it is listed.
+		const auto missing = FilesystemAccess::openDirectory(*root, "missing");
+		CHECK_FALSE((missing && FilesystemAccess::readDirectory(*missing).next()));
+
+		std::vector<ReadEntry> entries = readEntries(*nested);
+		std::ranges::sort(entries, {}, &ReadEntry::first);
+		CHECK(entries == expectedEntries);
+
+		std::vector<NativeName> names;
+		for (const ReadEntry& entry : entries)
+			names.push_back(entry.first);
+		names.push_back("missing");
+		std::vector<thin_io::filesystem_result<thin_io::entry_metadata>> results(names.size());
+		FilesystemAccess::getEntryMetadataBatch(*nested, names, results);
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			const auto expected = FilesystemAccess::getEntryMetadata(appendNativeName(nestedPath, names[i]),
+				thin_io::link_behavior::do_not_follow);
+			REQUIRE(expected.has_value() == results[i].has_value());
+			if (expected)
+				CHECK(*expected == *results[i]);
+			else
+				CHECK(expected.error().native_code == results[i].error().native_code);
+		}
+	}
+}
+
+TEST_CASE("FilesystemAccess reports the file ids of listed entries where the platform provides them", "[filesystem-access][integration]")
+{
+	QTemporaryDir directory;
+	REQUIRE(directory.isValid());
+	REQUIRE(QDir{directory.path()}.mkdir("child"));
+	for (const char* name : {"first.bin", "second.bin", "third.bin"})
+	{
+		QFile file{directory.filePath(name)};
+		REQUIRE(file.open(QIODevice::WriteOnly));
+		file.close();
+	}
+
+	const auto nativeDirectory = normalizedAbsoluteNativePath(directory.path());
+	REQUIRE(nativeDirectory);
+	for (const bool relativeResolution : {false, true})
+	{
+		const auto handle = FilesystemAccess::openDirectory(*nativeDirectory, relativeResolution);
+		REQUIRE(handle);
+		std::vector<NativeName> names;
+		for (const ReadEntry& entry : readEntries(*handle))
+			names.push_back(entry.first);
+		REQUIRE(names.size() == 4);
+		const std::vector<uint64_t> fileIds = FilesystemAccess::listedFileIds(*handle, names);
+#ifdef __linux__
+		REQUIRE(fileIds.size() == names.size());
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			struct stat status{};
+			const NativePath path = appendNativeName(*nativeDirectory, names[i]);
+			REQUIRE(::lstat(path.constData(), &status) == 0);
+			CHECK(fileIds[i] == status.st_ino);
+		}
+#else
+		CHECK(fileIds.empty());
+#endif
+	}
+
+	CHECK(FilesystemAccess::listedFileIds(appendNativeName(*nativeDirectory, "missing"), {}).empty());
+}
+
+TEST_CASE("FilesystemAccess reads directories in chunks that add up to their listing", "[filesystem-access][integration]")
+{
+	constexpr int FileCount = 2500;
+	QTemporaryDir directory;
+	REQUIRE(directory.isValid());
+	REQUIRE(QDir{directory.path()}.mkdir("child"));
+	for (int i = 0; i < FileCount; ++i)
+	{
+		QFile file{directory.filePath(QStringLiteral("entry-with-a-longer-name-%1.bin").arg(i))};
+		REQUIRE(file.open(QIODevice::WriteOnly));
+		file.close();
+	}
+#ifndef _WIN32
+	REQUIRE(QFile::link(directory.filePath("child"), directory.filePath("link")));
+#endif
+
+	const auto nativeDirectory = normalizedAbsoluteNativePath(directory.path());
+	REQUIRE(nativeDirectory);
+	const std::vector<ReadEntry> expected = listedEntries(*nativeDirectory);
+
+	for (const bool relativeResolution : {false, true})
+	{
+		const auto handle = FilesystemAccess::openDirectory(*nativeDirectory, relativeResolution);
+		REQUIRE(handle);
+		auto reader = FilesystemAccess::readDirectory(*handle);
+		std::vector<ReadEntry> listed;
+		std::vector<uint64_t> fileIds;
+		std::size_t chunks = 0;
+		for (;;)
+		{
+			const auto chunk = reader.next();
+			REQUIRE(chunk);
+			if (chunk->empty())
+				break;
+			++chunks;
+			for (const ListedDirectoryEntry& entry : *chunk)
+			{
+				listed.emplace_back(nativeNameFromView(entry.name), entry.attributes);
+				fileIds.push_back(entry.fileId);
+			}
+		}
+		CHECK(chunks > 1);
+		REQUIRE(listed.size() == expected.size());
+
+#ifdef __linux__
+		const bool fileIdsListed = handle->native() && statxDirectoryReaderSupported();
+#else
+		const bool fileIdsListed = false;
+#endif
+		for (size_t i = 0; i < listed.size(); ++i)
+		{
+			if (!fileIdsListed)
+			{
+				CHECK(fileIds[i] == 0);
+				continue;
+			}
+#ifdef __linux__
+			struct stat status{};
+			REQUIRE(::lstat(appendNativeName(*nativeDirectory, listed[i].first).constData(), &status) == 0);
+			CHECK(fileIds[i] == status.st_ino);
+#endif
+		}
+
+		std::ranges::sort(listed, {}, &ReadEntry::first);
+		CHECK(listed == expected);
+	}
+
+	const auto missing = FilesystemAccess::openDirectory(appendNativeName(*nativeDirectory, "missing"), false);
+	REQUIRE(missing);
+	CHECK_FALSE(FilesystemAccess::readDirectory(*missing).next());
+}
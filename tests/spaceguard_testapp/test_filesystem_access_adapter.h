@@ -1,21 +1,89 @@
 #pragma once
 
+#include "directory_listing.h"
 #include "fs.hpp"
 #include "native_path.h"
 
 #include <assert.h>
+#include <atomic>
+#include <cstddef>
 #include <functional>
+#include <optional>
+#include <span>
+#include <utility>
 #include <vector>
 
 class TestFilesystemAccess final
 {
 public:
+	// Resolution is always path-based here; a handle opened with relative resolution only counts towards the number of
+	// native handles a real backend would hold open.
+	class DirectoryHandle final
+	{
+	public:
+		DirectoryHandle(DirectoryHandle&& other) noexcept : m_path{std::move(other.m_path)}, m_native{std::exchange(other.m_native, false)}
+		{
+		}
+
+		DirectoryHandle& operator=(DirectoryHandle&& other) noexcept
+		{
+			if (this != &other)
+			{
+				release();
+				m_path = std::move(other.m_path);
+				m_native = std::exchange(other.m_native, false);
+			}
+			return *this;
+		}
+
+		~DirectoryHandle()
+		{
+			release();
+		}
+
+		[[nodiscard]] bool native() const noexcept
+		{
+			return m_native;
+		}
+
+	private:
+		DirectoryHandle(NativePath path, const bool native) noexcept : m_path{std::move(path)}, m_native{native}
+		{
+			if (!m_native)
+				return;
+			const std::size_t open = s_openNativeHandles.fetch_add(1, std::memory_order_relaxed) + 1;
+			std::size_t peak = s_peakNativeHandles.load(std::memory_order_relaxed);
+			while (peak < open && !s_peakNativeHandles.compare_exchange_weak(peak, open, std::memory_order_relaxed))
+				;
+		}
+
+		void release() noexcept
+		{
+			if (std::exchange(m_native, false))
+				s_openNativeHandles.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		NativePath m_path;
+		bool m_native = false;
+
+		friend class TestFilesystemAccess;
+	};
+
+	// The bound filesystem's listing, handed out in chunks without file ids.
+	using DirectoryReader = ChunkedDirectoryListing;
+
 	[[nodiscard]] static inline thin_io::filesystem_result<std::vector<thin_io::directory_entry>> listDirectory(const NativePath& path)
 	{
 		assert(s_listDirectory);
 		return s_listDirectory(path);
 	}
 
+	// Filesystems that do not report file ids return none, so the scanner keeps to name order.
+	[[nodiscard]] static inline std::vector<uint64_t> listedFileIds(const NativePath& path, const std::span<const NativeName> names)
+	{
+		return s_listedFileIds ? s_listedFileIds(path, names) : std::vector<uint64_t>{};
+	}
+
 	[[nodiscard]] static inline thin_io::filesystem_result<thin_io::entry_metadata> getEntryMetadata(
 		const NativePath& path, const thin_io::link_behavior linkBehavior)
 	{
@@ -23,34 +91,130 @@ public:
 		return s_getEntryMetadata(path, linkBehavior);
 	}
 
+	// Filesystems without their own batch support report a capacity of 1, so the scanner issues one call per entry as before.
+	[[nodiscard]] static inline std::size_t entryMetadataBatchCapacity()
+	{
+		return s_entryMetadataBatchCapacity ? s_entryMetadataBatchCapacity() : 1;
+	}
+
+	static inline void getEntryMetadataBatch(const std::span<const NativePath> paths,
+		const std::span<thin_io::filesystem_result<thin_io::entry_metadata>> results)
+	{
+		assert(paths.size() == results.size());
+		if (s_getEntryMetadataBatch)
+		{
+			s_getEntryMetadataBatch(paths, results);
+			return;
+		}
+		for (std::size_t i = 0; i < paths.size(); ++i)
+			results[i] = getEntryMetadata(paths[i], thin_io::link_behavior::do_not_follow);
+	}
+
+	[[nodiscard]] static inline thin_io::filesystem_result<DirectoryHandle> openDirectory(const NativePath& path, const bool relativeResolution)
+	{
+		return DirectoryHandle{path, relativeResolution};
+	}
+
+	[[nodiscard]] static inline thin_io::filesystem_result<DirectoryHandle> openDirectory(
+		const DirectoryHandle& parent, const NativeName& name)
+	{
+		return DirectoryHandle{appendNativeName(parent.m_path, name), parent.m_native};
+	}
+
+	[[nodiscard]] static inline DirectoryReader readDirectory(const DirectoryHandle& directory)
+	{
+		return DirectoryReader{directory.m_path, &TestFilesystemAccess::listDirectory};
+	}
+
+	[[nodiscard]] static inline std::vector<uint64_t> listedFileIds(const DirectoryHandle& directory, const std::span<const NativeName> names)
+	{
+		return listedFileIds(directory.m_path, names);
+	}
+
+	static inline void getEntryMetadataBatch(const DirectoryHandle& directory, const std::span<const NativeName> names,
+		const std::span<thin_io::filesystem_result<thin_io::entry_metadata>> results)
+	{
+		std::vector<NativePath> paths;
+		paths.reserve(names.size());
+		for (const NativeName& name : names)
+			paths.push_back(appendNativeName(directory.m_path, name));
+		getEntryMetadataBatch(paths, results);
+	}
+
 	[[nodiscard]] static inline thin_io::filesystem_result<thin_io::filesystem_space> getFilesystemSpace(const NativePath& path)
 	{
 		assert(s_getFilesystemSpace);
 		return s_getFilesystemSpace(path);
 	}
 
+	// Filesystems that do not report it leave the expected entry count of a scan unknown.
+	[[nodiscard]] static inline std::optional<uint64_t> getUsedFileCount(const NativePath& path)
+	{
+		return s_getUsedFileCount ? s_getUsedFileCount(path) : std::nullopt;
+	}
+
+	// Native handles that would currently be open, and the most that were open at once since the binding was made.
+	[[nodiscard]] static inline std::size_t openNativeHandles() noexcept
+	{
+		return s_openNativeHandles.load(std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] static inline std::size_t peakNativeHandles() noexcept
+	{
+		return s_peakNativeHandles.load(std::memory_order_relaxed);
+	}
+
 private:
 	template<class Filesystem>
 	static void bind(Filesystem& filesystem)
 	{
 		assert(!s_listDirectory && !s_getEntryMetadata && !s_getFilesystemSpace);
+		assert(s_openNativeHandles == 0);
+		s_peakNativeHandles = 0;
 		s_listDirectory = [&filesystem](const NativePath& path) { return filesystem.listDirectory(path); };
 		s_getEntryMetadata = [&filesystem](const NativePath& path, const thin_io::link_behavior linkBehavior) {
 			return filesystem.getEntryMetadata(path, linkBehavior);
 		};
 		s_getFilesystemSpace = [&filesystem](const NativePath& path) { return filesystem.getFilesystemSpace(path); };
+		if constexpr (requires(const NativePath& path, std::span<const NativeName> names) { filesystem.listedFileIds(path, names); })
+		{
+			s_listedFileIds = [&filesystem](const NativePath& path, const std::span<const NativeName> names) {
+				return filesystem.listedFileIds(path, names);
+			};
+		}
+		if constexpr (requires(const NativePath& path) { filesystem.getUsedFileCount(path); })
+			s_getUsedFileCount = [&filesystem](const NativePath& path) { return filesystem.getUsedFileCount(path); };
+		if constexpr (requires { filesystem.entryMetadataBatchCapacity(); })
+		{
+			s_entryMetadataBatchCapacity = [&filesystem] { return filesystem.entryMetadataBatchCapacity(); };
+			s_getEntryMetadataBatch = [&filesystem](const std::span<const NativePath> paths,
+				const std::span<thin_io::filesystem_result<thin_io::entry_metadata>> results) {
+				filesystem.getEntryMetadataBatch(paths, results);
+			};
+		}
 	}
 
 	static void unbind()
 	{
 		s_listDirectory = {};
+		s_listedFileIds = {};
 		s_getEntryMetadata = {};
 		s_getFilesystemSpace = {};
+		s_getUsedFileCount = {};
+		s_entryMetadataBatchCapacity = {};
+		s_getEntryMetadataBatch = {};
 	}
 
 	inline static std::function<thin_io::filesystem_result<std::vector<thin_io::directory_entry>>(const NativePath&)> s_listDirectory;
+	inline static std::function<std::vector<uint64_t>(const NativePath&, std::span<const NativeName>)> s_listedFileIds;
 	inline static std::function<thin_io::filesystem_result<thin_io::entry_metadata>(const NativePath&, thin_io::link_behavior)> s_getEntryMetadata;
 	inline static std::function<thin_io::filesystem_result<thin_io::filesystem_space>(const NativePath&)> s_getFilesystemSpace;
+	inline static std::function<std::optional<uint64_t>(const NativePath&)> s_getUsedFileCount;
+	inline static std::function<std::size_t()> s_entryMetadataBatchCapacity;
+	inline static std::function<void(std::span<const NativePath>, std::span<thin_io::filesystem_result<thin_io::entry_metadata>>)>
+		s_getEntryMetadataBatch;
+	inline static std::atomic_size_t s_openNativeHandles = 0;
+	inline static std::atomic_size_t s_peakNativeHandles = 0;
 
 	friend class ScopedTestFilesystemAccess;
 };
@@ -0,0 +1,84 @@
+#include "3rdparty/catch2/catch.hpp"
+
+#include "hard_link_table.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+thin_io::entry_identity identity(const uint64_t filesystem, const uint64_t entry)
+{
+	thin_io::entry_identity result;
+	result.filesystem = filesystem;
+	result.entry.fill(0);
+	std::copy_n(reinterpret_cast<const uint8_t*>(&entry), sizeof(entry), result.entry.begin());
+	return result;
+}
+
+NativePath aliasPath(const int thread, const int alias)
+{
+	const std::string path = "/links/" + std::to_string(thread) + "-" + std::to_string(alias);
+#ifdef _WIN32
+	return QString::fromStdString(path);
+#else
+	return QByteArray::fromStdString(path);
+#endif
+}
+
+} // namespace
+
+TEST_CASE("The hard-link table groups aliases added concurrently by identity", "[hard-link-table][parallel]")
+{
+	constexpr int ThreadCount = 4;
+	constexpr int AliasesPerThread = 500;
+	constexpr uint64_t FileCount = 50;
+
+	// Every alias path, by the position of the alias it names.
+	std::map<NativePath, int> aliasIndexes;
+	for (int thread = 0; thread < ThreadCount; ++thread)
+	{
+		for (int alias = 0; alias < AliasesPerThread; ++alias)
+			aliasIndexes.emplace(aliasPath(thread, alias), thread * AliasesPerThread + alias);
+	}
+	HardLinkTable table{8};
+	{
+		std::vector<std::jthread> threads;
+		for (int thread = 0; thread < ThreadCount; ++thread)
+		{
+			threads.emplace_back([&, thread] {
+				for (int alias = 0; alias < AliasesPerThread; ++alias)
+				{
+					// The same entry number on two filesystems names two different files.
+					const uint64_t file = static_cast<uint64_t>(alias) % FileCount;
+					table.add(identity(1 + file % 2, file / 2), aliasPath(thread, alias));
+				}
+			});
+		}
+	}
+
+	SnapshotHardLinkAliases grouped = table.take();
+	REQUIRE(grouped.size() == FileCount);
+	std::size_t aliasCount = 0;
+	for (const auto& [groupIdentity, aliases] : grouped)
+	{
+		CHECK(aliases.size() == ThreadCount * AliasesPerThread / FileCount);
+		for (const NativePath& alias : aliases)
+		{
+			const auto found = aliasIndexes.find(alias);
+			REQUIRE(found != aliasIndexes.end());
+			const int index = found->second;
+			aliasIndexes.erase(found); // Each alias is recorded once.
+			const auto file = static_cast<uint64_t>(index % AliasesPerThread) % FileCount;
+			CHECK(groupIdentity.filesystem == 1 + file % 2);
+			CHECK(groupIdentity.entry == identity(0, file / 2).entry);
+		}
+		aliasCount += aliases.size();
+	}
+	CHECK(aliasCount == ThreadCount * AliasesPerThread);
+	CHECK(aliasIndexes.empty());
+	CHECK(table.take().empty());
+}
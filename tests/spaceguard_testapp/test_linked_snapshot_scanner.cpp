@@ -0,0 +1,201 @@
+#include "3rdparty/catch2/catch.hpp"
+
+#include "linked_snapshot_scanner.h"
+#include "test_filesystem_access_adapter.h"
+#include "threading/cworkerthread.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <optional>
+#include <variant>
+#include <vector>
+
+namespace {
+
+NativePath nativePath(const char* path)
+{
+#ifdef _WIN32
+	return QString::fromUtf8(path);
+#else
+	return QByteArray{path};
+#endif
+}
+
+NativeName nativeName(const char* name)
+{
+	return nativePath(name);
+}
+
+thin_io::native_string thinIoName(const char* name)
+{
+#ifdef _WIN32
+	return QString::fromUtf8(name).toStdWString();
+#else
+	return name;
+#endif
+}
+
+NativePath rootPath()
+{
+#ifdef _WIN32
+	return R"(C:\scan)";
+#else
+	return "/scan";
+#endif
+}
+
+thin_io::entry_metadata metadata(const thin_io::entry_kind kind, const uint64_t filesystem, const uint8_t seed,
+	const uint64_t allocatedSize)
+{
+	thin_io::entry_metadata result;
+	result.attributes.kind = kind;
+	result.allocated_size = allocatedSize;
+	result.logical_size = allocatedSize;
+	result.hard_link_count = 1;
+	thin_io::entry_identity identity;
+	identity.filesystem = filesystem;
+	identity.entry.fill(seed);
+	result.identity = identity;
+	result.mount_id = filesystem;
+	return result;
+}
+
+thin_io::directory_entry listed(const char* name, const thin_io::entry_kind kind)
+{
+	thin_io::directory_entry entry;
+	entry.name = thinIoName(name);
+	entry.attributes.kind = kind;
+	return entry;
+}
+
+// The root filesystem (7) holds two mount points: "data" on filesystem 8 and "broken", whose filesystem cannot report
+// its space. Lookups are read-only, so the device groups may scan concurrently.
+class MountedFilesystems final
+{
+public:
+	MountedFilesystems()
+	{
+		addDirectory(rootPath(), metadata(thin_io::entry_kind::directory, 7, 1, 4096), {
+			listed("data", thin_io::entry_kind::directory),
+			listed("broken", thin_io::entry_kind::directory),
+			listed("file", thin_io::entry_kind::regular_file)
+		});
+		m_metadata.emplace(appendNativeName(rootPath(), nativeName("file")), metadata(thin_io::entry_kind::regular_file, 7, 2, 100));
+		addDirectory(dataPath(), metadata(thin_io::entry_kind::directory, 8, 3, 4096), {
+			listed("blob", thin_io::entry_kind::regular_file)
+		});
+		m_metadata.emplace(appendNativeName(dataPath(), nativeName("blob")), metadata(thin_io::entry_kind::regular_file, 8, 4, 8192));
+		addDirectory(brokenPath(), metadata(thin_io::entry_kind::directory, 9, 5, 4096), {});
+	}
+
+	static NativePath dataPath()
+	{
+		return appendNativeName(rootPath(), nativeName("data"));
+	}
+
+	static NativePath brokenPath()
+	{
+		return appendNativeName(rootPath(), nativeName("broken"));
+	}
+
+	std::vector<MountedFilesystem> mounts() const
+	{
+		return {{dataPath(), "ext4", "/dev/sdb1", "disk:8:16"}, {brokenPath(), "nfs4", "server:/export", "network:server"}};
+	}
+
+	thin_io::filesystem_result<std::vector<thin_io::directory_entry>> listDirectory(const NativePath& path) const
+	{
+		return m_directories.at(path);
+	}
+
+	thin_io::filesystem_result<thin_io::entry_metadata> getEntryMetadata(const NativePath& path, thin_io::link_behavior) const
+	{
+		const auto metadata = m_metadata.find(path);
+		if (metadata == m_metadata.end())
+			return std::unexpected{thin_io::filesystem_error{2}};
+		return metadata->second;
+	}
+
+	thin_io::filesystem_result<thin_io::filesystem_space> getFilesystemSpace(const NativePath& path) const
+	{
+		if (path == brokenPath())
+			return std::unexpected{thin_io::filesystem_error{5}};
+		return thin_io::filesystem_space{100000, 50000, 45000, path == dataPath() ? 8u : 7u};
+	}
+
+	void removeRootMetadata()
+	{
+		m_metadata.erase(rootPath());
+	}
+
+private:
+	void addDirectory(const NativePath& path, const thin_io::entry_metadata& directoryMetadata,
+		std::vector<thin_io::directory_entry> entries)
+	{
+		m_metadata.emplace(path, directoryMetadata);
+		m_directories.emplace(path, std::move(entries));
+	}
+
+	std::map<NativePath, std::vector<thin_io::directory_entry>> m_directories;
+	std::map<NativePath, thin_io::entry_metadata> m_metadata;
+};
+
+} // namespace
+
+TEST_CASE("Linked snapshots scan the filesystems mounted below the root and merge into one tree", "[linked-scanner][parallel]")
+{
+	MountedFilesystems filesystem;
+	ScopedTestFilesystemAccess binding{filesystem};
+	CWorkerThreadPool workerPool{4, "SpaceGuard linked scan test"};
+	std::atomic_bool canceled = false;
+
+	LinkedSnapshotScanResult result = scanLinkedSnapshots(rootPath(), filesystem.mounts(), canceled, workerPool);
+	auto* linked = std::get_if<LinkedSnapshots>(&result);
+	REQUIRE(linked);
+	REQUIRE(linked->snapshots.size() == 2);
+	CHECK(linked->snapshots[0].rootPath == rootPath());
+	CHECK(linked->snapshots[0].tree.toEntry().children.at(nativeName("data")).traversalState == DirectoryTraversalState::mount_boundary);
+	CHECK(linked->snapshots[1].rootPath == MountedFilesystems::dataPath());
+	REQUIRE(linked->failures.size() == 1);
+	CHECK(linked->failures.front() == SnapshotScanFailure{
+		SnapshotScanFailureCode::filesystem_space_at_start_unavailable, MountedFilesystems::brokenPath(), 5
+	});
+
+	const Snapshot merged = mergeLinkedSnapshots(std::move(*linked));
+	CHECK(merged.rootPath == rootPath());
+	const SnapshotEntry root = merged.tree.toEntry();
+	const SnapshotEntry& data = root.children.at(nativeName("data"));
+	CHECK(data.traversalState == DirectoryTraversalState::completed);
+	CHECK(data.children.at(nativeName("blob")).metadata->allocatedSize == 8192);
+	const std::optional<SnapshotTree::Index> dataIndex = merged.tree.findChild(SnapshotTree::RootIndex, nativeName("data"));
+	REQUIRE(dataIndex);
+	CHECK(merged.tree.derived(*dataIndex).subtreeAllocatedSize == 4096 + 8192);
+	// The mounted filesystem's directory is ranked with those of the root filesystem.
+	CHECK(std::ranges::any_of(merged.directoryCosts.largest, [](const SnapshotDirectoryCost& cost) {
+		return cost.path == MountedFilesystems::dataPath() && cost.entries == 1;
+	}));
+	CHECK(std::ranges::any_of(merged.directoryCosts.largest, [](const SnapshotDirectoryCost& cost) { return cost.path == rootPath(); }));
+	CHECK(root.children.at(nativeName("broken")).traversalState == DirectoryTraversalState::mount_boundary);
+	CHECK(std::ranges::find(merged.diagnostics, SnapshotDiagnostic{
+		MountedFilesystems::brokenPath(), SnapshotOperation::filesystem_space_at_start, 5
+	}) != merged.diagnostics.end());
+}
+
+TEST_CASE("Linked snapshots fail only when the root filesystem fails", "[linked-scanner][parallel]")
+{
+	MountedFilesystems filesystem;
+	filesystem.removeRootMetadata();
+	ScopedTestFilesystemAccess binding{filesystem};
+	CWorkerThreadPool workerPool{4, "SpaceGuard linked scan test"};
+	std::atomic_bool canceled = false;
+
+	const LinkedSnapshotScanResult failed = scanLinkedSnapshots(rootPath(), filesystem.mounts(), canceled, workerPool);
+	const auto* failure = std::get_if<SnapshotScanFailure>(&failed);
+	REQUIRE(failure);
+	CHECK(failure->code == SnapshotScanFailureCode::root_metadata_unavailable);
+	CHECK(failure->path == rootPath());
+
+	canceled = true;
+	CHECK(std::holds_alternative<SnapshotScanCanceled>(scanLinkedSnapshots(rootPath(), filesystem.mounts(), canceled, workerPool)));
+}
@@ -0,0 +1,97 @@
+#include "3rdparty/catch2/catch.hpp"
+
+#include "mount_table.h"
+
+#include <QString>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+NativePath nativePath(const std::string& path)
+{
+#ifdef _WIN32
+	return QString::fromStdString(path);
+#else
+	return QByteArray::fromStdString(path);
+#endif
+}
+
+NativePath absolutePath(const char* path)
+{
+#ifdef _WIN32
+	const auto normalized = normalizedAbsoluteNativePath(QStringLiteral("C:") + QString::fromUtf8(path));
+#else
+	const auto normalized = normalizedAbsoluteNativePath(QString::fromUtf8(path));
+#endif
+	REQUIRE(normalized);
+	return *normalized;
+}
+
+MountedFilesystem mountedAt(const char* path, const char* device)
+{
+	return {absolutePath(path), "ext4", {}, device};
+}
+
+std::vector<NativePath> mountPoints(const std::vector<MountedFilesystem>& mounts)
+{
+	std::vector<NativePath> paths;
+	for (const MountedFilesystem& mount : mounts)
+		paths.push_back(mount.mountPoint);
+	return paths;
+}
+
+} // namespace
+
+TEST_CASE("Mount info lines are parsed into devices, skipping pseudo filesystems", "[mount-table]")
+{
+	const std::vector<MountedFilesystem> mounts = parseMountInfo(
+		"22 1 8:2 / / rw,relatime shared:1 - ext4 /dev/sda2 rw\n"
+		"23 22 0:21 / /proc rw,nosuid shared:12 - proc proc rw\n"
+		"24 22 0:5 / /dev rw,nosuid shared:2 master:1 - devtmpfs udev rw,size=8g\n"
+		"30 22 8:3 / /home rw,relatime shared:3 - xfs /dev/sda3 rw\n"
+		"31 22 0:45 / /mnt/nas rw - nfs4 nas.local:/export rw,vers=4.2\n"
+		"32 22 0:46 / /mnt/share rw - cifs //fileserver/share rw\n"
+		"33 22 8:17 / /mnt/My\\040Disk\\134 rw - ext4 /dev/sdb1 rw\n"
+		"not a mountinfo line\n"
+		"34 22 8:18 / /mnt/short rw - ext4\n"
+		"35 22 8:19 / /mnt/last rw - ext4 /dev/sdb3 rw");
+
+	const std::vector<MountedFilesystem> expected{
+		{nativePath("/"), "ext4", "/dev/sda2", "device:8:2"},
+		{nativePath("/home"), "xfs", "/dev/sda3", "device:8:3"},
+		{nativePath("/mnt/nas"), "nfs4", "nas.local:/export", "network:nas.local"},
+		{nativePath("/mnt/share"), "cifs", "//fileserver/share", "network:fileserver"},
+		{nativePath("/mnt/My Disk\\"), "ext4", "/dev/sdb1", "device:8:17"},
+		{nativePath("/mnt/last"), "ext4", "/dev/sdb3", "device:8:19"}
+	};
+	CHECK(mounts == expected);
+	CHECK(parseMountInfo("").empty());
+}
+
+TEST_CASE("Mounts under a root exclude hidden mounts and list parents first", "[mount-table]")
+{
+	const std::vector<MountedFilesystem> mounts{
+		mountedAt("/", "disk:8:0"),
+		mountedAt("/mnt", "disk:8:16"),
+		mountedAt("/mnt/x", "disk:8:32"),
+		mountedAt("/mnt/x/deep", "disk:8:48"),
+		// Hides the three mounts above at or below /mnt.
+		mountedAt("/mnt", "disk:8:64"),
+		mountedAt("/mnt/y", "disk:8:80"),
+		mountedAt("/mnt/y/z", "disk:8:96"),
+		mountedAt("/mnt/longer-name", "disk:8:112"),
+		mountedAt("/mnt/q", "disk:8:128"),
+		mountedAt("/other", "disk:8:144")
+	};
+
+	const std::vector<MountedFilesystem> underMnt = mountsUnder(mounts, absolutePath("/mnt"));
+	CHECK(mountPoints(underMnt) == std::vector{
+		absolutePath("/mnt"), absolutePath("/mnt/y"), absolutePath("/mnt/q"), absolutePath("/mnt/y/z"), absolutePath("/mnt/longer-name")
+	});
+	CHECK(underMnt.front().device == "disk:8:64");
+	CHECK(mountsUnder(mounts, absolutePath("/mnt/x")).empty());
+	CHECK(mountPoints(mountsUnder(mounts, absolutePath("/mnt/y/z/inner"))).empty());
+	CHECK(mountsUnder(mounts, absolutePath("/")).size() == 7);
+}
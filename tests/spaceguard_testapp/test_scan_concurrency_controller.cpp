@@ -0,0 +1,80 @@
+#include "3rdparty/catch2/catch.hpp"
+
+#include "scan_concurrency_controller.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+namespace {
+
+constexpr std::chrono::milliseconds Interval{200};
+
+// A device that serves up to `parallelism` calls at once, each taking `serviceTime`; further calls queue behind them.
+ScanConcurrencyMeasurement deviceMeasurement(const uint32_t participants, const uint32_t parallelism,
+	const std::chrono::microseconds serviceTime)
+{
+	const double served = std::min(participants, parallelism);
+	const double throughput = served / std::chrono::duration<double>(serviceTime).count();
+	const auto operations = static_cast<uint64_t>(throughput * std::chrono::duration<double>(Interval).count());
+	const double latency = std::chrono::duration<double>(serviceTime).count() * participants / served;
+	return {operations, std::chrono::nanoseconds{static_cast<int64_t>(latency * 1e9 * static_cast<double>(operations))}, Interval};
+}
+
+std::vector<uint32_t> run(ScanConcurrencyController& controller, const int intervals,
+	const std::function<ScanConcurrencyMeasurement(uint32_t)>& device)
+{
+	std::vector<uint32_t> history;
+	for (int i = 0; i < intervals; ++i)
+		history.push_back(controller.update(device(controller.participants())));
+	return history;
+}
+
+} // namespace
+
+TEST_CASE("Scan concurrency settles near the parallelism of a saturating device", "[scan-concurrency]")
+{
+	ScanConcurrencyController controller{1, 64, 8};
+	const auto history = run(controller, 60, [](const uint32_t participants) {
+		return deviceMeasurement(participants, 4, std::chrono::microseconds{100});
+	});
+	CHECK(*std::ranges::max_element(history) <= 16);
+	// Past the first probe cycle the count stays within one step of the saturation point.
+	for (size_t i = 20; i < history.size(); ++i)
+	{
+		CHECK(history[i] >= 3);
+		CHECK(history[i] <= 5);
+	}
+}
+
+TEST_CASE("Scan concurrency grows to the limit on a high-latency device", "[scan-concurrency]")
+{
+	ScanConcurrencyController controller{1, 64, 8};
+	const auto history = run(controller, 40, [](const uint32_t participants) {
+		return deviceMeasurement(participants, 256, std::chrono::milliseconds{20});
+	});
+	CHECK(history.back() >= 60);
+	CHECK(std::ranges::is_sorted(history.begin(), history.begin() + 5));
+}
+
+TEST_CASE("Scan concurrency stays within its limits and ignores empty intervals", "[scan-concurrency]")
+{
+	ScanConcurrencyController controller{2, 6, 10};
+	CHECK(controller.participants() == 6);
+	CHECK(controller.update({0, std::chrono::nanoseconds{0}, Interval}) == 6);
+
+	const auto history = run(controller, 30, [](const uint32_t participants) {
+		return deviceMeasurement(participants, 1, std::chrono::microseconds{100});
+	});
+	for (const uint32_t participants : history)
+	{
+		CHECK(participants >= 2);
+		CHECK(participants <= 6);
+	}
+	CHECK(history.back() == 2);
+
+	ScanConcurrencyController single{1, 1, 4};
+	CHECK(single.participants() == 1);
+	CHECK(single.update(deviceMeasurement(1, 4, std::chrono::microseconds{100})) == 1);
+}
@@ -0,0 +1,111 @@
+#include "3rdparty/catch2/catch.hpp"
+
+#include "scan_exclusions.h"
+
+#include <vector>
+
+namespace {
+
+NativePath nativePath(const char* path)
+{
+#ifdef _WIN32
+	return QString::fromUtf8(path);
+#else
+	return QByteArray{path};
+#endif
+}
+
+NativePath absolutePath(const char* path)
+{
+#ifdef _WIN32
+	const auto normalized = normalizedAbsoluteNativePath(QStringLiteral("C:") + QString::fromUtf8(path));
+#else
+	const auto normalized = normalizedAbsoluteNativePath(QString::fromUtf8(path));
+#endif
+	REQUIRE(normalized);
+	return *normalized;
+}
+
+SnapshotExclusionRule rule(const SnapshotExclusionPatternKind kind, NativePath pattern,
+	const SnapshotExclusionAction action = SnapshotExclusionAction::skip)
+{
+	return {kind, std::move(pattern), action};
+}
+
+} // namespace
+
+TEST_CASE("Name globs match entry names without crossing separators", "[scan-exclusions]")
+{
+	const std::vector rules{
+		rule(SnapshotExclusionPatternKind::glob, nativePath("node_modules")),
+		rule(SnapshotExclusionPatternKind::glob, nativePath("*.t?p"), SnapshotExclusionAction::stat_only),
+		rule(SnapshotExclusionPatternKind::glob, nativePath("*cache*"))
+	};
+	const ScanExclusions exclusions{absolutePath("/scan"), rules};
+	CHECK_FALSE(exclusions.empty());
+	CHECK_FALSE(exclusions.needsDirectoryPath());
+	CHECK(exclusions.markers().empty());
+
+	const NativePath directory = absolutePath("/scan/project");
+	CHECK(exclusions.match(directory, nativePath("node_modules")) == SnapshotExclusionAction::skip);
+	CHECK_FALSE(exclusions.match(directory, nativePath("node_modules2")));
+	CHECK(exclusions.match(directory, nativePath("a.tmp")) == SnapshotExclusionAction::stat_only);
+	CHECK(exclusions.match(directory, nativePath(".tmp")) == SnapshotExclusionAction::stat_only);
+	CHECK_FALSE(exclusions.match(directory, nativePath("a.tp")));
+	CHECK(exclusions.match(directory, nativePath("cache")) == SnapshotExclusionAction::skip);
+	CHECK(exclusions.match(directory, nativePath("xcachex")) == SnapshotExclusionAction::skip);
+	CHECK_FALSE(exclusions.match(directory, nativePath("cach")));
+	// The first matching rule decides.
+	CHECK(exclusions.match(directory, nativePath("cache.tmp")) == SnapshotExclusionAction::stat_only);
+}
+
+TEST_CASE("Globs with a separator match the path relative to the root", "[scan-exclusions]")
+{
+	const std::vector rules{
+		rule(SnapshotExclusionPatternKind::glob, nativePath("*/.git/objects")),
+		rule(SnapshotExclusionPatternKind::glob, nativePath("var/lib/*/overlay*"), SnapshotExclusionAction::stat_only)
+	};
+	const ScanExclusions exclusions{absolutePath("/scan"), rules};
+	CHECK(exclusions.needsDirectoryPath());
+
+	CHECK(exclusions.match(absolutePath("/scan/repo/.git"), nativePath("objects")) == SnapshotExclusionAction::skip);
+	CHECK_FALSE(exclusions.match(absolutePath("/scan/a/repo/.git"), nativePath("objects")));
+	CHECK_FALSE(exclusions.match(absolutePath("/scan/.git"), nativePath("objects")));
+	CHECK(exclusions.match(absolutePath("/scan/var/lib/docker"), nativePath("overlay2")) == SnapshotExclusionAction::stat_only);
+	CHECK_FALSE(exclusions.match(absolutePath("/scan/var/lib/docker/x"), nativePath("overlay2")));
+	CHECK_FALSE(exclusions.match(absolutePath("/elsewhere/var/lib/docker"), nativePath("overlay2")));
+
+	const ScanExclusions fromSystemRoot{absolutePath("/"), rules};
+	CHECK(fromSystemRoot.match(absolutePath("/var/lib/containers"), nativePath("overlay")) == SnapshotExclusionAction::stat_only);
+}
+
+TEST_CASE("Path prefixes match the path and its descendants", "[scan-exclusions]")
+{
+	const std::vector rules{rule(SnapshotExclusionPatternKind::path_prefix, absolutePath("/scan/build"))};
+	const ScanExclusions exclusions{absolutePath("/scan"), rules};
+	CHECK(exclusions.needsDirectoryPath());
+
+	CHECK(exclusions.match(absolutePath("/scan"), nativePath("build")) == SnapshotExclusionAction::skip);
+	CHECK(exclusions.match(absolutePath("/scan/build/x"), nativePath("y")) == SnapshotExclusionAction::skip);
+	CHECK_FALSE(exclusions.match(absolutePath("/scan"), nativePath("build-tools")));
+	CHECK_FALSE(exclusions.match(absolutePath("/scan"), nativePath("buil")));
+
+	CHECK(exclusions.excludes(absolutePath("/scan/build")));
+	CHECK(exclusions.excludes(absolutePath("/scan/build/deep/mount")));
+	CHECK_FALSE(exclusions.excludes(absolutePath("/scan")));
+	CHECK_FALSE(exclusions.excludes(absolutePath("/scan/source")));
+	CHECK_FALSE(exclusions.excludes(absolutePath("/other/build")));
+}
+
+TEST_CASE("Marker rules are listed apart from the rules matched by name or path", "[scan-exclusions]")
+{
+	const std::vector rules{
+		rule(SnapshotExclusionPatternKind::marker_file, nativePath("CACHEDIR.TAG"), SnapshotExclusionAction::stat_only),
+		rule(SnapshotExclusionPatternKind::marker_file, nativePath(".nobackup"))
+	};
+	const ScanExclusions exclusions{absolutePath("/scan"), rules};
+	CHECK(exclusions.empty());
+	CHECK(exclusions.markers() == std::vector{nativePath("CACHEDIR.TAG"), nativePath(".nobackup")});
+	CHECK_FALSE(exclusions.match(absolutePath("/scan"), nativePath("CACHEDIR.TAG")));
+	CHECK_FALSE(exclusions.excludes(absolutePath("/scan/anything")));
+}
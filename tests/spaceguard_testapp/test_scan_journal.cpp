@@ -0,0 +1,271 @@
+#include "3rdparty/catch2/catch.hpp"
+
+#include "scan_journal.h"
+
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTimeZone>
+
+#include <chrono>
+#include <utility>
+
+namespace {
+
+NativePath nativePath(const char* path)
+{
+#ifdef _WIN32
+	return QString::fromUtf8(path);
+#else
+	return QByteArray{path};
+#endif
+}
+
+NativeName nativeName(const char* name)
+{
+	return nativePath(name);
+}
+
+NativePath rootPath()
+{
+#ifdef _WIN32
+	return nativePath("C:\\scan-root");
+#else
+	return nativePath("/scan-root");
+#endif
+}
+
+NativePath childPath(const char* name)
+{
+	return appendNativeName(rootPath(), nativeName(name));
+}
+
+thin_io::entry_identity identity(const uint8_t seed)
+{
+	thin_io::entry_identity result;
+	result.filesystem = 7;
+	for (size_t i = 0; i < result.entry.size(); ++i)
+		result.entry[i] = static_cast<uint8_t>(seed + i);
+	return result;
+}
+
+SnapshotEntry directoryEntry(const uint8_t seed, const DirectoryTraversalState state = DirectoryTraversalState::not_directory)
+{
+	SnapshotEntry entry;
+	entry.attributes.kind = thin_io::entry_kind::directory;
+	entry.metadata = SnapshotEntryMetadata{0, 4096, 1, identity(seed)};
+	entry.traversalState = state;
+	return entry;
+}
+
+SnapshotEntry fileEntry(const uint8_t seed, const uint64_t size)
+{
+	SnapshotEntry entry;
+	entry.attributes.kind = thin_io::entry_kind::regular_file;
+	entry.metadata = SnapshotEntryMetadata{size, size, 1, identity(seed)};
+	return entry;
+}
+
+ScanJournalHeader makeHeader()
+{
+	ScanJournalHeader header;
+	header.rootPath = rootPath();
+	header.scanStartedAtUtc = QDateTime::fromMSecsSinceEpoch(1'700'000'000'123, QTimeZone::UTC);
+	header.filesystemSpaceAtStart = {100000, 50000, 45000, 7};
+	header.root = directoryEntry(1);
+	header.fileResolution = SnapshotFileResolution::budgeted;
+	header.memoryBudget = 1 << 20;
+	header.exclusionRules = {{SnapshotExclusionPatternKind::glob, nativePath("*.tmp"), SnapshotExclusionAction::stat_only}};
+	header.exclusionRootPath = rootPath();
+	return header;
+}
+
+void appendDirectory(ScanJournal& journal, const NativePath& path, SnapshotEntry directory, const uint8_t seed)
+{
+	ScanJournalRecord record;
+	record.addChild(nativeName("file"), fileEntry(seed, seed * 10));
+	record.addChild(nativeName("subdirectory"), directoryEntry(static_cast<uint8_t>(seed + 1)));
+	record.addDiagnostic({appendNativeName(path, nativeName("unreadable")), SnapshotOperation::entry_metadata, 13});
+	directory.traversalState = DirectoryTraversalState::completed;
+	journal.append(path, directory, record);
+}
+
+} // namespace
+
+TEST_CASE("Scan journals restore the header and directories they recorded", "[scan-journal]")
+{
+	QTemporaryDir directory;
+	REQUIRE(directory.isValid());
+	const QString path = directory.filePath("scan.journal");
+	const ScanJournalHeader header = makeHeader();
+	{
+		auto journal = ScanJournal::create(path);
+		REQUIRE(journal);
+		CHECK_FALSE((*journal)->resumedHeader());
+		(*journal)->begin(header);
+		appendDirectory(**journal, rootPath(), header.root, 2);
+		appendDirectory(**journal, childPath("subdirectory"), directoryEntry(3), 4);
+
+		// The chunks of a split directory make up one record.
+		ScanJournalRecord first;
+		first.addChild(nativeName("b"), fileEntry(5, 1));
+		ScanJournalRecord second;
+		second.addChild(nativeName("a"), fileEntry(6, 2));
+		second.addDiagnostic({childPath("split"), SnapshotOperation::directory_enumeration, 2});
+		first.append(second);
+		(*journal)->append(childPath("split"), directoryEntry(7, DirectoryTraversalState::enumeration_failed), first);
+		CHECK_FALSE((*journal)->error());
+	}
+
+	auto journal = ScanJournal::resume(path);
+	REQUIRE(journal);
+	const auto& resumedHeader = (*journal)->resumedHeader();
+	REQUIRE(resumedHeader);
+	CHECK(resumedHeader->rootPath == header.rootPath);
+	CHECK(resumedHeader->scanStartedAtUtc == header.scanStartedAtUtc);
+	CHECK(resumedHeader->filesystemSpaceAtStart == header.filesystemSpaceAtStart);
+	CHECK(resumedHeader->root == header.root);
+	CHECK(resumedHeader->fileResolution == header.fileResolution);
+	CHECK(resumedHeader->memoryBudget == header.memoryBudget);
+	CHECK(resumedHeader->exclusionRules == header.exclusionRules);
+	CHECK(resumedHeader->exclusionRootPath == header.exclusionRootPath);
+
+	const auto directories = (*journal)->takeResumedDirectories();
+	REQUIRE(directories.size() == 3);
+	const ScanJournalDirectory& root = directories.at(rootPath());
+	CHECK(root.entry.traversalState == DirectoryTraversalState::completed);
+	CHECK(root.entry.metadata == header.root.metadata);
+	REQUIRE(root.entry.children.size() == 2);
+	CHECK(root.entry.children.find(nativeName("file")).value() == fileEntry(2, 20));
+	CHECK(root.entry.children.find(nativeName("subdirectory")).value() == directoryEntry(3));
+	CHECK(root.diagnostics == std::vector<SnapshotDiagnostic>{
+		{childPath("unreadable"), SnapshotOperation::entry_metadata, 13}
+	});
+
+	const ScanJournalDirectory& split = directories.at(childPath("split"));
+	CHECK(split.entry.traversalState == DirectoryTraversalState::enumeration_failed);
+	REQUIRE(split.entry.children.size() == 2);
+	CHECK(split.entry.children.begin().key() == nativeName("a"));
+	CHECK(split.diagnostics.size() == 1);
+	CHECK((*journal)->takeResumedDirectories().empty());
+}
+
+TEST_CASE("Scan journals resume after the last complete record", "[scan-journal]")
+{
+	QTemporaryDir directory;
+	REQUIRE(directory.isValid());
+	const QString path = directory.filePath("scan.journal");
+	const ScanJournalHeader header = makeHeader();
+	qint64 completeSize = 0;
+	{
+		auto journal = ScanJournal::create(path);
+		REQUIRE(journal);
+		(*journal)->begin(header);
+		appendDirectory(**journal, rootPath(), header.root, 2);
+		(*journal)->checkpoint();
+		completeSize = QFile{path}.size();
+		appendDirectory(**journal, childPath("subdirectory"), directoryEntry(3), 4);
+	}
+
+	SECTION("the process ended while writing a record")
+	{
+		QFile file{path};
+		REQUIRE(file.open(QIODevice::ReadWrite));
+		REQUIRE(file.resize(file.size() - 3));
+	}
+
+	SECTION("a record was damaged")
+	{
+		QFile file{path};
+		REQUIRE(file.open(QIODevice::ReadWrite));
+		REQUIRE(file.seek(file.size() - 1));
+		const QByteArray last = file.read(1);
+		REQUIRE(file.seek(file.size() - 1));
+		REQUIRE(file.write(QByteArray(1, static_cast<char>(last[0] ^ 0x5A))) == 1);
+	}
+
+	{
+		auto journal = ScanJournal::resume(path);
+		REQUIRE(journal);
+		REQUIRE((*journal)->resumedHeader());
+		const auto directories = (*journal)->takeResumedDirectories();
+		CHECK(directories.size() == 1);
+		CHECK(directories.contains(rootPath()));
+		CHECK(QFile{path}.size() == completeSize);
+
+		// Appending continues where the complete records end.
+		appendDirectory(**journal, childPath("other"), directoryEntry(5), 6);
+	}
+
+	auto journal = ScanJournal::resume(path);
+	REQUIRE(journal);
+	const auto directories = (*journal)->takeResumedDirectories();
+	CHECK(directories.size() == 2);
+	CHECK(directories.contains(childPath("other")));
+}
+
+TEST_CASE("Scan journals start over without a valid header", "[scan-journal]")
+{
+	QTemporaryDir directory;
+	REQUIRE(directory.isValid());
+	const QString path = directory.filePath("scan.journal");
+
+	SECTION("missing file")
+	{
+		auto journal = ScanJournal::resume(path);
+		REQUIRE(journal);
+		CHECK_FALSE((*journal)->resumedHeader());
+		CHECK((*journal)->takeResumedDirectories().empty());
+	}
+
+	SECTION("foreign file")
+	{
+		QFile file{path};
+		REQUIRE(file.open(QIODevice::WriteOnly));
+		REQUIRE(file.write("not a journal") == 13);
+		file.close();
+
+		auto journal = ScanJournal::resume(path);
+		REQUIRE(journal);
+		CHECK_FALSE((*journal)->resumedHeader());
+		CHECK(QFile{path}.size() == 0);
+	}
+}
+
+TEST_CASE("Scan journals discard what they resumed when they begin again", "[scan-journal]")
+{
+	QTemporaryDir directory;
+	REQUIRE(directory.isValid());
+	const QString path = directory.filePath("scan.journal");
+	ScanJournalHeader header = makeHeader();
+	{
+		auto journal = ScanJournal::create(path);
+		REQUIRE(journal);
+		(*journal)->begin(header);
+		appendDirectory(**journal, rootPath(), header.root, 2);
+	}
+
+	header.memoryBudget = 0;
+	{
+		auto journal = ScanJournal::resume(path);
+		REQUIRE(journal);
+		REQUIRE((*journal)->resumedHeader());
+		(*journal)->begin(header);
+		CHECK_FALSE((*journal)->resumedHeader());
+		CHECK((*journal)->takeResumedDirectories().empty());
+	}
+
+	auto journal = ScanJournal::resume(path);
+	REQUIRE(journal);
+	REQUIRE((*journal)->resumedHeader());
+	CHECK((*journal)->resumedHeader()->memoryBudget == 0);
+	CHECK((*journal)->takeResumedDirectories().empty());
+}
+
+TEST_CASE("Scan journal file names identify the root", "[scan-journal]")
+{
+	const QString name = scanJournalFileName(rootPath());
+	CHECK(name == scanJournalFileName(rootPath()));
+	CHECK(name != scanJournalFileName(childPath("subdirectory")));
+	CHECK(name.startsWith("spaceguard-scan-"));
+	CHECK(name.endsWith(".journal"));
+}
@@ -0,0 +1,83 @@
+#include "3rdparty/catch2/catch.hpp"
+
+#include "scan_throttle.h"
+
+#include <atomic>
+#include <chrono>
+
+TEST_CASE("I/O pressure stall totals are parsed from the some line", "[scan-throttle]")
+{
+	CHECK(parseIoPressureStallTotal(
+		"some avg10=1.50 avg60=0.75 avg300=0.20 total=123456789\n"
+		"full avg10=0.50 avg60=0.25 avg300=0.10 total=987654321\n") == 123456789u);
+	CHECK(parseIoPressureStallTotal("full avg10=0.00 avg60=0.00 avg300=0.00 total=5\nsome avg10=0.00 total=42") == 42u);
+	CHECK_FALSE(parseIoPressureStallTotal("").has_value());
+	CHECK_FALSE(parseIoPressureStallTotal("full avg10=0.00 total=5\n").has_value());
+	CHECK_FALSE(parseIoPressureStallTotal("some avg10=0.00 avg60=0.00\n").has_value());
+	CHECK_FALSE(parseIoPressureStallTotal("some total=x\n").has_value());
+}
+
+TEST_CASE("The scan throttle admits calls at its rate", "[scan-throttle]")
+{
+	std::atomic_bool canceled = false;
+	ScanThrottle unlimited{0, 0};
+	CHECK(unlimited.rate() == 0);
+	unlimited.acquire(1'000'000, canceled);
+
+	ScanThrottle throttle{1000, 0};
+	CHECK(throttle.rate() == 1000);
+	// The first 100 calls fit the initial burst, the next 100 take a tenth of a second.
+	const auto started = std::chrono::steady_clock::now();
+	for (int i = 0; i < 20; ++i)
+		throttle.acquire(10, canceled);
+	CHECK(std::chrono::steady_clock::now() - started >= std::chrono::milliseconds{90});
+
+	ScanThrottle slow{1, 0};
+	slow.acquire(1, canceled);
+	canceled = true;
+	const auto canceledStarted = std::chrono::steady_clock::now();
+	slow.acquire(1000, canceled);
+	CHECK(std::chrono::steady_clock::now() - canceledStarted < std::chrono::seconds{1});
+}
+
+TEST_CASE("The scan throttle backs off under I/O pressure and recovers below the target", "[scan-throttle]")
+{
+	constexpr std::chrono::nanoseconds Interval = std::chrono::milliseconds{500};
+
+	ScanThrottle throttle{1000, 0.2};
+	throttle.updatePressure(0.1, 500, Interval);
+	CHECK(throttle.rate() == 1000);
+	// Halves the lower of the configured and the achieved rate.
+	throttle.updatePressure(0.5, 300, Interval);
+	CHECK(throttle.rate() == 300);
+	throttle.updatePressure(0.5, 150, Interval);
+	CHECK(throttle.rate() == 150);
+	for (int i = 0; i < 20; ++i)
+		throttle.updatePressure(0.9, 0, Interval);
+	CHECK(throttle.rate() == 10);
+
+	double previous = throttle.rate();
+	for (int i = 0; i < 30; ++i)
+	{
+		throttle.updatePressure(0.0, 0, Interval);
+		CHECK(throttle.rate() > previous - 1e-9);
+		previous = throttle.rate();
+	}
+	CHECK(throttle.rate() == 1000);
+
+	// Without a configured maximum the limit is dropped once the scan no longer reaches it.
+	ScanThrottle unlimited{0, 0.2};
+	unlimited.updatePressure(0.1, 1000, Interval);
+	CHECK(unlimited.rate() == 0);
+	unlimited.updatePressure(0.5, 1000, Interval);
+	CHECK(unlimited.rate() == 1000);
+	unlimited.updatePressure(0.1, 1000, Interval);
+	CHECK(unlimited.rate() == 1250);
+	unlimited.updatePressure(0.1, 250, Interval);
+	CHECK(unlimited.rate() == 0);
+
+	// Without a target, pressure is ignored.
+	ScanThrottle fixed{1000, 0};
+	fixed.updatePressure(1.0, 500, Interval);
+	CHECK(fixed.rate() == 1000);
+}
@@ -0,0 +1,94 @@
+#include "3rdparty/catch2/catch.hpp"
+
+#include "scan_trace.h"
+
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <chrono>
+#include <thread>
+
+namespace {
+
+int occurrences(const QByteArray& json, const char* fragment)
+{
+	return static_cast<int>(json.count(fragment));
+}
+
+} // namespace
+
+TEST_CASE("Scan traces write one Chrome trace track per recording thread", "[scan-trace]")
+{
+	ScanTrace trace;
+	CHECK(trace.chromeTraceJson() == R"({"displayTimeUnit":"ms","traceEvents":[]})");
+
+	const auto origin = std::chrono::steady_clock::now();
+	trace.record(ScanTraceActivity::enumeration, origin, origin + std::chrono::nanoseconds{2'500'125}, 17);
+	std::thread other{[&trace, origin] {
+		trace.record(ScanTraceActivity::idle_wait, origin, origin + std::chrono::microseconds{40});
+		trace.record(ScanTraceActivity::lock_wait, origin, origin + std::chrono::nanoseconds{7});
+	}};
+	other.join();
+	trace.record(ScanTraceActivity::metadata, origin, origin + std::chrono::microseconds{3}, 4);
+
+	const QByteArray json = trace.chromeTraceJson();
+	CHECK(json.startsWith(R"({"displayTimeUnit":"ms","traceEvents":[)"));
+	CHECK(json.endsWith("]}"));
+	CHECK(occurrences(json, R"("ph":"M")") == 2);
+	CHECK(occurrences(json, R"("args":{"name":"Scan thread 1"})") == 1);
+	CHECK(occurrences(json, R"("args":{"name":"Scan thread 2"})") == 1);
+	CHECK(occurrences(json, R"("ph":"X")") == 4);
+	CHECK(json.contains(R"("name":"enumeration","cat":"scan","ph":"X","pid":1,"tid":1,)"));
+	CHECK(json.contains(R"(,"dur":2500.125,"args":{"count":17}})"));
+	CHECK(json.contains(R"("name":"metadata","cat":"scan","ph":"X","pid":1,"tid":1,)"));
+	CHECK(json.contains(R"("name":"idle wait","cat":"scan","ph":"X","pid":1,"tid":2,)"));
+	CHECK(json.contains(R"("name":"lock wait","cat":"scan","ph":"X","pid":1,"tid":2,)"));
+	CHECK(json.contains(R"(,"dur":0.007})"));
+	// Events of a track stay in the order they were recorded.
+	CHECK(json.indexOf("\"enumeration\"") < json.indexOf("\"metadata\""));
+	CHECK(json.indexOf("\"idle wait\"") < json.indexOf("\"lock wait\""));
+}
+
+TEST_CASE("Scan traces keep the latest events of each thread once its buffer is full", "[scan-trace]")
+{
+	ScanTrace trace{3};
+	const auto origin = std::chrono::steady_clock::now();
+	for (uint32_t i = 1; i <= 5; ++i)
+		trace.record(ScanTraceActivity::metadata, origin, origin + std::chrono::microseconds{i}, i);
+
+	const QByteArray json = trace.chromeTraceJson();
+	CHECK(occurrences(json, R"("ph":"X")") == 3);
+	CHECK_FALSE(json.contains(R"("count":1})"));
+	CHECK_FALSE(json.contains(R"("count":2})"));
+	const auto third = json.indexOf(R"("count":3})");
+	const auto fourth = json.indexOf(R"("count":4})");
+	const auto fifth = json.indexOf(R"("count":5})");
+	CHECK(third >= 0);
+	CHECK(third < fourth);
+	CHECK(fourth < fifth);
+
+	// A second trace recorded from the same thread starts a buffer of its own.
+	ScanTrace next;
+	next.record(ScanTraceActivity::enumeration, origin, origin);
+	CHECK(occurrences(next.chromeTraceJson(), R"("ph":"X")") == 1);
+	trace.record(ScanTraceActivity::metadata, origin, origin, 6);
+	CHECK(occurrences(trace.chromeTraceJson(), R"("ph":"M")") == 1);
+	CHECK(trace.chromeTraceJson().contains(R"("count":6})"));
+}
+
+TEST_CASE("Scan traces are written to a file", "[scan-trace]")
+{
+	QTemporaryDir directory;
+	REQUIRE(directory.isValid());
+	ScanTrace trace;
+	const auto origin = std::chrono::steady_clock::now();
+	trace.record(ScanTraceActivity::enumeration, origin, origin + std::chrono::milliseconds{1}, 2);
+
+	const QString path = directory.filePath("trace.json");
+	REQUIRE(trace.writeChromeTrace(path).has_value());
+	QFile file{path};
+	REQUIRE(file.open(QIODevice::ReadOnly));
+	CHECK(file.readAll() == trace.chromeTraceJson());
+
+	CHECK_FALSE(trace.writeChromeTrace(directory.filePath("missing/trace.json")).has_value());
+}
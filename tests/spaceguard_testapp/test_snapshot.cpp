@@ -9,6 +9,8 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <set>
 #include <string>
 #include <utility>
 
@@ -75,6 +77,7 @@ Snapshot makeSnapshot(const bool reverseInsertionOrder = false)
 
 	SnapshotEntry completed = directoryEntry(DirectoryTraversalState::completed, metadata(0, 4096, 1, identity(filesystem, 2)));
 	completed.children.try_emplace(nativeName("other"), SnapshotEntry{{thin_io::entry_kind::other, false, false, false, 0}, metadata(7, 8, 1)});
+	completed.foldedFiles = SnapshotFoldedFiles{5, 1000, 1024, 1, 1};
 
 	SnapshotEntry failed = directoryEntry(DirectoryTraversalState::enumeration_failed, metadata(0, 4096, 1, identity(filesystem, 3)));
 	SnapshotEntry unknownMetadata = directoryEntry(DirectoryTraversalState::metadata_unavailable, {});
@@ -84,6 +87,9 @@ Snapshot makeSnapshot(const bool reverseInsertionOrder = false)
 	link.attributes.reparse_tag = 0xA000000C;
 #endif
 	SnapshotEntry boundary = directoryEntry(DirectoryTraversalState::mount_boundary, metadata(0, 4096, 1, identity(99, 4)));
+	SnapshotEntry excluded = directoryEntry(DirectoryTraversalState::excluded, metadata(0, 4096, 1, identity(filesystem, 6)));
+	SnapshotEntry stalled = directoryEntry(DirectoryTraversalState::stalled, metadata(0, 4096, 1, identity(filesystem, 7)));
+	stalled.children.try_emplace(nativeName("unvisited"), directoryEntry(DirectoryTraversalState::metadata_unavailable, {}));
 	SnapshotEntry unknown;
 	unknown.attributes.kind = thin_io::entry_kind::unknown;
 
@@ -101,6 +107,8 @@ Snapshot makeSnapshot(const bool reverseInsertionOrder = false)
 		NamedEntry{nativeName("unknown-metadata"), std::move(unknownMetadata)},
 		NamedEntry{nativeName("link"), std::move(link)},
 		NamedEntry{nativeName("boundary"), std::move(boundary)},
+		NamedEntry{nativeName("excluded"), std::move(excluded)},
+		NamedEntry{nativeName("stalled"), std::move(stalled)},
 		NamedEntry{nativeName("unknown"), std::move(unknown)},
 		NamedEntry{std::move(unusualName), fileEntry(8192, 4096, identity(filesystem, 5))}
 	};
@@ -113,6 +121,11 @@ Snapshot makeSnapshot(const bool reverseInsertionOrder = false)
 	snapshot.filesystemSpaceAtCompletion = thin_io::filesystem_space{100000, 35000, 25000, {}};
 	snapshot.scanStartedAtUtc = QDateTime::fromMSecsSinceEpoch(1000, QTimeZone::UTC);
 	snapshot.scanCompletedAtUtc = QDateTime::fromMSecsSinceEpoch(2000, QTimeZone::UTC);
+	snapshot.exclusionRules = {
+		{SnapshotExclusionPatternKind::glob, nativePath("node_modules"), SnapshotExclusionAction::skip},
+		{SnapshotExclusionPatternKind::path_prefix, snapshot.rootPath + nativePath("/cache"), SnapshotExclusionAction::stat_only},
+		{SnapshotExclusionPatternKind::marker_file, nativePath("CACHEDIR.TAG"), SnapshotExclusionAction::stat_only}
+	};
 
 	const std::array operations{
 		SnapshotOperation::root_metadata,
@@ -120,11 +133,12 @@ Snapshot makeSnapshot(const bool reverseInsertionOrder = false)
 		SnapshotOperation::entry_metadata,
 		SnapshotOperation::filesystem_space_at_start,
 		SnapshotOperation::filesystem_space_at_completion,
-		SnapshotOperation::entry_changed_during_scan
+		SnapshotOperation::entry_changed_during_scan,
+		SnapshotOperation::call_deadline_exceeded
 	};
 	for (size_t i = 0; i < operations.size(); ++i)
-		snapshot.diagnostics.push_back({snapshot.rootPath, operations[i], operations[i] == SnapshotOperation::entry_changed_during_scan
-			? std::nullopt : std::optional{static_cast<thin_io::filesystem_error_code>(5 + i)}});
+		snapshot.diagnostics.push_back({snapshot.rootPath, operations[i], snapshotOperationHasNativeErrorCode(operations[i])
+			? std::optional{static_cast<thin_io::filesystem_error_code>(5 + i)} : std::nullopt});
 	return snapshot;
 }
 
@@ -171,15 +185,38 @@ void checkLoadError(const QString& path, const QByteArray& data, const SnapshotL
 	CHECK(result.error().code == expectedError);
 }
 
-qsizetype rootKindOffset(const Snapshot& snapshot)
+qsizetype nativeStringSize(const NativePath& value)
 {
 #ifdef _WIN32
-	return sizeof(quint32) + snapshot.rootPath.size() * sizeof(quint16);
+	return sizeof(quint32) + value.size() * sizeof(quint16);
 #else
-	return sizeof(quint32) + snapshot.rootPath.size();
+	return sizeof(quint32) + value.size();
 #endif
 }
 
+// The table that holds every distinct name once, between the root path and the root.
+qsizetype nameTableSize(const Snapshot& snapshot)
+{
+	std::set<NativeName> names;
+	const auto collect = [&names](auto&& self, const SnapshotEntry& entry) -> void {
+		for (auto child = entry.children.begin(), end = entry.children.end(); child != end; ++child)
+		{
+			names.insert(child.key());
+			self(self, child.value());
+		}
+	};
+	collect(collect, snapshot.root);
+	qsizetype size = sizeof(quint32);
+	for (const NativeName& name : names)
+		size += nativeStringSize(name);
+	return size;
+}
+
+qsizetype rootKindOffset(const Snapshot& snapshot)
+{
+	return nativeStringSize(snapshot.rootPath) + nameTableSize(snapshot);
+}
+
 qsizetype rootTraversalStateOffset(const Snapshot& snapshot)
 {
 	constexpr qsizetype AttributesSize = 8;
@@ -195,26 +232,131 @@ TEST_CASE("Snapshots preserve all factual fields", "[snapshot][persistence]")
 	QTemporaryDir directory;
 	REQUIRE(directory.isValid());
 	const QString path = directory.filePath("snapshot.spaceguard");
-	const Snapshot original = makeSnapshot();
+	Snapshot original = makeSnapshot();
+	original.directoryCosts.slowest = {
+		{original.rootPath + nativePath("/complete"), std::chrono::milliseconds{1500}, 1},
+		{original.rootPath, std::chrono::nanoseconds{750}, 8}
+	};
+	original.directoryCosts.largest = {{original.rootPath, std::chrono::nanoseconds{750}, 8}};
 
 	REQUIRE(original.save(path));
 	const auto loaded = Snapshot::load(path);
 	REQUIRE(loaded);
 	CHECK(*loaded == original);
+	CHECK(loaded->directoryCosts == original.directoryCosts);
 	CHECK(loaded->derivedDataAvailable);
 
 	Snapshot withoutOptionalRootFacts = original;
 	withoutOptionalRootFacts.filesystemSpaceAtStart.reset();
 	withoutOptionalRootFacts.filesystemSpaceAtCompletion.reset();
 	withoutOptionalRootFacts.diagnostics.clear();
+	withoutOptionalRootFacts.exclusionRules.clear();
+	withoutOptionalRootFacts.directoryCosts = {};
 	const QString optionalPath = directory.filePath("without-optional-fields.spaceguard");
 	REQUIRE(withoutOptionalRootFacts.save(optionalPath));
 	const auto optionalLoaded = Snapshot::load(optionalPath);
 	REQUIRE(optionalLoaded);
 	CHECK(*optionalLoaded == withoutOptionalRootFacts);
+	CHECK(optionalLoaded->directoryCosts == SnapshotDirectoryCostReport{});
 	CHECK(optionalLoaded->derivedDataAvailable);
 }
 
+TEST_CASE("Snapshots saved before exclusion rules, folded files and directory costs still load", "[snapshot][persistence]")
+{
+	QTemporaryDir directory;
+	REQUIRE(directory.isValid());
+	const QString path = directory.filePath("snapshot.spaceguard");
+	Snapshot original = makeSnapshot();
+	original.root.children.clear();
+	original.exclusionRules.clear();
+	original.diagnostics.clear();
+	REQUIRE(original.save(path));
+	const QByteArray current = readFile(path);
+
+	// Version 6 writes each name where its entry is instead of in a table, which holds nothing but its count here.
+	QByteArray payload = uncompressedPayload(current);
+	const qsizetype nameTableOffset = nativeStringSize(original.rootPath);
+	const qsizetype emptyNameTableSize = nameTableSize(original);
+	REQUIRE(payload.sliced(nameTableOffset, emptyNameTableSize) == QByteArray(emptyNameTableSize, '\0'));
+	payload = payload.first(nameTableOffset) + payload.sliced(nameTableOffset + emptyNameTableSize);
+	QByteArray version6 = replacePayload(current, payload);
+	qToLittleEndian<quint16>(6, reinterpret_cast<uchar*>(version6.data() + 8));
+	writeFile(path, version6);
+	const auto loadedVersion6 = Snapshot::load(path);
+	REQUIRE(loadedVersion6);
+	CHECK(*loadedVersion6 == original);
+
+	// Version 5 only lacks the stalled traversal state and the call deadline diagnostic.
+	QByteArray version5 = version6;
+	qToLittleEndian<quint16>(5, reinterpret_cast<uchar*>(version5.data() + 8));
+	writeFile(path, version5);
+	const auto loadedVersion5 = Snapshot::load(path);
+	REQUIRE(loadedVersion5);
+	CHECK(*loadedVersion5 == original);
+
+	// Version 4 also lacks the two directory cost counts at the end of the payload.
+	REQUIRE(payload.endsWith(QByteArray(16, '\0')));
+	payload.chop(2 * sizeof(quint32));
+	QByteArray version4 = replacePayload(current, payload);
+	qToLittleEndian<quint16>(4, reinterpret_cast<uchar*>(version4.data() + 8));
+	writeFile(path, version4);
+	const auto loadedVersion4 = Snapshot::load(path);
+	REQUIRE(loadedVersion4);
+	CHECK(*loadedVersion4 == original);
+	CHECK(loadedVersion4->directoryCosts == SnapshotDirectoryCostReport{});
+
+	// Version 3 also lacks the folded-files flag that follows each traversal state; the root is the only entry here.
+	const qsizetype foldedFilesFlagOffset = rootTraversalStateOffset(original) - emptyNameTableSize + 1;
+	REQUIRE(payload[foldedFilesFlagOffset] == '\0');
+	payload = payload.first(foldedFilesFlagOffset) + payload.sliced(foldedFilesFlagOffset + 1);
+	QByteArray version3 = replacePayload(current, payload);
+	qToLittleEndian<quint16>(3, reinterpret_cast<uchar*>(version3.data() + 8));
+	writeFile(path, version3);
+	const auto loadedVersion3 = Snapshot::load(path);
+	REQUIRE(loadedVersion3);
+	CHECK(*loadedVersion3 == original);
+
+	// Version 2 also lacks the rule count that precedes the diagnostic count at the end of the payload.
+	REQUIRE(payload.endsWith(QByteArray(8, '\0')));
+	payload.chop(sizeof(quint32));
+	QByteArray version2 = replacePayload(current, payload);
+	qToLittleEndian<quint16>(2, reinterpret_cast<uchar*>(version2.data() + 8));
+	writeFile(path, version2);
+	const auto loadedVersion2 = Snapshot::load(path);
+	REQUIRE(loadedVersion2);
+	CHECK(*loadedVersion2 == original);
+}
+
+TEST_CASE("Directory cost reports keep the costliest directories of both rankings", "[snapshot]")
+{
+	const auto cost = [](const uint64_t index, const int64_t milliseconds, const uint64_t entries) {
+		return SnapshotDirectoryCost{nativePath(("/directory-" + std::to_string(index)).c_str()), std::chrono::milliseconds{milliseconds}, entries};
+	};
+
+	SnapshotDirectoryCostReport report;
+	SnapshotDirectoryCostReport other;
+	for (uint64_t i = 0; i < SnapshotDirectoryCostReport::Size; ++i)
+	{
+		report.slowest.push_back(cost(i, static_cast<int64_t>(i), i));
+		report.largest.push_back(cost(i, static_cast<int64_t>(i), i));
+	}
+	other.slowest = {cost(100, 1000, 0), cost(101, 3, 0)};
+	other.largest = {cost(102, 0, 1000), cost(103, 0, 3)};
+	report.add(other);
+
+	REQUIRE(report.slowest.size() == SnapshotDirectoryCostReport::Size);
+	REQUIRE(report.largest.size() == SnapshotDirectoryCostReport::Size);
+	CHECK(std::ranges::is_sorted(report.slowest, slowerDirectory));
+	CHECK(std::ranges::is_sorted(report.largest, largerDirectory));
+	CHECK(report.slowest.front() == cost(100, 1000, 0));
+	CHECK(report.largest.front() == cost(102, 0, 1000));
+	// Equal costs are ranked by path, which keeps the cut deterministic.
+	CHECK(std::ranges::find(report.slowest, cost(101, 3, 0)) != report.slowest.end());
+	CHECK(std::ranges::find(report.slowest, cost(3, 3, 3)) != report.slowest.end());
+	CHECK(report.slowest.back() == cost(2, 2, 2));
+	CHECK(report.largest.back() == cost(2, 2, 2));
+}
+
 TEST_CASE("Snapshot serialization is deterministic", "[snapshot][persistence]")
 {
 	QTemporaryDir directory;
@@ -256,7 +398,7 @@ TEST_CASE("Large snapshots round-trip", "[snapshot][persistence]")
 	const auto loaded = Snapshot::load(path);
 	REQUIRE(loaded);
 	CHECK(*loaded == original);
-	CHECK(loaded->root.children.size() == EntryCount);
+	CHECK(loaded->tree.children(SnapshotTree::RootIndex).size() == EntryCount);
 	CHECK(loaded->diagnostics.size() == DiagnosticCount);
 	CHECK(loaded->derivedDataAvailable);
 }
@@ -324,12 +466,14 @@ TEST_CASE("Snapshot loader distinguishes damaged payloads", "[snapshot][persiste
 	invalidEnumPayload[rootTraversalStateOffset(snapshot)] = static_cast<char>(0xFF);
 	checkLoadError(path, replacePayload(valid, invalidEnumPayload), SnapshotLoadErrorCode::corrupt_data);
 
+	// The last diagnostic's operation precedes its error code flag and the two empty directory cost lists.
 	invalidEnumPayload = uncompressedPayload(valid);
-	invalidEnumPayload[invalidEnumPayload.size() - 2] = static_cast<char>(0xFF);
+	invalidEnumPayload[invalidEnumPayload.size() - 2 - 2 * static_cast<qsizetype>(sizeof(quint32))] = static_cast<char>(0xFF);
 	checkLoadError(path, replacePayload(valid, invalidEnumPayload), SnapshotLoadErrorCode::corrupt_data);
 
 	QByteArray oversizedCountPayload = uncompressedPayload(valid);
-	std::fill_n(oversizedCountPayload.begin() + rootTraversalStateOffset(snapshot) + 1, sizeof(quint32), static_cast<char>(0xFF));
+	// The child count follows the traversal state and the folded-files flag.
+	std::fill_n(oversizedCountPayload.begin() + rootTraversalStateOffset(snapshot) + 2, sizeof(quint32), static_cast<char>(0xFF));
 	checkLoadError(path, replacePayload(valid, oversizedCountPayload), SnapshotLoadErrorCode::corrupt_data);
 
 	QByteArray oversizedStringPayload = uncompressedPayload(valid);
@@ -341,11 +485,17 @@ TEST_CASE("Snapshot loader distinguishes damaged payloads", "[snapshot][persiste
 	REQUIRE(withoutDiagnostics.save(path));
 	const QByteArray withoutDiagnosticsFile = readFile(path);
 	QByteArray oversizedDiagnosticCountPayload = uncompressedPayload(withoutDiagnosticsFile);
-	REQUIRE(oversizedDiagnosticCountPayload.size() >= static_cast<qsizetype>(sizeof(quint32)));
-	const qsizetype diagnosticCountOffset = oversizedDiagnosticCountPayload.size() - static_cast<qsizetype>(sizeof(quint32));
+	REQUIRE(oversizedDiagnosticCountPayload.size() >= 3 * static_cast<qsizetype>(sizeof(quint32)));
+	const qsizetype diagnosticCountOffset = oversizedDiagnosticCountPayload.size() - 3 * static_cast<qsizetype>(sizeof(quint32));
 	std::fill_n(oversizedDiagnosticCountPayload.begin() + diagnosticCountOffset, sizeof(quint32), static_cast<char>(0xFF));
 	checkLoadError(path, replacePayload(withoutDiagnosticsFile, oversizedDiagnosticCountPayload), SnapshotLoadErrorCode::corrupt_data);
 
+	// More directory costs than a report holds.
+	QByteArray oversizedCostCountPayload = uncompressedPayload(withoutDiagnosticsFile);
+	oversizedCostCountPayload[oversizedCostCountPayload.size() - static_cast<qsizetype>(sizeof(quint32))] =
+		static_cast<char>(SnapshotDirectoryCostReport::Size + 1);
+	checkLoadError(path, replacePayload(withoutDiagnosticsFile, oversizedCostCountPayload), SnapshotLoadErrorCode::corrupt_data);
+
 	QByteArray inconsistentPayload = uncompressedPayload(valid);
 	inconsistentPayload[rootKindOffset(snapshot) + 4] = 1;
 	checkLoadError(path, replacePayload(valid, inconsistentPayload), SnapshotLoadErrorCode::corrupt_data);
@@ -374,6 +524,27 @@ TEST_CASE("Snapshot load and save failures are transactional", "[snapshot][persi
 	CHECK(invalidSpaceResult.error().code == SnapshotSaveErrorCode::invalid_snapshot);
 	CHECK(readFile(path) == originalBytes);
 
+	invalid = original;
+	invalid.root.children.at(nativeName("failed")).foldedFiles = SnapshotFoldedFiles{1, 10, 10, 0, 0};
+	const auto invalidFoldedResult = invalid.save(path);
+	REQUIRE_FALSE(invalidFoldedResult);
+	CHECK(invalidFoldedResult.error().code == SnapshotSaveErrorCode::invalid_snapshot);
+	CHECK(readFile(path) == originalBytes);
+
+	invalid = original;
+	invalid.root.children.at(nativeName("stalled")).metadata.reset();
+	const auto invalidStalledResult = invalid.save(path);
+	REQUIRE_FALSE(invalidStalledResult);
+	CHECK(invalidStalledResult.error().code == SnapshotSaveErrorCode::invalid_snapshot);
+	CHECK(readFile(path) == originalBytes);
+
+	invalid = original;
+	invalid.directoryCosts.slowest.push_back({nativePath("relative"), std::chrono::seconds{1}, 1});
+	const auto invalidCostResult = invalid.save(path);
+	REQUIRE_FALSE(invalidCostResult);
+	CHECK(invalidCostResult.error().code == SnapshotSaveErrorCode::invalid_snapshot);
+	CHECK(readFile(path) == originalBytes);
+
 	const Snapshot current = original;
 	writeFile(path, QByteArray{"not a snapshot"});
 	const auto loadResult = Snapshot::load(path);
@@ -1,11 +1,14 @@
 #include "3rdparty/catch2/catch.hpp"
 
 #include "snapshot_comparison.h"
+#include "threading/cworkerthread.h"
 
 #include <QTimeZone>
 
 #include <algorithm>
+#include <initializer_list>
 #include <limits>
+#include <string>
 #include <utility>
 
 namespace {
@@ -79,6 +82,19 @@ NativePath childPath(const NativePath& parent, const char* child)
 	return appendNativeName(parent, nativeName(child));
 }
 
+// The derived data of the entry that the names lead to from the root.
+SnapshotEntryDerivedData derivedData(const Snapshot& snapshot, const std::initializer_list<const char*> names = {})
+{
+	SnapshotTree::Index entry = SnapshotTree::RootIndex;
+	for (const char* const name : names)
+	{
+		const std::optional<SnapshotTree::Index> child = snapshot.tree.findChild(entry, nativeName(name));
+		REQUIRE(child);
+		entry = *child;
+	}
+	return snapshot.tree.derived(entry);
+}
+
 const ComparisonChange* findChange(const SnapshotComparisonResult& result, const NativePath& path)
 {
 	const auto change = std::ranges::find_if(result.changes, [&path](const ComparisonChange& candidate) { return candidate.path == path; });
@@ -105,8 +121,9 @@ const ComparisonExcludedRegion* findExcludedRegion(const SnapshotComparisonResul
 	return region != result.excludedRegions.end() ? &*region : nullptr;
 }
 
+// Takes copies, so that the callers can keep changing the entries staged in their snapshots.
 std::expected<SnapshotComparisonResult, SnapshotComparisonError> comparePrepared(
-	Snapshot& baseline, Snapshot& current, const uint64_t threshold)
+	Snapshot baseline, Snapshot current, const uint64_t threshold)
 {
 	baseline.rebuildDerivedData();
 	current.rebuildDerivedData();
@@ -134,10 +151,10 @@ TEST_CASE("Derived accounting groups hard links deterministically", "[snapshot][
 	CHECK(group.allAliasesObserved);
 	CHECK(group.accountingExact);
 	CHECK(group.presentationPath == childPath(childPath(snapshot.rootPath, "a"), "z"));
-	CHECK(snapshot.root.derived.subtreeAllocatedSize == 100);
-	CHECK(snapshot.root.derived.knownSubtreeAllocatedSizeLowerBound == 100);
-	CHECK(snapshot.root.children.at(nativeName("a")).children.at(nativeName("z")).derived.localAllocatedSize == 100);
-	CHECK(snapshot.root.children.at(nativeName("b")).children.at(nativeName("a")).derived.localAllocatedSize == 0);
+	CHECK(derivedData(snapshot).subtreeAllocatedSize == 100);
+	CHECK(derivedData(snapshot).knownSubtreeAllocatedSizeLowerBound == 100);
+	CHECK(derivedData(snapshot, {"a", "z"}).localAllocatedSize == 100);
+	CHECK(derivedData(snapshot, {"b", "a"}).localAllocatedSize == 0);
 }
 
 TEST_CASE("Derived accounting bypasses hard-link grouping for one-link files", "[snapshot][accounting]")
@@ -147,9 +164,9 @@ TEST_CASE("Derived accounting bypasses hard-link grouping for one-link files", "
 
 	snapshot.rebuildDerivedData();
 	CHECK(snapshot.hardLinkGroups.empty());
-	CHECK(snapshot.root.children.at(nativeName("file")).derived.localAllocatedSize == 100);
-	CHECK(snapshot.root.derived.subtreeAllocatedSize == 100);
-	CHECK(snapshot.root.derived.knownSubtreeAllocatedSizeLowerBound == 100);
+	CHECK(derivedData(snapshot, {"file"}).localAllocatedSize == 100);
+	CHECK(derivedData(snapshot).subtreeAllocatedSize == 100);
+	CHECK(derivedData(snapshot).knownSubtreeAllocatedSizeLowerBound == 100);
 }
 
 TEST_CASE("Derived accounting retains known allocation below incomplete subtrees", "[snapshot][accounting]")
@@ -164,12 +181,12 @@ TEST_CASE("Derived accounting retains known allocation below incomplete subtrees
 	snapshot.root.children.try_emplace(nativeName("unknown"), std::move(unknownFile));
 
 	snapshot.rebuildDerivedData();
-	CHECK_FALSE(snapshot.root.derived.subtreeAllocatedSize);
-	CHECK(snapshot.root.derived.knownSubtreeAllocatedSizeLowerBound == 100);
-	const SnapshotEntry& partial = snapshot.root.children.at(nativeName("partial"));
-	CHECK_FALSE(partial.derived.subtreeAllocatedSize);
-	CHECK(partial.derived.knownSubtreeAllocatedSizeLowerBound == 100);
-	CHECK_FALSE(snapshot.root.children.at(nativeName("unknown")).derived.knownSubtreeAllocatedSizeLowerBound);
+	CHECK_FALSE(derivedData(snapshot).subtreeAllocatedSize);
+	CHECK(derivedData(snapshot).knownSubtreeAllocatedSizeLowerBound == 100);
+	const SnapshotEntryDerivedData partial = derivedData(snapshot, {"partial"});
+	CHECK_FALSE(partial.subtreeAllocatedSize);
+	CHECK(partial.knownSubtreeAllocatedSizeLowerBound == 100);
+	CHECK_FALSE(derivedData(snapshot, {"unknown"}).knownSubtreeAllocatedSizeLowerBound);
 }
 
 TEST_CASE("Derived accounting identifies unavailable and inconsistent hard-link facts", "[snapshot][accounting]")
@@ -179,9 +196,9 @@ TEST_CASE("Derived accounting identifies unavailable and inconsistent hard-link
 		Snapshot snapshot = makeSnapshot();
 		snapshot.root.children.try_emplace(nativeName("file"), regularFile(100, 2));
 		snapshot.rebuildDerivedData();
-		CHECK_FALSE(snapshot.root.children.at(nativeName("file")).derived.localAllocatedSize);
-		CHECK_FALSE(snapshot.root.derived.subtreeAllocatedSize);
-		CHECK(snapshot.root.derived.knownSubtreeAllocatedSizeLowerBound == 0);
+		CHECK_FALSE(derivedData(snapshot, {"file"}).localAllocatedSize);
+		CHECK_FALSE(derivedData(snapshot).subtreeAllocatedSize);
+		CHECK(derivedData(snapshot).knownSubtreeAllocatedSizeLowerBound == 0);
 	}
 
 	SECTION("Unobserved aliases are uncertain")
@@ -193,7 +210,7 @@ TEST_CASE("Derived accounting identifies unavailable and inconsistent hard-link
 		CHECK(snapshot.hardLinkGroups.front().metadataConsistent);
 		CHECK_FALSE(snapshot.hardLinkGroups.front().allAliasesObserved);
 		CHECK_FALSE(snapshot.hardLinkGroups.front().accountingExact);
-		CHECK_FALSE(snapshot.root.derived.subtreeAllocatedSize);
+		CHECK_FALSE(derivedData(snapshot).subtreeAllocatedSize);
 	}
 
 	SECTION("Conflicting alias metadata is uncertain")
@@ -206,9 +223,9 @@ TEST_CASE("Derived accounting identifies unavailable and inconsistent hard-link
 		REQUIRE(snapshot.hardLinkGroups.size() == 1);
 		CHECK_FALSE(snapshot.hardLinkGroups.front().metadataConsistent);
 		CHECK_FALSE(snapshot.hardLinkGroups.front().accountingExact);
-		CHECK_FALSE(snapshot.root.children.at(nativeName("a")).derived.localAllocatedSize);
-		CHECK_FALSE(snapshot.root.children.at(nativeName("b")).derived.localAllocatedSize);
-		CHECK_FALSE(snapshot.root.derived.subtreeAllocatedSize);
+		CHECK_FALSE(derivedData(snapshot, {"a"}).localAllocatedSize);
+		CHECK_FALSE(derivedData(snapshot, {"b"}).localAllocatedSize);
+		CHECK_FALSE(derivedData(snapshot).subtreeAllocatedSize);
 	}
 }
 
@@ -218,9 +235,9 @@ TEST_CASE("Derived accounting rejects allocated-size overflow", "[snapshot][acco
 	snapshot.root.children.try_emplace(nativeName("a"), regularFile(std::numeric_limits<uint64_t>::max()));
 	snapshot.root.children.try_emplace(nativeName("b"), regularFile(1));
 	snapshot.rebuildDerivedData();
-	CHECK(snapshot.root.derived.allocationOverflow);
-	CHECK_FALSE(snapshot.root.derived.subtreeAllocatedSize);
-	CHECK_FALSE(snapshot.root.derived.knownSubtreeAllocatedSizeLowerBound);
+	CHECK(derivedData(snapshot).allocationOverflow);
+	CHECK_FALSE(derivedData(snapshot).subtreeAllocatedSize);
+	CHECK_FALSE(derivedData(snapshot).knownSubtreeAllocatedSizeLowerBound);
 }
 
 TEST_CASE("Derived accounting excludes mount boundaries but includes link entries", "[snapshot][accounting]")
@@ -235,10 +252,74 @@ TEST_CASE("Derived accounting excludes mount boundaries but includes link entrie
 	snapshot.root.children.try_emplace(nativeName("mount"), std::move(mount));
 
 	snapshot.rebuildDerivedData();
-	CHECK(snapshot.root.children.at(nativeName("mount")).derived.localAllocatedSize == 0);
-	CHECK(snapshot.root.children.at(nativeName("link")).derived.localAllocatedSize == 20);
-	CHECK(snapshot.root.derived.subtreeAllocatedSize == 20);
-	CHECK(snapshot.root.derived.subtreeCoverageComplete);
+	CHECK(derivedData(snapshot, {"mount"}).localAllocatedSize == 0);
+	CHECK(derivedData(snapshot, {"link"}).localAllocatedSize == 20);
+	CHECK(derivedData(snapshot).subtreeAllocatedSize == 20);
+	CHECK(derivedData(snapshot).subtreeCoverageComplete);
+}
+
+TEST_CASE("Derived accounting on a worker pool matches the serial rebuild", "[snapshot][accounting][parallel]")
+{
+	// Enough entries at one depth, and enough hard-link groups, for both to be split between the pool's workers.
+	constexpr int DirectoryCount = 300;
+	constexpr int FileCount = 300;
+	Snapshot serial = makeSnapshot();
+	for (int directoryIndex = 0; directoryIndex < DirectoryCount; ++directoryIndex)
+	{
+		SnapshotEntry entry = directory(directoryIndex % 17 == 0 ? DirectoryTraversalState::enumeration_failed
+			: DirectoryTraversalState::completed);
+		if (directoryIndex % 5 == 0)
+			entry.foldedFiles = SnapshotFoldedFiles{3, 30, 30, static_cast<uint64_t>(directoryIndex % 2), 0};
+		for (int file = 0; file < FileCount; ++file)
+		{
+			SnapshotEntry child = regularFile(static_cast<uint64_t>(file));
+			if (file % 4 == 0)
+			{
+				// Groups of two names in neighbouring directories, some of them reporting a third name never seen.
+				const int group = (directoryIndex / 2) * FileCount + file;
+				child = regularFile(100, group % 3 == 0 ? 3 : 2, entryIdentity(1000 + static_cast<uint64_t>(group), 9));
+			}
+			else if (file % 97 == 0)
+				child.metadata.reset();
+			else if (directoryIndex == 150 && file == 1)
+				child = regularFile(std::numeric_limits<uint64_t>::max());
+			entry.children.try_emplace(nativeName(("file-" + std::to_string(file)).c_str()), std::move(child));
+		}
+		if (directoryIndex % 10 == 0)
+		{
+			SnapshotEntry nested = directory();
+			nested.children.try_emplace(nativeName("nested-file"), regularFile(7));
+			entry.children.try_emplace(nativeName("nested"), std::move(nested));
+		}
+		serial.root.children.try_emplace(nativeName(("directory-" + std::to_string(directoryIndex)).c_str()), std::move(entry));
+	}
+	Snapshot pooled = serial;
+	Snapshot pooledFromAliases = serial;
+
+	serial.rebuildDerivedData();
+	REQUIRE(serial.hardLinkGroups.size() > 2048);
+	SnapshotHardLinkAliases aliases;
+	for (const SnapshotHardLinkGroup& group : serial.hardLinkGroups)
+		aliases.emplace_back(group.identity, std::vector<NativePath>{group.aliases.rbegin(), group.aliases.rend()});
+	std::ranges::reverse(aliases);
+
+	CWorkerThreadPool workerPool{4, "SpaceGuard derived data test"};
+	pooled.rebuildDerivedData(&workerPool);
+	pooledFromAliases.rebuildDerivedData(std::move(aliases), &workerPool);
+	for (const Snapshot* const snapshot : {&pooled, &pooledFromAliases})
+	{
+		REQUIRE(snapshot->derivedDataAvailable);
+		CHECK(snapshot->hardLinkGroups == serial.hardLinkGroups);
+		REQUIRE(snapshot->tree.size() == serial.tree.size());
+		std::size_t differingEntries = 0;
+		for (SnapshotTree::Index entry = SnapshotTree::RootIndex; entry < serial.tree.size(); ++entry)
+		{
+			if (!(snapshot->tree.derived(entry) == serial.tree.derived(entry)))
+				++differingEntries;
+		}
+		CHECK(differingEntries == 0);
+	}
+	CHECK(serial.tree.derived(SnapshotTree::RootIndex).allocationOverflow);
 }
 
 TEST_CASE("Comparison reports lowest significant positive changes", "[snapshot][comparison]")
@@ -266,12 +347,12 @@ TEST_CASE("Comparison reports lowest significant positive changes", "[snapshot][
 		childPath(childPath(baseline.rootPath, "added"), "large"), 0, 70, thin_io::entry_kind::regular_file, false));
 	CHECK(result->summary.allocatedTreeChange == (MagnitudeChange{ChangeDirection::increase, 110}));
 
-	const auto aboveThreshold = compareSnapshots(baseline, current, 111);
+	const auto aboveThreshold = comparePrepared(baseline, current, 111);
 	REQUIRE(aboveThreshold);
 	CHECK(aboveThreshold->changes.empty());
 	CHECK(aboveThreshold->hasPositiveChangeBelowThreshold);
 
-	const auto withoutThreshold = compareSnapshots(baseline, current, 0);
+	const auto withoutThreshold = comparePrepared(baseline, current, 0);
 	REQUIRE(withoutThreshold);
 	CHECK_FALSE(withoutThreshold->hasPositiveChangeBelowThreshold);
 }
@@ -359,6 +440,90 @@ TEST_CASE("Incomplete regions do not hide comparable siblings", "[snapshot][comp
 	CHECK(result->summary.reconciliation == ReconciliationState::incomplete);
 }
 
+TEST_CASE("Excluded subtrees are not reported as deletions", "[snapshot][comparison]")
+{
+	Snapshot baseline = makeSnapshot();
+	SnapshotEntry modules = directory();
+	modules.children.try_emplace(nativeName("package"), regularFile(300));
+	baseline.root.children.try_emplace(nativeName("node_modules"), std::move(modules));
+	SnapshotEntry cache = directory();
+	cache.children.try_emplace(nativeName("blob"), regularFile(200));
+	baseline.root.children.try_emplace(nativeName("cache"), std::move(cache));
+	baseline.root.children.try_emplace(nativeName("deleted"), regularFile(50));
+	baseline.root.children.try_emplace(nativeName("good"), regularFile(100));
+
+	Snapshot current = makeSnapshot();
+	current.exclusionRules = {{SnapshotExclusionPatternKind::glob, nativePath("node_*"), SnapshotExclusionAction::skip}};
+	current.root.children.try_emplace(nativeName("cache"), directory(DirectoryTraversalState::excluded));
+	current.root.children.try_emplace(nativeName("good"), regularFile(200));
+
+	const auto result = comparePrepared(baseline, current, 50);
+	REQUIRE(result);
+	REQUIRE(result->changes.size() == 1);
+	CHECK(result->changes.front() == expectedChange(childPath(current.rootPath, "good"), 100, 200, thin_io::entry_kind::regular_file, true));
+	const ComparisonExcludedRegion* skipped = findExcludedRegion(*result, childPath(current.rootPath, "node_modules"));
+	REQUIRE(skipped);
+	CHECK(skipped->currentExcludedByRule);
+	CHECK(skipped->currentCoverageIncomplete);
+	CHECK_FALSE(skipped->baselineExcludedByRule);
+	const ComparisonExcludedRegion* statOnly = findExcludedRegion(*result, childPath(current.rootPath, "cache"));
+	REQUIRE(statOnly);
+	CHECK(statOnly->currentExcludedByRule);
+	CHECK_FALSE(findExcludedRegion(*result, childPath(current.rootPath, "deleted")));
+	CHECK_FALSE(result->summary.allocatedTreeChange);
+}
+
+TEST_CASE("Folded directories compare at directory resolution", "[snapshot][comparison]")
+{
+	auto folded = [](const SnapshotFoldedFiles& files) {
+		SnapshotEntry entry = directory();
+		entry.foldedFiles = files;
+		return entry;
+	};
+
+	Snapshot baseline = makeSnapshot();
+	SnapshotEntry data = directory();
+	data.children.try_emplace(nativeName("a"), regularFile(100));
+	data.children.try_emplace(nativeName("b"), regularFile(200));
+	SnapshotEntry nested = directory();
+	nested.children.try_emplace(nativeName("c"), regularFile(10));
+	data.children.try_emplace(nativeName("nested"), nested);
+	baseline.root.children.try_emplace(nativeName("data"), std::move(data));
+	baseline.root.children.try_emplace(nativeName("archive"), folded({1, 100, 100, 0, 0}));
+	SnapshotEntry shared = directory();
+	shared.children.try_emplace(nativeName("linked"), regularFile(100));
+	baseline.root.children.try_emplace(nativeName("shared"), std::move(shared));
+
+	Snapshot current = makeSnapshot();
+	SnapshotEntry foldedData = folded({2, 400, 400, 0, 0});
+	foldedData.children.try_emplace(nativeName("nested"), std::move(nested));
+	current.root.children.try_emplace(nativeName("data"), std::move(foldedData));
+	SnapshotEntry archive = directory();
+	archive.children.try_emplace(nativeName("old"), regularFile(100));
+	archive.children.try_emplace(nativeName("fresh"), regularFile(300));
+	current.root.children.try_emplace(nativeName("archive"), std::move(archive));
+	current.root.children.try_emplace(nativeName("shared"), folded({1, 0, 0, 1, 0}));
+
+	const auto result = comparePrepared(baseline, current, 50);
+	REQUIRE(result);
+	REQUIRE(result->changes.size() == 2);
+	const ComparisonChange* dataChange = findChange(*result, childPath(current.rootPath, "data"));
+	REQUIRE(dataChange);
+	CHECK(*dataChange == expectedChange(childPath(current.rootPath, "data"), 310, 410, thin_io::entry_kind::directory, true));
+	const ComparisonChange* archiveChange = findChange(*result, childPath(current.rootPath, "archive"));
+	REQUIRE(archiveChange);
+	CHECK(*archiveChange == expectedChange(childPath(current.rootPath, "archive"), 100, 400, thin_io::entry_kind::directory, true));
+	CHECK_FALSE(findExcludedRegion(*result, childPath(childPath(current.rootPath, "data"), "a")));
+
+	// The space of a folded multi-link file cannot be attributed, so its directory is left out of the comparison.
+	const ComparisonExcludedRegion* sharedRegion = findExcludedRegion(*result, childPath(current.rootPath, "shared"));
+	REQUIRE(sharedRegion);
+	CHECK(sharedRegion->currentCoverageIncomplete);
+	CHECK_FALSE(sharedRegion->baselineCoverageIncomplete);
+	current.rebuildDerivedData();
+	CHECK(derivedData(current, {"shared"}).knownSubtreeAllocatedSizeLowerBound == 0);
+}
+
 TEST_CASE("Comparison results own source-derived paths", "[snapshot][comparison][lifetime]")
 {
 	SnapshotComparisonResult comparison;
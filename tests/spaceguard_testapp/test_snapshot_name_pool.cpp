@@ -0,0 +1,63 @@
+#include "3rdparty/catch2/catch.hpp"
+
+#include "snapshot_name_pool.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+NativeName nativeName(const std::string& name)
+{
+#ifdef _WIN32
+	return QString::fromStdString(name);
+#else
+	return QByteArray::fromStdString(name);
+#endif
+}
+
+} // namespace
+
+TEST_CASE("The name pool keeps one copy of each name interned concurrently", "[snapshot][name-pool][parallel]")
+{
+	constexpr int ThreadCount = 4;
+	constexpr int NamesPerThread = 2000;
+	constexpr int DistinctNames = 100;
+
+	SnapshotNamePool pool{8};
+	std::vector<std::vector<NativeName>> interned(ThreadCount);
+	{
+		std::vector<std::jthread> threads;
+		for (int thread = 0; thread < ThreadCount; ++thread)
+		{
+			threads.emplace_back([&, thread] {
+				for (int i = 0; i < NamesPerThread; ++i)
+				{
+					const NativeName name = nativeName("name-" + std::to_string((i + thread) % DistinctNames));
+					interned[static_cast<std::size_t>(thread)].push_back(pool.intern(name));
+				}
+			});
+		}
+	}
+
+	CHECK(pool.size() == DistinctNames);
+	for (int thread = 0; thread < ThreadCount; ++thread)
+	{
+		for (int i = 0; i < NamesPerThread; ++i)
+		{
+			const NativeName& name = interned[static_cast<std::size_t>(thread)][static_cast<std::size_t>(i)];
+			CHECK(name == nativeName("name-" + std::to_string((i + thread) % DistinctNames)));
+		}
+	}
+}
+
+TEST_CASE("The name pool tells names apart by their exact characters", "[snapshot][name-pool]")
+{
+	SnapshotNamePool pool;
+	CHECK(pool.intern(nativeName("Index")) == nativeName("Index"));
+	CHECK(pool.intern(nativeName("index")) == nativeName("index"));
+	CHECK(pool.intern(nativeName("index.")) == nativeName("index."));
+	CHECK(pool.intern(nativeName("index")) == nativeName("index"));
+	CHECK(pool.size() == 3);
+}
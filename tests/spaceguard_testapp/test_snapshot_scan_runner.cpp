@@ -3,6 +3,9 @@
 #include "snapshot_scan_runner.h"
 #include "test_filesystem_access_adapter.h"
 
+#include <QTemporaryDir>
+
+#include <algorithm>
 #include <assert.h>
 #include <atomic>
 #include <chrono>
@@ -10,6 +13,7 @@
 #include <future>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <thread>
 #include <utility>
@@ -130,6 +134,12 @@ public:
 		return thin_io::filesystem_space{100000, 50000 - call, 45000 - call, 7};
 	}
 
+	// The root and its files, as a filesystem scanned from its mount point would report them.
+	std::optional<uint64_t> getUsedFileCount(const NativePath&) const
+	{
+		return m_entryCount + 1;
+	}
+
 	bool waitUntilBlocked()
 	{
 		std::unique_lock lock{m_blockMutex};
@@ -194,6 +204,14 @@ bool waitUntilIdle(const SnapshotScanRunner& runner)
 	return !runner.scanInProgress();
 }
 
+// The rate and the latencies depend on timing.
+SnapshotScanProgress counters(SnapshotScanProgress progress)
+{
+	progress.entriesPerSecond = 0;
+	progress.operationTimings = {};
+	return progress;
+}
+
 const SnapshotScanResult& onlyCompletion(const PublishedEvents& events)
 {
 	REQUIRE(events.completions.size() == 1);
@@ -213,7 +231,6 @@ TEST_CASE("Snapshot scan runner publishes progress before one immutable completi
 	const auto generation = runner.start(rootPath());
 	REQUIRE(generation == 1);
 	REQUIRE(filesystem.waitUntilBlocked());
-	CHECK_FALSE(runner.start(rootPath()));
 	filesystem.release();
 	REQUIRE(waitUntilIdle(runner));
 	CHECK(events.completions.empty());
@@ -221,7 +238,7 @@ TEST_CASE("Snapshot scan runner publishes progress before one immutable completi
 
 	REQUIRE(events.progress.size() == 1);
 	CHECK(events.progress.front().first == *generation);
-	CHECK(events.progress.front().second == (SnapshotScanProgress{1, 20, 0}));
+	CHECK(counters(events.progress.front().second) == (SnapshotScanProgress{1, 20, 0, 20}));
 	REQUIRE(events.order.size() == 2);
 	CHECK(events.order[0] == 'p');
 	CHECK(events.order[1] == 'c');
@@ -281,6 +298,49 @@ TEST_CASE("Snapshot scan runner preserves fatal and recoverable outcomes", "[sna
 	}
 }
 
+TEST_CASE("Snapshot scan runner runs concurrent scans with separate generations and cancellation", "[snapshot][scan-runner]")
+{
+	ControlledFilesystem filesystem{20, FilesystemBehavior::success, BlockPoint::root_enumeration};
+	ScopedTestFilesystemAccess filesystemBinding{filesystem};
+	CExecutionQueue queue;
+	PublishedEvents events;
+	SnapshotScanRunner runner{queue, events.callbacks()};
+
+	std::vector<uint64_t> generations;
+	for (size_t i = 0; i < SnapshotScanRunner::MaximumConcurrentScans; ++i)
+	{
+		const auto generation = runner.start(rootPath());
+		REQUIRE(generation);
+		generations.push_back(*generation);
+	}
+	CHECK_FALSE(runner.start(rootPath()));
+	REQUIRE(filesystem.waitUntilBlocked());
+	REQUIRE(runner.cancel(generations[1]));
+	filesystem.release();
+	REQUIRE(waitUntilIdle(runner));
+	CHECK_FALSE(runner.scanInProgress(generations[0]));
+	queue.exec();
+
+	REQUIRE(events.completions.size() == generations.size());
+	for (const uint64_t generation : generations)
+	{
+		const auto completion = std::ranges::find(events.completions, generation,
+			&std::pair<uint64_t, std::shared_ptr<const SnapshotScanResult>>::first);
+		REQUIRE(completion != events.completions.end());
+		if (generation == generations[1])
+		{
+			CHECK(std::holds_alternative<SnapshotScanCanceled>(*completion->second));
+			continue;
+		}
+		CHECK(std::holds_alternative<Snapshot>(*completion->second));
+		// Progress of one scan is never coalesced away by another's.
+		const auto lastProgress = std::ranges::find(events.progress.rbegin(), events.progress.rend(), generation,
+			&std::pair<uint64_t, SnapshotScanProgress>::first);
+		REQUIRE(lastProgress != events.progress.rend());
+		CHECK(counters(lastProgress->second) == (SnapshotScanProgress{1, 20, 0, 20}));
+	}
+}
+
 TEST_CASE("Snapshot scan runner cancellation is nonblocking and terminal", "[snapshot][scan-runner]")
 {
 	ControlledFilesystem filesystem{10, FilesystemBehavior::success, BlockPoint::root_enumeration};
@@ -288,19 +348,60 @@ TEST_CASE("Snapshot scan runner cancellation is nonblocking and terminal", "[sna
 	CExecutionQueue queue;
 	PublishedEvents events;
 	SnapshotScanRunner runner{queue, events.callbacks()};
-	REQUIRE(runner.start(rootPath()));
+	const auto generation = runner.start(rootPath());
+	REQUIRE(generation);
 	REQUIRE(filesystem.waitUntilBlocked());
 
-	auto cancellation = std::async(std::launch::async, [&runner] { return runner.cancel(); });
+	auto cancellation = std::async(std::launch::async, [&runner, &generation] { return runner.cancel(*generation); });
 	CHECK(cancellation.wait_for(std::chrono::milliseconds{500}) == std::future_status::ready);
 	filesystem.release();
 	CHECK(cancellation.get());
 	REQUIRE(waitUntilIdle(runner));
-	CHECK_FALSE(runner.cancel());
+	CHECK_FALSE(runner.cancel(*generation));
 	queue.exec();
 	CHECK(std::holds_alternative<SnapshotScanCanceled>(onlyCompletion(events)));
 }
 
+TEST_CASE("Snapshot scan runner keeps the journal of a canceled scan for resuming", "[snapshot][scan-runner]")
+{
+	QTemporaryDir directory;
+	REQUIRE(directory.isValid());
+	CExecutionQueue queue;
+	PublishedEvents events;
+	SnapshotScanRunner runner{queue, events.callbacks()};
+	runner.setJournalDirectory(directory.filePath("journals"));
+	CHECK_FALSE(runner.hasResumableScan(rootPath()));
+	{
+		ControlledFilesystem filesystem{10, FilesystemBehavior::success, BlockPoint::completion_space};
+		ScopedTestFilesystemAccess filesystemBinding{filesystem};
+		const auto generation = runner.start(rootPath());
+		REQUIRE(generation);
+		REQUIRE(filesystem.waitUntilBlocked());
+		CHECK_FALSE(runner.hasResumableScan(rootPath()));
+		REQUIRE(runner.cancel(*generation));
+		filesystem.release();
+		REQUIRE(waitUntilIdle(runner));
+	}
+	CHECK(runner.hasResumableScan(rootPath()));
+
+	ControlledFilesystem filesystem{10};
+	ScopedTestFilesystemAccess filesystemBinding{filesystem};
+	REQUIRE(runner.resume(rootPath()));
+	REQUIRE(waitUntilIdle(runner));
+	CHECK_FALSE(runner.hasResumableScan(rootPath()));
+	queue.exec();
+
+	REQUIRE(events.completions.size() == 2);
+	CHECK(std::holds_alternative<SnapshotScanCanceled>(*events.completions[0].second));
+	const auto* snapshot = std::get_if<Snapshot>(events.completions[1].second.get());
+	REQUIRE(snapshot);
+	// The root was restored from the journal with the metadata the canceled scan had collected.
+	REQUIRE(snapshot->tree.children(SnapshotTree::RootIndex).size() == 10);
+	for (const SnapshotTree::Index child : snapshot->tree.children(SnapshotTree::RootIndex))
+		CHECK(snapshot->tree.metadata(child));
+	CHECK(snapshot->tree.derived(SnapshotTree::RootIndex).subtreeAllocatedSize == 4096 + 55);
+}
+
 TEST_CASE("Snapshot scan generations let receivers discard stale publication", "[snapshot][scan-runner]")
 {
 	ControlledFilesystem filesystem;
@@ -356,9 +457,10 @@ TEST_CASE("Snapshot scan runner destruction is safe at every scan-job phase", "[
 			CExecutionQueue queue;
 			PublishedEvents events;
 			auto runner = std::make_unique<SnapshotScanRunner>(queue, events.callbacks());
-			REQUIRE(runner->start(rootPath()));
+			const auto generation = runner->start(rootPath());
+			REQUIRE(generation);
 			REQUIRE(filesystem.waitUntilBlocked());
-			REQUIRE(runner->cancel());
+			REQUIRE(runner->cancel(*generation));
 			auto destruction = std::async(std::launch::async, [&runner] { runner.reset(); });
 			CHECK(destruction.wait_for(std::chrono::milliseconds{50}) == std::future_status::timeout);
 			filesystem.release();
@@ -0,0 +1,373 @@
+#include "3rdparty/catch2/catch.hpp"
+
+#include "snapshot.h"
+
+#include <limits>
+#include <optional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+NativePath nativePath(const char* path)
+{
+#ifdef _WIN32
+	return QString::fromUtf8(path);
+#else
+	return QByteArray{path};
+#endif
+}
+
+NativeName nativeName(const char* name)
+{
+	return nativePath(name);
+}
+
+NativePath rootPath()
+{
+#ifdef _WIN32
+	return nativePath("C:\\scan-root");
+#else
+	return nativePath("/scan-root");
+#endif
+}
+
+thin_io::entry_identity identity(const uint64_t filesystem, const uint8_t seed)
+{
+	thin_io::entry_identity result;
+	result.filesystem = filesystem;
+	for (size_t i = 0; i < result.entry.size(); ++i)
+		result.entry[i] = static_cast<uint8_t>(seed + i);
+	return result;
+}
+
+SnapshotEntry fileEntry(const uint64_t size, const uint8_t seed)
+{
+	SnapshotEntry entry;
+	entry.attributes.kind = thin_io::entry_kind::regular_file;
+	entry.metadata = SnapshotEntryMetadata{size, size, 1, identity(7, seed)};
+	return entry;
+}
+
+SnapshotEntry directoryEntry(const uint8_t seed)
+{
+	SnapshotEntry entry;
+	entry.attributes.kind = thin_io::entry_kind::directory;
+	entry.metadata = SnapshotEntryMetadata{0, 4096, 1, identity(7, seed)};
+	entry.traversalState = DirectoryTraversalState::completed;
+	return entry;
+}
+
+// root: b/ (y, x), a (file), c/ (z/ (deep)), d (without metadata, on another filesystem's boundary)
+SnapshotEntry makeRoot()
+{
+	SnapshotEntry b = directoryEntry(2);
+	b.children.try_emplace(nativeName("y"), fileEntry(20, 3));
+	b.children.try_emplace(nativeName("x"), fileEntry(10, 4));
+	b.foldedFiles = SnapshotFoldedFiles{2, 30, 30, 0, 0};
+
+	SnapshotEntry z = directoryEntry(5);
+	z.children.try_emplace(nativeName("deep"), fileEntry(5, 6));
+	SnapshotEntry c = directoryEntry(7);
+	c.children.try_emplace(nativeName("z"), std::move(z));
+
+	SnapshotEntry d;
+	d.attributes = {thin_io::entry_kind::directory, true, false, false, 0xA000000C};
+	d.traversalState = DirectoryTraversalState::mount_boundary;
+
+	SnapshotEntry root = directoryEntry(1);
+	root.children.try_emplace(nativeName("b"), std::move(b));
+	root.children.try_emplace(nativeName("a"), fileEntry(1, 8));
+	root.children.try_emplace(nativeName("c"), std::move(c));
+	root.children.try_emplace(nativeName("d"), std::move(d));
+	return root;
+}
+
+std::vector<NativeName> childNames(const SnapshotTree& tree, const SnapshotTree::Index directory)
+{
+	std::vector<NativeName> names;
+	for (const SnapshotTree::Index child : tree.children(directory))
+		names.push_back(nativeNameFromView(tree.name(child)));
+	return names;
+}
+
+// A random tree of at most maximumDepth levels below entry.
+void addRandomChildren(SnapshotEntry& entry, std::mt19937_64& random, const int maximumDepth)
+{
+	if (maximumDepth == 0)
+		return;
+	const int childCount = static_cast<int>(random() % 6);
+	for (int child = 0; child < childCount; ++child)
+	{
+		SnapshotEntry childEntry = random() % 3 == 0 ? fileEntry(1, 1) : directoryEntry(1);
+		if (childEntry.attributes.kind == thin_io::entry_kind::directory)
+			addRandomChildren(childEntry, random, maximumDepth - 1);
+		entry.children.try_emplace(nativeName(("entry-" + std::to_string(child)).c_str()), std::move(childEntry));
+	}
+}
+
+// Local derived data as the rebuild leaves it, where only a missing size can have overflowed. Sizes are often
+// missing, and near the top of the range often enough for sums of two or three of them to overflow.
+SnapshotEntryDerivedData randomLocalDerivedData(std::mt19937_64& random)
+{
+	constexpr uint64_t Maximum = std::numeric_limits<uint64_t>::max();
+	SnapshotEntryDerivedData derived;
+	derived.localCoverageComplete = random() % 4 != 0;
+	switch (random() % 6)
+	{
+	case 0:
+		derived.allocationOverflow = true;
+		break;
+	case 1:
+		break;
+	case 2:
+		derived.localAllocatedSize = Maximum - random() % 3;
+		break;
+	case 3:
+		derived.localAllocatedSize = Maximum / 2 + random() % 3;
+		break;
+	default:
+		derived.localAllocatedSize = random() % 1000;
+		break;
+	}
+	return derived;
+}
+
+std::optional<uint64_t> referenceSum(
+	const std::optional<uint64_t> total, const std::optional<uint64_t> value, bool& overflow)
+{
+	if (!total || !value)
+		return {};
+	if (*value > std::numeric_limits<uint64_t>::max() - *total)
+	{
+		overflow = true;
+		return {};
+	}
+	return *total + *value;
+}
+
+std::optional<uint64_t> referenceKnownSum(
+	const std::optional<uint64_t> total, const std::optional<uint64_t> value, bool& overflow)
+{
+	if (overflow)
+		return {};
+	if (!total || !value)
+		return total ? total : value;
+	return referenceSum(total, value, overflow);
+}
+
+// Derives the subtree data the way rebuilds did over nested entries, one optional sum per size, and counts the sums
+// that overflowed.
+void referenceAggregate(const SnapshotTree& tree, std::vector<SnapshotEntryDerivedData>& derived,
+	const SnapshotTree::Index entry, std::size_t& sumOverflows)
+{
+	SnapshotEntryDerivedData& data = derived[entry];
+	data.subtreeCoverageComplete = data.localCoverageComplete;
+	bool exactOverflow = data.allocationOverflow;
+	bool knownOverflow = data.allocationOverflow;
+	std::optional<uint64_t> exactSize = data.localAllocatedSize;
+	std::optional<uint64_t> knownSize = data.localAllocatedSize;
+	for (const SnapshotTree::Index child : tree.children(entry))
+	{
+		referenceAggregate(tree, derived, child, sumOverflows);
+		const SnapshotEntryDerivedData& childData = derived[child];
+		data.subtreeCoverageComplete &= childData.subtreeCoverageComplete;
+		exactOverflow |= childData.allocationOverflow;
+		knownOverflow |= childData.allocationOverflow;
+		const bool overflowed = exactOverflow || knownOverflow;
+		exactSize = referenceSum(exactSize, childData.subtreeAllocatedSize, exactOverflow);
+		knownSize = referenceKnownSum(knownSize, childData.knownSubtreeAllocatedSizeLowerBound, knownOverflow);
+		sumOverflows += !overflowed && (exactOverflow || knownOverflow);
+	}
+	if (!data.subtreeCoverageComplete || exactOverflow)
+		exactSize.reset();
+	if (knownOverflow)
+		knownSize.reset();
+	data.allocationOverflow = exactOverflow || knownOverflow;
+	data.subtreeAllocatedSize = exactSize;
+	data.knownSubtreeAllocatedSizeLowerBound = knownSize;
+}
+
+} // namespace
+
+TEST_CASE("Snapshot trees number entries breadth first with children in name order", "[snapshot][tree]")
+{
+	const SnapshotTree tree{makeRoot()};
+	REQUIRE(tree.size() == 9);
+	CHECK(tree.name(SnapshotTree::RootIndex).isEmpty());
+	CHECK(childNames(tree, SnapshotTree::RootIndex) == std::vector{nativeName("a"), nativeName("b"), nativeName("c"), nativeName("d")});
+	CHECK(tree.children(SnapshotTree::RootIndex).front() == 1);
+
+	const std::optional<SnapshotTree::Index> b = tree.findChild(SnapshotTree::RootIndex, nativeName("b"));
+	REQUIRE(b);
+	CHECK(childNames(tree, *b) == std::vector{nativeName("x"), nativeName("y")});
+	CHECK(tree.foldedFiles(*b) == SnapshotFoldedFiles{2, 30, 30, 0, 0});
+	CHECK(tree.children(*tree.findChild(SnapshotTree::RootIndex, nativeName("a"))).empty());
+	CHECK_FALSE(tree.findChild(SnapshotTree::RootIndex, nativeName("e")));
+	CHECK_FALSE(tree.findChild(*b, nativeName("a")));
+
+	const std::optional<SnapshotTree::Index> d = tree.findChild(SnapshotTree::RootIndex, nativeName("d"));
+	REQUIRE(d);
+	CHECK_FALSE(tree.metadata(*d));
+	CHECK(tree.attributes(*d) == thin_io::entry_attributes{thin_io::entry_kind::directory, true, false, false, 0xA000000C});
+	CHECK(tree.traversalState(*d) == DirectoryTraversalState::mount_boundary);
+	CHECK(tree.kind(*b) == thin_io::entry_kind::directory);
+	CHECK(tree.metadata(*b) == SnapshotEntryMetadata{0, 4096, 1, identity(7, 2)});
+
+	for (SnapshotTree::Index entry = 1; entry < tree.size(); ++entry)
+	{
+		const std::optional<SnapshotTree::Index> parent = tree.parent(entry);
+		REQUIRE(parent);
+		CHECK(*parent < entry);
+		CHECK(tree.findChild(*parent, tree.name(entry)) == entry);
+	}
+	CHECK_FALSE(tree.parent(SnapshotTree::RootIndex));
+}
+
+TEST_CASE("Snapshot trees resolve paths in both directions", "[snapshot][tree]")
+{
+	const SnapshotTree tree{makeRoot()};
+	const NativePath deepPath = appendNativeName(appendNativeName(appendNativeName(rootPath(), nativeName("c")), nativeName("z")), nativeName("deep"));
+	const std::optional<SnapshotTree::Index> deep = tree.find(rootPath(), deepPath);
+	REQUIRE(deep);
+	CHECK(nativeNamesEqual(tree.name(*deep), nativeName("deep")));
+	CHECK(tree.path(rootPath(), *deep) == deepPath);
+	CHECK(tree.find(rootPath(), rootPath()) == SnapshotTree::RootIndex);
+	CHECK(tree.path(rootPath(), SnapshotTree::RootIndex) == rootPath());
+	CHECK_FALSE(tree.find(rootPath(), appendNativeName(rootPath(), nativeName("missing"))));
+	CHECK_FALSE(tree.find(rootPath(), appendNativeName(deepPath, nativeName("below-a-file"))));
+}
+
+TEST_CASE("Snapshot trees convert back to the nested entries they were built from", "[snapshot][tree]")
+{
+	const SnapshotEntry root = makeRoot();
+	const SnapshotTree copied{root};
+	SnapshotEntry moved = makeRoot();
+	SnapshotTree tree{std::move(moved)};
+	CHECK(moved == SnapshotEntry{});
+	CHECK(tree == copied);
+	CHECK(tree.toEntry() == root);
+	CHECK(tree.toEntry(*tree.findChild(SnapshotTree::RootIndex, nativeName("c"))) == root.children.at(nativeName("c")));
+
+	// Derived data is not part of the tree's identity.
+	tree.setDerived(SnapshotTree::RootIndex, SnapshotEntryDerivedData{true, true, false, 4096, 8192, 8192});
+	CHECK(tree.derived(SnapshotTree::RootIndex) == SnapshotEntryDerivedData{true, true, false, 4096, 8192, 8192});
+	CHECK(tree == copied);
+
+	SnapshotEntry changed = makeRoot();
+	changed.children.at(nativeName("a")).metadata->allocatedSize = 2;
+	CHECK_FALSE(SnapshotTree{changed} == copied);
+	CHECK(SnapshotTree{SnapshotEntry{}}.size() == 1);
+
+	// Link counts too large for an entry's own byte are kept apart.
+	SnapshotEntry manyLinks = makeRoot();
+	manyLinks.children.at(nativeName("a")).metadata->hardLinkCount = 1000;
+	manyLinks.children.at(nativeName("b")).metadata->hardLinkCount = 254;
+	CHECK(SnapshotTree{manyLinks}.toEntry() == manyLinks);
+	CHECK_FALSE(SnapshotTree{manyLinks} == copied);
+}
+
+TEST_CASE("Snapshot trees take a fraction of the memory of nested entries", "[snapshot][tree]")
+{
+	constexpr int DirectoryCount = 100;
+	constexpr int FileCount = 100;
+	SnapshotEntry root = directoryEntry(1);
+	for (int directory = 0; directory < DirectoryCount; ++directory)
+	{
+		SnapshotEntry entry = directoryEntry(2);
+		for (int file = 0; file < FileCount; ++file)
+			entry.children.try_emplace(nativeName(("file-" + std::to_string(file) + ".dat").c_str()), fileEntry(static_cast<uint64_t>(file), 3));
+		root.children.try_emplace(nativeName(("directory-" + std::to_string(directory)).c_str()), std::move(entry));
+	}
+
+	const SnapshotTree tree{std::move(root)};
+	constexpr std::size_t EntryCount = 1 + DirectoryCount + DirectoryCount * FileCount;
+	REQUIRE(tree.size() == EntryCount);
+	// Every directory holds the same file names, which the tree keeps once.
+	CHECK(tree.nameCount() == DirectoryCount + FileCount);
+	const SnapshotTree::Index firstDirectory = tree.children(SnapshotTree::RootIndex).front();
+	const SnapshotTree::Index lastDirectory = tree.children(SnapshotTree::RootIndex).back();
+	CHECK(tree.nameHandle(tree.children(firstDirectory).front()) == tree.nameHandle(tree.children(lastDirectory).front()));
+	// A nested entry took at least its own size and that of its name, before any allocation for the name's characters. Before
+	// the tree, every entry held its derived data and none held folded files.
+	constexpr std::size_t NestedEntrySize = sizeof(SnapshotEntry) - sizeof(std::optional<SnapshotFoldedFiles>) + sizeof(SnapshotEntryDerivedData);
+	CHECK(tree.memoryUsage() * 3 < EntryCount * (NestedEntrySize + sizeof(NativeName)));
+}
+
+TEST_CASE("Snapshot trees keep the derived data of neighbouring entries apart", "[snapshot][tree]")
+{
+	// Enough entries for the flags of several to share a word.
+	constexpr int FileCount = 150;
+	SnapshotEntry root = directoryEntry(1);
+	for (int file = 0; file < FileCount; ++file)
+		root.children.try_emplace(nativeName(("file-" + std::to_string(1000 + file)).c_str()), fileEntry(static_cast<uint64_t>(file), 2));
+	SnapshotTree tree{std::move(root)};
+	REQUIRE(tree.size() == FileCount + 1);
+
+	const auto derivedFor = [](const SnapshotTree::Index entry) {
+		SnapshotEntryDerivedData derived;
+		derived.localCoverageComplete = entry % 2 == 0;
+		derived.subtreeCoverageComplete = entry % 3 == 0;
+		derived.allocationOverflow = entry % 5 == 0;
+		if (entry % 7 != 0)
+			derived.localAllocatedSize = entry * 10;
+		if (entry % 11 != 0)
+			derived.knownSubtreeAllocatedSizeLowerBound = entry * 100;
+		if (entry % 4 == 0 && derived.knownSubtreeAllocatedSizeLowerBound)
+			derived.subtreeAllocatedSize = derived.knownSubtreeAllocatedSizeLowerBound;
+		return derived;
+	};
+	for (SnapshotTree::Index entry = 0; entry < tree.size(); ++entry)
+		tree.setDerived(entry, derivedFor(entry));
+	for (SnapshotTree::Index entry = 0; entry < tree.size(); ++entry)
+	{
+		const SnapshotEntryDerivedData expected = derivedFor(entry);
+		CHECK(tree.derived(entry) == expected);
+		CHECK(tree.localAllocatedSize(entry) == expected.localAllocatedSize);
+		CHECK(tree.subtreeAllocatedSize(entry) == expected.subtreeAllocatedSize);
+		CHECK(tree.knownSubtreeAllocatedSizeLowerBound(entry) == expected.knownSubtreeAllocatedSizeLowerBound);
+		CHECK(tree.localCoverageComplete(entry) == expected.localCoverageComplete);
+		CHECK(tree.subtreeCoverageComplete(entry) == expected.subtreeCoverageComplete);
+		CHECK(tree.allocationOverflow(entry) == expected.allocationOverflow);
+	}
+
+	// Clearing one entry leaves those that share its words alone.
+	tree.setDerived(64, {});
+	CHECK(tree.derived(64) == SnapshotEntryDerivedData{});
+	CHECK(tree.derived(63) == derivedFor(63));
+	CHECK(tree.derived(65) == derivedFor(65));
+}
+
+TEST_CASE("Snapshot trees aggregate derived data as optional sums over nested entries would", "[snapshot][tree]")
+{
+	std::mt19937_64 random{20260417};
+	std::size_t sumOverflows = 0;
+	std::size_t exactEntries = 0;
+	for (int round = 0; round < 200; ++round)
+	{
+		SnapshotEntry root = directoryEntry(1);
+		addRandomChildren(root, random, 5);
+		SnapshotTree tree{std::move(root)};
+
+		std::vector<SnapshotEntryDerivedData> expected;
+		for (SnapshotTree::Index entry = 0; entry < tree.size(); ++entry)
+		{
+			expected.push_back(randomLocalDerivedData(random));
+			tree.setDerived(entry, expected.back());
+		}
+		referenceAggregate(tree, expected, SnapshotTree::RootIndex, sumOverflows);
+		for (SnapshotTree::Index entry = tree.size(); entry-- > SnapshotTree::RootIndex;)
+			tree.aggregateDerivedData(entry);
+
+		for (SnapshotTree::Index entry = 0; entry < tree.size(); ++entry)
+		{
+			REQUIRE(tree.derived(entry) == expected[entry]);
+			exactEntries += tree.subtreeAllocatedSize(entry).has_value();
+		}
+	}
+	// Both paths were taken: sums that overflowed and subtrees whose size is known exactly.
+	CHECK(sumOverflows > 0);
+	CHECK(exactEntries > 0);
+}